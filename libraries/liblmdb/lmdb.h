@@ -303,6 +303,12 @@ typedef void (MDB_rel_func)(MDB_val *item, void *oldptr, void *newptr, void *rel
 #define MDB_NORDAHEAD	0x800000
 	/** don't initialize malloc'd memory before writing to datafile */
 #define MDB_NOMEMINIT	0x1000000
+	/** keep the freelist as extents of free pages */
+#define MDB_EXTFREE		0x2000000
+	/** sync meta pages in groups of committing write transactions */
+#define MDB_GROUPCOMMIT	0x4000000
+	/** don't write pages with io_uring (no effect except on Linux) */
+#define MDB_NOURING		0x8000000
 /** @} */
 
 /**	@defgroup	mdb_dbi_open	Database Flags
@@ -321,6 +327,8 @@ typedef void (MDB_rel_func)(MDB_val *item, void *oldptr, void *newptr, void *rel
 #define MDB_INTEGERDUP	0x20
 	/** with #MDB_DUPSORT, use reverse string dups */
 #define MDB_REVERSEDUP	0x40
+	/** store the prefix shared by the keys of a leaf page only once */
+#define MDB_PREFIXKEYS	0x80
 	/** create DB if not already existing */
 #define MDB_CREATE		0x40000
 /** @} */
@@ -356,6 +364,34 @@ typedef void (MDB_rel_func)(MDB_val *item, void *oldptr, void *newptr, void *rel
  * pages sequentially.
  */
 #define MDB_CP_COMPACT	0x01
+/** With #MDB_CP_COMPACT: Write the copy with an #MDB_EXTFREE freelist. */
+#define MDB_CP_EXTFREE	0x02
+/*	@} */
+
+/**	@defgroup mdb_prefault	Memory Map Hints
+ *	@{
+ */
+/** Ask the OS to start reading the data file into memory when it is mapped. */
+#define MDB_PF_WILLNEED	0x01
+/** Read the whole data file into memory when it is mapped, before
+ *	#mdb_env_open() returns. Ignored with #MDB_WRITEMAP.
+ */
+#define MDB_PF_POPULATE	0x02
+/** Ask the OS to back the map with transparent huge pages, where the
+ *	file system supports them.
+ */
+#define MDB_PF_HUGEPAGE	0x04
+/*	@} */
+
+/**	@defgroup mdb_verify	Verify Flags
+ *	@{
+ */
+/** Don't check the order of keys in named databases that are not
+ *	open in the environment. Their comparison functions are unknown
+ *	unless the application has set them with #mdb_set_compare() or
+ *	#mdb_set_dupsort().
+ */
+#define MDB_VERIFY_NOORDER	0x01
 /*	@} */
 
 /** @brief Cursor Get operations.
@@ -473,6 +509,37 @@ typedef struct MDB_envinfo {
 	unsigned int me_numreaders;		/**< max reader slots used in the environment */
 } MDB_envinfo;
 
+/** @defgroup mdb_pgtype	Page Types
+ *	@{
+ */
+	/** internal (non-leaf) page of a B-tree */
+#define MDB_PG_BRANCH	0x01
+	/** leaf page of a B-tree */
+#define MDB_PG_LEAF		0x02
+	/** overflow pages holding one large data item */
+#define MDB_PG_OVERFLOW	0x04
+	/** set along with one of the above for pages of a sorted-duplicate subtree */
+#define MDB_PG_DUPSORT	0x10
+/** @} */
+
+/** @brief Information about a page of a database, for #mdb_page_walk() */
+typedef struct MDB_pginfo {
+	size_t		pi_pgno;			/**< Page number */
+	unsigned int	pi_type;		/**< @ref mdb_pgtype */
+	unsigned int	pi_depth;		/**< Level of the page in its tree, 0 for the root */
+	unsigned int	pi_nkeys;		/**< Number of items in a branch or leaf page */
+	size_t		pi_pages;			/**< Number of pages, more than 1 only for overflow pages */
+	size_t		pi_used;			/**< Number of bytes in use, including page headers */
+} MDB_pginfo;
+
+/** @brief A callback function for #mdb_page_walk().
+ *
+ * @param[in] pi The page being visited.
+ * @param[in] ctx An arbitrary context pointer for the callback.
+ * @return 0 to go on with the walk, anything else to end it with that value.
+ */
+typedef int (MDB_pgwalk_func)(const MDB_pginfo *pi, void *ctx);
+
 	/** @brief Return the LMDB library version information.
 	 *
 	 * @param[out] major if non-NULL, the library major version number is copied here
@@ -594,6 +661,9 @@ int  mdb_env_create(MDB_env **env);
 	 *		read requests by default. This option turns it off if the OS
 	 *		supports it. Turning it off may help random read performance
 	 *		when the DB is larger than RAM and system RAM is full.
+	 *		Cursors that walk from leaf page to leaf page still ask the
+	 *		OS for the pages ahead of them, and values on overflow pages
+	 *		are read in one request.
 	 *		The option is not implemented on Windows.
 	 *	<li>#MDB_NOMEMINIT
 	 *		Don't initialize malloc'd memory before writing to unused spaces
@@ -614,6 +684,40 @@ int  mdb_env_create(MDB_env **env);
 	 *		caller is expected to overwrite all of the memory that was
 	 *		reserved in that case.
 	 *		This flag may be changed at any time using #mdb_env_set_flags().
+	 *	<li>#MDB_EXTFREE
+	 *		Store the freelist as sorted extents (first page, page count)
+	 *		instead of lists of single page numbers, and index the free
+	 *		extents by size while writing. This keeps freelist records small
+	 *		in fragmented databases and lets multi-page allocations for large
+	 *		data items find a fitting extent without scanning the freelist.
+	 *		This flag must be specified when creating the environment, and is
+	 *		stored persistently in it: existing environments keep the format
+	 *		they were created with, and #mdb_env_get_flags() reports it.
+	 *		Such environments cannot be opened by LMDB versions which lack
+	 *		this feature. An existing environment can be converted by copying
+	 *		it with #MDB_CP_COMPACT and #MDB_CP_EXTFREE.
+	 *	<li>#MDB_GROUPCOMMIT
+	 *		Commit write transactions as a group. A commit still flushes its
+	 *		data pages to disk before writing the meta page, but does not
+	 *		flush the meta page itself. Instead it releases the write lock
+	 *		and then waits until the meta page is on disk: the data flush of
+	 *		the next write transaction also flushes all meta pages written
+	 *		before it, and if no writer comes along, one waiting committer
+	 *		flushes once on behalf of all of them. Under a steady stream of
+	 *		commits this needs about one flush per transaction instead of two,
+	 *		while #mdb_txn_commit() still only returns after the transaction
+	 *		is durable. Only commits from the same #MDB_env are grouped;
+	 *		the flag is harmless but ineffective with other writers.
+	 *		It has no effect with #MDB_NOSYNC, or #MDB_MAPASYNC with
+	 *		#MDB_WRITEMAP. It can also be requested for single transactions
+	 *		in #mdb_txn_begin().
+	 *		This flag may be changed at any time using #mdb_env_set_flags().
+	 *	<li>#MDB_NOURING
+	 *		On Linux, a write transaction normally submits all its page
+	 *		writes and the following data sync to an io_uring at once, when
+	 *		the kernel supports it. This flag turns that off, and pages are
+	 *		written with pwrite()-style calls as on other platforms.
+	 *		The io_uring is never used with #MDB_WRITEMAP or #MDB_RDONLY.
 	 * </ul>
 	 * @param[in] mode The UNIX permissions to set on created files and semaphores.
 	 * This parameter is ignored on Windows.
@@ -681,6 +785,10 @@ int  mdb_env_copyfd(MDB_env *env, mdb_filehandle_t fd);
 	 *		pages and sequentially renumber all pages in output. This option
 	 *		consumes more CPU and runs more slowly than the default.
 	 *		Currently it fails if the environment has suffered a page leak.
+	 *		The copy keeps the freelist format of the environment.
+	 *	<li>#MDB_CP_EXTFREE - With #MDB_CP_COMPACT, write the copy with an
+	 *		#MDB_EXTFREE freelist. This converts an existing environment
+	 *		to the extent format.
 	 * </ul>
 	 * @return A non-zero error value on failure and 0 on success.
 	 */
@@ -705,6 +813,90 @@ int  mdb_env_copy2(MDB_env *env, const char *path, unsigned int flags);
 	 */
 int  mdb_env_copyfd2(MDB_env *env, mdb_filehandle_t fd, unsigned int flags);
 
+	/** @brief Copy an LMDB environment to the specified path, with options
+	 *	and several threads.
+	 *
+	 * Like #mdb_env_copy2(), but a compacting copy splits the trees into
+	 * subtrees and walks up to \b nthreads of them at once. Pages of the
+	 * subtrees are buffered until the subtrees before them have been
+	 * written, so the copy is still written sequentially and may go to
+	 * a pipe. The pages of the copy are not in the same order as in a
+	 * single-threaded copy. Without #MDB_CP_COMPACT, or with \b nthreads
+	 * of 1 or less, this is the same as #mdb_env_copy2(). On Windows the
+	 * copy always uses a single thread.
+	 * @param[in] env An environment handle returned by #mdb_env_create(). It
+	 * must have already been opened successfully.
+	 * @param[in] path The directory in which the copy will reside. This
+	 * directory must already exist and be writable but must otherwise be
+	 * empty.
+	 * @param[in] flags Special options for this operation.
+	 * See #mdb_env_copy2() for options.
+	 * @param[in] nthreads The number of threads walking the environment.
+	 * @return A non-zero error value on failure and 0 on success.
+	 */
+int  mdb_env_copy3(MDB_env *env, const char *path, unsigned int flags, int nthreads);
+
+	/** @brief Copy an LMDB environment to the specified file descriptor,
+	 *	with options and several threads.
+	 *
+	 * See #mdb_env_copy3() for details.
+	 * @param[in] env An environment handle returned by #mdb_env_create(). It
+	 * must have already been opened successfully.
+	 * @param[in] fd The filedescriptor to write the copy to. It must
+	 * have already been opened for Write access.
+	 * @param[in] flags Special options for this operation.
+	 * See #mdb_env_copy2() for options.
+	 * @param[in] nthreads The number of threads walking the environment.
+	 * @return A non-zero error value on failure and 0 on success.
+	 */
+int  mdb_env_copyfd3(MDB_env *env, mdb_filehandle_t fd, unsigned int flags, int nthreads);
+
+	/** @brief Write the changes to an LMDB environment since an earlier copy.
+	 *
+	 * This writes an incremental backup: the pages of the current snapshot
+	 * of \b env which differ from the pages with the same numbers in \b base,
+	 * followed by a new meta page. Applying it to \b base with
+	 * #mdb_env_apply() turns \b base into a copy of this snapshot.
+	 * Pages don't record which transaction wrote them, so every page in
+	 * use is still read and compared; only the delta is proportional to
+	 * the changes. This does not block writers.
+	 * @param[in] env An environment handle returned by #mdb_env_create(). It
+	 * must have already been opened successfully.
+	 * @param[in] base An environment handle opened on the earlier copy.
+	 * This must be a copy made without #MDB_CP_COMPACT, possibly with
+	 * deltas applied to it since, or else the delta holds every page.
+	 * It may be opened with #MDB_RDONLY and #MDB_NOLOCK.
+	 * @param[in] fd The filedescriptor to write the delta to. It must
+	 * have already been opened for Write access.
+	 * @return A non-zero error value on failure and 0 on success. Some
+	 * possible errors are:
+	 * <ul>
+	 *	<li>#MDB_INCOMPATIBLE - the environments have different page sizes.
+	 * </ul>
+	 */
+int  mdb_env_delta(MDB_env *env, MDB_env *base, mdb_filehandle_t fd);
+
+	/** @brief Apply a delta written by #mdb_env_delta() to a copy.
+	 *
+	 * The pages of the delta are written and flushed to disk before its
+	 * meta page, so an interrupted update leaves the copy unusable until
+	 * the same delta is applied again. Applying a delta twice is harmless.
+	 * The environment must be closed afterward, and nothing else may use
+	 * it meanwhile.
+	 * @param[in] env An environment handle opened on the copy, without
+	 * #MDB_RDONLY. #MDB_NOLOCK avoids creating a lock file next to it.
+	 * @param[in] fd The filedescriptor to read the delta from.
+	 * @return A non-zero error value on failure and 0 on success. Some
+	 * possible errors are:
+	 * <ul>
+	 *	<li>#MDB_INVALID - the input is not a delta, or is truncated.
+	 *	<li>#MDB_INCOMPATIBLE - the delta was made against another copy,
+	 *		or another state of this one.
+	 *	<li>EACCES - the environment is read-only.
+	 * </ul>
+	 */
+int  mdb_env_apply(MDB_env *env, mdb_filehandle_t fd);
+
 	/** @brief Return statistics about the LMDB environment.
 	 *
 	 * @param[in] env An environment handle returned by #mdb_env_create()
@@ -844,6 +1036,50 @@ int  mdb_env_get_fd(MDB_env *env, mdb_filehandle_t *fd);
 	 */
 int  mdb_env_set_mapsize(MDB_env *env, size_t size);
 
+	/** @brief Set hints for the memory map of the environment.
+	 *
+	 * This function may only be called after #mdb_env_create() and before
+	 * #mdb_env_open(). The hints apply whenever the map is set up, and are
+	 * ignored where the OS lacks them, and on Windows.
+	 * @param[in] env An environment handle returned by #mdb_env_create()
+	 * @param[in] flags Hints for the map. This may be set to 0 or by
+	 * bitwise OR'ing together one or more of the values described here.
+	 * <ul>
+	 *	<li>#MDB_PF_WILLNEED
+	 *		Start reading the used part of the data file in the background.
+	 *	<li>#MDB_PF_POPULATE
+	 *		Read the whole data file before #mdb_env_open() returns.
+	 *	<li>#MDB_PF_HUGEPAGE
+	 *		Use transparent huge pages for the map, where possible.
+	 * </ul>
+	 * @return A non-zero error value on failure and 0 on success. Some
+	 * possible errors are:
+	 * <ul>
+	 *	<li>EINVAL - an invalid parameter was specified, or the environment is
+	 *	already open.
+	 * </ul>
+	 */
+int  mdb_env_set_prefault(MDB_env *env, unsigned int flags);
+
+	/** @brief Read the top levels of the databases in the background.
+	 *
+	 * After a restart, the first lookups in a large environment wait for
+	 * the pages along their path to be read from disk. This starts a thread
+	 * which reads the top \b levels of the trees of the main DB and of every
+	 * named DB currently open in the environment, so the branch pages are
+	 * in memory by the time they are needed. The children of each branch
+	 * page are requested from the OS at once where possible. The thread
+	 * uses a read-only transaction for each DB, and stops early when the
+	 * environment is closed or its map size is changed. Calling this again
+	 * restarts the warm-up, e.g. after opening more DBs.
+	 * @param[in] env An environment handle returned by #mdb_env_create(). It
+	 * must have already been opened successfully.
+	 * @param[in] levels The number of levels of each tree to read, counting
+	 * the root. 0 reads every level except the leaf pages.
+	 * @return A non-zero error value on failure and 0 on success.
+	 */
+int  mdb_env_prefault(MDB_env *env, unsigned int levels);
+
 	/** @brief Set the maximum number of threads/reader slots for the environment.
 	 *
 	 * This defines the number of slots in the lock table that is used to track readers in the
@@ -949,12 +1185,22 @@ int  mdb_env_set_assert(MDB_env *env, MDB_assert_func *func);
 	 * as its parent. Transactions may be nested to any level. A parent
 	 * transaction and its cursors may not issue any other operations than
 	 * mdb_txn_commit and mdb_txn_abort while it has active child transactions.
+	 * If both \b parent and the new transaction are read-only, the new
+	 * transaction is not nested: it reads the same snapshot as \b parent.
+	 * This lets several threads read one snapshot, each in its own
+	 * transaction. It takes no reader slot, \b parent's slot keeps the
+	 * snapshot, so it may be begun in any thread whether #MDB_NOTLS is
+	 * in use or not. It must not be used once \b parent has ended or
+	 * been reset, other than to end it.
 	 * @param[in] flags Special options for this transaction. This parameter
 	 * must be set to 0 or by bitwise OR'ing together one or more of the
 	 * values described here.
 	 * <ul>
 	 *	<li>#MDB_RDONLY
 	 *		This transaction will not perform any write operations.
+	 *	<li>#MDB_GROUPCOMMIT
+	 *		Commit this write transaction as part of a group, as if the
+	 *		environment had #MDB_GROUPCOMMIT set.
 	 * </ul>
 	 * @param[out] txn Address where the new #MDB_txn handle will be stored
 	 * @return A non-zero error value on failure and 0 on success. Some possible
@@ -1112,6 +1358,14 @@ int  mdb_txn_renew(MDB_txn *txn);
 	 *	<li>#MDB_REVERSEDUP
 	 *		This option specifies that duplicate data items should be compared as
 	 *		strings in reverse order.
+	 *	<li>#MDB_PREFIXKEYS
+	 *		Leaf pages store the prefix their keys have in common only once,
+	 *		so more keys fit in a page when keys share long leading bytes.
+	 *		Keys are compared as strings, so this option can't be combined
+	 *		with #MDB_REVERSEKEY, #MDB_INTEGERKEY or #mdb_set_compare().
+	 *		Keys returned by a cursor are put together in a buffer of the
+	 *		cursor, and only remain valid until the next operation on that
+	 *		cursor. Earlier versions of LMDB can't read such databases.
 	 *	<li>#MDB_CREATE
 	 *		Create the named database if it doesn't exist. This option is not
 	 *		allowed in a read-only transaction or a read-only environment.
@@ -1123,6 +1377,8 @@ int  mdb_txn_renew(MDB_txn *txn);
 	 *	<li>#MDB_NOTFOUND - the specified database doesn't exist in the environment
 	 *		and #MDB_CREATE was not specified.
 	 *	<li>#MDB_DBS_FULL - too many databases have been opened. See #mdb_env_set_maxdbs().
+	 *	<li>EINVAL - #MDB_PREFIXKEYS was combined with #MDB_REVERSEKEY
+	 *		or #MDB_INTEGERKEY.
 	 * </ul>
 	 */
 int  mdb_dbi_open(MDB_txn *txn, const char *name, unsigned int flags, MDB_dbi *dbi);
@@ -1141,6 +1397,26 @@ int  mdb_dbi_open(MDB_txn *txn, const char *name, unsigned int flags, MDB_dbi *d
 	 */
 int  mdb_stat(MDB_txn *txn, MDB_dbi dbi, MDB_stat *stat);
 
+	/** @brief Visit every page of a database.
+	 *
+	 * The branch and leaf pages of the database's B-tree are visited
+	 * depth first, each followed by the overflow pages and the
+	 * sorted-duplicate subtrees of its items. The pages of named
+	 * databases are not part of the main database. This reads the
+	 * whole database, it is meant for tools analyzing space usage.
+	 * @param[in] txn A transaction handle returned by #mdb_txn_begin()
+	 * @param[in] dbi A database handle returned by #mdb_dbi_open()
+	 * @param[in] func The function to call for each page
+	 * @param[in] ctx An arbitrary context pointer for the callback
+	 * @return A non-zero error value on failure, the first non-zero
+	 * return value of \b func, and 0 on success. Some possible
+	 * errors are:
+	 * <ul>
+	 *	<li>EINVAL - an invalid parameter was specified.
+	 * </ul>
+	 */
+int  mdb_page_walk(MDB_txn *txn, MDB_dbi dbi, MDB_pgwalk_func *func, void *ctx);
+
 	/** @brief Retrieve the DB flags for a database handle.
 	 *
 	 * @param[in] txn A transaction handle returned by #mdb_txn_begin()
@@ -1195,7 +1471,8 @@ int  mdb_drop(MDB_txn *txn, MDB_dbi dbi, int del);
 	 * @return A non-zero error value on failure and 0 on success. Some possible
 	 * errors are:
 	 * <ul>
-	 *	<li>EINVAL - an invalid parameter was specified.
+	 *	<li>EINVAL - an invalid parameter was specified, or the database
+	 *		uses #MDB_PREFIXKEYS.
 	 * </ul>
 	 */
 int  mdb_set_compare(MDB_txn *txn, MDB_dbi dbi, MDB_cmp_func *cmp);
@@ -1287,6 +1564,35 @@ int  mdb_set_relctx(MDB_txn *txn, MDB_dbi dbi, void *ctx);
 	 */
 int  mdb_get(MDB_txn *txn, MDB_dbi dbi, MDB_val *key, MDB_val *data);
 
+	/** @brief Get items for several keys from a database.
+	 *
+	 * This function looks up each of the \b n keys in \b keys, like
+	 * #mdb_get(), and returns the data for keys[i] in data[i]. A key
+	 * that is not in the database gets a data item with a NULL
+	 * mv_data and a zero mv_size.
+	 *
+	 * The keys should be sorted in ascending order, by the database's
+	 * key comparison function. The lookups then share one walk through
+	 * the tree, and each key only searches the pages below the lowest
+	 * branch page that covers it. Keys that are out of order are still
+	 * found, with a search from the root.
+	 *
+	 * See #mdb_get() for restrictions on using the output values.
+	 * @param[in] txn A transaction handle returned by #mdb_txn_begin()
+	 * @param[in] dbi A database handle returned by #mdb_dbi_open()
+	 * @param[in] keys An array of \b n keys to search for
+	 * @param[out] data An array of \b n data items for the keys
+	 * @param[in] n The number of keys
+	 * @return A non-zero error value on failure and 0 on success. Some possible
+	 * errors are:
+	 * <ul>
+	 *	<li>#MDB_BAD_VALSIZE - a key had a zero length.
+	 *	<li>EINVAL - an invalid parameter was specified.
+	 * </ul>
+	 */
+int  mdb_get_batch(MDB_txn *txn, MDB_dbi dbi, MDB_val *keys, MDB_val *data,
+			    unsigned int n);
+
 	/** @brief Store items into a database.
 	 *
 	 * This function stores key/data pairs in the database. The default behavior
@@ -1445,6 +1751,26 @@ MDB_dbi mdb_cursor_dbi(MDB_cursor *cursor);
 int  mdb_cursor_get(MDB_cursor *cursor, MDB_val *key, MDB_val *data,
 			    MDB_cursor_op op);
 
+	/** @brief Retrieve items for several keys by cursor.
+	 *
+	 * This is #mdb_get_batch() on an open cursor. The walk starts from
+	 * the cursor's current position, so a caller that resolves sorted
+	 * keys in several calls keeps the benefit across them. On return
+	 * the cursor is positioned on the last key, if it was found.
+	 * @param[in] cursor A cursor handle returned by #mdb_cursor_open()
+	 * @param[in] keys An array of \b n keys to search for
+	 * @param[out] data An array of \b n data items for the keys
+	 * @param[in] n The number of keys
+	 * @return A non-zero error value on failure and 0 on success. Some possible
+	 * errors are:
+	 * <ul>
+	 *	<li>#MDB_BAD_VALSIZE - a key had a zero length.
+	 *	<li>EINVAL - an invalid parameter was specified.
+	 * </ul>
+	 */
+int  mdb_cursor_get_batch(MDB_cursor *cursor, MDB_val *keys, MDB_val *data,
+			    unsigned int n);
+
 	/** @brief Store by cursor.
 	 *
 	 * This function stores key/data pairs into the database.
@@ -1564,6 +1890,99 @@ int  mdb_cmp(MDB_txn *txn, MDB_dbi dbi, const MDB_val *a, const MDB_val *b);
 	 */
 int  mdb_dcmp(MDB_txn *txn, MDB_dbi dbi, const MDB_val *a, const MDB_val *b);
 
+	/** @brief Opaque structure for a bottom-up bulk load, see #mdb_bulk_open() */
+typedef struct MDB_bulk MDB_bulk;
+
+	/** @brief A callback function used to feed sorted items to #mdb_bulk_load().
+	 *
+	 * @param[in] ctx An arbitrary context pointer for the callback.
+	 * @param[out] key The next key to load.
+	 * @param[out] data The data for the key.
+	 * @return 0 if an item was returned, #MDB_NOTFOUND at the end of the
+	 * input, any other value to stop the load with that error.
+	 */
+typedef int (MDB_bulk_func)(void *ctx, MDB_val *key, MDB_val *data);
+
+	/** @brief Start a bulk load into a database.
+	 *
+	 * A bulk load builds the tree bottom-up from items which arrive in
+	 * sorted order. Leaf and branch pages are filled completely and no
+	 * page is ever split, which makes this much faster than a sequence
+	 * of #mdb_cursor_put() calls with #MDB_APPEND, and yields a smaller
+	 * database. In an #MDB_DUPSORT database, the data items of each key
+	 * are stored on a sub-page or in a sub-database the same way.
+	 *
+	 * The database may be empty or not; new items are added after its
+	 * last key. Existing keys can not get more data items.
+	 * While the load is in progress the database may still be read, but
+	 * it must not be written except through the bulk handle, and no
+	 * child transaction may be started.
+	 * The handle must be closed with #mdb_bulk_close() before the
+	 * transaction ends, otherwise it will be freed with the transaction
+	 * and the items of the last #MDB_DUPSORT key are lost.
+	 * @param[in] txn A transaction handle returned by #mdb_txn_begin()
+	 * @param[in] dbi A database handle returned by #mdb_dbi_open()
+	 * @param[out] bulk Address where the new #MDB_bulk handle will be stored
+	 * @return A non-zero error value on failure and 0 on success. Some possible
+	 * errors are:
+	 * <ul>
+	 *	<li>EACCES - an attempt was made to write in a read-only transaction.
+	 *	<li>EINVAL - an invalid parameter was specified.
+	 * </ul>
+	 */
+int  mdb_bulk_open(MDB_txn *txn, MDB_dbi dbi, MDB_bulk **bulk);
+
+	/** @brief Add an item to a bulk load.
+	 *
+	 * Keys must be given in strictly ascending order, and must sort after
+	 * the last key which was in the database when the load started. In an
+	 * #MDB_DUPSORT database the same key may be repeated, with its data items
+	 * in strictly ascending order. A key's data items are only stored when
+	 * the next key is put or the handle is closed.
+	 * @param[in] bulk A handle returned by #mdb_bulk_open()
+	 * @param[in] key The key to store.
+	 * @param[in] data The data to store.
+	 * @param[in] flags Options for this operation. This parameter
+	 * must be set to 0 or one of the values described here.
+	 * <ul>
+	 *	<li>#MDB_RESERVE - reserve space for data of the given size, as for
+	 *		#mdb_cursor_put(). This flag must not be specified if the database
+	 *		was opened with #MDB_DUPSORT.
+	 * </ul>
+	 * @return A non-zero error value on failure and 0 on success. Some possible
+	 * errors are:
+	 * <ul>
+	 *	<li>#MDB_KEYEXIST - the key or data item is not greater than the
+	 *		previous one. Nothing was stored, the load may continue.
+	 *	<li>#MDB_MAP_FULL - the database is full, see #mdb_env_set_mapsize().
+	 *	<li>#MDB_TXN_FULL - the transaction has too many dirty pages.
+	 *	<li>EINVAL - an invalid parameter was specified.
+	 * </ul>
+	 */
+int  mdb_bulk_put(MDB_bulk *bulk, MDB_val *key, MDB_val *data,
+				unsigned int flags);
+
+	/** @brief Finish a bulk load.
+	 *
+	 * Stores the pending #MDB_DUPSORT key, if any, and frees the handle.
+	 * The handle is freed even if an error is returned.
+	 * @param[in] bulk A handle returned by #mdb_bulk_open()
+	 * @return A non-zero error value on failure and 0 on success.
+	 */
+int  mdb_bulk_close(MDB_bulk *bulk);
+
+	/** @brief Bulk load all the items returned by an iterator.
+	 *
+	 * This is #mdb_bulk_open(), #mdb_bulk_put() for each item returned
+	 * by \b func, and #mdb_bulk_close().
+	 * @param[in] txn A transaction handle returned by #mdb_txn_begin()
+	 * @param[in] dbi A database handle returned by #mdb_dbi_open()
+	 * @param[in] func A #MDB_bulk_func function returning the items in order
+	 * @param[in] ctx Anything the iterator function needs
+	 * @return A non-zero error value on failure and 0 on success.
+	 */
+int  mdb_bulk_load(MDB_txn *txn, MDB_dbi dbi, MDB_bulk_func *func, void *ctx);
+
 	/** @brief A callback function used to print a message from the library.
 	 *
 	 * @param[in] msg The string to be printed.
@@ -1588,6 +2007,41 @@ int	mdb_reader_list(MDB_env *env, MDB_msg_func *func, void *ctx);
 	 * @return 0 on success, non-zero on failure.
 	 */
 int	mdb_reader_check(MDB_env *env, int *dead);
+
+	/** @brief Check the integrity of an environment.
+	 *
+	 * Every tree of the current snapshot is walked, checking the layout of
+	 * each page, the order of the keys, and the page and item counts
+	 * recorded for each database. Every page of the data file must belong to
+	 * exactly one database or be listed as free. The check runs in its own
+	 * read-only transaction, so it may run while writers are active.
+	 * Keys are compared with the functions of the databases open in \b env,
+	 * or the defaults for their flags.
+	 * @param[in] env An environment handle returned by #mdb_env_create().
+	 *	It must not have an active read-only transaction in this thread,
+	 *	unless the environment was opened with #MDB_NOTLS.
+	 * @param[in] flags Special options for this check. This parameter
+	 * must be set to 0 or by bitwise OR'ing together one or more of the
+	 * values described here.
+	 * <ul>
+	 *	<li>#MDB_VERIFY_NOORDER - Don't check the order of keys of named
+	 *		databases that have no open handle in \b env.
+	 * </ul>
+	 * @param[in] nthreads The number of threads walking the trees at once.
+	 *	Large trees are split into subtrees checked in parallel.
+	 *	Ignored on Windows.
+	 * @param[in] func A #MDB_msg_func function, called with a description
+	 *	of each problem found. May be NULL.
+	 * @param[in] ctx Anything the message function needs
+	 * @return A non-zero error value on failure and 0 on success. Some
+	 * possible errors are:
+	 * <ul>
+	 *	<li>#MDB_CORRUPTED - problems were found.
+	 *	<li>ENOMEM - out of memory.
+	 * </ul>
+	 */
+int	mdb_env_verify(MDB_env *env, unsigned int flags, int nthreads,
+	MDB_msg_func *func, void *ctx);
 /**	@} */
 
 #ifdef __cplusplus
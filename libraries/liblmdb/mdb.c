@@ -93,6 +93,27 @@ extern int cacheflush(char *addr, int nbytes, int cache);
 #define	BROKEN_FDATASYNC
 #endif
 
+/** On Linux, write dirty pages through an io_uring if the kernel
+ *	allows it, see #mdb_page_flush(). Without one, or with #MDB_NOURING,
+ *	pages are written with plain write calls as on other platforms.
+ *	Compile with -DMDB_USE_IO_URING=0 to leave the io_uring code out.
+ */
+#ifndef MDB_USE_IO_URING
+# if defined(__linux__) && defined(__has_include)
+#  if __has_include(<linux/io_uring.h>)
+#   define MDB_USE_IO_URING	1
+#  endif
+# endif
+# ifndef MDB_USE_IO_URING
+#  define MDB_USE_IO_URING	0
+# endif
+#endif
+
+#if MDB_USE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+
 #include <errno.h>
 #include <limits.h>
 #include <stddef.h>
@@ -535,6 +556,11 @@ static txnid_t mdb_debug_start;
 
 	/**	The version number for a database's datafile format. */
 #define MDB_DATA_VERSION	 ((MDB_DEVEL) ? 999 : 1)
+	/**	The datafile format version when the freeDB holds extent lists
+	 *	(#MDB_EXTFREE). Older libraries refuse it instead of misreading
+	 *	the freelist.
+	 */
+#define MDB_DATA_VERSION_EXT	 ((MDB_DEVEL) ? 998 : 2)
 	/**	The version number for a database's lockfile format. */
 #define MDB_LOCK_VERSION	 1
 
@@ -565,6 +591,11 @@ static txnid_t mdb_debug_start;
 #define ENV_MAXKEY(env)	((env)->me_maxkey)
 #endif
 
+	/**	The size of a buffer for a whole key of a #P_PREFIX page.
+	 *	#MDB_PREFIXKEYS is refused if keys may be bigger.
+	 */
+#define MDB_KBUFSIZE	((MDB_MAXKEYSIZE) > 0 ? (MDB_MAXKEYSIZE) : 511)
+
 	/**	@brief The maximum size of a data item.
 	 *
 	 *	We only store a 32 bit value for node sizes.
@@ -743,6 +774,11 @@ typedef struct MDB_txbody {
 		 *	when readers release their slots.
 		 */
 	volatile unsigned	mtb_numreaders;
+		/** Where to start looking for a free reader slot. This is only
+		 *	a hint, updated without the reader mutex. It fits in the
+		 *	padding after #mtb_numreaders.
+		 */
+	volatile unsigned	mtb_rfree;
 } MDB_txbody;
 
 	/** The actual reader table definition. */
@@ -755,6 +791,7 @@ typedef struct MDB_txninfo {
 #define mti_rmname	mt1.mtb.mtb_rmname
 #define mti_txnid	mt1.mtb.mtb_txnid
 #define mti_numreaders	mt1.mtb.mtb_numreaders
+#define mti_rfree	mt1.mtb.mtb_rfree
 		char pad[(sizeof(MDB_txbody)+CACHELINE-1) & ~(CACHELINE-1)];
 	} mt1;
 	union {
@@ -770,12 +807,32 @@ typedef struct MDB_txninfo {
 	MDB_reader	mti_readers[1];
 } MDB_txninfo;
 
+	/** @brief Compare-and-swap on a reader table field.
+	 *
+	 *	Readers claim a slot by swapping their pid into it, so they
+	 *	do not serialize on the reader mutex. Without an atomic
+	 *	compare-and-swap, slots are claimed under the reader mutex
+	 *	instead, and this is a plain compare and store.
+	 */
+#if defined(_WIN32)
+#define MDB_CAS(p, o, n) \
+	(InterlockedCompareExchange((LONG volatile *)(p), (LONG)(n), (LONG)(o)) == (LONG)(o))
+#define MDB_RCAS	1
+#elif (__GNUC__ * 100 + __GNUC_MINOR__ >= 401)
+#define MDB_CAS(p, o, n)	__sync_bool_compare_and_swap(p, o, n)
+#define MDB_RCAS	1
+#else
+#define MDB_CAS(p, o, n)	(*(p) == (o) ? (*(p) = (n), 1) : 0)
+#define MDB_RCAS	0
+#endif
+
 	/** Lockfile format signature: version, features and field layout */
 #define MDB_LOCK_FORMAT \
 	((uint32_t) \
 	 ((MDB_LOCK_VERSION) \
 	  /* Flags which describe functionality */ \
-	  + (((MDB_PIDLOCK) != 0) << 16)))
+	  + (((MDB_PIDLOCK) != 0) << 16) \
+	  + (((MDB_RCAS) != 0) << 17)))
 /** @} */
 
 /** Common header for all page types. The page type depends on #mp_flags.
@@ -793,6 +850,10 @@ typedef struct MDB_txninfo {
  *
  * #P_META pages contain #MDB_meta, the start point of an LMDB snapshot.
  *
+ * #P_PREFIX leaf pages of #MDB_PREFIXKEYS databases keep the first
+ * #mp_pad bytes, which all their keys share, at the end of the page.
+ * Their nodes only hold the rest of each key.
+ *
  * Each non-metapage up to #MDB_meta.%mm_last_pg is reachable exactly once
  * in the snapshot: Either used by a database or listed in a freeDB record.
  */
@@ -803,7 +864,8 @@ typedef struct MDB_page {
 		pgno_t		p_pgno;	/**< page number */
 		struct MDB_page *p_next; /**< for in-memory list of freed pages */
 	} mp_p;
-	uint16_t	mp_pad;			/**< key size if this is a LEAF2 page */
+	uint16_t	mp_pad;			/**< key size if this is a LEAF2 page,
+							 *	key prefix size if #P_PREFIX */
 /**	@defgroup mdb_page	Page Flags
  *	@ingroup internal
  *	Flags for the page headers.
@@ -816,6 +878,7 @@ typedef struct MDB_page {
 #define	P_DIRTY		 0x10		/**< dirty page, also set for #P_SUBP pages */
 #define	P_LEAF2		 0x20		/**< for #MDB_DUPFIXED records */
 #define	P_SUBP		 0x40		/**< for #MDB_DUPSORT sub-pages */
+#define	P_PREFIX	 0x80		/**< leaf keys share a prefix, for #MDB_PREFIXKEYS */
 #define	P_LOOSE		 0x4000		/**< page was dirtied then freed, can be reused */
 #define	P_KEEP		 0x8000		/**< leave this page alone during spill */
 /** @} */
@@ -866,6 +929,11 @@ typedef struct MDB_page {
 #define IS_OVERFLOW(p)	 F_ISSET((p)->mp_flags, P_OVERFLOW)
 	/** Test if a page is a sub page */
 #define IS_SUBP(p)	 F_ISSET((p)->mp_flags, P_SUBP)
+	/** Test if a page is a leaf page with a key prefix */
+#define IS_PREFIX(p)	 F_ISSET((p)->mp_flags, P_PREFIX)
+
+	/** Address of the key prefix of a #P_PREFIX page */
+#define PREFIXKEY(p, psize)	((char *)(p) + (psize) - EVEN((p)->mp_pad))
 
 	/** The number of overflow pages needed to store the given size. */
 #define OVPAGES(size, psize)	((PAGEHDRSZ-1 + (size)) / (psize) + 1)
@@ -957,6 +1025,8 @@ typedef struct MDB_node {
 	(node)->mn_lo = (size) & 0xffff; (node)->mn_hi = (size) >> 16;} while(0)
 	/** The size of a key in a node */
 #define NODEKSZ(node)	 ((node)->mn_ksize)
+	/** The size of a key in a node on page \b p, with the page's key prefix */
+#define NODEFKSZ(p, node)	 (NODEKSZ(node) + (IS_PREFIX(p) ? (p)->mp_pad : 0))
 
 	/** Copy a page number from src to dst */
 #ifdef MISALIGNED_OK
@@ -988,10 +1058,6 @@ typedef struct MDB_node {
 	 */
 #define LEAF2KEY(p, i, ks)	((char *)(p) + PAGEHDRSZ + ((i)*(ks)))
 
-	/** Set the \b node's key into \b keyptr, if requested. */
-#define MDB_GET_KEY(node, keyptr)	{ if ((keyptr) != NULL) { \
-	(keyptr)->mv_size = NODEKSZ(node); (keyptr)->mv_data = NODEKEY(node); } }
-
 	/** Set the \b node's key into \b key. */
 #define MDB_GET_KEY2(node, key)	{ key.mv_size = NODEKSZ(node); key.mv_data = NODEKEY(node); }
 
@@ -1011,7 +1077,7 @@ typedef struct MDB_db {
 #define PERSISTENT_FLAGS	(0xffff & ~(MDB_VALID))
 	/** #mdb_dbi_open() flags */
 #define VALID_FLAGS	(MDB_REVERSEKEY|MDB_DUPSORT|MDB_INTEGERKEY|MDB_DUPFIXED|\
-	MDB_INTEGERDUP|MDB_REVERSEDUP|MDB_CREATE)
+	MDB_INTEGERDUP|MDB_REVERSEDUP|MDB_PREFIXKEYS|MDB_CREATE)
 
 	/** Handle for the DB used to track free pages. */
 #define	FREE_DBI	0
@@ -1031,7 +1097,8 @@ typedef struct MDB_meta {
 		/** Stamp identifying this as an LMDB file. It must be set
 		 *	to #MDB_MAGIC. */
 	uint32_t	mm_magic;
-		/** Version number of this file. Must be set to #MDB_DATA_VERSION. */
+		/** Version number of this file. Must be set to #MDB_DATA_VERSION,
+		 *	or #MDB_DATA_VERSION_EXT for an #MDB_EXTFREE freelist. */
 	uint32_t	mm_version;
 	void		*mm_address;		/**< address for fixed mapping */
 	size_t		mm_mapsize;			/**< size of mmap region */
@@ -1101,11 +1168,24 @@ struct MDB_txn {
 	 */
 	MDB_IDL		mt_spill_pgs;
 	union {
-		/** For write txns: Modified pages. Sorted when not MDB_WRITEMAP. */
+		/** For write txns: Modified pages. Sorted unless indexed
+		 *	by #mt_dirty_hash.
+		 */
 		MDB_ID2L	dirty_list;
 		/** For read txns: This thread/txn's reader table slot, or NULL. */
 		MDB_reader	*reader;
 	} mt_u;
+	/** Open-addressed hash of dirty list indices by page number,
+	 *	used once the dirty list is large and no longer sorted.
+	 *	Kept allocated across txns, see #mdb_dlist_insert().
+	 */
+	unsigned	*mt_dirty_hash;
+	/** Number of slots in #mt_dirty_hash minus 1, or 0 when the
+	 *	dirty list is sorted and the hash is not in use.
+	 */
+	unsigned	mt_dirty_hmask;
+	/** Number of slots allocated for #mt_dirty_hash */
+	unsigned	mt_dirty_hsize;
 	/** Array of records for each DB known in the environment. */
 	MDB_dbx		*mt_dbxs;
 	/** Array of MDB_db records for each known DB */
@@ -1138,8 +1218,9 @@ struct MDB_txn {
  *	@{
  */
 	/** #mdb_txn_begin() flags */
-#define MDB_TXN_BEGIN_FLAGS	MDB_RDONLY
+#define MDB_TXN_BEGIN_FLAGS	(MDB_RDONLY|MDB_GROUPCOMMIT)
 #define MDB_TXN_RDONLY		MDB_RDONLY	/**< read-only transaction */
+#define MDB_TXN_GROUPCOMMIT	MDB_GROUPCOMMIT	/**< commit as part of a group */
 	/* internal txn flags */
 #define MDB_TXN_WRITEMAP	MDB_WRITEMAP	/**< copy of #MDB_env flag in writers */
 #define MDB_TXN_FINISHED	0x01		/**< txn is finished or never began */
@@ -1203,11 +1284,21 @@ struct MDB_cursor {
 #define C_EOF	0x02			/**< No more data */
 #define C_SUB	0x04			/**< Cursor is a sub-cursor */
 #define C_DEL	0x08			/**< last op was a cursor_del */
+#define C_BULK	0x10			/**< Cursor belongs to a #MDB_bulk loader */
 #define C_UNTRACK	0x40		/**< Un-track cursor when closing */
 /** @} */
 	unsigned int	mc_flags;	/**< @ref mdb_cursor */
 	MDB_page	*mc_pg[CURSOR_STACK];	/**< stack of pushed pages */
 	indx_t		mc_ki[CURSOR_STACK];	/**< stack of page indices */
+	/** Where keys of #P_PREFIX pages are returned, NULL in
+	 *	cursors the user doesn't see */
+	char		*mc_kbuf;
+	/** Leaf page last reached by #mdb_cursor_sibling() */
+	pgno_t		mc_rapg;
+	/** Number of leaf pages walked in a row up to #mc_rapg,
+	 *	negative when walking to the left
+	 */
+	int			mc_raseq;
 };
 
 	/** Context for sorted-dup records.
@@ -1245,7 +1336,8 @@ typedef struct MDB_xcursor {
 
 	/** State of FreeDB old pages, stored in the MDB_env */
 typedef struct MDB_pgstate {
-	pgno_t		*mf_pghead;	/**< Reclaimed freeDB pages, or NULL before use */
+	pgno_t		*mf_pghead;	/**< Reclaimed freeDB pages, or NULL before use.
+							 *	An extent list with #MDB_EXTFREE. */
 	txnid_t		mf_pglast;	/**< ID of last used record, or 0 if !mf_pghead */
 } MDB_pgstate;
 
@@ -1261,7 +1353,7 @@ struct MDB_env {
 	/** me_txkey is set */
 #define	MDB_ENV_TXKEY	0x10000000U
 	/** fdatasync is unreliable */
-#define	MDB_FSYNCONLY	0x08000000U
+#define	MDB_FSYNCONLY	0x40000000U
 	uint32_t 	me_flags;		/**< @ref mdb_env */
 	unsigned int	me_psize;	/**< DB page size, inited from me_os_psize */
 	unsigned int	me_os_psize;	/**< OS page size, from #GET_PAGESIZE */
@@ -1289,6 +1381,11 @@ struct MDB_env {
 	MDB_pgstate	me_pgstate;		/**< state of old pages from freeDB */
 #	define		me_pglast	me_pgstate.mf_pglast
 #	define		me_pghead	me_pgstate.mf_pghead
+	/** (length, first page) pairs of the extents in me_pghead, for
+	 *	#MDB_EXTFREE. Only valid while me_pgsizes_ok is set.
+	 */
+	MDB_IDL		me_pgsizes;
+	int			me_pgsizes_ok;	/**< me_pgsizes matches me_pghead */
 	MDB_page	*me_dpages;		/**< list of malloc'd blocks for re-use */
 	/** IDL of pages that became unused in a write txn */
 	MDB_IDL		me_free_pgs;
@@ -1302,6 +1399,9 @@ struct MDB_env {
 	unsigned int	me_maxkey;	/**< max size of a key */
 #endif
 	int		me_live_reader;		/**< have liveness lock in reader table */
+#if MDB_USE_IO_URING
+	struct MDB_ring	*me_ring;	/**< for writing pages, or NULL */
+#endif
 #ifdef _WIN32
 	int		me_pidquery;		/**< Used in OpenProcess */
 #endif
@@ -1312,6 +1412,23 @@ struct MDB_env {
 	mdb_mutex_t	me_rmutex;
 	mdb_mutex_t	me_wmutex;
 #endif
+	/** Protects the me_gc fields, for #MDB_GROUPCOMMIT. This state is
+	 *	per-process: commits from other processes are not grouped with ours.
+	 */
+	pthread_mutex_t	me_gc_mutex;
+#ifndef _WIN32
+	pthread_cond_t	me_gc_cond;	/**< Signaled when me_gc_synced advances */
+#endif
+	txnid_t		me_gc_committed;	/**< last meta page written by a group commit */
+	txnid_t		me_gc_synced;	/**< meta pages up to this txnid are on disk */
+	int			me_gc_busy;		/**< number of syncs in progress */
+	int			me_gc_rc;		/**< sticky error from a failed sync */
+	unsigned int	me_pfhints;	/**< @ref mdb_prefault flags */
+	/** Background warm-up from #mdb_env_prefault(), if me_pfrun is set */
+	pthread_t	me_pfthr;
+	int			me_pfrun;
+	volatile int	me_pfstop;	/**< tells me_pfthr to give up */
+	unsigned int	me_pflevels;	/**< levels of each tree to read */
 	void		*me_userctx;	 /**< User-settable context */
 	MDB_assert_func *me_assert_func; /**< Callback for assertion failures */
 };
@@ -1375,6 +1492,7 @@ static int	mdb_page_split(MDB_cursor *mc, MDB_val *newkey, MDB_val *newdata,
 static int  mdb_env_read_header(MDB_env *env, MDB_meta *meta);
 static MDB_meta *mdb_env_pick_meta(const MDB_env *env);
 static int  mdb_env_write_meta(MDB_txn *txn);
+static int  mdb_fsize(HANDLE fd, size_t *size);
 #ifdef MDB_USE_POSIX_MUTEX /* Drop unused excl arg */
 # define mdb_env_close0(env, excl) mdb_env_close1(env)
 #endif
@@ -1389,6 +1507,11 @@ static int	mdb_node_move(MDB_cursor *csrc, MDB_cursor *cdst, int fromleft);
 static int  mdb_node_read(MDB_cursor *mc, MDB_node *leaf, MDB_val *data);
 static size_t	mdb_leaf_size(MDB_env *env, MDB_val *key, MDB_val *data);
 static size_t	mdb_branch_size(MDB_env *env, MDB_val *key);
+static size_t	mdb_prefix_need(MDB_env *env, MDB_page *mp, MDB_val *key, MDB_val *data,
+			    unsigned int flags);
+static int	mdb_prefix_fit(MDB_cursor *mc, MDB_val *key, MDB_val *data,
+			    unsigned int flags, size_t *need);
+static int	mdb_page_prefix(MDB_cursor *mc, MDB_page *mp, unsigned int plen, char *pfx);
 
 static int	mdb_rebalance(MDB_cursor *mc);
 static int	mdb_update_key(MDB_cursor *mc, MDB_val *key);
@@ -1834,6 +1957,172 @@ mdb_dlist_free(MDB_txn *txn)
 		mdb_dpage_free(env, dl[i].mptr);
 	}
 	dl[0].mid = 0;
+	txn->mt_dirty_hmask = 0;
+}
+
+/** Dirty list length below which an out-of-order page is just
+ *	inserted into the sorted list. At or above it, the list is left
+ *	unsorted and indexed by #MDB_txn.%mt_dirty_hash until it is
+ *	flushed, so huge txns do not keep shifting the list around.
+ */
+#ifndef MDB_DLIST_HASHMIN
+#define MDB_DLIST_HASHMIN	256
+#endif
+
+/** Home slot of page number \b pgno in a dirty list hash */
+#define MDB_DHASH(pgno, mask) \
+	((unsigned)((pgno) * 0x9E3779B97F4A7C15ULL >> 32) & (mask))
+
+/** Compare two dirty list entries by page number */
+static int
+mdb_id2_cmp(const void *a, const void *b)
+{
+	const MDB_ID2 *x = a, *y = b;
+
+	return (x->mid > y->mid) - (x->mid < y->mid);
+}
+
+/** Sort the dirty list, if it is unsorted, and stop using its hash.
+ *	Done once when the list is flushed or merged, instead of keeping
+ *	it sorted on every insert.
+ */
+static void
+mdb_dlist_sort(MDB_txn *txn)
+{
+	MDB_ID2L dl = txn->mt_u.dirty_list;
+
+	if (txn->mt_dirty_hmask) {
+		qsort(dl + 1, dl[0].mid, sizeof(MDB_ID2), mdb_id2_cmp);
+		txn->mt_dirty_hmask = 0;
+	}
+}
+
+/** (Re)build the dirty list hash with room for \b n pages.
+ * @return 0 on success, ENOMEM on failure. The old hash, if any,
+ *	is still valid on failure.
+ */
+static int
+mdb_dlist_hash(MDB_txn *txn, unsigned n)
+{
+	MDB_ID2L dl = txn->mt_u.dirty_list;
+	unsigned *h = txn->mt_dirty_hash, i, x, mask;
+	unsigned size = MDB_DLIST_HASHMIN * 4;
+
+	while (size < n * 2)
+		size <<= 1;
+	if (size > txn->mt_dirty_hsize) {
+		if (!(h = malloc(size * sizeof(unsigned))))
+			return ENOMEM;
+		free(txn->mt_dirty_hash);
+		txn->mt_dirty_hash = h;
+		txn->mt_dirty_hsize = size;
+	}
+	mask = size - 1;
+	memset(h, 0, size * sizeof(unsigned));
+	for (i = 1; i <= dl[0].mid; i++) {
+		for (x = MDB_DHASH(dl[i].mid, mask); h[x]; x = (x + 1) & mask)
+			;
+		h[x] = i;
+	}
+	txn->mt_dirty_hmask = mask;
+	return MDB_SUCCESS;
+}
+
+/** Find a page in the dirty list.
+ * @return the index of the page, or 0 if it is not there.
+ */
+static unsigned
+mdb_dlist_search(MDB_txn *txn, pgno_t pgno)
+{
+	MDB_ID2L dl = txn->mt_u.dirty_list;
+	unsigned i, x, mask = txn->mt_dirty_hmask;
+
+	if (mask) {
+		unsigned *h = txn->mt_dirty_hash;
+		for (x = MDB_DHASH(pgno, mask); (i = h[x]) != 0; x = (x + 1) & mask)
+			if (dl[i].mid == pgno)
+				return i;
+		return 0;
+	}
+	if (!dl[0].mid)
+		return 0;
+	x = mdb_mid2l_search(dl, pgno);
+	return x <= dl[0].mid && dl[x].mid == pgno ? x : 0;
+}
+
+/** Add a page to the dirty list.
+ * Pages in ascending order are appended, keeping the list sorted.
+ * Otherwise a short list stays sorted with #mdb_mid2l_insert(),
+ * and a long one is hashed and appended to.
+ * If the hash cannot be allocated the list is simply kept sorted.
+ * @return 0 on success, -1 if the page is already there.
+ */
+static int
+mdb_dlist_insert(MDB_txn *txn, MDB_ID2 *id)
+{
+	MDB_ID2L dl = txn->mt_u.dirty_list;
+	unsigned *h, x, n = dl[0].mid, mask = txn->mt_dirty_hmask;
+
+	if (!mask) {
+		if (!n || id->mid > dl[n].mid) {
+			dl[++n] = *id;
+			dl[0].mid = n;
+			return 0;
+		}
+		if (n < MDB_DLIST_HASHMIN || mdb_dlist_hash(txn, n + 1))
+			return mdb_mid2l_insert(dl, id);
+	} else if ((n + 1) * 2 > mask + 1) {
+		if (mdb_dlist_hash(txn, n + 1)) {
+			mdb_dlist_sort(txn);
+			return mdb_mid2l_insert(dl, id);
+		}
+	}
+	mask = txn->mt_dirty_hmask;
+	h = txn->mt_dirty_hash;
+	for (x = MDB_DHASH(id->mid, mask); h[x]; x = (x + 1) & mask)
+		if (dl[h[x]].mid == id->mid)
+			return -1;
+	dl[++n] = *id;
+	dl[0].mid = n;
+	h[x] = n;
+	return 0;
+}
+
+/** Remove entry \b x from the dirty list.
+ * A hashed list moves its last entry into the hole, a sorted
+ * list is shifted down.
+ */
+static void
+mdb_dlist_remove(MDB_txn *txn, unsigned x)
+{
+	MDB_ID2L dl = txn->mt_u.dirty_list;
+	unsigned n = dl[0].mid, mask = txn->mt_dirty_hmask;
+
+	if (mask) {
+		unsigned *h = txn->mt_dirty_hash, i, j, k;
+		for (i = MDB_DHASH(dl[x].mid, mask); h[i] != x; i = (i + 1) & mask)
+			;
+		/* Pull later entries of the probe sequence back into the gap,
+		 * unless their home slot lies after it */
+		for (j = i; h[j = (j + 1) & mask]; ) {
+			k = MDB_DHASH(dl[h[j]].mid, mask);
+			if (i < j ? (k <= i || k > j) : (k <= i && k > j)) {
+				h[i] = h[j];
+				i = j;
+			}
+		}
+		h[i] = 0;
+		if (x < n) {
+			for (i = MDB_DHASH(dl[n].mid, mask); h[i] != n; i = (i + 1) & mask)
+				;
+			h[i] = x;
+			dl[x] = dl[n];
+		}
+	} else {
+		for (; x < n; x++)
+			dl[x] = dl[x+1];
+	}
+	dl[0].mid = n - 1;
 }
 
 /** Loosen or free a single page.
@@ -1859,17 +2148,15 @@ mdb_page_loose(MDB_cursor *mc, MDB_page *mp)
 			/* If txn has a parent, make sure the page is in our
 			 * dirty list.
 			 */
-			if (dl[0].mid) {
-				unsigned x = mdb_mid2l_search(dl, pgno);
-				if (x <= dl[0].mid && dl[x].mid == pgno) {
-					if (mp != dl[x].mptr) { /* bad cursor? */
-						mc->mc_flags &= ~(C_INITIALIZED|C_EOF);
-						txn->mt_flags |= MDB_TXN_ERROR;
-						return MDB_CORRUPTED;
-					}
-					/* ok, it's ours */
-					loose = 1;
+			unsigned x = mdb_dlist_search(txn, pgno);
+			if (x) {
+				if (mp != dl[x].mptr) { /* bad cursor? */
+					mc->mc_flags &= ~(C_INITIALIZED|C_EOF);
+					txn->mt_flags |= MDB_TXN_ERROR;
+					return MDB_CORRUPTED;
 				}
+				/* ok, it's ours */
+				loose = 1;
 			}
 		} else {
 			/* no parent txn, so it's just ours */
@@ -1931,6 +2218,9 @@ mdb_pages_xkeep(MDB_cursor *mc, unsigned pflags, int all)
 					break;
 				if (! (mp && (mp->mp_flags & P_LEAF)))
 					break;
+				/* A bulk loader's sub-DB is not in its leaf yet */
+				if (m3->mc_flags & C_BULK)
+					continue;
 				leaf = NODEPTR(mp, m3->mc_ki[j-1]);
 				if (!(leaf->mn_flags & F_SUBDATA))
 					break;
@@ -1958,7 +2248,7 @@ mdb_pages_xkeep(MDB_cursor *mc, unsigned pflags, int all)
 	return rc;
 }
 
-static int mdb_page_flush(MDB_txn *txn, int keep);
+static int mdb_page_flush(MDB_txn *txn, int keep, int *sync);
 
 /**	Spill pages from the dirty list back to disk.
  * This is intended to prevent running into #MDB_TXN_FULL situations,
@@ -2050,6 +2340,7 @@ mdb_page_spill(MDB_cursor *m0, MDB_val *key, MDB_val *data)
 
 	/* Save the page IDs of all the pages we're flushing */
 	/* flush from the tail forward, this saves a lot of shifting later on. */
+	mdb_dlist_sort(txn);
 	for (i=dl[0].mid; i && need; i--) {
 		MDB_ID pn = dl[i].mid << 1;
 		dp = dl[i].mptr;
@@ -2079,7 +2370,7 @@ mdb_page_spill(MDB_cursor *m0, MDB_val *key, MDB_val *data)
 	mdb_midl_sort(txn->mt_spill_pgs);
 
 	/* Flush the spilled part of dirty list */
-	if ((rc = mdb_page_flush(txn, i)) != MDB_SUCCESS)
+	if ((rc = mdb_page_flush(txn, i, NULL)) != MDB_SUCCESS)
 		goto done;
 
 	/* Reset any dirty pages we kept that page_flush didn't see */
@@ -2114,20 +2405,142 @@ static void
 mdb_page_dirty(MDB_txn *txn, MDB_page *mp)
 {
 	MDB_ID2 mid;
-	int rc, (*insert)(MDB_ID2L, MDB_ID2 *);
+	int rc;
 
-	if (txn->mt_flags & MDB_TXN_WRITEMAP) {
-		insert = mdb_mid2l_append;
-	} else {
-		insert = mdb_mid2l_insert;
-	}
 	mid.mid = mp->mp_pgno;
 	mid.mptr = mp;
-	rc = insert(txn->mt_u.dirty_list, &mid);
+	rc = mdb_dlist_insert(txn, &mid);
 	mdb_tassert(txn, rc == 0);
 	txn->mt_dirty_room--;
 }
 
+/** Index the extents in me_pghead by size.
+ * @param[in] env the environment handle
+ * @return 0 on success, ENOMEM on failure.
+ */
+static int
+mdb_pgsizes_build(MDB_env *env)
+{
+	MDB_IDL mop = env->me_pghead, sz = env->me_pgsizes;
+	unsigned x, n = MDB_EXT_NUM(mop);
+
+	if (!sz) {
+		if (!(sz = mdb_midl_alloc(mop[0])))
+			return ENOMEM;
+		env->me_pgsizes = sz;
+	} else {
+		sz[0] = 0;
+		if (mdb_midl_need(&env->me_pgsizes, mop[0]))
+			return ENOMEM;
+		sz = env->me_pgsizes;
+	}
+	for (x = 1; x <= n; x++) {
+		MDB_EXT_ID(sz, x) = MDB_EXT_LEN(mop, x);
+		MDB_EXT_LEN(sz, x) = MDB_EXT_ID(mop, x);
+	}
+	sz[0] = mop[0];
+	mdb_mext_sort(sz);
+	env->me_pgsizes_ok = 1;
+	return MDB_SUCCESS;
+}
+
+/** Replace an extent in the size index of me_pghead.
+ * Failure to grow the index just invalidates it.
+ * @param[in] env the environment handle
+ * @param[in] pgno first page of the old extent
+ * @param[in] len length of the old extent, or 0 if there was none
+ * @param[in] npgno first page of the new extent
+ * @param[in] nlen length of the new extent, or 0 if there is none
+ */
+static void
+mdb_pgsizes_update(MDB_env *env, pgno_t pgno, pgno_t len,
+	pgno_t npgno, pgno_t nlen)
+{
+	unsigned x;
+
+	if (!env->me_pgsizes_ok)
+		return;
+	if (len) {
+		x = mdb_mext_search(env->me_pgsizes, len, pgno);
+		mdb_mext_delete(env->me_pgsizes, x);
+	}
+	if (nlen) {
+		if (mdb_midl_need(&env->me_pgsizes, 2)) {
+			env->me_pgsizes_ok = 0;
+			return;
+		}
+		x = mdb_mext_search(env->me_pgsizes, nlen, npgno);
+		mdb_mext_insert(env->me_pgsizes, x, nlen, npgno);
+	}
+}
+
+/** Take pages from the start of an extent in me_pghead.
+ * @param[in] env the environment handle
+ * @param[in] x index of the extent
+ * @param[in] num number of pages to take
+ */
+static void
+mdb_pghead_take(MDB_env *env, unsigned x, unsigned num)
+{
+	MDB_IDL mop = env->me_pghead;
+	pgno_t pgno = MDB_EXT_ID(mop, x), len = MDB_EXT_LEN(mop, x);
+
+	if (len > num) {
+		MDB_EXT_ID(mop, x) = pgno + num;
+		MDB_EXT_LEN(mop, x) = len - num;
+	} else {
+		mdb_mext_delete(mop, x);
+	}
+	mdb_pgsizes_update(env, pgno, len, pgno + num, len - num);
+}
+
+/** Return a range of pages to the extents in me_pghead, merging
+ * it with the extents it touches.
+ * @param[in] env the environment handle
+ * @param[in] pg first page of the range
+ * @param[in] num number of pages in the range
+ * @return 0 on success, ENOMEM on failure.
+ */
+static int
+mdb_pghead_insert(MDB_env *env, pgno_t pg, pgno_t num)
+{
+	MDB_IDL mop;
+	pgno_t xpg, xlen;
+	unsigned x;
+	int rc;
+
+	if ((rc = mdb_midl_need(&env->me_pghead, 2)) != 0)
+		return rc;
+	mop = env->me_pghead;
+	/* Extent x is below the range, extent x-1 above it */
+	x = mdb_mext_search(mop, pg, 0);
+	if (x <= MDB_EXT_NUM(mop) &&
+		MDB_EXT_ID(mop, x) + MDB_EXT_LEN(mop, x) == pg) {
+		xpg = MDB_EXT_ID(mop, x);
+		xlen = MDB_EXT_LEN(mop, x);
+		num += xlen;
+		if (x > 1 && MDB_EXT_ID(mop, x-1) == pg + num - xlen) {
+			mdb_pgsizes_update(env, MDB_EXT_ID(mop, x-1),
+				MDB_EXT_LEN(mop, x-1), 0, 0);
+			num += MDB_EXT_LEN(mop, x-1);
+			mdb_mext_delete(mop, --x);
+		}
+		MDB_EXT_LEN(mop, x) = num;
+		mdb_pgsizes_update(env, xpg, xlen, xpg, num);
+	} else if (x > 1 && MDB_EXT_ID(mop, x-1) == pg + num) {
+		x--;
+		xpg = MDB_EXT_ID(mop, x);
+		xlen = MDB_EXT_LEN(mop, x);
+		MDB_EXT_ID(mop, x) = pg;
+		MDB_EXT_LEN(mop, x) = xlen + num;
+		mdb_pgsizes_update(env, xpg, xlen, pg, xlen + num);
+	} else {
+		mdb_mext_insert(mop, x, pg, num);
+		mdb_pgsizes_update(env, 0, 0, pg, num);
+	}
+	return MDB_SUCCESS;
+}
+
 /** Allocate page numbers and memory for writing.  Maintain me_pglast,
  * me_pghead and mt_next_pgno.  Set #MDB_TXN_ERROR on failure.
  *
@@ -2195,7 +2608,31 @@ mdb_page_alloc(MDB_cursor *mc, int num, MDB_page **mp)
 		/* Seek a big enough contiguous page range. Prefer
 		 * pages at the tail, just truncating the list.
 		 */
-		if (mop_len > n2) {
+		if (env->me_flags & MDB_EXTFREE) {
+			/* Take single pages from the lowest extent, and
+			 * ranges from the smallest extent which fits them.
+			 */
+			if (mop_len) {
+				i = MDB_EXT_NUM(mop);
+				if (n2) {
+					MDB_IDL sz;
+					if (!env->me_pgsizes_ok &&
+						(rc = mdb_pgsizes_build(env)) != 0)
+						goto fail;
+					sz = env->me_pgsizes;
+					i = mdb_mext_search(sz, num, 0) - 1;
+					if (i)
+						i = mdb_mext_search(mop,
+							MDB_EXT_LEN(sz, i), MDB_EXT_ID(sz, i));
+				}
+				if (i) {
+					pgno = MDB_EXT_ID(mop, i);
+					goto search_done;
+				}
+				if (--retry < 0)
+					break;
+			}
+		} else if (mop_len > n2) {
 			i = mop_len;
 			do {
 				pgno = mop[i];
@@ -2274,7 +2711,12 @@ mdb_page_alloc(MDB_cursor *mc, int num, MDB_page **mp)
 			DPRINTF(("IDL %"Z"u", idl[j]));
 #endif
 		/* Merge in descending sorted order */
-		mdb_midl_xmerge(mop, idl);
+		if (env->me_flags & MDB_EXTFREE) {
+			mdb_mext_merge(mop, idl);
+			env->me_pgsizes_ok = 0;
+		} else {
+			mdb_midl_xmerge(mop, idl);
+		}
 		mop_len = mop[0];
 	}
 
@@ -2297,10 +2739,14 @@ search_done:
 		}
 	}
 	if (i) {
-		mop[0] = mop_len -= num;
-		/* Move any stragglers down */
-		for (j = i-num; j < mop_len; )
-			mop[++j] = mop[++i];
+		if (env->me_flags & MDB_EXTFREE) {
+			mdb_pghead_take(env, i, num);
+		} else {
+			mop[0] = mop_len -= num;
+			/* Move any stragglers down */
+			for (j = i-num; j < mop_len; )
+				mop[++j] = mop[++i];
+		}
 	} else {
 		txn->mt_next_pgno = pgno + num;
 	}
@@ -2446,16 +2892,14 @@ mdb_page_touch(MDB_cursor *mc)
 		/* If txn has a parent, make sure the page is in our
 		 * dirty list.
 		 */
-		if (dl[0].mid) {
-			unsigned x = mdb_mid2l_search(dl, pgno);
-			if (x <= dl[0].mid && dl[x].mid == pgno) {
-				if (mp != dl[x].mptr) { /* bad cursor? */
-					mc->mc_flags &= ~(C_INITIALIZED|C_EOF);
-					txn->mt_flags |= MDB_TXN_ERROR;
-					return MDB_CORRUPTED;
-				}
-				return 0;
+		unsigned x = mdb_dlist_search(txn, pgno);
+		if (x) {
+			if (mp != dl[x].mptr) { /* bad cursor? */
+				mc->mc_flags &= ~(C_INITIALIZED|C_EOF);
+				txn->mt_flags |= MDB_TXN_ERROR;
+				return MDB_CORRUPTED;
 			}
+			return 0;
 		}
 		mdb_cassert(mc, dl[0].mid < MDB_IDL_UM_MAX);
 		/* No - copy it */
@@ -2464,7 +2908,7 @@ mdb_page_touch(MDB_cursor *mc)
 			return ENOMEM;
 		mid.mid = pgno;
 		mid.mptr = np;
-		rc = mdb_mid2l_insert(dl, &mid);
+		rc = mdb_dlist_insert(txn, &mid);
 		mdb_cassert(mc, rc == 0);
 	} else {
 		return 0;
@@ -2533,6 +2977,100 @@ mdb_env_sync(MDB_env *env, int force)
 	return rc;
 }
 
+/** Start a sync on behalf of group committers.
+ *	Expects env->me_gc_mutex to be held.
+ *	@param[in] env the environment handle
+ *	@return the txnid of the last meta page the sync will make durable.
+ */
+static txnid_t
+mdb_env_gc_start(MDB_env *env)
+{
+	env->me_gc_busy++;
+	return env->me_gc_committed;
+}
+
+/** Finish a sync started by #mdb_env_gc_start() and wake up the waiters.
+ *	Expects env->me_gc_mutex to be held.
+ *	@param[in] env the environment handle
+ *	@param[in] target the return value of #mdb_env_gc_start()
+ *	@param[in] rc the result of the sync
+ */
+static void
+mdb_env_gc_done(MDB_env *env, txnid_t target, int rc)
+{
+	env->me_gc_busy--;
+	if (rc) {
+		/* Whether the pending meta pages reached the disk is unknown,
+		 * and a later sync which succeeds does not tell either.
+		 */
+		if (env->me_gc_synced < env->me_gc_committed && !env->me_gc_rc) {
+			env->me_gc_rc = rc;
+			env->me_flags |= MDB_FATAL_ERROR;
+		}
+	} else if (env->me_gc_synced < target) {
+		env->me_gc_synced = target;
+	}
+#ifndef _WIN32
+	pthread_cond_broadcast(&env->me_gc_cond);
+#endif
+}
+
+/** Sync the data file in a group commit, before writing the meta page.
+ *	This also makes the meta pages of earlier group commits durable.
+ *	@param[in] env the environment handle
+ *	@return 0 on success, non-zero on failure.
+ */
+static int
+mdb_env_gc_sync(MDB_env *env)
+{
+	txnid_t target;
+	int rc;
+
+	pthread_mutex_lock(&env->me_gc_mutex);
+	target = mdb_env_gc_start(env);
+	pthread_mutex_unlock(&env->me_gc_mutex);
+	rc = mdb_env_sync(env, 0);
+	pthread_mutex_lock(&env->me_gc_mutex);
+	mdb_env_gc_done(env, target, rc);
+	pthread_mutex_unlock(&env->me_gc_mutex);
+	return rc;
+}
+
+/** Wait until the meta page of a group commit is durable.
+ *	Usually the data sync of the next writer takes care of it.
+ *	If no sync is in progress, sync on behalf of all waiters.
+ *	The caller must not hold the write lock.
+ *	@param[in] env the environment handle
+ *	@param[in] txnid the ID of the committed transaction
+ *	@return 0 on success, non-zero on failure.
+ */
+static int
+mdb_env_gc_wait(MDB_env *env, txnid_t txnid)
+{
+	txnid_t target;
+	int rc;
+
+	pthread_mutex_lock(&env->me_gc_mutex);
+	while (!(rc = env->me_gc_rc) && env->me_gc_synced < txnid) {
+#ifndef _WIN32
+		/* A sync in progress may cover us. If not, the next leader
+		 * syncs for everyone who committed in the meantime.
+		 */
+		if (env->me_gc_busy) {
+			pthread_cond_wait(&env->me_gc_cond, &env->me_gc_mutex);
+			continue;
+		}
+#endif
+		target = mdb_env_gc_start(env);
+		pthread_mutex_unlock(&env->me_gc_mutex);
+		rc = mdb_env_sync(env, 1);
+		pthread_mutex_lock(&env->me_gc_mutex);
+		mdb_env_gc_done(env, target, rc);
+	}
+	pthread_mutex_unlock(&env->me_gc_mutex);
+	return rc;
+}
+
 /** Back up parent txn's cursors, then grab the originals for tracking */
 static int
 mdb_cursor_shadow(MDB_txn *src, MDB_txn *dst)
@@ -2668,20 +3206,29 @@ mdb_reader_pid(MDB_env *env, enum Pidlock_op op, MDB_PID_T pid)
 
 /** Common code for #mdb_txn_begin() and #mdb_txn_renew().
  * @param[in] txn the transaction handle to initialize
+ * @param[in] snap for a read-only txn, an active read-only txn whose
+ * snapshot to use instead of the latest one, or NULL. The txn takes
+ * no reader slot then.
  * @return 0 on success, non-zero on failure.
  */
 static int
-mdb_txn_renew0(MDB_txn *txn)
+mdb_txn_renew0(MDB_txn *txn, MDB_txn *snap)
 {
 	MDB_env *env = txn->mt_env;
 	MDB_txninfo *ti = env->me_txns;
 	MDB_meta *meta;
-	unsigned int i, nr, flags = txn->mt_flags;
+	unsigned int i, j, nr, flags = txn->mt_flags;
 	uint16_t x;
 	int rc, new_notls = 0;
 
 	if ((flags &= MDB_TXN_RDONLY) != 0) {
-		if (!ti) {
+		if (snap) {
+			/* snap's reader slot keeps the snapshot. Taking a slot
+			 * here would share the thread's slot without MDB_NOTLS.
+			 */
+			txn->mt_txnid = snap->mt_txnid;
+			txn->mt_u.reader = NULL;
+		} else if (!ti) {
 			meta = mdb_env_pick_meta(env);
 			txn->mt_txnid = meta->mm_txnid;
 			txn->mt_u.reader = NULL;
@@ -2694,7 +3241,9 @@ mdb_txn_renew0(MDB_txn *txn)
 			} else {
 				MDB_PID_T pid = env->me_pid;
 				MDB_THR_T tid = pthread_self();
+#if !MDB_RCAS
 				mdb_mutexref_t rmutex = env->me_rmutex;
+#endif
 
 				if (!env->me_live_reader) {
 					rc = mdb_reader_pid(env, Pidset, pid);
@@ -2703,31 +3252,50 @@ mdb_txn_renew0(MDB_txn *txn)
 					env->me_live_reader = 1;
 				}
 
+#if !MDB_RCAS
 				if (LOCK_MUTEX(rc, env, rmutex))
 					return rc;
+#endif
+				/* Claim a free slot: look from the hint up to
+				 * mti_numreaders, then wrap around. Extend the table
+				 * only if none is free. Slots past mti_numreaders are
+				 * always free, except the ones being claimed.
+				 */
 				nr = ti->mti_numreaders;
-				for (i=0; i<nr; i++)
-					if (ti->mti_readers[i].mr_pid == 0)
-						break;
-				if (i == env->me_maxreaders) {
-					UNLOCK_MUTEX(rmutex);
-					return MDB_READERS_FULL;
+				i = ti->mti_rfree;
+				if (i >= nr)
+					i = 0;
+				for (j = 0; j < nr; j++) {
+					if (ti->mti_readers[i].mr_pid == 0 &&
+						MDB_CAS(&ti->mti_readers[i].mr_pid, 0, pid))
+						goto claimed;
+					if (++i == nr)
+						i = 0;
 				}
-				r = &ti->mti_readers[i];
-				/* Claim the reader slot, carefully since other code
-				 * uses the reader table un-mutexed: First reset the
-				 * slot, next publish it in mti_numreaders.  After
-				 * that, it is safe for mdb_env_close() to touch it.
-				 * When it will be closed, we can finally claim it.
+				for (i = nr; i < env->me_maxreaders; i++)
+					if (MDB_CAS(&ti->mti_readers[i].mr_pid, 0, pid))
+						goto claimed;
+#if !MDB_RCAS
+				UNLOCK_MUTEX(rmutex);
+#endif
+				return MDB_READERS_FULL;
+claimed:
+				/* The slot is ours. Its old mr_txnid only makes
+				 * writers keep more pages until we reset it. Then
+				 * publish it in mti_numreaders, and where
+				 * mdb_env_close() will look for it.
 				 */
-				r->mr_pid = 0;
+				r = &ti->mti_readers[i];
 				r->mr_txnid = (txnid_t)-1;
 				r->mr_tid = tid;
-				if (i == nr)
-					ti->mti_numreaders = ++nr;
-				env->me_close_readers = nr;
-				r->mr_pid = pid;
+				while ((nr = ti->mti_numreaders) <= i &&
+					!MDB_CAS(&ti->mti_numreaders, nr, i+1)) ;
+				while ((j = env->me_close_readers) <= i &&
+					!MDB_CAS(&env->me_close_readers, (int)j, (int)i+1)) ;
+				ti->mti_rfree = i+1;
+#if !MDB_RCAS
 				UNLOCK_MUTEX(rmutex);
+#endif
 
 				new_notls = (env->me_flags & MDB_NOTLS);
 				if (!new_notls && (rc=pthread_setspecific(env->me_txkey, r))) {
@@ -2765,6 +3333,7 @@ mdb_txn_renew0(MDB_txn *txn)
 		txn->mt_dirty_room = MDB_IDL_UM_MAX;
 		txn->mt_u.dirty_list = env->me_dirty_list;
 		txn->mt_u.dirty_list[0].mid = 0;
+		txn->mt_dirty_hmask = 0;
 		txn->mt_free_pgs = env->me_free_pgs;
 		txn->mt_free_pgs[0] = 0;
 		txn->mt_spill_pgs = NULL;
@@ -2773,10 +3342,16 @@ mdb_txn_renew0(MDB_txn *txn)
 	}
 
 	/* Copy the DB info and flags */
-	memcpy(txn->mt_dbs, meta->mm_dbs, CORE_DBS * sizeof(MDB_db));
+	if (snap) {
+		/* The meta page may have been reused since snap began */
+		memcpy(txn->mt_dbs, snap->mt_dbs, CORE_DBS * sizeof(MDB_db));
+		txn->mt_next_pgno = snap->mt_next_pgno;
+	} else {
+		memcpy(txn->mt_dbs, meta->mm_dbs, CORE_DBS * sizeof(MDB_db));
 
-	/* Moved to here to avoid a data race in read TXNs */
-	txn->mt_next_pgno = meta->mm_last_pg+1;
+		/* Moved to here to avoid a data race in read TXNs */
+		txn->mt_next_pgno = meta->mm_last_pg+1;
+	}
 
 	txn->mt_flags = flags;
 
@@ -2810,7 +3385,7 @@ mdb_txn_renew(MDB_txn *txn)
 	if (!txn || !F_ISSET(txn->mt_flags, MDB_TXN_RDONLY|MDB_TXN_FINISHED))
 		return EINVAL;
 
-	rc = mdb_txn_renew0(txn);
+	rc = mdb_txn_renew0(txn, NULL);
 	if (rc == MDB_SUCCESS) {
 		DPRINTF(("renew txn %"Z"u%c %p on mdbenv %p, root page %"Z"u",
 			txn->mt_txnid, (txn->mt_flags & MDB_TXN_RDONLY) ? 'r' : 'w',
@@ -2822,7 +3397,7 @@ mdb_txn_renew(MDB_txn *txn)
 int
 mdb_txn_begin(MDB_env *env, MDB_txn *parent, unsigned int flags, MDB_txn **ret)
 {
-	MDB_txn *txn;
+	MDB_txn *txn, *snap = NULL;
 	MDB_ntxn *ntxn;
 	int rc, size, tsize;
 
@@ -2832,6 +3407,14 @@ mdb_txn_begin(MDB_env *env, MDB_txn *parent, unsigned int flags, MDB_txn **ret)
 	if (env->me_flags & MDB_RDONLY & ~flags) /* write txn in RDONLY env */
 		return EACCES;
 
+	if (parent && (flags & parent->mt_flags & MDB_TXN_RDONLY)) {
+		/* Not nested, just a reader of the same snapshot */
+		if (parent->mt_env != env || (parent->mt_flags & MDB_TXN_FINISHED))
+			return MDB_BAD_TXN;
+		snap = parent;
+		parent = NULL;
+	}
+
 	if (parent) {
 		/* Nested transactions: Max 1 child, write txns only, no writemap */
 		flags |= parent->mt_flags;
@@ -2904,7 +3487,7 @@ mdb_txn_begin(MDB_env *env, MDB_txn *parent, unsigned int flags, MDB_txn **ret)
 	} else { /* MDB_RDONLY */
 		txn->mt_dbiseqs = env->me_dbiseqs;
 renew:
-		rc = mdb_txn_renew0(txn);
+		rc = mdb_txn_renew0(txn, snap);
 	}
 	if (rc) {
 		if (txn != env->me_txn0)
@@ -3000,6 +3583,7 @@ mdb_txn_end(MDB_txn *txn, unsigned mode)
 	} else if (!F_ISSET(txn->mt_flags, MDB_TXN_FINISHED)) {
 		pgno_t *pghead = env->me_pghead;
 
+		env->me_pgsizes_ok = 0;
 		if (!(mode & MDB_END_UPDATE)) /* !(already closed cursors) */
 			mdb_cursors_close(txn, 0);
 		if (!(env->me_flags & MDB_WRITEMAP)) {
@@ -3029,6 +3613,7 @@ mdb_txn_end(MDB_txn *txn, unsigned mode)
 			mdb_midl_free(txn->mt_free_pgs);
 			mdb_midl_free(txn->mt_spill_pgs);
 			free(txn->mt_u.dirty_list);
+			free(txn->mt_dirty_hash);
 		}
 
 		mdb_midl_free(pghead);
@@ -3082,6 +3667,11 @@ mdb_freelist_save(MDB_txn *txn)
 
 	mdb_cursor_init(&mc, txn, FREE_DBI, NULL);
 
+	if (env->me_flags & MDB_EXTFREE) {
+		/* Records must hold whole extents, see head_room below */
+		maxfree_1pg &= ~1;
+	}
+
 	if (env->me_pghead) {
 		/* Make sure first page of freeDB is touched and on freelist */
 		rc = mdb_page_search(&mc, NULL, MDB_PS_FIRST|MDB_PS_MODIFY);
@@ -3141,7 +3731,14 @@ mdb_freelist_save(MDB_txn *txn)
 			key.mv_data = &txn->mt_txnid;
 			do {
 				freecnt = free_pgs[0];
-				data.mv_size = MDB_IDL_SIZEOF(free_pgs);
+				if (env->me_flags & MDB_EXTFREE) {
+					/* Store the runs of the IDL */
+					mdb_midl_sort(free_pgs);
+					data.mv_size = (2 * mdb_mext_runs(free_pgs) + 1) *
+						sizeof(MDB_ID);
+				} else {
+					data.mv_size = MDB_IDL_SIZEOF(free_pgs);
+				}
 				rc = mdb_cursor_put(&mc, &key, &data, MDB_RESERVE);
 				if (rc)
 					return rc;
@@ -3149,7 +3746,10 @@ mdb_freelist_save(MDB_txn *txn)
 				free_pgs = txn->mt_free_pgs;
 			} while (freecnt < free_pgs[0]);
 			mdb_midl_sort(free_pgs);
-			memcpy(data.mv_data, free_pgs, data.mv_size);
+			if (env->me_flags & MDB_EXTFREE)
+				mdb_mext_encode(data.mv_data, free_pgs);
+			else
+				memcpy(data.mv_data, free_pgs, data.mv_size);
 #if (MDB_DEBUG) > 1
 			{
 				unsigned int i = free_pgs[0];
@@ -3164,6 +3764,10 @@ mdb_freelist_save(MDB_txn *txn)
 
 		mop = env->me_pghead;
 		mop_len = (mop ? mop[0] : 0) + txn->mt_loose_count;
+		if (env->me_flags & MDB_EXTFREE) {
+			/* Worst case, each loose page becomes an extent */
+			mop_len += txn->mt_loose_count;
+		}
 
 		/* Reserve records for me_pghead[]. Split it if multi-page,
 		 * to avoid searching freeDB for a page range. Use keys in
@@ -3188,6 +3792,10 @@ mdb_freelist_save(MDB_txn *txn)
 			/* Rare case, not bothering to delete this record */
 			head_room = 0;
 		}
+		if (env->me_flags & MDB_EXTFREE) {
+			/* Records must hold whole extents */
+			head_room &= ~(ssize_t)1;
+		}
 		key.mv_size = sizeof(head_id);
 		key.mv_data = &head_id;
 		data.mv_size = (head_room + 1) * sizeof(pgno_t);
@@ -3206,7 +3814,16 @@ mdb_freelist_save(MDB_txn *txn)
 	/* Return loose page numbers to me_pghead, though usually none are
 	 * left at this point.  The pages themselves remain in dirty_list.
 	 */
-	if (txn->mt_loose_pgs) {
+	if (txn->mt_loose_pgs && (env->me_flags & MDB_EXTFREE)) {
+		MDB_page *mp = txn->mt_loose_pgs;
+		for (; mp; mp = NEXT_LOOSE_PAGE(mp))
+			if ((rc = mdb_pghead_insert(env, mp->mp_pgno, 1)) != 0)
+				return rc;
+		txn->mt_loose_pgs = NULL;
+		txn->mt_loose_count = 0;
+		mop = env->me_pghead;
+		mop_len = mop[0];
+	} else if (txn->mt_loose_pgs) {
 		MDB_page *mp = txn->mt_loose_pgs;
 		unsigned count = txn->mt_loose_count;
 		MDB_IDL loose;
@@ -3255,30 +3872,294 @@ mdb_freelist_save(MDB_txn *txn)
 	return rc;
 }
 
-/** Flush (some) dirty pages to the map, after clearing their dirty flag.
- * @param[in] txn the transaction that's being committed
- * @param[in] keep number of initial pages in dirty_list to keep dirty.
- * @return 0 on success, non-zero on failure.
+#if MDB_USE_IO_URING
+	/** Number of SQEs in an #MDB_ring. The last one is kept for the sync. */
+#define MDB_RING_SIZE	64
+
+	/** An io_uring for writing dirty pages in #mdb_page_flush().
+	 *	Writes are queued until the ring fills up or the flush ends, and
+	 *	are then submitted together. Only the current writer uses it.
+	 */
+typedef struct MDB_ring {
+	int			mr_fd;			/**< the io_uring file descriptor */
+	int			mr_failed;		/**< io_uring_enter() failed, don't use */
+	unsigned	mr_next;		/**< next free SQE slot */
+	unsigned	mr_queued;		/**< SQEs queued but not submitted */
+	unsigned	mr_inflight;	/**< SQEs submitted but not completed */
+	unsigned	*mr_sqtail;
+	unsigned	*mr_sqmask;
+	unsigned	*mr_sqarray;
+	unsigned	*mr_cqhead;
+	unsigned	*mr_cqtail;
+	unsigned	*mr_cqmask;
+	struct io_uring_sqe	*mr_sqes;
+	struct io_uring_cqe	*mr_cqes;
+	void		*mr_sqmap;		/**< mmap of the SQ ring */
+	void		*mr_cqmap;		/**< mmap of the CQ ring */
+	size_t		mr_sqlen;
+	size_t		mr_cqlen;
+	size_t		mr_sqeslen;
+	/** The write in each SQE slot. The iovecs must live until it is done */
+	struct {
+		off_t		mw_pos;
+		ssize_t		mw_size;
+		int			mw_n;
+		struct iovec mw_iov[MDB_COMMIT_PAGES];
+	} mr_writes[MDB_RING_SIZE];
+} MDB_ring;
+
+/** Release an #MDB_ring */
+static void ESECT
+mdb_ring_close(MDB_ring *r)
+{
+	if (r->mr_sqes)
+		munmap(r->mr_sqes, r->mr_sqeslen);
+	if (r->mr_cqmap)
+		munmap(r->mr_cqmap, r->mr_cqlen);
+	if (r->mr_sqmap)
+		munmap(r->mr_sqmap, r->mr_sqlen);
+	close(r->mr_fd);
+	free(r);
+}
+
+/** Set up an io_uring for writing pages, if the kernel lets us.
+ *	Otherwise leave env->me_ring NULL, to write pages the usual way.
  */
-static int
-mdb_page_flush(MDB_txn *txn, int keep)
+static void ESECT
+mdb_ring_open(MDB_env *env)
 {
-	MDB_env		*env = txn->mt_env;
-	MDB_ID2L	dl = txn->mt_u.dirty_list;
-	unsigned	psize = env->me_psize, j;
-	int			i, pagecount = dl[0].mid, rc;
-	size_t		size = 0, pos = 0;
-	pgno_t		pgno = 0;
-	MDB_page	*dp = NULL;
-#ifdef _WIN32
-	OVERLAPPED	ov;
-#else
-	struct iovec iov[MDB_COMMIT_PAGES];
-	ssize_t		wpos = 0, wsize = 0, wres;
-	size_t		next_pos = 1; /* impossible pos, so pos != next_pos */
-	int			n = 0;
-#endif
+	MDB_ring *r;
+	struct io_uring_params p;
+	char *sq, *cq;
+	void *sqes;
 
+	if ((r = calloc(1, sizeof(MDB_ring))) == NULL)
+		return;
+	memset(&p, 0, sizeof(p));
+	r->mr_fd = syscall(__NR_io_uring_setup, MDB_RING_SIZE, &p);
+	if (r->mr_fd < 0) {
+		DPRINTF(("io_uring_setup: %s", strerror(errno)));
+		free(r);
+		return;
+	}
+	r->mr_sqlen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->mr_cqlen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	r->mr_sqeslen = p.sq_entries * sizeof(struct io_uring_sqe);
+	sq = mmap(NULL, r->mr_sqlen, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+		r->mr_fd, IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED)
+		goto fail;
+	r->mr_sqmap = sq;
+	cq = mmap(NULL, r->mr_cqlen, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+		r->mr_fd, IORING_OFF_CQ_RING);
+	if (cq == MAP_FAILED)
+		goto fail;
+	r->mr_cqmap = cq;
+	sqes = mmap(NULL, r->mr_sqeslen, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_POPULATE, r->mr_fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED)
+		goto fail;
+	r->mr_sqes = sqes;
+	r->mr_sqtail = (unsigned *)(sq + p.sq_off.tail);
+	r->mr_sqmask = (unsigned *)(sq + p.sq_off.ring_mask);
+	r->mr_sqarray = (unsigned *)(sq + p.sq_off.array);
+	r->mr_cqhead = (unsigned *)(cq + p.cq_off.head);
+	r->mr_cqtail = (unsigned *)(cq + p.cq_off.tail);
+	r->mr_cqmask = (unsigned *)(cq + p.cq_off.ring_mask);
+	r->mr_cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	env->me_ring = r;
+	return;
+
+fail:
+	DPRINTF(("io_uring mmap: %s", strerror(errno)));
+	mdb_ring_close(r);
+}
+
+/** Get a cleared SQE for a slot of the ring */
+static struct io_uring_sqe *
+mdb_ring_sqe(MDB_ring *r, unsigned slot)
+{
+	struct io_uring_sqe *sqe = &r->mr_sqes[slot];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->user_data = slot;
+	return sqe;
+}
+
+/** Queue the SQE of a slot, to be submitted by #mdb_ring_run() */
+static void
+mdb_ring_queue(MDB_ring *r, unsigned slot)
+{
+	unsigned tail = *r->mr_sqtail;
+	r->mr_sqarray[tail & *r->mr_sqmask] = slot;
+	__atomic_store_n(r->mr_sqtail, tail + 1, __ATOMIC_RELEASE);
+	r->mr_queued++;
+}
+
+/** Check the completion of a write or sync queued on the ring.
+ *	A write the kernel could not do asynchronously is redone here.
+ *	@return 0 on success, non-zero on failure.
+ */
+static int
+mdb_ring_done(MDB_env *env, struct io_uring_cqe *cqe)
+{
+	MDB_ring *r = env->me_ring;
+	unsigned slot = cqe->user_data;
+	ssize_t res = cqe->res;
+	int rc;
+
+	if (slot == MDB_RING_SIZE-1) {
+		if (res < 0) {
+			DPRINTF(("io_uring fsync: %s", strerror(-res)));
+			return -res;
+		}
+		return MDB_SUCCESS;
+	}
+	if (res == -EAGAIN || res == -EINTR) {
+		do
+			res = pwritev(env->me_fd, r->mr_writes[slot].mw_iov,
+				r->mr_writes[slot].mw_n, r->mr_writes[slot].mw_pos);
+		while (res < 0 && (res = -ErrCode()) == -EINTR);
+	}
+	if (res != r->mr_writes[slot].mw_size) {
+		if (res < 0) {
+			rc = -res;
+			DPRINTF(("Write error: %s", strerror(rc)));
+		} else {
+			rc = EIO; /* TODO: Use which error code? */
+			DPUTS("short write, filesystem full?");
+		}
+		return rc;
+	}
+	return MDB_SUCCESS;
+}
+
+/** Submit the queued SQEs and wait for everything in flight.
+ *	@return 0 on success, non-zero on failure.
+ */
+static int
+mdb_ring_run(MDB_env *env)
+{
+	MDB_ring *r = env->me_ring;
+	unsigned head;
+	int ret, rc = MDB_SUCCESS, err;
+
+	while (r->mr_queued || r->mr_inflight) {
+		ret = syscall(__NR_io_uring_enter, r->mr_fd, r->mr_queued,
+			r->mr_queued + r->mr_inflight, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (ret < 0) {
+			err = ErrCode();
+			if (err != EINTR && err != EAGAIN && err != EBUSY) {
+				DPRINTF(("io_uring_enter: %s", strerror(err)));
+				/* Pages in flight may still get written later, over
+				 * whatever reuses them. Don't risk it.
+				 */
+				if (r->mr_inflight)
+					env->me_flags |= MDB_FATAL_ERROR;
+				r->mr_failed = 1;
+				return err;
+			}
+			ret = 0;
+		}
+		r->mr_queued -= ret;
+		r->mr_inflight += ret;
+		head = *r->mr_cqhead;
+		while (head != __atomic_load_n(r->mr_cqtail, __ATOMIC_ACQUIRE)) {
+			err = mdb_ring_done(env, &r->mr_cqes[head & *r->mr_cqmask]);
+			if (err && !rc)
+				rc = err;
+			r->mr_inflight--;
+			head++;
+		}
+		__atomic_store_n(r->mr_cqhead, head, __ATOMIC_RELEASE);
+	}
+	r->mr_next = 0;
+	return rc;
+}
+
+/** Queue a write of dirty pages on the ring.
+ *	The iovecs are copied, the pages must stay until #mdb_ring_run().
+ *	@return 0 on success, non-zero on failure.
+ */
+static int
+mdb_ring_write(MDB_env *env, struct iovec *iov, int n, off_t pos, ssize_t size)
+{
+	MDB_ring *r = env->me_ring;
+	struct io_uring_sqe *sqe;
+	unsigned slot;
+	int rc;
+
+	if (r->mr_next == MDB_RING_SIZE-1 && (rc = mdb_ring_run(env)))
+		return rc;
+	slot = r->mr_next++;
+	memcpy(r->mr_writes[slot].mw_iov, iov, n * sizeof(struct iovec));
+	r->mr_writes[slot].mw_n = n;
+	r->mr_writes[slot].mw_pos = pos;
+	r->mr_writes[slot].mw_size = size;
+	sqe = mdb_ring_sqe(r, slot);
+	sqe->opcode = IORING_OP_WRITEV;
+	sqe->fd = env->me_fd;
+	sqe->off = pos;
+	sqe->addr = (uintptr_t)r->mr_writes[slot].mw_iov;
+	sqe->len = n;
+	mdb_ring_queue(r, slot);
+	return MDB_SUCCESS;
+}
+
+/** Queue a sync of the data file behind all the queued writes.
+ *	IOSQE_IO_DRAIN holds it back until every earlier SQE is done,
+ *	without serializing the writes themselves as IOSQE_IO_LINK would.
+ */
+static void
+mdb_ring_sync(MDB_env *env)
+{
+	MDB_ring *r = env->me_ring;
+	struct io_uring_sqe *sqe;
+
+	sqe = mdb_ring_sqe(r, MDB_RING_SIZE-1);
+	sqe->opcode = IORING_OP_FSYNC;
+	sqe->fd = env->me_fd;
+	sqe->flags = IOSQE_IO_DRAIN;
+	if (!(env->me_flags & MDB_FSYNCONLY))
+		sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+	mdb_ring_queue(r, MDB_RING_SIZE-1);
+}
+#endif	/* MDB_USE_IO_URING */
+
+/** Flush (some) dirty pages to the map, after clearing their dirty flag.
+ * @param[in] txn the transaction that's being committed
+ * @param[in] keep number of initial pages in dirty_list to keep dirty.
+ * @param[in,out] sync If not NULL, nonzero if the caller is going to sync
+ *	the data file after the flush. Cleared if the flush already did it.
+ * @return 0 on success, non-zero on failure.
+ */
+static int
+mdb_page_flush(MDB_txn *txn, int keep, int *sync)
+{
+	MDB_env		*env = txn->mt_env;
+	MDB_ID2L	dl = txn->mt_u.dirty_list;
+	unsigned	psize = env->me_psize, j;
+	int			i, pagecount = dl[0].mid, rc;
+	size_t		size = 0, pos = 0;
+	pgno_t		pgno = 0;
+	MDB_page	*dp = NULL;
+#ifdef _WIN32
+	OVERLAPPED	ov;
+#else
+	struct iovec iov[MDB_COMMIT_PAGES];
+	ssize_t		wpos = 0, wsize = 0, wres;
+	size_t		next_pos = 1; /* impossible pos, so pos != next_pos */
+	int			n = 0;
+#endif
+#if MDB_USE_IO_URING
+	int			ring = env->me_ring && !env->me_ring->mr_failed;
+#endif
+
+	/* Sorted lists give the longest contiguous writes, and the
+	 * kept pages below are compacted in place */
+	mdb_dlist_sort(txn);
+	/* A top-level txn's dirty_room accounts for all of its dirty pages */
+	mdb_tassert(txn, txn->mt_parent ||
+		dl[0].mid + txn->mt_dirty_room == MDB_IDL_UM_MAX);
 	j = i = keep;
 
 	if (env->me_flags & MDB_WRITEMAP) {
@@ -3336,6 +4217,13 @@ mdb_page_flush(MDB_txn *txn, int keep)
 		/* Write up to MDB_COMMIT_PAGES dirty pages at a time. */
 		if (pos!=next_pos || n==MDB_COMMIT_PAGES || wsize+size>MAX_WRITE) {
 			if (n) {
+#if MDB_USE_IO_URING
+				if (ring) {
+					if ((rc = mdb_ring_write(env, iov, n, wpos, wsize)))
+						return rc;
+					goto written;
+				}
+#endif
 retry_write:
 				/* Write previous page(s) */
 #ifdef MDB_USE_PWRITEV
@@ -3367,6 +4255,9 @@ retry_seek:
 					}
 					return rc;
 				}
+#if MDB_USE_IO_URING
+written:
+#endif
 				n = 0;
 			}
 			if (i > pagecount)
@@ -3383,6 +4274,19 @@ retry_seek:
 #endif	/* _WIN32 */
 	}
 
+#if MDB_USE_IO_URING
+	if (ring) {
+		/* Sync in the same submission as the last writes */
+		int dsync = sync && *sync && !(env->me_flags & MDB_NOSYNC);
+		if (dsync)
+			mdb_ring_sync(env);
+		if ((rc = mdb_ring_run(env)))
+			return rc;
+		if (dsync)
+			*sync = 0;
+	}
+#endif
+
 	/* MIPS has cache coherency issues, this is a no-op everywhere else
 	 * Note: for any size >= on-chip cache size, entire on-chip cache is
 	 * flushed.
@@ -3410,9 +4314,10 @@ done:
 int
 mdb_txn_commit(MDB_txn *txn)
 {
-	int		rc;
+	int		rc, sync;
 	unsigned int i, end_mode;
 	MDB_env	*env;
+	txnid_t	gc_txnid = 0;
 
 	if (txn == NULL)
 		return EINVAL;
@@ -3473,6 +4378,9 @@ mdb_txn_commit(MDB_txn *txn)
 			parent->mt_dbflags[i] = txn->mt_dbflags[i] | x;
 		}
 
+		/* The merge below needs both dirty lists sorted */
+		mdb_dlist_sort(parent);
+		mdb_dlist_sort(txn);
 		dst = parent->mt_u.dirty_list;
 		src = txn->mt_u.dirty_list;
 		/* Remove anything in our dirty list from parent's spill list */
@@ -3503,14 +4411,10 @@ mdb_txn_commit(MDB_txn *txn)
 				if (pn & 1)
 					continue;	/* deleted spillpg */
 				pn >>= 1;
-				y = mdb_mid2l_search(dst, pn);
-				if (y <= dst[0].mid && dst[y].mid == pn) {
+				y = mdb_dlist_search(parent, pn);
+				if (y) {
 					free(dst[y].mptr);
-					while (y < dst[0].mid) {
-						dst[y] = dst[y+1];
-						y++;
-					}
-					dst[0].mid--;
+					mdb_dlist_remove(parent, y);
 				}
 			}
 		}
@@ -3545,6 +4449,7 @@ mdb_txn_commit(MDB_txn *txn)
 		mdb_tassert(txn, i == x);
 		dst[0].mid = len;
 		free(txn->mt_u.dirty_list);
+		free(txn->mt_dirty_hash);
 		parent->mt_dirty_room = txn->mt_dirty_room;
 		if (txn->mt_spill_pgs) {
 			if (parent->mt_spill_pgs) {
@@ -3621,14 +4526,35 @@ mdb_txn_commit(MDB_txn *txn)
 	mdb_audit(txn);
 #endif
 
-	if ((rc = mdb_page_flush(txn, 0)) ||
-		(rc = mdb_env_sync(env, 0)) ||
+	/* Group commit needs the data syncs to be durable */
+	txn->mt_flags |= env->me_flags & MDB_GROUPCOMMIT;
+	if ((env->me_flags & MDB_NOSYNC) ||
+		(env->me_flags & (MDB_WRITEMAP|MDB_MAPASYNC)) == (MDB_WRITEMAP|MDB_MAPASYNC))
+		txn->mt_flags &= ~MDB_TXN_GROUPCOMMIT;
+
+	/* A group commit must tell a failed sync from a failed write,
+	 * so it does not let #mdb_page_flush() sync.
+	 */
+	sync = !(txn->mt_flags & MDB_TXN_GROUPCOMMIT);
+	if ((rc = mdb_page_flush(txn, 0, &sync)) ||
+		(rc = (txn->mt_flags & MDB_TXN_GROUPCOMMIT)
+			? mdb_env_gc_sync(env) : sync ? mdb_env_sync(env, 0) : 0) ||
 		(rc = mdb_env_write_meta(txn)))
 		goto fail;
 	end_mode = MDB_END_COMMITTED|MDB_END_UPDATE;
 
+	if (txn->mt_flags & MDB_TXN_GROUPCOMMIT) {
+		/* Publish the meta page before the next writer can sync */
+		gc_txnid = txn->mt_txnid;
+		pthread_mutex_lock(&env->me_gc_mutex);
+		env->me_gc_committed = gc_txnid;
+		pthread_mutex_unlock(&env->me_gc_mutex);
+	}
+
 done:
 	mdb_txn_end(txn, end_mode);
+	if (gc_txnid)
+		return mdb_env_gc_wait(env, gc_txnid);
 	return MDB_SUCCESS;
 
 fail:
@@ -3688,7 +4614,8 @@ mdb_env_read_header(MDB_env *env, MDB_meta *meta)
 			return MDB_INVALID;
 		}
 
-		if (m->mm_version != MDB_DATA_VERSION) {
+		if (m->mm_version != MDB_DATA_VERSION &&
+			m->mm_version != MDB_DATA_VERSION_EXT) {
 			DPRINTF(("database is version %u, expected version %u",
 				m->mm_version, MDB_DATA_VERSION));
 			return MDB_VERSION_MISMATCH;
@@ -3705,7 +4632,8 @@ static void ESECT
 mdb_env_init_meta0(MDB_env *env, MDB_meta *meta)
 {
 	meta->mm_magic = MDB_MAGIC;
-	meta->mm_version = MDB_DATA_VERSION;
+	meta->mm_version = (env->me_flags & MDB_EXTFREE) ?
+		MDB_DATA_VERSION_EXT : MDB_DATA_VERSION;
 	meta->mm_mapsize = env->me_mapsize;
 	meta->mm_psize = env->me_psize;
 	meta->mm_last_pg = NUM_METAS-1;
@@ -3796,6 +4724,9 @@ mdb_env_write_meta(MDB_txn *txn)
 
 	env = txn->mt_env;
 	flags = env->me_flags;
+	/* A group commit syncs the meta page later, see #mdb_env_gc_wait() */
+	if (txn->mt_flags & MDB_TXN_GROUPCOMMIT)
+		flags |= MDB_NOMETASYNC;
 	mp = env->me_metas[toggle];
 	mapsize = env->me_metas[toggle ^ 1]->mm_mapsize;
 	/* Persist any increases of mapsize config */
@@ -3914,10 +4845,28 @@ int ESECT
 mdb_env_create(MDB_env **env)
 {
 	MDB_env *e;
+	int rc;
 
 	e = calloc(1, sizeof(MDB_env));
 	if (!e)
 		return ENOMEM;
+#ifdef _WIN32
+	if (!(e->me_gc_mutex = CreateMutex(NULL, FALSE, NULL))) {
+		rc = ErrCode();
+		free(e);
+		return rc;
+	}
+#else
+	if ((rc = pthread_mutex_init(&e->me_gc_mutex, NULL)) != 0) {
+		free(e);
+		return rc;
+	}
+	if ((rc = pthread_cond_init(&e->me_gc_cond, NULL)) != 0) {
+		pthread_mutex_destroy(&e->me_gc_mutex);
+		free(e);
+		return rc;
+	}
+#endif
 
 	e->me_maxreaders = DEFAULT_READERS;
 	e->me_maxdbs = e->me_numdbs = CORE_DBS;
@@ -3980,18 +4929,43 @@ mdb_env_map(MDB_env *env, void *addr)
 		return rc;
 #else
 	int prot = PROT_READ;
+	int mflags = MAP_SHARED;
 	if (flags & MDB_WRITEMAP) {
 		prot |= PROT_WRITE;
 		if (ftruncate(env->me_fd, env->me_mapsize) < 0)
 			return ErrCode();
 	}
-	env->me_map = mmap(addr, env->me_mapsize, prot, MAP_SHARED,
+#ifdef MAP_POPULATE
+	/* With a writable map, the file is already as large as the map */
+	else if (env->me_pfhints & MDB_PF_POPULATE)
+		mflags |= MAP_POPULATE;
+#endif
+	env->me_map = mmap(addr, env->me_mapsize, prot, mflags,
 		env->me_fd, 0);
 	if (env->me_map == MAP_FAILED) {
 		env->me_map = NULL;
 		return ErrCode();
 	}
 
+#ifdef MADV_HUGEPAGE
+	if (env->me_pfhints & MDB_PF_HUGEPAGE)
+		madvise(env->me_map, env->me_mapsize, MADV_HUGEPAGE);
+#endif
+	if (env->me_pfhints & MDB_PF_WILLNEED) {
+		size_t fsize = 0;
+		if (mdb_fsize(env->me_fd, &fsize) == MDB_SUCCESS && fsize) {
+			if (fsize > env->me_mapsize)
+				fsize = env->me_mapsize;
+#ifdef MADV_WILLNEED
+			madvise(env->me_map, fsize, MADV_WILLNEED);
+#else
+#ifdef POSIX_MADV_WILLNEED
+			posix_madvise(env->me_map, fsize, POSIX_MADV_WILLNEED);
+#endif /* POSIX_MADV_WILLNEED */
+#endif /* MADV_WILLNEED */
+		}
+	}
+
 	if (flags & MDB_NORDAHEAD) {
 		/* Turn off readahead. It's harmful when the DB is larger than RAM. */
 #ifdef MADV_RANDOM
@@ -4019,6 +4993,101 @@ mdb_env_map(MDB_env *env, void *addr)
 	return MDB_SUCCESS;
 }
 
+	/** Read the top levels of a tree, for #mdb_env_prefault().
+	 * @param[in] mc a cursor on the tree, for its transaction.
+	 * @param[in] pg the page to read.
+	 * @param[in] levels the levels left to read, including this page's.
+	 */
+static void ESECT
+mdb_env_pfwalk(MDB_cursor *mc, pgno_t pg, unsigned int levels)
+{
+	MDB_env *env = mc->mc_txn->mt_env;
+	MDB_page *mp;
+	unsigned int i, n;
+
+	if (env->me_pfstop || mdb_page_get(mc, pg, &mp, NULL) != MDB_SUCCESS ||
+		!IS_BRANCH(mp) || --levels == 0)
+		return;
+	n = NUMKEYS(mp);
+#if defined(MADV_WILLNEED) && !defined(_WIN32)
+	/* Have the OS read all the children at once, instead of
+	 * waiting for each of them in turn.
+	 */
+	for (i=0; i<n; i++)
+		madvise(env->me_map + (size_t)env->me_psize * NODEPGNO(NODEPTR(mp, i)),
+			env->me_psize, MADV_WILLNEED);
+#endif
+	for (i=0; i<n; i++)
+		mdb_env_pfwalk(mc, NODEPGNO(NODEPTR(mp, i)), levels);
+}
+
+	/** Background thread of #mdb_env_prefault(). */
+static THREAD_RET ESECT CALL_CONV
+mdb_env_pfthr(void *arg)
+{
+	MDB_env *env = arg;
+	MDB_txn *txn;
+	MDB_cursor mc;
+	MDB_xcursor mx;
+	MDB_dbi dbi;
+	unsigned int depth, levels;
+
+	/* A txn for each DB, so old pages aren't held back for long */
+	for (dbi = MAIN_DBI; dbi < env->me_numdbs && !env->me_pfstop; dbi++) {
+		if (mdb_txn_begin(env, NULL, MDB_RDONLY, &txn) != MDB_SUCCESS)
+			break;
+		if (dbi < txn->mt_numdbs && TXN_DBI_EXIST(txn, dbi, DB_USRVALID)) {
+			/* This looks up the root of a named DB */
+			mdb_cursor_init(&mc, txn, dbi, &mx);
+			depth = txn->mt_dbs[dbi].md_depth;
+			levels = env->me_pflevels;
+			if (!levels)
+				levels = depth > 1 ? depth - 1 : 1;
+			if (txn->mt_dbs[dbi].md_root != P_INVALID)
+				mdb_env_pfwalk(&mc, txn->mt_dbs[dbi].md_root, levels);
+		}
+		mdb_txn_abort(txn);
+	}
+	return (THREAD_RET)0;
+}
+
+	/** Stop the background thread of #mdb_env_prefault(), if any. */
+static void ESECT
+mdb_env_pfstop(MDB_env *env)
+{
+	if (env->me_pfrun) {
+		env->me_pfstop = 1;
+		THREAD_FINISH(env->me_pfthr);
+		env->me_pfrun = 0;
+	}
+}
+
+int ESECT
+mdb_env_prefault(MDB_env *env, unsigned int levels)
+{
+	int rc;
+
+	if (!env || !env->me_map)
+		return EINVAL;
+	mdb_env_pfstop(env);
+	env->me_pflevels = levels;
+	env->me_pfstop = 0;
+	rc = THREAD_CREATE(env->me_pfthr, mdb_env_pfthr, env);
+	if (rc == MDB_SUCCESS)
+		env->me_pfrun = 1;
+	return rc;
+}
+
+int ESECT
+mdb_env_set_prefault(MDB_env *env, unsigned int flags)
+{
+	if (!env || env->me_map ||
+		(flags & ~(MDB_PF_WILLNEED|MDB_PF_POPULATE|MDB_PF_HUGEPAGE)))
+		return EINVAL;
+	env->me_pfhints = flags;
+	return MDB_SUCCESS;
+}
+
 int ESECT
 mdb_env_set_mapsize(MDB_env *env, size_t size)
 {
@@ -4040,6 +5109,7 @@ mdb_env_set_mapsize(MDB_env *env, size_t size)
 			if (size < minsize)
 				size = minsize;
 		}
+		mdb_env_pfstop(env);
 		munmap(env->me_map, env->me_mapsize);
 		env->me_mapsize = size;
 		old = (env->me_flags & MDB_FIXEDMAP) ? env->me_map : NULL;
@@ -4368,6 +5438,11 @@ mdb_env_open2(MDB_env *env)
 		meta.mm_mapsize = DEFAULT_MAPSIZE;
 	} else {
 		env->me_psize = meta.mm_psize;
+		/* The freelist format was chosen when the file was created */
+		if (meta.mm_version == MDB_DATA_VERSION_EXT)
+			env->me_flags |= MDB_EXTFREE;
+		else
+			env->me_flags &= ~MDB_EXTFREE;
 	}
 
 	/* Was a mapsize configured? */
@@ -4869,6 +5944,10 @@ mdb_env_setup_locks(MDB_env *env, MDB_name *fname, int mode, int *excl)
 		env->me_txns->mti_format = MDB_LOCK_FORMAT;
 		env->me_txns->mti_txnid = 0;
 		env->me_txns->mti_numreaders = 0;
+		env->me_txns->mti_rfree = 0;
+		/* Slots are claimed by their pid, clear any left over */
+		memset(env->me_txns->mti_readers, 0,
+			env->me_maxreaders * sizeof(MDB_reader));
 
 	} else {
 		if (env->me_txns->mti_magic != MDB_MAGIC) {
@@ -4910,9 +5989,10 @@ fail:
 	 *	at runtime. Changing other flags requires closing the
 	 *	environment and re-opening it with the new flags.
 	 */
-#define	CHANGEABLE	(MDB_NOSYNC|MDB_NOMETASYNC|MDB_MAPASYNC|MDB_NOMEMINIT)
+#define	CHANGEABLE	(MDB_NOSYNC|MDB_NOMETASYNC|MDB_MAPASYNC|MDB_NOMEMINIT| \
+	MDB_GROUPCOMMIT)
 #define	CHANGELESS	(MDB_FIXEDMAP|MDB_NOSUBDIR|MDB_RDONLY| \
-	MDB_WRITEMAP|MDB_NOTLS|MDB_NOLOCK|MDB_NORDAHEAD)
+	MDB_WRITEMAP|MDB_NOTLS|MDB_NOLOCK|MDB_NORDAHEAD|MDB_EXTFREE|MDB_NOURING)
 
 #if VALID_FLAGS & PERSISTENT_FLAGS & (CHANGEABLE|CHANGELESS)
 # error "Persistent DB flags & env flags overlap, but both go in mm_flags"
@@ -5007,6 +6087,10 @@ mdb_env_open(MDB_env *env, const char *path, unsigned int flags, mdb_mode_t mode
 			} else {
 				rc = ENOMEM;
 			}
+#if MDB_USE_IO_URING
+			if (!rc && !(flags & (MDB_WRITEMAP|MDB_NOURING)))
+				mdb_ring_open(env);
+#endif
 		}
 	}
 
@@ -5027,6 +6111,8 @@ mdb_env_close0(MDB_env *env, int excl)
 	if (!(env->me_flags & MDB_ENV_ACTIVE))
 		return;
 
+	mdb_env_pfstop(env);
+
 	/* Doing this here since me_dbxs may not exist during mdb_env_close */
 	if (env->me_dbxs) {
 		for (i = env->me_maxdbs; --i >= CORE_DBS; )
@@ -5039,6 +6125,9 @@ mdb_env_close0(MDB_env *env, int excl)
 	free(env->me_dbflags);
 	free(env->me_path);
 	free(env->me_dirty_list);
+	mdb_midl_free(env->me_pgsizes);
+	if (env->me_txn0)
+		free(env->me_txn0->mt_dirty_hash);
 	free(env->me_txn0);
 	mdb_midl_free(env->me_free_pgs);
 
@@ -5058,6 +6147,12 @@ mdb_env_close0(MDB_env *env, int excl)
 	if (env->me_map) {
 		munmap(env->me_map, env->me_mapsize);
 	}
+#if MDB_USE_IO_URING
+	if (env->me_ring) {
+		mdb_ring_close(env->me_ring);
+		env->me_ring = NULL;
+	}
+#endif
 	if (env->me_mfd != INVALID_HANDLE_VALUE)
 		(void) close(env->me_mfd);
 	if (env->me_fd != INVALID_HANDLE_VALUE)
@@ -5072,8 +6167,11 @@ mdb_env_close0(MDB_env *env, int excl)
 		 * our readers), and clear each reader atomically.
 		 */
 		for (i = env->me_close_readers; --i >= 0; )
-			if (env->me_txns->mti_readers[i].mr_pid == pid)
+			if (env->me_txns->mti_readers[i].mr_pid == pid) {
 				env->me_txns->mti_readers[i].mr_pid = 0;
+				if ((unsigned)i < env->me_txns->mti_rfree)
+					env->me_txns->mti_rfree = i;
+			}
 #ifdef _WIN32
 		if (env->me_rmutex) {
 			CloseHandle(env->me_rmutex);
@@ -5131,6 +6229,12 @@ mdb_env_close(MDB_env *env)
 	}
 
 	mdb_env_close0(env, 0);
+#ifdef _WIN32
+	CloseHandle(env->me_gc_mutex);
+#else
+	pthread_cond_destroy(&env->me_gc_cond);
+	pthread_mutex_destroy(&env->me_gc_mutex);
+#endif
 	free(env);
 }
 
@@ -5229,6 +6333,100 @@ mdb_cmp_memnr(const MDB_val *a, const MDB_val *b)
 	return len_diff<0 ? -1 : len_diff;
 }
 
+/** Count the leading bytes \b a and \b b have in common, up to \b n */
+static unsigned int
+mdb_prefix_len(const char *a, const char *b, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n && a[i] == b[i]; i++) ;
+	return i;
+}
+
+/** Count how many bytes of the key prefix of #P_PREFIX page \b mp
+ *	\b key starts with.
+ */
+static unsigned int
+mdb_prefix_match(MDB_env *env, MDB_page *mp, MDB_val *key)
+{
+	unsigned int n = mp->mp_pad;
+
+	if (key->mv_size < n)
+		n = key->mv_size;
+	return mdb_prefix_len(key->mv_data, PREFIXKEY(mp, env->me_psize), n);
+}
+
+/** Compare \b key with the key prefix of #P_PREFIX page \b mp.
+ * @return < 0 if \b key sorts before all keys of the page, > 0 if
+ * it sorts after them, 0 if it starts with the prefix.
+ */
+static int
+mdb_cmp_prefix(MDB_env *env, MDB_page *mp, MDB_val *key)
+{
+	unsigned int plen = mp->mp_pad;
+	int rc;
+
+	rc = memcmp(key->mv_data, PREFIXKEY(mp, env->me_psize),
+		key->mv_size < plen ? key->mv_size : plen);
+	if (!rc && key->mv_size < plen)
+		rc = -1;
+	return rc;
+}
+
+/** Get the whole key of leaf node \b node on page \b mp.
+ *	Keys of #P_PREFIX pages are put together in \b buf, which
+ *	must hold #MDB_KBUFSIZE bytes.
+ */
+static void
+mdb_node_key(MDB_env *env, MDB_page *mp, MDB_node *node, MDB_val *key, char *buf)
+{
+	unsigned int plen = IS_PREFIX(mp) ? mp->mp_pad : 0;
+
+	key->mv_size = NODEKSZ(node);
+	key->mv_data = NODEKEY(node);
+	if (plen) {
+		memcpy(buf, PREFIXKEY(mp, env->me_psize), plen);
+		memcpy(buf + plen, key->mv_data, key->mv_size);
+		key->mv_size += plen;
+		key->mv_data = buf;
+	}
+}
+
+/** Set the key of \b node on the cursor's top page into \b key,
+ *	if requested. Keys of #P_PREFIX pages go in the cursor's buffer.
+ */
+static void
+mdb_cursor_key(MDB_cursor *mc, MDB_node *node, MDB_val *key)
+{
+	MDB_page *mp = mc->mc_pg[mc->mc_top];
+
+	if (key == NULL)
+		return;
+	mdb_cassert(mc, mc->mc_kbuf || !IS_PREFIX(mp) || !mp->mp_pad);
+	mdb_node_key(mc->mc_txn->mt_env, mp, node, key, mc->mc_kbuf);
+}
+
+/** Compare \b key with the key of leaf node \b node on page \b mp.
+ *	#P_PREFIX pages only occur in databases using #mdb_cmp_memn,
+ *	so their key prefix can be compared on its own.
+ */
+static int
+mdb_cmp_node(MDB_cursor *mc, MDB_page *mp, MDB_node *node, MDB_val *key)
+{
+	MDB_val nodekey, rest;
+	int rc;
+
+	MDB_GET_KEY2(node, nodekey);
+	if (IS_PREFIX(mp) && mp->mp_pad) {
+		if ((rc = mdb_cmp_prefix(mc->mc_txn->mt_env, mp, key)) != 0)
+			return rc;
+		rest.mv_size = key->mv_size - mp->mp_pad;
+		rest.mv_data = (char *)key->mv_data + mp->mp_pad;
+		return mdb_cmp_memn(&rest, &nodekey);
+	}
+	return mc->mc_dbx->md_cmp(key, &nodekey);
+}
+
 /** Search for key within a page, using binary search.
  * Returns the smallest entry larger or equal to the key.
  * If exactp is non-null, stores whether the found entry was an exact match
@@ -5244,7 +6442,7 @@ mdb_node_search(MDB_cursor *mc, MDB_val *key, int *exactp)
 	int		 rc = 0;
 	MDB_page *mp = mc->mc_pg[mc->mc_top];
 	MDB_node	*node = NULL;
-	MDB_val	 nodekey;
+	MDB_val	 nodekey, rest;
 	MDB_cmp_func *cmp;
 	DKBUF;
 
@@ -5285,6 +6483,21 @@ mdb_node_search(MDB_cursor *mc, MDB_val *key, int *exactp)
 				high = i - 1;
 		}
 	} else {
+		if (IS_PREFIX(mp) && mp->mp_pad && nkeys) {
+			/* Keys without the page's prefix sort before or after
+			 * all of its nodes. Otherwise only search the rest.
+			 */
+			rc = mdb_cmp_prefix(mc->mc_txn->mt_env, mp, key);
+			if (rc) {
+				i = rc < 0 ? 0 : nkeys-1;
+				node = NODEPTR(mp, i);
+				high = low - 1;
+			} else {
+				rest.mv_size = key->mv_size - mp->mp_pad;
+				rest.mv_data = (char *)key->mv_data + mp->mp_pad;
+				key = &rest;
+			}
+		}
 		while (low <= high) {
 			i = (low + high) >> 1;
 
@@ -5414,12 +6627,9 @@ mdb_page_get(MDB_cursor *mc, pgno_t pgno, MDB_page **ret, int *lvl)
 					goto done;
 				}
 			}
-			if (dl[0].mid) {
-				unsigned x = mdb_mid2l_search(dl, pgno);
-				if (x <= dl[0].mid && dl[x].mid == pgno) {
-					p = dl[x].mptr;
-					goto done;
-				}
+			if ((x = mdb_dlist_search(tx2, pgno)) != 0) {
+				p = dl[x].mptr;
+				goto done;
 			}
 			level++;
 		} while ((tx2 = tx2->mt_parent) != NULL);
@@ -5660,8 +6870,9 @@ mdb_ovpage_free(MDB_cursor *mc, MDB_page *mp)
 	{
 		unsigned i, j;
 		pgno_t *mop;
-		MDB_ID2 *dl, ix, iy;
-		rc = mdb_midl_need(&env->me_pghead, ovpages);
+		MDB_ID2 *dl;
+		rc = mdb_midl_need(&env->me_pghead,
+			(env->me_flags & MDB_EXTFREE) ? 2 : ovpages);
 		if (rc)
 			return rc;
 		if (!(mp->mp_flags & P_DIRTY)) {
@@ -5674,25 +6885,23 @@ mdb_ovpage_free(MDB_cursor *mc, MDB_page *mp)
 		}
 		/* Remove from dirty list */
 		dl = txn->mt_u.dirty_list;
-		x = dl[0].mid--;
-		for (ix = dl[x]; ix.mptr != mp; ix = iy) {
-			if (x > 1) {
-				x--;
-				iy = dl[x];
-				dl[x] = ix;
-			} else {
-				mdb_cassert(mc, x > 1);
-				j = ++(dl[0].mid);
-				dl[j] = ix;		/* Unsorted. OK when MDB_TXN_ERROR. */
-				txn->mt_flags |= MDB_TXN_ERROR;
-				return MDB_CORRUPTED;
-			}
+		x = mdb_dlist_search(txn, pg);
+		if (!x || dl[x].mptr != mp) {
+			mdb_cassert(mc, x && dl[x].mptr == mp);
+			txn->mt_flags |= MDB_TXN_ERROR;
+			return MDB_CORRUPTED;
 		}
+		mdb_dlist_remove(txn, x);
 		txn->mt_dirty_room++;
 		if (!(env->me_flags & MDB_WRITEMAP))
 			mdb_dpage_free(env, mp);
 release:
 		/* Insert in me_pghead */
+		if (env->me_flags & MDB_EXTFREE) {
+			/* Cannot fail, we already made room */
+			mdb_pghead_insert(env, pg, ovpages);
+			goto done;
+		}
 		mop = env->me_pghead;
 		j = mop[0] + ovpages;
 		for (i = mop[0]; i && mop[i] < pg; i--)
@@ -5705,10 +6914,36 @@ release:
 		if (rc)
 			return rc;
 	}
+done:
 	mc->mc_db->md_overflow_pages -= ovpages;
 	return 0;
 }
 
+	/** Number of leaf pages a cursor must have walked in a row
+	 *	before it starts reading ahead.
+	 */
+#define MDB_RDAHEAD_MIN	2
+	/** Number of leaf pages a cursor reads ahead in a sequential walk */
+#define MDB_RDAHEAD_LEAVES	16
+
+/** Ask the OS to start reading pages of the map.
+ * This is only a hint, errors are ignored.
+ * @param[in] env An environment handle.
+ * @param[in] pgno The first page to read.
+ * @param[in] count The number of pages to read.
+ */
+static void
+mdb_page_rdahead(MDB_env *env, pgno_t pgno, pgno_t count)
+{
+#ifdef MADV_WILLNEED
+	madvise(env->me_map + (size_t)env->me_psize * pgno,
+		(size_t)env->me_psize * count, MADV_WILLNEED);
+#elif defined(POSIX_MADV_WILLNEED)
+	posix_madvise(env->me_map + (size_t)env->me_psize * pgno,
+		(size_t)env->me_psize * count, POSIX_MADV_WILLNEED);
+#endif
+}
+
 /** Return the data associated with a given node.
  * @param[in] mc The cursor for this operation.
  * @param[in] leaf The node being read.
@@ -5718,6 +6953,7 @@ release:
 static int
 mdb_node_read(MDB_cursor *mc, MDB_node *leaf, MDB_val *data)
 {
+	MDB_env		*env = mc->mc_txn->mt_env;
 	MDB_page	*omp;		/* overflow page */
 	pgno_t		 pgno;
 	int rc;
@@ -5732,6 +6968,14 @@ mdb_node_read(MDB_cursor *mc, MDB_node *leaf, MDB_val *data)
 	 */
 	data->mv_size = NODEDSZ(leaf);
 	memcpy(&pgno, NODEDATA(leaf), sizeof(pgno));
+	/* With #MDB_NORDAHEAD the OS would fault the value in one page
+	 * at a time. Ask for all of it, unless a sequential walk did.
+	 */
+	if ((env->me_flags & MDB_NORDAHEAD) &&
+		data->mv_size > env->me_psize - PAGEHDRSZ &&
+		(mc->mc_pg[mc->mc_top]->mp_pgno != mc->mc_rapg ||
+		 (mc->mc_raseq < MDB_RDAHEAD_MIN && mc->mc_raseq > -MDB_RDAHEAD_MIN)))
+		mdb_page_rdahead(env, pgno, OVPAGES(data->mv_size, env->me_psize));
 	if ((rc = mdb_page_get(mc, pgno, &omp, NULL)) != 0) {
 		DPRINTF(("read overflow page %"Z"u failed", pgno));
 		return rc;
@@ -5762,30 +7006,214 @@ mdb_get(MDB_txn *txn, MDB_dbi dbi,
 	return mdb_cursor_set(&mc, key, data, MDB_SET, &exact);
 }
 
-/** Find a sibling for a page.
- * Replaces the page at the top of the cursor's stack with the
- * specified sibling, if one exists.
- * @param[in] mc The cursor for this operation.
- * @param[in] move_right Non-zero if the right sibling is requested,
- * otherwise the left sibling.
- * @return 0 on success, non-zero on failure.
+/** Move the cursor to the leaf page that \b key belongs in.
+ *	If the cursor is already positioned at or before \b key, only
+ *	the part of its stack below the deepest page whose key range
+ *	still holds \b key is searched again. Otherwise the search
+ *	starts from the root.
  */
 static int
-mdb_cursor_sibling(MDB_cursor *mc, int move_right)
+mdb_cursor_seek(MDB_cursor *mc, MDB_val *key)
 {
-	int		 rc;
-	MDB_node	*indx;
 	MDB_page	*mp;
+	MDB_node	*node;
+	MDB_val		 nodekey;
+	int i;
 
-	if (mc->mc_snum < 2) {
-		return MDB_NOTFOUND;		/* root has no siblings */
-	}
+	if (!(mc->mc_flags & C_INITIALIZED))
+		return mdb_page_search(mc, key, 0);
+	mp = mc->mc_pg[mc->mc_top];
+	if (!NUMKEYS(mp))
+		return mdb_page_search(mc, key, 0);
+	if (mdb_cmp_node(mc, mp, NODEPTR(mp, 0), key) < 0)
+		return mdb_page_search(mc, key, 0);
 
-	mdb_cursor_pop(mc);
-	DPRINTF(("parent page is page %"Z"u, index %u",
-		mc->mc_pg[mc->mc_top]->mp_pgno, mc->mc_ki[mc->mc_top]));
+	/* Every page above the leaf ends at the next separator of the
+	 * nearest parent that has one.
+	 */
+	for (i = mc->mc_top-1; i >= 0; i--) {
+		mp = mc->mc_pg[i];
+		if (mc->mc_ki[i] < NUMKEYS(mp)-1) {
+			node = NODEPTR(mp, mc->mc_ki[i] + 1);
+			MDB_GET_KEY2(node, nodekey);
+			if (mc->mc_dbx->md_cmp(key, &nodekey) < 0)
+				break;
+		}
+	}
+	if (++i == mc->mc_top)
+		return MDB_SUCCESS;
+	mc->mc_snum = i + 1;
+	mc->mc_top = i;
+	return mdb_page_search_root(mc, key, 0);
+}
 
-	if (move_right ? (mc->mc_ki[mc->mc_top] + 1u >= NUMKEYS(mc->mc_pg[mc->mc_top]))
+int
+mdb_cursor_get_batch(MDB_cursor *mc, MDB_val *keys, MDB_val *data,
+    unsigned int n)
+{
+	MDB_node	*leaf;
+	unsigned int i;
+	int exact, rc;
+
+	if (mc == NULL || (n && (!keys || !data)))
+		return EINVAL;
+
+	if (mc->mc_txn->mt_flags & MDB_TXN_BLOCKED)
+		return MDB_BAD_TXN;
+
+	for (i = 0; i < n; i++) {
+		if (keys[i].mv_size == 0)
+			return MDB_BAD_VALSIZE;
+		if (mc->mc_xcursor)
+			mc->mc_xcursor->mx_cursor.mc_flags &= ~(C_INITIALIZED|C_EOF);
+		data[i].mv_size = 0;
+		data[i].mv_data = NULL;
+		if ((rc = mdb_cursor_seek(mc, &keys[i])) != MDB_SUCCESS) {
+			if (rc == MDB_NOTFOUND)
+				continue;
+			mc->mc_flags &= ~C_INITIALIZED;
+			return rc;
+		}
+		mc->mc_flags |= C_INITIALIZED;
+		mc->mc_flags &= ~C_EOF;
+		leaf = mdb_node_search(mc, &keys[i], &exact);
+		if (!leaf || !exact)
+			continue;
+		if (F_ISSET(leaf->mn_flags, F_DUPDATA)) {
+			mdb_xcursor_init1(mc, leaf);
+			rc = mdb_cursor_first(&mc->mc_xcursor->mx_cursor, &data[i], NULL);
+		} else {
+			rc = mdb_node_read(mc, leaf, &data[i]);
+		}
+		if (rc)
+			return rc;
+	}
+	return MDB_SUCCESS;
+}
+
+int
+mdb_get_batch(MDB_txn *txn, MDB_dbi dbi,
+    MDB_val *keys, MDB_val *data, unsigned int n)
+{
+	MDB_cursor	mc;
+	MDB_xcursor	mx;
+
+	if (!TXN_DBI_EXIST(txn, dbi, DB_USRVALID))
+		return EINVAL;
+
+	if (txn->mt_flags & MDB_TXN_BLOCKED)
+		return MDB_BAD_TXN;
+
+	mdb_cursor_init(&mc, txn, dbi, &mx);
+	return mdb_cursor_get_batch(&mc, keys, data, n);
+}
+
+/** Read ahead of a cursor walking from leaf to leaf.
+ * Random lookups never get here, and a walk only needs to hold on to
+ * a few leaves before the OS is asked for the ones that follow it
+ * in the parent page. The window is renewed every half window and at
+ * each new parent page, so there is a syscall for every few leaves
+ * rather than for each of them. The overflow pages of the leaf just
+ * reached are requested as well, before the caller reads them.
+ * @param[in] mc A cursor that has just moved to a sibling leaf.
+ * @param[in] seq The number of leaves walked in a row, negative
+ * when walking to the left.
+ */
+static void
+mdb_cursor_rdahead(MDB_cursor *mc, int seq)
+{
+	MDB_env	*env = mc->mc_txn->mt_env;
+	MDB_page	*mp = mc->mc_pg[mc->mc_top-1];
+	MDB_node	*node;
+	pgno_t	 pg, run = 0, count = 0;
+	int		 dir = seq < 0 ? -1 : 1;
+	int		 i, n = NUMKEYS(mp), ki = mc->mc_ki[mc->mc_top-1];
+
+	if (seq < 0)
+		seq = -seq;
+	if ((seq - MDB_RDAHEAD_MIN) % (MDB_RDAHEAD_LEAVES/2) == 0 ||
+		ki == (dir > 0 ? 0 : n-1)) {
+		for (i = ki + dir; i >= 0 && i < n &&
+			i != ki + dir * (MDB_RDAHEAD_LEAVES+1); i += dir) {
+			pg = NODEPGNO(NODEPTR(mp, i));
+			if (count && pg == run + count) {
+				count++;
+			} else if (count && pg + 1 == run) {
+				run = pg;
+				count++;
+			} else {
+				if (count)
+					mdb_page_rdahead(env, run, count);
+				run = pg;
+				count = 1;
+			}
+		}
+		if (count)
+			mdb_page_rdahead(env, run, count);
+		/* The window reaches past this parent, get the next one */
+		if ((i < 0 || i >= n) && mc->mc_top > 1) {
+			mp = mc->mc_pg[mc->mc_top-2];
+			i = mc->mc_ki[mc->mc_top-2] + dir;
+			if (i >= 0 && i < (int)NUMKEYS(mp))
+				mdb_page_rdahead(env, NODEPGNO(NODEPTR(mp, i)), 1);
+		}
+	}
+
+	mp = mc->mc_pg[mc->mc_top];
+	if (IS_LEAF2(mp))
+		return;
+	count = 0;
+	n = NUMKEYS(mp);
+	for (i=0; i<n; i++) {
+		node = NODEPTR(mp, i);
+		if (!F_ISSET(node->mn_flags, F_BIGDATA))
+			continue;
+		memcpy(&pg, NODEDATA(node), sizeof(pg));
+		if (count && pg == run + count) {
+			count += OVPAGES(NODEDSZ(node), env->me_psize);
+		} else {
+			if (count)
+				mdb_page_rdahead(env, run, count);
+			run = pg;
+			count = OVPAGES(NODEDSZ(node), env->me_psize);
+		}
+	}
+	if (count)
+		mdb_page_rdahead(env, run, count);
+}
+
+/** Find a sibling for a page.
+ * Replaces the page at the top of the cursor's stack with the
+ * specified sibling, if one exists.
+ * @param[in] mc The cursor for this operation.
+ * @param[in] move_right Non-zero if the right sibling is requested,
+ * otherwise the left sibling.
+ * @return 0 on success, non-zero on failure.
+ */
+static int
+mdb_cursor_sibling(MDB_cursor *mc, int move_right)
+{
+	int		 rc, seq = 0;
+	MDB_node	*indx;
+	MDB_page	*mp;
+
+	if (mc->mc_snum < 2) {
+		return MDB_NOTFOUND;		/* root has no siblings */
+	}
+
+	/* Count the leaves walked in a row in the same direction */
+	mp = mc->mc_pg[mc->mc_top];
+	if (IS_LEAF(mp)) {
+		seq = move_right ? 1 : -1;
+		if (mp->mp_pgno == mc->mc_rapg && (mc->mc_raseq ^ seq) >= 0)
+			seq += mc->mc_raseq;
+	}
+
+	mdb_cursor_pop(mc);
+	DPRINTF(("parent page is page %"Z"u, index %u",
+		mc->mc_pg[mc->mc_top]->mp_pgno, mc->mc_ki[mc->mc_top]));
+
+	if (move_right ? (mc->mc_ki[mc->mc_top] + 1u >= NUMKEYS(mc->mc_pg[mc->mc_top]))
 		       : (mc->mc_ki[mc->mc_top] == 0)) {
 		DPRINTF(("no more keys left, moving to %s sibling",
 		    move_right ? "right" : "left"));
@@ -5813,6 +7241,12 @@ mdb_cursor_sibling(MDB_cursor *mc, int move_right)
 	}
 
 	mdb_cursor_push(mc, mp);
+	if (seq) {
+		mc->mc_rapg = NODEPGNO(indx);
+		mc->mc_raseq = seq;
+		if (seq >= MDB_RDAHEAD_MIN || seq <= -MDB_RDAHEAD_MIN)
+			mdb_cursor_rdahead(mc, seq);
+	}
 	if (!move_right)
 		mc->mc_ki[mc->mc_top] = NUMKEYS(mp)-1;
 
@@ -5848,7 +7282,7 @@ mdb_cursor_next(MDB_cursor *mc, MDB_val *key, MDB_val *data, MDB_cursor_op op)
 				rc = mdb_cursor_next(&mc->mc_xcursor->mx_cursor, data, NULL, MDB_NEXT);
 				if (op != MDB_NEXT || rc != MDB_NOTFOUND) {
 					if (rc == MDB_SUCCESS)
-						MDB_GET_KEY(leaf, key);
+						mdb_cursor_key(mc, leaf, key);
 					return rc;
 				}
 			}
@@ -5904,7 +7338,7 @@ skip:
 		}
 	}
 
-	MDB_GET_KEY(leaf, key);
+	mdb_cursor_key(mc, leaf, key);
 	return MDB_SUCCESS;
 }
 
@@ -5932,7 +7366,7 @@ mdb_cursor_prev(MDB_cursor *mc, MDB_val *key, MDB_val *data, MDB_cursor_op op)
 				rc = mdb_cursor_prev(&mc->mc_xcursor->mx_cursor, data, NULL, MDB_PREV);
 				if (op != MDB_PREV || rc != MDB_NOTFOUND) {
 					if (rc == MDB_SUCCESS) {
-						MDB_GET_KEY(leaf, key);
+						mdb_cursor_key(mc, leaf, key);
 						mc->mc_flags &= ~C_EOF;
 					}
 					return rc;
@@ -5987,7 +7421,7 @@ mdb_cursor_prev(MDB_cursor *mc, MDB_val *key, MDB_val *data, MDB_cursor_op op)
 		}
 	}
 
-	MDB_GET_KEY(leaf, key);
+	mdb_cursor_key(mc, leaf, key);
 	return MDB_SUCCESS;
 }
 
@@ -6019,11 +7453,11 @@ mdb_cursor_set(MDB_cursor *mc, MDB_val *key, MDB_val *data,
 		if (mp->mp_flags & P_LEAF2) {
 			nodekey.mv_size = mc->mc_db->md_pad;
 			nodekey.mv_data = LEAF2KEY(mp, 0, nodekey.mv_size);
+			rc = mc->mc_dbx->md_cmp(key, &nodekey);
 		} else {
 			leaf = NODEPTR(mp, 0);
-			MDB_GET_KEY2(leaf, nodekey);
+			rc = mdb_cmp_node(mc, mp, leaf, key);
 		}
-		rc = mc->mc_dbx->md_cmp(key, &nodekey);
 		if (rc == 0) {
 			/* Probably happens rarely, but first node on the page
 			 * was the one we wanted.
@@ -6040,11 +7474,11 @@ mdb_cursor_set(MDB_cursor *mc, MDB_val *key, MDB_val *data,
 				if (mp->mp_flags & P_LEAF2) {
 					nodekey.mv_data = LEAF2KEY(mp,
 						 nkeys-1, nodekey.mv_size);
+					rc = mc->mc_dbx->md_cmp(key, &nodekey);
 				} else {
 					leaf = NODEPTR(mp, nkeys-1);
-					MDB_GET_KEY2(leaf, nodekey);
+					rc = mdb_cmp_node(mc, mp, leaf, key);
 				}
-				rc = mc->mc_dbx->md_cmp(key, &nodekey);
 				if (rc == 0) {
 					/* last node was the one we wanted */
 					mc->mc_ki[mc->mc_top] = nkeys-1;
@@ -6058,11 +7492,11 @@ mdb_cursor_set(MDB_cursor *mc, MDB_val *key, MDB_val *data,
 						if (mp->mp_flags & P_LEAF2) {
 							nodekey.mv_data = LEAF2KEY(mp,
 								 mc->mc_ki[mc->mc_top], nodekey.mv_size);
+							rc = mc->mc_dbx->md_cmp(key, &nodekey);
 						} else {
 							leaf = NODEPTR(mp, mc->mc_ki[mc->mc_top]);
-							MDB_GET_KEY2(leaf, nodekey);
+							rc = mdb_cmp_node(mc, mp, leaf, key);
 						}
-						rc = mc->mc_dbx->md_cmp(key, &nodekey);
 						if (rc == 0) {
 							/* current node was the one we wanted */
 							if (exactp)
@@ -6185,7 +7619,7 @@ set1:
 
 	/* The key already matches in all other cases */
 	if (op == MDB_SET_RANGE || op == MDB_SET_KEY)
-		MDB_GET_KEY(leaf, key);
+		mdb_cursor_key(mc, leaf, key);
 	DPRINTF(("==> cursor placed on key [%s]", DKEY(key)));
 
 	return rc;
@@ -6231,7 +7665,7 @@ mdb_cursor_first(MDB_cursor *mc, MDB_val *key, MDB_val *data)
 				return rc;
 		}
 	}
-	MDB_GET_KEY(leaf, key);
+	mdb_cursor_key(mc, leaf, key);
 	return MDB_SUCCESS;
 }
 
@@ -6257,8 +7691,10 @@ mdb_cursor_last(MDB_cursor *mc, MDB_val *key, MDB_val *data)
 	leaf = NODEPTR(mc->mc_pg[mc->mc_top], mc->mc_ki[mc->mc_top]);
 
 	if (IS_LEAF2(mc->mc_pg[mc->mc_top])) {
-		key->mv_size = mc->mc_db->md_pad;
-		key->mv_data = LEAF2KEY(mc->mc_pg[mc->mc_top], mc->mc_ki[mc->mc_top], key->mv_size);
+		if (key) {
+			key->mv_size = mc->mc_db->md_pad;
+			key->mv_data = LEAF2KEY(mc->mc_pg[mc->mc_top], mc->mc_ki[mc->mc_top], key->mv_size);
+		}
 		return MDB_SUCCESS;
 	}
 
@@ -6274,7 +7710,7 @@ mdb_cursor_last(MDB_cursor *mc, MDB_val *key, MDB_val *data)
 		}
 	}
 
-	MDB_GET_KEY(leaf, key);
+	mdb_cursor_key(mc, leaf, key);
 	return MDB_SUCCESS;
 }
 
@@ -6310,7 +7746,7 @@ mdb_cursor_get(MDB_cursor *mc, MDB_val *key, MDB_val *data,
 				key->mv_data = LEAF2KEY(mp, mc->mc_ki[mc->mc_top], key->mv_size);
 			} else {
 				MDB_node *leaf = NODEPTR(mp, mc->mc_ki[mc->mc_top]);
-				MDB_GET_KEY(leaf, key);
+				mdb_cursor_key(mc, leaf, key);
 				if (data) {
 					if (F_ISSET(leaf->mn_flags, F_DUPDATA)) {
 						rc = mdb_cursor_get(&mc->mc_xcursor->mx_cursor, data, NULL, MDB_GET_CURRENT);
@@ -6436,7 +7872,7 @@ fetchm:
 		{
 			MDB_node *leaf = NODEPTR(mc->mc_pg[mc->mc_top], mc->mc_ki[mc->mc_top]);
 			if (!F_ISSET(leaf->mn_flags, F_DUPDATA)) {
-				MDB_GET_KEY(leaf, key);
+				mdb_cursor_key(mc, leaf, key);
 				rc = mdb_node_read(mc, leaf, data);
 				break;
 			}
@@ -6568,9 +8004,16 @@ mdb_cursor_put(MDB_cursor *mc, MDB_val *key, MDB_val *data,
 		MDB_val d2;
 		if (flags & MDB_APPEND) {
 			MDB_val k2;
-			rc = mdb_cursor_last(mc, &k2, &d2);
+			rc = mdb_cursor_last(mc, NULL, &d2);
 			if (rc == 0) {
-				rc = mc->mc_dbx->md_cmp(key, &k2);
+				mp = mc->mc_pg[mc->mc_top];
+				if (IS_LEAF2(mp)) {
+					k2.mv_size = mc->mc_db->md_pad;
+					k2.mv_data = LEAF2KEY(mp, mc->mc_ki[mc->mc_top], k2.mv_size);
+					rc = mc->mc_dbx->md_cmp(key, &k2);
+				} else {
+					rc = mdb_cmp_node(mc, mp, NODEPTR(mp, mc->mc_ki[mc->mc_top]), key);
+				}
 				if (rc > 0) {
 					rc = MDB_NOTFOUND;
 					mc->mc_ki[mc->mc_top]++;
@@ -6761,7 +8204,8 @@ more:
 			}
 
 			fp_flags = fp->mp_flags;
-			if (NODESIZE + NODEKSZ(leaf) + xdata.mv_size > env->me_nodemax) {
+			if (NODESIZE + NODEFKSZ(mc->mc_pg[mc->mc_top], leaf) + xdata.mv_size >
+				env->me_nodemax) {
 					/* Too big for a sub-page, convert to sub-DB */
 					fp_flags &= ~P_SUBP;
 prep_subDB:
@@ -6853,7 +8297,7 @@ current:
 					id2.mid = pg;
 					id2.mptr = np;
 					/* Note - this page is already counted in parent's dirty_room */
-					rc2 = mdb_mid2l_insert(mc->mc_txn->mt_u.dirty_list, &id2);
+					rc2 = mdb_dlist_insert(mc->mc_txn, &id2);
 					mdb_cassert(mc, rc2 == 0);
 					/* Currently we make the page look as with put() in the
 					 * parent txn, in case the user peeks at MDB_RESERVEd
@@ -6905,6 +8349,9 @@ current:
 new_sub:
 	nflags = flags & NODE_ADD_FLAGS;
 	nsize = IS_LEAF2(mc->mc_pg[mc->mc_top]) ? key->mv_size : mdb_leaf_size(env, key, rdata);
+	if (IS_PREFIX(mc->mc_pg[mc->mc_top]) &&
+		(rc = mdb_prefix_fit(mc, key, rdata, nflags, &nsize)) != MDB_SUCCESS)
+		goto bad_sub;
 	if (SIZELEFT(mc->mc_pg[mc->mc_top]) < nsize) {
 		if (( flags & (F_DUPDATA|F_SUBDATA)) == F_DUPDATA )
 			nflags &= ~MDB_APPEND; /* sub-page may need room to grow */
@@ -7148,6 +8595,10 @@ mdb_page_new(MDB_cursor *mc, uint32_t flags, int num, MDB_page **mp)
 		return rc;
 	DPRINTF(("allocated new mpage %"Z"u, page size %u",
 	    np->mp_pgno, mc->mc_txn->mt_env->me_psize));
+	if ((flags & P_LEAF) && (mc->mc_db->md_flags & MDB_PREFIXKEYS)) {
+		flags |= P_PREFIX;
+		np->mp_pad = 0;
+	}
 	np->mp_flags = flags | P_DIRTY;
 	np->mp_lower = (PAGEHDRSZ-PAGEBASE);
 	np->mp_upper = mc->mc_txn->mt_env->me_psize - PAGEBASE;
@@ -7215,6 +8666,170 @@ mdb_branch_size(MDB_env *env, MDB_val *key)
 	return sz + sizeof(indx_t);
 }
 
+/** Calculate the space used by the nodes of leaf page \b mp if
+ * its key prefix were \b plen bytes long. The prefix itself is
+ * not counted.
+ */
+static size_t
+mdb_prefix_used(MDB_page *mp, unsigned int plen)
+{
+	MDB_node	*node;
+	unsigned int	 i, nkeys = NUMKEYS(mp), pad = IS_PREFIX(mp) ? mp->mp_pad : 0;
+	size_t		 sz = 0;
+
+	for (i = 0; i < nkeys; i++) {
+		node = NODEPTR(mp, i);
+		sz += EVEN(NODESIZE + NODEKSZ(node) + pad - plen +
+			(F_ISSET(node->mn_flags, F_BIGDATA) ? sizeof(pgno_t) : NODEDSZ(node)));
+	}
+	return sz + nkeys * sizeof(indx_t);
+}
+
+/** Calculate the room a new node needs on #P_PREFIX page \b mp.
+ * A key that doesn't start with the whole key prefix of the page
+ * makes the prefix shorter, and every other key on the page longer.
+ * @param[in] env The environment handle.
+ * @param[in] mp The leaf page.
+ * @param[in] key The key for the node.
+ * @param[in] data The data for the node.
+ * @param[in] flags Flags for the node.
+ * @return The number of bytes the page must have left, as
+ * compared with #SIZELEFT().
+ */
+static size_t
+mdb_prefix_need(MDB_env *env, MDB_page *mp, MDB_val *key, MDB_val *data,
+	unsigned int flags)
+{
+	size_t		 sz, total, used;
+	unsigned int	 m;
+
+	sz = NODESIZE + key->mv_size;
+	if ((flags & F_BIGDATA) || sz + data->mv_size > env->me_nodemax)
+		sz += sizeof(pgno_t);
+	else
+		sz += data->mv_size;
+	m = mdb_prefix_match(env, mp, key);
+	sz = EVEN(sz - m) + sizeof(indx_t);
+	if (m == mp->mp_pad)
+		return sz;
+	total = mdb_prefix_used(mp, m) + EVEN(m) + sz;
+	used = env->me_psize - PAGEHDRSZ - SIZELEFT(mp);
+	return total > used ? total - used : 0;
+}
+
+/** Give #P_PREFIX page \b mp a key prefix of \b plen bytes.
+ * The nodes are laid out again with their keys cut or extended
+ * to match. Cursors on the page keep their positions.
+ * @param[in] mc A cursor on the page's database.
+ * @param[in] mp The leaf page.
+ * @param[in] plen The length of the new prefix.
+ * @param[in] pfx The new prefix, or NULL to keep the first \b plen
+ * bytes of the current one. Every key on the page must start with it.
+ * @return 0 on success, ENOMEM if no scratch page was available.
+ */
+static int
+mdb_page_prefix(MDB_cursor *mc, MDB_page *mp, unsigned int plen, char *pfx)
+{
+	MDB_env		*env = mc->mc_txn->mt_env;
+	MDB_page	*tmp = NULL;
+	MDB_node	*node, *onode;
+	MDB_cursor	*m2;
+	unsigned int	 i, nkeys = NUMKEYS(mp), oplen = mp->mp_pad, ksize, dsize;
+	indx_t		 upper;
+	char		*opfx, *key;
+
+	mdb_cassert(mc, IS_PREFIX(mp) && !IS_LEAF2(mp));
+	opfx = PREFIXKEY(mp, env->me_psize);
+	if (nkeys) {
+		if ((tmp = mdb_page_malloc(mc->mc_txn, 1)) == NULL)
+			return ENOMEM;
+		mdb_page_copy(tmp, mp, env->me_psize);
+		opfx = PREFIXKEY(tmp, env->me_psize);
+	}
+
+	upper = env->me_psize - PAGEBASE - EVEN(plen);
+	memmove((char *)mp + upper + PAGEBASE, pfx ? pfx : opfx, plen);
+
+	for (i = 0; i < nkeys; i++) {
+		onode = NODEPTR(tmp, i);
+		ksize = NODEKSZ(onode) + oplen - plen;
+		dsize = F_ISSET(onode->mn_flags, F_BIGDATA) ? sizeof(pgno_t) : NODEDSZ(onode);
+		upper -= EVEN(NODESIZE + ksize + dsize);
+		mp->mp_ptrs[i] = upper + PAGEBASE;
+		node = NODEPTR(mp, i);
+		memcpy(node, onode, NODESIZE);
+		node->mn_ksize = ksize;
+		key = NODEKEY(node);
+		if (plen < oplen) {
+			memcpy(key, opfx + plen, oplen - plen);
+			memcpy(key + oplen - plen, NODEKEY(onode), NODEKSZ(onode));
+		} else {
+			memcpy(key, (char *)NODEKEY(onode) + plen - oplen, ksize);
+		}
+		memcpy(key + ksize, NODEDATA(onode), dsize);
+	}
+	mp->mp_pad = plen;
+	mp->mp_upper = upper;
+	if (tmp)
+		mdb_page_free(env, tmp);
+
+	/* Sub-pages of cursors on the page have moved. A bulk loader's
+	 * sub-cursor is on the pending key, not on the page.
+	 */
+	for (m2 = mc->mc_txn->mt_cursors[mc->mc_dbi]; m2; m2=m2->mc_next) {
+		if ((m2->mc_flags & (C_INITIALIZED|C_BULK)) != C_INITIALIZED ||
+			m2->mc_snum <= mc->mc_top || m2->mc_pg[mc->mc_top] != mp)
+			continue;
+		XCURSOR_REFRESH(m2, mc->mc_top, mp);
+	}
+	return MDB_SUCCESS;
+}
+
+/** Make room for a new node on #P_PREFIX page \b mp, if needed, by
+ * lengthening the page's key prefix to what all its keys share.
+ * @param[in] mc The cursor for this operation.
+ * @param[in] key The key for the node.
+ * @param[in] data The data for the node.
+ * @param[in] flags Flags for the node.
+ * @param[out] need The room the node needs, see #mdb_prefix_need().
+ * @return 0 on success, non-zero on failure.
+ */
+static int
+mdb_prefix_fit(MDB_cursor *mc, MDB_val *key, MDB_val *data,
+	unsigned int flags, size_t *need)
+{
+	MDB_env		*env = mc->mc_txn->mt_env;
+	MDB_page	*mp = mc->mc_pg[mc->mc_top];
+	MDB_node	*first, *last;
+	unsigned int	 plen = mp->mp_pad, nkeys = NUMKEYS(mp), g, n;
+	char		 buf[MDB_KBUFSIZE];
+	int		 rc;
+
+	*need = mdb_prefix_need(env, mp, key, data, flags);
+	if (*need <= SIZELEFT(mp) || nkeys < 2 ||
+		mdb_prefix_match(env, mp, key) < plen)
+		return MDB_SUCCESS;
+
+	first = NODEPTR(mp, 0);
+	last = NODEPTR(mp, nkeys-1);
+	n = NODEKSZ(first);
+	if (n > NODEKSZ(last))
+		n = NODEKSZ(last);
+	g = mdb_prefix_len(NODEKEY(first), NODEKEY(last), n);
+	if (g > key->mv_size - plen)
+		g = key->mv_size - plen;
+	g = mdb_prefix_len(NODEKEY(first), (char *)key->mv_data + plen, g);
+	if (!g)
+		return MDB_SUCCESS;
+
+	memcpy(buf, PREFIXKEY(mp, env->me_psize), plen);
+	memcpy(buf + plen, NODEKEY(first), g);
+	if ((rc = mdb_page_prefix(mc, mp, plen + g, buf)) != MDB_SUCCESS)
+		return rc;
+	*need = mdb_prefix_need(env, mp, key, data, flags);
+	return MDB_SUCCESS;
+}
+
 /** Add a node to the page pointed to by the cursor.
  * Set #MDB_TXN_ERROR on failure.
  * @param[in] mc The cursor for this operation.
@@ -7235,7 +8850,7 @@ static int
 mdb_node_add(MDB_cursor *mc, indx_t indx,
     MDB_val *key, MDB_val *data, pgno_t pgno, unsigned int flags)
 {
-	unsigned int	 i;
+	unsigned int	 i, plen = 0;
 	size_t		 node_size = NODESIZE;
 	ssize_t		 room;
 	indx_t		 ofs;
@@ -7243,6 +8858,7 @@ mdb_node_add(MDB_cursor *mc, indx_t indx,
 	MDB_page	*mp = mc->mc_pg[mc->mc_top];
 	MDB_page	*ofp = NULL;		/* overflow page */
 	void		*ndata;
+	int			 rc;
 	DKBUF;
 
 	mdb_cassert(mc, mp->mp_upper >= mp->mp_lower);
@@ -7269,9 +8885,26 @@ mdb_node_add(MDB_cursor *mc, indx_t indx,
 		return MDB_SUCCESS;
 	}
 
+	if (IS_PREFIX(mp) && mp->mp_pad) {
+		/* Only the rest of the key goes in the node. Cut the
+		 * page's prefix down first if the key doesn't share it.
+		 */
+		mdb_cassert(mc, key && data);
+		plen = mdb_prefix_match(mc->mc_txn->mt_env, mp, key);
+		if (plen < mp->mp_pad) {
+			if (mdb_prefix_need(mc->mc_txn->mt_env, mp, key, data, flags) > SIZELEFT(mp))
+				goto full;
+			if ((rc = mdb_page_prefix(mc, mp, plen, NULL)) != MDB_SUCCESS)
+				return rc;
+		}
+	}
+
 	room = (ssize_t)SIZELEFT(mp) - (ssize_t)sizeof(indx_t);
 	if (key != NULL)
 		node_size += key->mv_size;
+	/* The overflow decision counts the whole key, so that the node
+	 * can move to pages with another prefix.
+	 */
 	if (IS_LEAF(mp)) {
 		mdb_cassert(mc, key && data);
 		if (F_ISSET(flags, F_BIGDATA)) {
@@ -7279,11 +8912,10 @@ mdb_node_add(MDB_cursor *mc, indx_t indx,
 			node_size += sizeof(pgno_t);
 		} else if (node_size + data->mv_size > mc->mc_txn->mt_env->me_nodemax) {
 			int ovpages = OVPAGES(data->mv_size, mc->mc_txn->mt_env->me_psize);
-			int rc;
 			/* Put data on overflow page. */
 			DPRINTF(("data size is %"Z"u, node would be %"Z"u, put data on overflow page",
 			    data->mv_size, node_size+data->mv_size));
-			node_size = EVEN(node_size + sizeof(pgno_t));
+			node_size = EVEN(node_size - plen + sizeof(pgno_t));
 			if ((ssize_t)node_size > room)
 				goto full;
 			if ((rc = mdb_page_new(mc, P_OVERFLOW, ovpages, &ofp)))
@@ -7295,7 +8927,7 @@ mdb_node_add(MDB_cursor *mc, indx_t indx,
 			node_size += data->mv_size;
 		}
 	}
-	node_size = EVEN(node_size);
+	node_size = EVEN(node_size - plen);
 	if ((ssize_t)node_size > room)
 		goto full;
 
@@ -7313,7 +8945,7 @@ update:
 
 	/* Write the node data. */
 	node = NODEPTR(mp, indx);
-	node->mn_ksize = (key == NULL) ? 0 : key->mv_size;
+	node->mn_ksize = (key == NULL) ? 0 : key->mv_size - plen;
 	node->mn_flags = flags;
 	if (IS_LEAF(mp))
 		SETDSZ(node,data->mv_size);
@@ -7321,7 +8953,7 @@ update:
 		SETPGNO(node,pgno);
 
 	if (key)
-		memcpy(NODEKEY(node), key->mv_data, key->mv_size);
+		memcpy(NODEKEY(node), (char *)key->mv_data + plen, key->mv_size - plen);
 
 	if (IS_LEAF(mp)) {
 		ndata = NODEDATA(node);
@@ -7478,6 +9110,9 @@ mdb_xcursor_init0(MDB_cursor *mc)
 	mx->mx_cursor.mc_snum = 0;
 	mx->mx_cursor.mc_top = 0;
 	mx->mx_cursor.mc_flags = C_SUB;
+	mx->mx_cursor.mc_kbuf = NULL;
+	mx->mx_cursor.mc_rapg = P_INVALID;
+	mx->mx_cursor.mc_raseq = 0;
 	mx->mx_dbx.md_name.mv_size = 0;
 	mx->mx_dbx.md_name.mv_data = NULL;
 	mx->mx_dbx.md_cmp = mc->mc_dbx->md_dcmp;
@@ -7581,6 +9216,9 @@ mdb_cursor_init(MDB_cursor *mc, MDB_txn *txn, MDB_dbi dbi, MDB_xcursor *mx)
 	mc->mc_pg[0] = 0;
 	mc->mc_ki[0] = 0;
 	mc->mc_flags = 0;
+	mc->mc_kbuf = NULL;
+	mc->mc_rapg = P_INVALID;
+	mc->mc_raseq = 0;
 	if (txn->mt_dbs[dbi].md_flags & MDB_DUPSORT) {
 		mdb_tassert(txn, mx != NULL);
 		mc->mc_xcursor = mx;
@@ -7610,9 +9248,13 @@ mdb_cursor_open(MDB_txn *txn, MDB_dbi dbi, MDB_cursor **ret)
 
 	if (txn->mt_dbs[dbi].md_flags & MDB_DUPSORT)
 		size += sizeof(MDB_xcursor);
+	if (txn->mt_dbs[dbi].md_flags & MDB_PREFIXKEYS)
+		size += MDB_KBUFSIZE;
 
 	if ((mc = malloc(size)) != NULL) {
 		mdb_cursor_init(mc, txn, dbi, (MDB_xcursor *)(mc + 1));
+		if (txn->mt_dbs[dbi].md_flags & MDB_PREFIXKEYS)
+			mc->mc_kbuf = (char *)mc + size - MDB_KBUFSIZE;
 		if (txn->mt_cursors) {
 			mc->mc_next = txn->mt_cursors[dbi];
 			txn->mt_cursors[dbi] = mc;
@@ -7630,6 +9272,8 @@ mdb_cursor_open(MDB_txn *txn, MDB_dbi dbi, MDB_cursor **ret)
 int
 mdb_cursor_renew(MDB_txn *txn, MDB_cursor *mc)
 {
+	char *kbuf;
+
 	if (!mc || !TXN_DBI_EXIST(txn, mc->mc_dbi, DB_VALID))
 		return EINVAL;
 
@@ -7639,7 +9283,9 @@ mdb_cursor_renew(MDB_txn *txn, MDB_cursor *mc)
 	if (txn->mt_flags & MDB_TXN_BLOCKED)
 		return MDB_BAD_TXN;
 
+	kbuf = mc->mc_kbuf;
 	mdb_cursor_init(mc, txn, mc->mc_dbi, mc->mc_xcursor);
+	mc->mc_kbuf = kbuf;
 	return MDB_SUCCESS;
 }
 
@@ -7809,12 +9455,14 @@ mdb_cursor_copy(const MDB_cursor *csrc, MDB_cursor *cdst);
 static int
 mdb_node_move(MDB_cursor *csrc, MDB_cursor *cdst, int fromleft)
 {
+	MDB_env		*env = csrc->mc_txn->mt_env;
 	MDB_node		*srcnode;
 	MDB_val		 key, data;
 	pgno_t	srcpg;
 	MDB_cursor mn;
 	int			 rc;
 	unsigned short flags;
+	char		 kbuf[MDB_KBUFSIZE];
 
 	DKBUF;
 
@@ -7847,14 +9495,12 @@ mdb_node_move(MDB_cursor *csrc, MDB_cursor *cdst, int fromleft)
 				key.mv_data = LEAF2KEY(csrc->mc_pg[csrc->mc_top], 0, key.mv_size);
 			} else {
 				s2 = NODEPTR(csrc->mc_pg[csrc->mc_top], 0);
-				key.mv_size = NODEKSZ(s2);
-				key.mv_data = NODEKEY(s2);
+				mdb_node_key(env, csrc->mc_pg[csrc->mc_top], s2, &key, kbuf);
 			}
 			csrc->mc_snum = snum--;
 			csrc->mc_top = snum;
 		} else {
-			key.mv_size = NODEKSZ(srcnode);
-			key.mv_data = NODEKEY(srcnode);
+			mdb_node_key(env, csrc->mc_pg[csrc->mc_top], srcnode, &key, kbuf);
 		}
 		data.mv_size = NODEDSZ(srcnode);
 		data.mv_data = NODEDATA(srcnode);
@@ -7864,6 +9510,7 @@ mdb_node_move(MDB_cursor *csrc, MDB_cursor *cdst, int fromleft)
 		unsigned int snum = cdst->mc_snum;
 		MDB_node *s2;
 		MDB_val bkey;
+		char bbuf[MDB_KBUFSIZE];
 		/* must find the lowest key below dst */
 		mdb_cursor_copy(cdst, &mn);
 		rc = mdb_page_search_lowest(&mn);
@@ -7874,8 +9521,7 @@ mdb_node_move(MDB_cursor *csrc, MDB_cursor *cdst, int fromleft)
 			bkey.mv_data = LEAF2KEY(mn.mc_pg[mn.mc_top], 0, bkey.mv_size);
 		} else {
 			s2 = NODEPTR(mn.mc_pg[mn.mc_top], 0);
-			bkey.mv_size = NODEKSZ(s2);
-			bkey.mv_data = NODEKEY(s2);
+			mdb_node_key(env, mn.mc_pg[mn.mc_top], s2, &bkey, bbuf);
 		}
 		mn.mc_snum = snum--;
 		mn.mc_top = snum;
@@ -7968,8 +9614,7 @@ mdb_node_move(MDB_cursor *csrc, MDB_cursor *cdst, int fromleft)
 				key.mv_data = LEAF2KEY(csrc->mc_pg[csrc->mc_top], 0, key.mv_size);
 			} else {
 				srcnode = NODEPTR(csrc->mc_pg[csrc->mc_top], 0);
-				key.mv_size = NODEKSZ(srcnode);
-				key.mv_data = NODEKEY(srcnode);
+				mdb_node_key(env, csrc->mc_pg[csrc->mc_top], srcnode, &key, kbuf);
 			}
 			DPRINTF(("update separator for source page %"Z"u to [%s]",
 				csrc->mc_pg[csrc->mc_top]->mp_pgno, DKEY(&key)));
@@ -7999,8 +9644,7 @@ mdb_node_move(MDB_cursor *csrc, MDB_cursor *cdst, int fromleft)
 				key.mv_data = LEAF2KEY(cdst->mc_pg[cdst->mc_top], 0, key.mv_size);
 			} else {
 				srcnode = NODEPTR(cdst->mc_pg[cdst->mc_top], 0);
-				key.mv_size = NODEKSZ(srcnode);
-				key.mv_data = NODEKEY(srcnode);
+				mdb_node_key(env, cdst->mc_pg[cdst->mc_top], srcnode, &key, kbuf);
 			}
 			DPRINTF(("update separator for destination page %"Z"u to [%s]",
 				cdst->mc_pg[cdst->mc_top]->mp_pgno, DKEY(&key)));
@@ -8038,12 +9682,14 @@ mdb_node_move(MDB_cursor *csrc, MDB_cursor *cdst, int fromleft)
 static int
 mdb_page_merge(MDB_cursor *csrc, MDB_cursor *cdst)
 {
+	MDB_env		*env = csrc->mc_txn->mt_env;
 	MDB_page	*psrc, *pdst;
 	MDB_node	*srcnode;
 	MDB_val		 key, data;
 	unsigned	 nkeys;
 	int			 rc;
 	indx_t		 i, j;
+	char		 kbuf[MDB_KBUFSIZE];
 
 	psrc = csrc->mc_pg[csrc->mc_top];
 	pdst = cdst->mc_pg[cdst->mc_top];
@@ -8073,6 +9719,29 @@ mdb_page_merge(MDB_cursor *csrc, MDB_cursor *cdst)
 			key.mv_data = (char *)key.mv_data + key.mv_size;
 		}
 	} else {
+		if (IS_PREFIX(pdst) && NUMKEYS(psrc)) {
+			/* Cut the prefix of dst down to what the keys
+			 * of src share with it, all at once.
+			 */
+			MDB_val last;
+			char lbuf[MDB_KBUFSIZE];
+			unsigned int m, m2;
+			mdb_node_key(env, psrc, NODEPTR(psrc, 0), &key, kbuf);
+			mdb_node_key(env, psrc, NODEPTR(psrc, NUMKEYS(psrc)-1), &last, lbuf);
+			if (!nkeys) {
+				m = key.mv_size < last.mv_size ? key.mv_size : last.mv_size;
+				m = mdb_prefix_len(key.mv_data, last.mv_data, m);
+				rc = mdb_page_prefix(cdst, pdst, m, key.mv_data);
+			} else {
+				m = mdb_prefix_match(env, pdst, &key);
+				m2 = mdb_prefix_match(env, pdst, &last);
+				if (m2 < m)
+					m = m2;
+				rc = m < pdst->mp_pad ? mdb_page_prefix(cdst, pdst, m, NULL) : MDB_SUCCESS;
+			}
+			if (rc != MDB_SUCCESS)
+				return rc;
+		}
 		for (i = 0; i < NUMKEYS(psrc); i++, j++) {
 			srcnode = NODEPTR(psrc, i);
 			if (i == 0 && IS_BRANCH(psrc)) {
@@ -8089,12 +9758,10 @@ mdb_page_merge(MDB_cursor *csrc, MDB_cursor *cdst)
 					key.mv_data = LEAF2KEY(mn.mc_pg[mn.mc_top], 0, key.mv_size);
 				} else {
 					s2 = NODEPTR(mn.mc_pg[mn.mc_top], 0);
-					key.mv_size = NODEKSZ(s2);
-					key.mv_data = NODEKEY(s2);
+					mdb_node_key(env, mn.mc_pg[mn.mc_top], s2, &key, kbuf);
 				}
 			} else {
-				key.mv_size = srcnode->mn_ksize;
-				key.mv_data = NODEKEY(srcnode);
+				mdb_node_key(env, psrc, srcnode, &key, kbuf);
 			}
 
 			data.mv_size = NODEDSZ(srcnode);
@@ -8189,6 +9856,8 @@ mdb_cursor_copy(const MDB_cursor *csrc, MDB_cursor *cdst)
 	cdst->mc_snum = csrc->mc_snum;
 	cdst->mc_top = csrc->mc_top;
 	cdst->mc_flags = csrc->mc_flags;
+	cdst->mc_rapg = P_INVALID;
+	cdst->mc_raseq = 0;
 
 	for (i=0; i<csrc->mc_snum; i++) {
 		cdst->mc_pg[i] = csrc->mc_pg[i];
@@ -8196,6 +9865,56 @@ mdb_cursor_copy(const MDB_cursor *csrc, MDB_cursor *cdst)
 	}
 }
 
+/** Check if leaf nodes can move between the pages of two cursors
+ * in a #MDB_PREFIXKEYS database. Keys that don't share the key
+ * prefix of the destination page grow when they move, so two pages
+ * that are below the fill threshold need not fit together.
+ * @param[in] csrc Cursor pointing to the source page.
+ * @param[in] cdst Cursor pointing to the destination page.
+ * @param[in] all Check all nodes of the source page, or only the one
+ * at the cursor.
+ * @return 1 if the nodes fit, 0 otherwise.
+ */
+static int
+mdb_prefix_fits(MDB_cursor *csrc, MDB_cursor *cdst, int all)
+{
+	MDB_env		*env = csrc->mc_txn->mt_env;
+	MDB_page	*src = csrc->mc_pg[csrc->mc_top];
+	MDB_page	*dst = cdst->mc_pg[cdst->mc_top];
+	MDB_node	*node;
+	MDB_val		 key, last, data;
+	unsigned int	 m, m2;
+	char		 kbuf[MDB_KBUFSIZE], lbuf[MDB_KBUFSIZE];
+
+	if (!IS_LEAF(src) || IS_LEAF2(src))
+		return 1;
+	if (!all) {
+		node = NODEPTR(src, csrc->mc_ki[csrc->mc_top]);
+		mdb_node_key(env, src, node, &key, kbuf);
+		data.mv_size = NODEDSZ(node);
+		if (IS_PREFIX(dst))
+			return mdb_prefix_need(env, dst, &key, &data, node->mn_flags) <= SIZELEFT(dst);
+		return mdb_leaf_size(env, &key, &data) <= SIZELEFT(dst);
+	}
+	if (!NUMKEYS(src))
+		return 1;
+	mdb_node_key(env, src, NODEPTR(src, 0), &key, kbuf);
+	mdb_node_key(env, src, NODEPTR(src, NUMKEYS(src)-1), &last, lbuf);
+	if (!IS_PREFIX(dst)) {
+		m = 0;
+	} else if (!NUMKEYS(dst)) {
+		m = key.mv_size < last.mv_size ? key.mv_size : last.mv_size;
+		m = mdb_prefix_len(key.mv_data, last.mv_data, m);
+	} else {
+		m = mdb_prefix_match(env, dst, &key);
+		m2 = mdb_prefix_match(env, dst, &last);
+		if (m2 < m)
+			m = m2;
+	}
+	return mdb_prefix_used(dst, m) + EVEN(m) + mdb_prefix_used(src, m) <=
+		env->me_psize - PAGEHDRSZ;
+}
+
 /** Rebalance the tree after a delete operation.
  * @param[in] mc Cursor pointing to the page where rebalancing
  * should begin.
@@ -8362,10 +10081,25 @@ mdb_rebalance(MDB_cursor *mc)
 	 * (A branch page must never have less than 2 keys.)
 	 */
 	if (PAGEFILL(mc->mc_txn->mt_env, mn.mc_pg[mn.mc_top]) >= thresh && NUMKEYS(mn.mc_pg[mn.mc_top]) > minkeys) {
-		rc = mdb_node_move(&mn, mc, fromleft);
-		if (fromleft) {
-			/* if we inserted on left, bump position up */
-			oldki++;
+		if ((mc->mc_db->md_flags & MDB_PREFIXKEYS) && !mdb_prefix_fits(&mn, mc, 0)) {
+			/* Leave the page as it is */
+			rc = MDB_SUCCESS;
+		} else {
+			rc = mdb_node_move(&mn, mc, fromleft);
+			if (fromleft) {
+				/* if we inserted on left, bump position up */
+				oldki++;
+			}
+		}
+	} else if ((mc->mc_db->md_flags & MDB_PREFIXKEYS) &&
+		!(fromleft ? mdb_prefix_fits(mc, &mn, 1) : mdb_prefix_fits(&mn, mc, 1))) {
+		/* The pages don't fit on one, try to borrow a key instead */
+		if (NUMKEYS(mn.mc_pg[mn.mc_top]) > minkeys && mdb_prefix_fits(&mn, mc, 0)) {
+			rc = mdb_node_move(&mn, mc, fromleft);
+			if (fromleft)
+				oldki++;
+		} else {
+			rc = MDB_SUCCESS;
 		}
 	} else {
 		if (!fromleft) {
@@ -8570,6 +10304,10 @@ mdb_page_split(MDB_cursor *mc, MDB_val *newkey, MDB_val *newdata, pgno_t newpgno
 	MDB_page	*mp, *rp, *pp;
 	int ptop;
 	MDB_cursor	mn;
+	unsigned int plen = 0;
+	int pfxbreak = 0;
+	char *pfx = NULL;
+	char sepbuf[MDB_KBUFSIZE], keybuf[MDB_KBUFSIZE];
 	DKBUF;
 
 	mp = mc->mc_pg[mc->mc_top];
@@ -8580,10 +10318,26 @@ mdb_page_split(MDB_cursor *mc, MDB_val *newkey, MDB_val *newdata, pgno_t newpgno
 	    IS_LEAF(mp) ? "leaf" : "branch", mp->mp_pgno,
 	    DKEY(newkey), mc->mc_ki[mc->mc_top], nkeys));
 
+	/* Both halves keep the key prefix, unless the new key doesn't
+	 * share it. Such a key sorts before or after all others on the
+	 * page, and goes on a page of its own.
+	 */
+	if (IS_PREFIX(mp)) {
+		plen = mp->mp_pad;
+		pfx = PREFIXKEY(mp, env->me_psize);
+		pfxbreak = mdb_prefix_match(env, mp, newkey) < plen;
+	}
+
 	/* Create a right sibling. */
 	if ((rc = mdb_page_new(mc, mp->mp_flags, 1, &rp)))
 		return rc;
-	rp->mp_pad = mp->mp_pad;
+	if (IS_PREFIX(rp)) {
+		if ((!pfxbreak || (!(nflags & MDB_APPEND) && !newindx)) &&
+			(rc = mdb_page_prefix(mc, rp, plen, pfx)) != MDB_SUCCESS)
+			goto done;
+	} else {
+		rp->mp_pad = mp->mp_pad;
+	}
 	DPRINTF(("new right sibling: page %"Z"u", rp->mp_pgno));
 
 	/* Usually when splitting the root page, the cursor
@@ -8678,7 +10432,10 @@ mdb_page_split(MDB_cursor *mc, MDB_val *newkey, MDB_val *newdata, pgno_t newpgno
 			int psize, nsize, k;
 			/* Maximum free space in an empty page */
 			pmax = env->me_psize - PAGEHDRSZ;
-			if (IS_LEAF(mp))
+			if (IS_PREFIX(mp)) {
+				nsize = mdb_prefix_need(env, mp, newkey, newdata, nflags);
+				pmax -= EVEN(plen);
+			} else if (IS_LEAF(mp))
 				nsize = mdb_leaf_size(env, newkey, newdata);
 			else
 				nsize = mdb_branch_size(env, newkey);
@@ -8694,6 +10451,12 @@ mdb_page_split(MDB_cursor *mc, MDB_val *newkey, MDB_val *newdata, pgno_t newpgno
 			copy->mp_flags = mp->mp_flags;
 			copy->mp_lower = (PAGEHDRSZ-PAGEBASE);
 			copy->mp_upper = env->me_psize - PAGEBASE;
+			if (IS_PREFIX(mp)) {
+				copy->mp_pad = 0;
+				if ((!pfxbreak || newindx) &&
+					(rc = mdb_page_prefix(mc, copy, plen, pfx)) != MDB_SUCCESS)
+					goto done;
+			}
 
 			/* prepare to insert */
 			for (i=0, j=0; i<nkeys; i++) {
@@ -8718,7 +10481,9 @@ mdb_page_split(MDB_cursor *mc, MDB_val *newkey, MDB_val *newdata, pgno_t newpgno
 			 * the split so the new page is emptier than the old page.
 			 * This yields better packing during sequential inserts.
 			 */
-			if (nkeys < 20 || nsize > pmax/16 || newindx >= nkeys) {
+			if (pfxbreak) {
+				split_indx = newindx ? newindx : 1;
+			} else if (nkeys < 20 || nsize > pmax/16 || newindx >= nkeys) {
 				/* Find split point */
 				psize = 0;
 				if (newindx <= split_indx || newindx >= nkeys) {
@@ -8754,8 +10519,7 @@ mdb_page_split(MDB_cursor *mc, MDB_val *newkey, MDB_val *newdata, pgno_t newpgno
 				sepkey.mv_data = newkey->mv_data;
 			} else {
 				node = (MDB_node *)((char *)mp + copy->mp_ptrs[split_indx] + PAGEBASE);
-				sepkey.mv_size = node->mn_ksize;
-				sepkey.mv_data = NODEKEY(node);
+				mdb_node_key(env, mp, node, &sepkey, sepbuf);
 			}
 		}
 	}
@@ -8831,8 +10595,7 @@ mdb_page_split(MDB_cursor *mc, MDB_val *newkey, MDB_val *newdata, pgno_t newpgno
 				mc->mc_ki[mc->mc_top] = j;
 			} else {
 				node = (MDB_node *)((char *)mp + copy->mp_ptrs[i] + PAGEBASE);
-				rkey.mv_data = NODEKEY(node);
-				rkey.mv_size = node->mn_ksize;
+				mdb_node_key(env, mp, node, &rkey, keybuf);
 				if (IS_LEAF(mp)) {
 					xdata.mv_data = NODEDATA(node);
 					xdata.mv_size = NODEDSZ(node);
@@ -8865,6 +10628,8 @@ mdb_page_split(MDB_cursor *mc, MDB_val *newkey, MDB_val *newdata, pgno_t newpgno
 			mp->mp_ptrs[i] = copy->mp_ptrs[i];
 		mp->mp_lower = copy->mp_lower;
 		mp->mp_upper = copy->mp_upper;
+		if (IS_PREFIX(mp))
+			mp->mp_pad = copy->mp_pad;
 		memcpy(NODEPTR(mp, nkeys-1), NODEPTR(copy, nkeys-1),
 			env->me_psize - copy->mp_upper - PAGEBASE);
 
@@ -8993,61 +10758,571 @@ mdb_put(MDB_txn *txn, MDB_dbi dbi,
 	return rc;
 }
 
-#ifndef MDB_WBUF
-#define MDB_WBUF	(1024*1024)
-#endif
-#define MDB_EOF		0x10	/**< #mdb_env_copyfd1() is done reading */
+	/** State of a bottom-up bulk load into one database.
+	 *	The loader keeps the right edge of the tree in its cursor
+	 *	and appends to it, so every page but the last one on each
+	 *	level is filled up completely. The cursor is tracked in the
+	 *	txn like any other cursor, which keeps its pages from being
+	 *	spilled, and frees the loader when the txn ends.
+	 */
+struct MDB_bulk {
+	MDB_cursor	mb_cursor;	/**< right edge of the main DB, must be first */
+	MDB_xcursor	mb_xcursor;	/**< right edge of the pending key's sub-DB */
+	MDB_cmp_func	*mb_dcmp;	/**< compare data items of #mb_key */
+	MDB_val		mb_key;		/**< #MDB_DUPSORT key waiting to be stored */
+	MDB_val		mb_dlast;	/**< last data item put for #mb_key */
+	size_t		mb_ndups;	/**< number of data items for #mb_key */
+	MDB_page	*mb_sub;	/**< sub-page collecting the data items */
+};
 
-	/** State needed for a double-buffering compacting copy. */
-typedef struct mdb_copy {
-	MDB_env *mc_env;
-	MDB_txn *mc_txn;
-	pthread_mutex_t mc_mutex;
-	pthread_cond_t mc_cond;	/**< Condition variable for #mc_new */
-	char *mc_wbuf[2];
-	char *mc_over[2];
-	int mc_wlen[2];
-	int mc_olen[2];
-	pgno_t mc_next_pgno;
-	HANDLE mc_fd;
-	int mc_toggle;			/**< Buffer number in provider */
-	int mc_new;				/**< (0-2 buffers to write) | (#MDB_EOF at end) */
-	/** Error code.  Never cleared if set.  Both threads can set nonzero
-	 *	to fail the copy.  Not mutex-protected, LMDB expects atomic int.
+	/** Unset the position of the other cursors on the loader's DB.
+	 *	They may point at pages the loader has since restructured.
 	 */
-	volatile int mc_error;
-} mdb_copy;
+static void
+mdb_bulk_unpos(MDB_cursor *mc)
+{
+	MDB_cursor *m2;
 
-	/** Dedicated writer thread for compacting copy. */
-static THREAD_RET ESECT CALL_CONV
-mdb_env_copythr(void *arg)
+	if (mc->mc_flags & C_SUB)
+		return;
+	for (m2 = mc->mc_txn->mt_cursors[mc->mc_dbi]; m2; m2 = m2->mc_next)
+		if (m2 != mc)
+			m2->mc_flags &= ~(C_INITIALIZED|C_EOF);
+}
+
+	/** Grow a new root page above the current one */
+static int
+mdb_bulk_root(MDB_cursor *mc)
 {
-	mdb_copy *my = arg;
-	char *ptr;
-	int toggle = 0, wsize, rc;
-#ifdef _WIN32
-	DWORD len;
-#define DO_WRITE(rc, fd, ptr, w2, len)	rc = WriteFile(fd, ptr, w2, &len, NULL)
-#else
-	int len;
-#define DO_WRITE(rc, fd, ptr, w2, len)	len = write(fd, ptr, w2); rc = (len >= 0)
-#ifdef SIGPIPE
-	sigset_t set;
-	sigemptyset(&set);
-	sigaddset(&set, SIGPIPE);
-	if ((rc = pthread_sigmask(SIG_BLOCK, &set, NULL)) != 0)
-		my->mc_error = rc;
-#endif
-#endif
+	MDB_page *np;
+	int rc;
 
-	pthread_mutex_lock(&my->mc_mutex);
-	for(;;) {
-		while (!my->mc_new)
-			pthread_cond_wait(&my->mc_cond, &my->mc_mutex);
-		if (my->mc_new == 0 + MDB_EOF) /* 0 buffers, just EOF */
-			break;
-		wsize = my->mc_wlen[toggle];
-		ptr = my->mc_wbuf[toggle];
+	if (mc->mc_snum >= CURSOR_STACK) {
+		mc->mc_txn->mt_flags |= MDB_TXN_ERROR;
+		return MDB_CURSOR_FULL;
+	}
+	if ((rc = mdb_page_new(mc, P_BRANCH, 1, &np)))
+		return rc;
+	memmove(mc->mc_pg+1, mc->mc_pg, mc->mc_snum * sizeof(mc->mc_pg[0]));
+	memmove(mc->mc_ki+1, mc->mc_ki, mc->mc_snum * sizeof(mc->mc_ki[0]));
+	mc->mc_pg[0] = np;
+	mc->mc_ki[0] = 0;
+	mc->mc_snum++;
+	mc->mc_top = 0;
+	mc->mc_db->md_root = np->mp_pgno;
+	mc->mc_db->md_depth++;
+	mdb_bulk_unpos(mc);
+	return mdb_node_add(mc, 0, NULL, NULL, mc->mc_pg[1]->mp_pgno, 0);
+}
+
+	/** Append a branch node to level \b lvl of the right edge.
+	 *	If the page there is full, a new page is started with its
+	 *	last node and this one, and pushed into the level above.
+	 *	Moving a node over keeps every branch page at two or more
+	 *	keys, as #mdb_page_search_root() expects.
+	 * @param[in] mc The loader's cursor.
+	 * @param[in] lvl The stack level to append to. -1 adds a new root.
+	 * @param[in] key The first key of the subtree below \b pgno.
+	 * @param[in] pgno The child page number.
+	 * @return 0 on success, non-zero on failure.
+	 */
+static int
+mdb_bulk_branch(MDB_cursor *mc, int lvl, MDB_val *key, pgno_t pgno)
+{
+	MDB_page *mp, *np;
+	MDB_node *node;
+	MDB_val mkey;
+	pgno_t mpgno;
+	unsigned snum;
+	int rc;
+
+	if (lvl < 0) {
+		if ((rc = mdb_bulk_root(mc)))
+			return rc;
+		lvl = 0;
+	}
+	mp = mc->mc_pg[lvl];
+	if (EVEN(mdb_branch_size(mc->mc_txn->mt_env, key)) <= SIZELEFT(mp)) {
+		mc->mc_top = lvl;
+		mc->mc_ki[lvl] = NUMKEYS(mp);
+		return mdb_node_add(mc, NUMKEYS(mp), key, NULL, pgno, 0);
+	}
+
+	if ((rc = mdb_page_new(mc, P_BRANCH, 1, &np)))
+		return rc;
+	node = NODEPTR(mp, NUMKEYS(mp)-1);
+	mkey.mv_size = NODEKSZ(node);
+	mkey.mv_data = NODEKEY(node);
+	mpgno = NODEPGNO(node);
+	snum = mc->mc_snum;
+	if ((rc = mdb_bulk_branch(mc, lvl-1, &mkey, np->mp_pgno)))
+		return rc;
+	lvl += mc->mc_snum - snum;
+	mc->mc_top = lvl;
+	mc->mc_ki[lvl] = NUMKEYS(mp)-1;
+	mdb_node_del(mc, 0);
+	mdb_bulk_unpos(mc);
+	mc->mc_pg[lvl] = np;
+	mc->mc_ki[lvl] = 0;
+	/* The first key of a branch page is never looked at */
+	if ((rc = mdb_node_add(mc, 0, NULL, NULL, mpgno, 0)))
+		return rc;
+	mc->mc_ki[lvl] = 1;
+	return mdb_node_add(mc, 1, key, NULL, pgno, 0);
+}
+
+	/** Append a leaf node to the right edge of the tree in \b mc.
+	 *	The caller must have checked that \b key sorts last, and
+	 *	made room in the dirty list.
+	 * @param[in] mc The loader's cursor, or its sub-DB cursor.
+	 * @param[in] key The key to store.
+	 * @param[in] data The data to store.
+	 * @param[in] flags Node flags, and optionally #MDB_RESERVE.
+	 * @return 0 on success, non-zero on failure.
+	 */
+static int
+mdb_bulk_leaf(MDB_cursor *mc, MDB_val *key, MDB_val *data, unsigned int flags)
+{
+	MDB_page *mp, *np;
+	uint32_t pflags = P_LEAF;
+	size_t need;
+	int rc;
+
+	if ((mc->mc_flags & C_SUB) && (mc->mc_db->md_flags & MDB_DUPFIXED))
+		pflags |= P_LEAF2;
+
+	if (mc->mc_db->md_root == P_INVALID) {
+		if ((rc = mdb_page_new(mc, pflags, 1, &np)))
+			goto fail;
+		if (pflags & P_LEAF2)
+			np->mp_pad = mc->mc_db->md_pad;
+		mc->mc_pg[0] = np;
+		mc->mc_ki[0] = 0;
+		mc->mc_snum = 1;
+		mc->mc_top = 0;
+		mc->mc_flags |= C_INITIALIZED;
+		mc->mc_db->md_root = np->mp_pgno;
+		mc->mc_db->md_depth = 1;
+		*mc->mc_dbflag |= DB_DIRTY;
+	} else {
+		mp = mc->mc_pg[mc->mc_snum-1];
+		mc->mc_top = mc->mc_snum-1;
+		if (IS_PREFIX(mp)) {
+			if ((rc = mdb_prefix_fit(mc, key, data, flags, &need)))
+				goto fail;
+		} else {
+			need = (pflags & P_LEAF2) ? mc->mc_db->md_pad :
+				mdb_leaf_size(mc->mc_txn->mt_env, key, data);
+		}
+		if (need > SIZELEFT(mp)) {
+			if ((rc = mdb_page_new(mc, pflags, 1, &np)))
+				goto fail;
+			if (pflags & P_LEAF2)
+				np->mp_pad = mc->mc_db->md_pad;
+			if ((rc = mdb_bulk_branch(mc, mc->mc_snum-2, key, np->mp_pgno)))
+				goto fail;
+			mc->mc_pg[mc->mc_snum-1] = np;
+		}
+	}
+	mc->mc_top = mc->mc_snum-1;
+	mp = mc->mc_pg[mc->mc_top];
+	mc->mc_ki[mc->mc_top] = NUMKEYS(mp);
+	if ((rc = mdb_node_add(mc, NUMKEYS(mp), key, data, 0, flags)))
+		goto fail;
+	return MDB_SUCCESS;
+
+fail:
+	mc->mc_txn->mt_flags |= MDB_TXN_ERROR;
+	return rc;
+}
+
+	/** Get the last data item put for the pending key */
+static void
+mdb_bulk_dlast(MDB_bulk *mb)
+{
+	MDB_cursor *mx = &mb->mb_xcursor.mx_cursor;
+	MDB_page *mp = mx->mc_pg[mx->mc_snum ? mx->mc_snum-1 : 0];
+	MDB_node *node;
+
+	if (IS_LEAF2(mp)) {
+		mb->mb_dlast.mv_size = mp->mp_pad;
+		mb->mb_dlast.mv_data = LEAF2KEY(mp, NUMKEYS(mp)-1, mp->mp_pad);
+	} else {
+		node = NODEPTR(mp, NUMKEYS(mp)-1);
+		MDB_GET_KEY2(node, mb->mb_dlast);
+	}
+}
+
+	/** Move the pending key's data items from the sub-page to a sub-DB */
+static int
+mdb_bulk_subdb(MDB_bulk *mb)
+{
+	MDB_cursor *mc = &mb->mb_cursor;
+	MDB_xcursor *mx = &mb->mb_xcursor;
+	MDB_page *fp = mb->mb_sub;
+	MDB_val data, xdata;
+	unsigned i;
+	int rc;
+
+	mx->mx_db.md_flags = 0;
+	if (mc->mc_db->md_flags & MDB_DUPFIXED) {
+		mx->mx_db.md_flags = MDB_DUPFIXED;
+		if (mc->mc_db->md_flags & MDB_INTEGERDUP)
+			mx->mx_db.md_flags |= MDB_INTEGERKEY;
+	}
+	mx->mx_db.md_depth = 0;
+	mx->mx_db.md_branch_pages = 0;
+	mx->mx_db.md_leaf_pages = 0;
+	mx->mx_db.md_overflow_pages = 0;
+	mx->mx_db.md_root = P_INVALID;
+	mx->mx_cursor.mc_snum = 0;
+	mx->mx_cursor.mc_top = 0;
+
+	xdata.mv_size = 0;
+	xdata.mv_data = "";
+	for (i=0; i<NUMKEYS(fp); i++) {
+		if (IS_LEAF2(fp)) {
+			data.mv_size = fp->mp_pad;
+			data.mv_data = LEAF2KEY(fp, i, fp->mp_pad);
+		} else {
+			MDB_node *node = NODEPTR(fp, i);
+			MDB_GET_KEY2(node, data);
+		}
+		if ((rc = mdb_bulk_leaf(&mx->mx_cursor, &data, &xdata, 0)))
+			return rc;
+	}
+	return MDB_SUCCESS;
+}
+
+	/** Add a data item to the pending key */
+static int
+mdb_bulk_dup(MDB_bulk *mb, MDB_val *data)
+{
+	MDB_cursor *mc = &mb->mb_cursor;
+	MDB_cursor *mx = &mb->mb_xcursor.mx_cursor;
+	MDB_env *env = mc->mc_txn->mt_env;
+	MDB_page *fp = mb->mb_sub;
+	MDB_val xdata;
+	size_t size;
+	int rc;
+
+	xdata.mv_size = 0;
+	xdata.mv_data = "";
+	if (!(mx->mc_flags & C_INITIALIZED)) {
+		/* Still on the sub-page. Would it be too big with this item? */
+		if (IS_LEAF2(fp)) {
+			if (data->mv_size != fp->mp_pad)
+				return MDB_BAD_VALSIZE;
+			size = fp->mp_pad;
+		} else {
+			size = EVEN(NODESIZE + data->mv_size) + sizeof(indx_t);
+		}
+		size += env->me_psize - SIZELEFT(fp);
+		if (NODESIZE + mb->mb_key.mv_size + size <= env->me_nodemax) {
+			mx->mc_pg[0] = fp;
+			mx->mc_top = 0;
+			if ((rc = mdb_node_add(mx, NUMKEYS(fp), data, &xdata, 0, 0)))
+				return rc;
+			goto done;
+		}
+		xdata.mv_size = size;
+		if ((rc = mdb_page_spill(mc, &mb->mb_key, &xdata)))
+			return rc;
+		xdata.mv_size = 0;
+		if ((rc = mdb_bulk_subdb(mb)))
+			return rc;
+	} else if (IS_LEAF2(fp) && data->mv_size != fp->mp_pad) {
+		return MDB_BAD_VALSIZE;
+	}
+	if ((rc = mdb_page_spill(mc, data, &xdata)))
+		return rc;
+	if ((rc = mdb_bulk_leaf(mx, data, &xdata, 0)))
+		return rc;
+done:
+	mb->mb_ndups++;
+	mdb_bulk_dlast(mb);
+	return MDB_SUCCESS;
+}
+
+	/** Store the pending key with all of its data items */
+static int
+mdb_bulk_flush(MDB_bulk *mb)
+{
+	MDB_cursor *mc = &mb->mb_cursor;
+	MDB_xcursor *mx = &mb->mb_xcursor;
+	MDB_env *env = mc->mc_txn->mt_env;
+	MDB_page *fp = mb->mb_sub, *np;
+	MDB_val xdata;
+	unsigned int flags;
+	unsigned i, n, off;
+	int rc;
+
+	if (mx->mx_cursor.mc_flags & C_INITIALIZED) {
+		mx->mx_db.md_entries = mb->mb_ndups;
+		xdata.mv_size = sizeof(MDB_db);
+		xdata.mv_data = &mx->mx_db;
+		flags = F_DUPDATA|F_SUBDATA;
+	} else if (mb->mb_ndups == 1) {
+		xdata = mb->mb_dlast;
+		flags = 0;
+	} else {
+		xdata.mv_size = env->me_psize - SIZELEFT(fp);
+		flags = F_DUPDATA|MDB_RESERVE;
+	}
+	if ((rc = mdb_page_spill(mc, &mb->mb_key, &xdata)))
+		return rc;
+	if ((rc = mdb_bulk_leaf(mc, &mb->mb_key, &xdata, flags)))
+		return rc;
+
+	if (flags & MDB_RESERVE) {
+		/* Copy the sub-page without its free space */
+		np = xdata.mv_data;
+		n = NUMKEYS(fp);
+		off = env->me_psize - xdata.mv_size;
+		np->mp_pgno = mc->mc_pg[mc->mc_top]->mp_pgno;
+		np->mp_pad = fp->mp_pad;
+		np->mp_flags = fp->mp_flags;
+		np->mp_lower = fp->mp_lower;
+		np->mp_upper = fp->mp_upper - off;
+		if (IS_LEAF2(fp)) {
+			memcpy(METADATA(np), METADATA(fp), n * fp->mp_pad);
+		} else {
+			for (i=0; i<n; i++)
+				np->mp_ptrs[i] = fp->mp_ptrs[i] - off;
+			memcpy((char *)np + np->mp_upper + PAGEBASE,
+				(char *)fp + fp->mp_upper + PAGEBASE,
+				env->me_psize - fp->mp_upper - PAGEBASE);
+		}
+	}
+	mc->mc_db->md_entries += mb->mb_ndups;
+	mx->mx_cursor.mc_flags = C_SUB;
+	mx->mx_cursor.mc_snum = 0;
+	mb->mb_key.mv_size = 0;
+	mb->mb_ndups = 0;
+	return MDB_SUCCESS;
+}
+
+int
+mdb_bulk_open(MDB_txn *txn, MDB_dbi dbi, MDB_bulk **ret)
+{
+	MDB_bulk *mb;
+	MDB_cursor *mc;
+	MDB_env *env;
+	int rc;
+
+	if (!ret || !TXN_DBI_EXIST(txn, dbi, DB_USRVALID))
+		return EINVAL;
+
+	if (txn->mt_flags & (MDB_TXN_RDONLY|MDB_TXN_BLOCKED))
+		return (txn->mt_flags & MDB_TXN_RDONLY) ? EACCES : MDB_BAD_TXN;
+
+	env = txn->mt_env;
+	if ((mb = malloc(sizeof(MDB_bulk) + env->me_psize + ENV_MAXKEY(env))) == NULL)
+		return ENOMEM;
+	mc = &mb->mb_cursor;
+	mdb_cursor_init(mc, txn, dbi, &mb->mb_xcursor);
+	mb->mb_sub = (MDB_page *)(mb + 1);
+	mb->mb_key.mv_size = 0;
+	mb->mb_key.mv_data = (char *)mb->mb_sub + env->me_psize;
+	mb->mb_ndups = 0;
+
+	/* Continue from the last key, with a writable right edge */
+	if (mc->mc_db->md_root != P_INVALID) {
+		if ((rc = mdb_page_spill(mc, NULL, NULL)) ||
+			(rc = mdb_cursor_last(mc, NULL, NULL)) ||
+			(rc = mdb_cursor_touch(mc))) {
+			free(mb);
+			return rc;
+		}
+		if (mc->mc_xcursor)
+			mdb_xcursor_init0(mc);
+	}
+	mc->mc_flags |= C_BULK|C_UNTRACK;
+	mc->mc_next = txn->mt_cursors[dbi];
+	txn->mt_cursors[dbi] = mc;
+	*ret = mb;
+	return MDB_SUCCESS;
+}
+
+int
+mdb_bulk_put(MDB_bulk *mb, MDB_val *key, MDB_val *data, unsigned int flags)
+{
+	MDB_cursor *mc;
+	MDB_txn *txn;
+	MDB_page *mp;
+	MDB_node *leaf;
+	int rc;
+
+	if (!mb || !key || !data || (flags & ~MDB_RESERVE))
+		return EINVAL;
+
+	mc = &mb->mb_cursor;
+	txn = mc->mc_txn;
+	if (txn->mt_flags & MDB_TXN_BLOCKED)
+		return MDB_BAD_TXN;
+
+	if (key->mv_size-1 >= ENV_MAXKEY(txn->mt_env))
+		return MDB_BAD_VALSIZE;
+#if SIZE_MAX > MAXDATASIZE
+	if (data->mv_size > ((mc->mc_db->md_flags & MDB_DUPSORT) ? ENV_MAXKEY(txn->mt_env) : MAXDATASIZE))
+		return MDB_BAD_VALSIZE;
+#else
+	if ((mc->mc_db->md_flags & MDB_DUPSORT) && data->mv_size > ENV_MAXKEY(txn->mt_env))
+		return MDB_BAD_VALSIZE;
+#endif
+
+	if (mb->mb_key.mv_size) {
+		rc = mc->mc_dbx->md_cmp(key, &mb->mb_key);
+		if (rc == 0) {
+			if (mb->mb_dcmp(data, &mb->mb_dlast) <= 0)
+				return MDB_KEYEXIST;
+			return mdb_bulk_dup(mb, data);
+		}
+		if (rc < 0)
+			return MDB_KEYEXIST;
+		if ((rc = mdb_bulk_flush(mb)))
+			return rc;
+	} else if (mc->mc_flags & C_INITIALIZED) {
+		mp = mc->mc_pg[mc->mc_top];
+		leaf = NODEPTR(mp, NUMKEYS(mp)-1);
+		if (mdb_cmp_node(mc, mp, leaf, key) <= 0)
+			return MDB_KEYEXIST;
+	}
+
+	if (mc->mc_db->md_flags & MDB_DUPSORT) {
+		MDB_page *fp = mb->mb_sub;
+		if (flags & MDB_RESERVE)
+			return EINVAL;
+		/* Hold on to the key until all of its data items are known */
+		mb->mb_dcmp = mc->mc_dbx->md_dcmp;
+#if UINT_MAX < SIZE_MAX
+		if (mb->mb_dcmp == mdb_cmp_int && data->mv_size == sizeof(size_t))
+			mb->mb_dcmp = mdb_cmp_clong;
+#endif
+		memcpy(mb->mb_key.mv_data, key->mv_data, key->mv_size);
+		fp->mp_flags = P_LEAF|P_DIRTY|P_SUBP;
+		fp->mp_pad = 0;
+		if (mc->mc_db->md_flags & MDB_DUPFIXED) {
+			fp->mp_flags |= P_LEAF2;
+			fp->mp_pad = data->mv_size;
+		}
+		fp->mp_lower = (PAGEHDRSZ-PAGEBASE);
+		fp->mp_upper = txn->mt_env->me_psize - PAGEBASE;
+		mb->mb_xcursor.mx_db.md_pad = fp->mp_pad;
+		mb->mb_key.mv_size = key->mv_size;
+		if ((rc = mdb_bulk_dup(mb, data)))
+			mb->mb_key.mv_size = 0;
+		return rc;
+	}
+
+	if ((rc = mdb_page_spill(mc, key, data)))
+		return rc;
+	if ((rc = mdb_bulk_leaf(mc, key, data, flags)))
+		return rc;
+	mc->mc_db->md_entries++;
+	return MDB_SUCCESS;
+}
+
+int
+mdb_bulk_close(MDB_bulk *mb)
+{
+	int rc = MDB_SUCCESS;
+
+	if (!mb)
+		return EINVAL;
+	if (mb->mb_key.mv_size) {
+		if (mb->mb_cursor.mc_txn->mt_flags & MDB_TXN_BLOCKED)
+			rc = MDB_BAD_TXN;
+		else
+			rc = mdb_bulk_flush(mb);
+	}
+	mdb_cursor_close(&mb->mb_cursor);
+	return rc;
+}
+
+int
+mdb_bulk_load(MDB_txn *txn, MDB_dbi dbi, MDB_bulk_func *func, void *ctx)
+{
+	MDB_bulk *mb;
+	MDB_val key, data;
+	int rc, rc2;
+
+	if (!func)
+		return EINVAL;
+	if ((rc = mdb_bulk_open(txn, dbi, &mb)))
+		return rc;
+	while ((rc = func(ctx, &key, &data)) == MDB_SUCCESS) {
+		if ((rc = mdb_bulk_put(mb, &key, &data, 0)))
+			break;
+	}
+	if (rc == MDB_NOTFOUND)
+		rc = MDB_SUCCESS;
+	rc2 = mdb_bulk_close(mb);
+	return rc ? rc : rc2;
+}
+
+#ifndef MDB_WBUF
+#define MDB_WBUF	(1024*1024)
+#endif
+#define MDB_EOF		0x10	/**< #mdb_env_copyfd1() is done reading */
+
+	/** State needed for a double-buffering compacting copy. */
+typedef struct mdb_copy {
+	MDB_env *mc_env;
+	MDB_txn *mc_txn;
+	pthread_mutex_t mc_mutex;
+	pthread_cond_t mc_cond;	/**< Condition variable for #mc_new */
+	char *mc_wbuf[2];
+	char *mc_over[2];
+	int mc_wlen[2];
+	int mc_olen[2];
+	pgno_t mc_next_pgno;
+	HANDLE mc_fd;
+	int mc_toggle;			/**< Buffer number in provider */
+	int mc_new;				/**< (0-2 buffers to write) | (#MDB_EOF at end) */
+	/** Error code.  Never cleared if set.  Both threads can set nonzero
+	 *	to fail the copy.  Not mutex-protected, LMDB expects atomic int.
+	 */
+	volatile int mc_error;
+	struct mdb_pcopy *mc_pcopy;	/**< Shared state, in a thread of a parallel copy */
+	struct mdb_pcsub *mc_sub;	/**< Subtree being walked, in a parallel copy */
+	struct mdb_pcbuf *mc_buf;	/**< Buffer being filled, in a parallel copy */
+} mdb_copy;
+
+#ifndef _WIN32
+static int mdb_env_pctoggle(mdb_copy *my);
+#endif
+
+	/** Dedicated writer thread for compacting copy. */
+static THREAD_RET ESECT CALL_CONV
+mdb_env_copythr(void *arg)
+{
+	mdb_copy *my = arg;
+	char *ptr;
+	int toggle = 0, wsize, rc;
+#ifdef _WIN32
+	DWORD len;
+#define DO_WRITE(rc, fd, ptr, w2, len)	rc = WriteFile(fd, ptr, w2, &len, NULL)
+#else
+	int len;
+#define DO_WRITE(rc, fd, ptr, w2, len)	len = write(fd, ptr, w2); rc = (len >= 0)
+#ifdef SIGPIPE
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGPIPE);
+	if ((rc = pthread_sigmask(SIG_BLOCK, &set, NULL)) != 0)
+		my->mc_error = rc;
+#endif
+#endif
+
+	pthread_mutex_lock(&my->mc_mutex);
+	for(;;) {
+		while (!my->mc_new)
+			pthread_cond_wait(&my->mc_cond, &my->mc_mutex);
+		if (my->mc_new == 0 + MDB_EOF) /* 0 buffers, just EOF */
+			break;
+		wsize = my->mc_wlen[toggle];
+		ptr = my->mc_wbuf[toggle];
 again:
 		rc = MDB_SUCCESS;
 		while (wsize > 0 && !my->mc_error) {
@@ -9103,6 +11378,10 @@ again:
 static int ESECT
 mdb_env_cthr_toggle(mdb_copy *my, int adjust)
 {
+#ifndef _WIN32
+	if (my->mc_pcopy)
+		return mdb_env_pctoggle(my);
+#endif
 	pthread_mutex_lock(&my->mc_mutex);
 	my->mc_new += adjust;
 	pthread_cond_signal(&my->mc_cond);
@@ -9276,12 +11555,87 @@ done:
 	return rc;
 }
 
-	/** Copy environment with compaction. */
+	/** Prepare the meta pages of a compacting copy.
+	 * @param[in] txn the read-only transaction being copied.
+	 * @param[in] flags the #mdb_copy flags.
+	 * @param[out] buf the #NUM_METAS pages to write first.
+	 * @param[out] last the new root of the main DB, which is the last
+	 *	page of the copy.
+	 * @return 0 on success, non-zero on failure.
+	 */
 static int ESECT
-mdb_env_copyfd1(MDB_env *env, HANDLE fd)
+mdb_env_cmeta(MDB_txn *txn, unsigned int flags, char *buf, pgno_t *last)
 {
+	MDB_env *env = txn->mt_env;
 	MDB_meta *mm;
 	MDB_page *mp;
+	pgno_t root, new_root;
+	int rc = MDB_SUCCESS;
+
+	mp = (MDB_page *)buf;
+	memset(mp, 0, NUM_METAS * env->me_psize);
+	mp->mp_pgno = 0;
+	mp->mp_flags = P_META;
+	mm = (MDB_meta *)METADATA(mp);
+	mdb_env_init_meta0(env, mm);
+	mm->mm_address = env->me_metas[0]->mm_address;
+	if (flags & MDB_CP_EXTFREE)
+		mm->mm_version = MDB_DATA_VERSION_EXT;
+
+	mp = (MDB_page *)(buf + env->me_psize);
+	mp->mp_pgno = 1;
+	mp->mp_flags = P_META;
+	*(MDB_meta *)METADATA(mp) = *mm;
+	mm = (MDB_meta *)METADATA(mp);
+
+	/* Set metapage 1 with current main DB */
+	root = new_root = txn->mt_dbs[MAIN_DBI].md_root;
+	if (root != P_INVALID) {
+		/* Count free pages + freeDB pages.  Subtract from last_pg
+		 * to find the new last_pg, which also becomes the new root.
+		 */
+		MDB_ID freecount = 0;
+		MDB_cursor mc;
+		MDB_val key, data;
+		mdb_cursor_init(&mc, txn, FREE_DBI, NULL);
+		while ((rc = mdb_cursor_get(&mc, &key, &data, MDB_NEXT)) == 0) {
+			MDB_ID *idl = data.mv_data;
+			if (env->me_flags & MDB_EXTFREE) {
+				unsigned x;
+				for (x = MDB_EXT_NUM(idl); x; x--)
+					freecount += MDB_EXT_LEN(idl, x);
+			} else {
+				freecount += *idl;
+			}
+		}
+		if (rc != MDB_NOTFOUND)
+			return rc;
+		rc = MDB_SUCCESS;
+		freecount += txn->mt_dbs[FREE_DBI].md_branch_pages +
+			txn->mt_dbs[FREE_DBI].md_leaf_pages +
+			txn->mt_dbs[FREE_DBI].md_overflow_pages;
+
+		new_root = txn->mt_next_pgno - 1 - freecount;
+		mm->mm_last_pg = new_root;
+		mm->mm_dbs[MAIN_DBI] = txn->mt_dbs[MAIN_DBI];
+		mm->mm_dbs[MAIN_DBI].md_root = new_root;
+	} else {
+		/* When the DB is empty, handle it specially to
+		 * fix any breakage like page leaks from ITS#8174.
+		 */
+		mm->mm_dbs[MAIN_DBI].md_flags = txn->mt_dbs[MAIN_DBI].md_flags;
+	}
+	if (root != P_INVALID || mm->mm_dbs[MAIN_DBI].md_flags) {
+		mm->mm_txnid = 1;		/* use metapage 1 */
+	}
+	*last = new_root;
+	return rc;
+}
+
+	/** Copy environment with compaction. */
+static int ESECT
+mdb_env_copyfd1(MDB_env *env, HANDLE fd, unsigned int flags)
+{
 	mdb_copy my = {0};
 	MDB_txn *txn = NULL;
 	pthread_t thr;
@@ -9333,51 +11687,10 @@ mdb_env_copyfd1(MDB_env *env, HANDLE fd)
 	if (rc)
 		goto finish;
 
-	mp = (MDB_page *)my.mc_wbuf[0];
-	memset(mp, 0, NUM_METAS * env->me_psize);
-	mp->mp_pgno = 0;
-	mp->mp_flags = P_META;
-	mm = (MDB_meta *)METADATA(mp);
-	mdb_env_init_meta0(env, mm);
-	mm->mm_address = env->me_metas[0]->mm_address;
-
-	mp = (MDB_page *)(my.mc_wbuf[0] + env->me_psize);
-	mp->mp_pgno = 1;
-	mp->mp_flags = P_META;
-	*(MDB_meta *)METADATA(mp) = *mm;
-	mm = (MDB_meta *)METADATA(mp);
-
-	/* Set metapage 1 with current main DB */
-	root = new_root = txn->mt_dbs[MAIN_DBI].md_root;
-	if (root != P_INVALID) {
-		/* Count free pages + freeDB pages.  Subtract from last_pg
-		 * to find the new last_pg, which also becomes the new root.
-		 */
-		MDB_ID freecount = 0;
-		MDB_cursor mc;
-		MDB_val key, data;
-		mdb_cursor_init(&mc, txn, FREE_DBI, NULL);
-		while ((rc = mdb_cursor_get(&mc, &key, &data, MDB_NEXT)) == 0)
-			freecount += *(MDB_ID *)data.mv_data;
-		if (rc != MDB_NOTFOUND)
-			goto finish;
-		freecount += txn->mt_dbs[FREE_DBI].md_branch_pages +
-			txn->mt_dbs[FREE_DBI].md_leaf_pages +
-			txn->mt_dbs[FREE_DBI].md_overflow_pages;
-
-		new_root = txn->mt_next_pgno - 1 - freecount;
-		mm->mm_last_pg = new_root;
-		mm->mm_dbs[MAIN_DBI] = txn->mt_dbs[MAIN_DBI];
-		mm->mm_dbs[MAIN_DBI].md_root = new_root;
-	} else {
-		/* When the DB is empty, handle it specially to
-		 * fix any breakage like page leaks from ITS#8174.
-		 */
-		mm->mm_dbs[MAIN_DBI].md_flags = txn->mt_dbs[MAIN_DBI].md_flags;
-	}
-	if (root != P_INVALID || mm->mm_dbs[MAIN_DBI].md_flags) {
-		mm->mm_txnid = 1;		/* use metapage 1 */
-	}
+	root = txn->mt_dbs[MAIN_DBI].md_root;
+	rc = mdb_env_cmeta(txn, flags, my.mc_wbuf[0], &new_root);
+	if (rc)
+		goto finish;
 
 	my.mc_wlen[0] = env->me_psize * NUM_METAS;
 	my.mc_txn = txn;
@@ -9407,425 +11720,2309 @@ done2:
 	return rc ? rc : my.mc_error;
 }
 
-	/** Copy environment as-is. */
+#ifndef _WIN32
+#ifndef MDB_CPTASK
+/** Number of pages a thread of a parallel compacting copy should walk
+ *	at once. Bigger trees are split into subtrees of about this size.
+ */
+#define MDB_CPTASK	1024
+#endif
+#ifndef MDB_CPQUEUE
+/** Number of #MDB_WBUF buffers per thread of a parallel compacting copy.
+ *	Threads wait when they have filled this many buffers which can not
+ *	be written yet.
+ */
+#define MDB_CPQUEUE	8
+#endif
+
+	/** A write buffer of a parallel compacting copy. */
+typedef struct mdb_pcbuf {
+	struct mdb_pcbuf *pb_next;	/**< Next in a subtree's queue or the free list */
+	struct mdb_pcbuf *pb_link;	/**< Next allocated buffer */
+	char *pb_buf;			/**< #MDB_WBUF bytes of pages */
+	char *pb_over;			/**< Overflow page tail to write after #pb_buf */
+	size_t pb_olen;
+	int pb_wlen;
+} mdb_pcbuf;
+
+	/** A subtree walked by one thread of a parallel compacting copy.
+	 *	Its pages are numbered from 0 while walking, and renumbered
+	 *	from #ps_base when they are written.
+	 */
+typedef struct mdb_pcsub {
+	pgno_t ps_pgno;			/**< Root page in the environment */
+	pgno_t ps_root;			/**< Root page in the copy, from 0 */
+	pgno_t ps_base;			/**< First page number in the copy */
+	pgno_t ps_count;		/**< Number of pages in the copy */
+	mdb_pcbuf *ps_head;		/**< Filled buffers, oldest first */
+	mdb_pcbuf **ps_tail;
+	int ps_nbufs;			/**< Number of filled buffers */
+	int ps_flags;			/**< #F_DUPDATA for a sorted-duplicate sub-DB */
+	int ps_done;			/**< The walk is complete */
+} mdb_pcsub;
+
+	/** A page above the subtrees. These are kept in memory and
+	 *	written after all subtrees.
+	 */
+typedef struct mdb_pctop {
+	MDB_page *pt_page;		/**< Copy of the page */
+	int *pt_kids;			/**< For each node, the subtree (>0) or page (<0)
+							 *	it points to, or 0.
+							 */
+} mdb_pctop;
+
+	/** State of a parallel compacting copy.
+	 *	The subtrees are walked by several threads, and written in order
+	 *	by a writer thread, which then writes the pages above them.
+	 */
+typedef struct mdb_pcopy {
+	MDB_env *pc_env;
+	MDB_txn *pc_txn;
+	HANDLE pc_fd;
+	pthread_mutex_t pc_mutex;
+	pthread_cond_t pc_cond;	/**< Broadcast when buffers are queued or freed */
+	mdb_pcsub *pc_subs;
+	mdb_pctop *pc_tops;
+	unsigned int pc_nsubs, pc_maxsubs;
+	unsigned int pc_ntops, pc_maxtops;
+	unsigned int pc_next;	/**< Next subtree to walk */
+	unsigned int pc_head;	/**< Subtree being written */
+	mdb_pcbuf *pc_free;		/**< Unused buffers */
+	mdb_pcbuf *pc_bufs;		/**< All allocated buffers */
+	int pc_nbufs;			/**< Number of allocated buffers */
+	int pc_maxbufs;			/**< Limit for threads not walking #pc_head */
+	mdb_pcbuf *pc_wbuf;		/**< Buffer of the writer thread */
+	pgno_t pc_next_pgno;	/**< Next page number in the copy */
+	pgno_t pc_last;			/**< Expected new root of the main DB */
+	int pc_root;			/**< Main DB root, a subtree (>0) or page (<0) */
+	volatile int pc_error;	/**< Error code, never cleared once set */
+} mdb_pcopy;
+
+	/** Get an empty buffer for a thread of a parallel copy.
+	 *	Called with #mdb_pcopy.pc_mutex held. Threads wait while all
+	 *	buffers are in use, except for the one walking the subtree
+	 *	being written, so that the writer can always make progress.
+	 * @param[in] pc control structure.
+	 * @param[in] sub the subtree being walked, or NULL for the writer.
+	 * @param[out] ret the buffer.
+	 * @return 0 on success, non-zero on failure.
+	 */
 static int ESECT
-mdb_env_copyfd0(MDB_env *env, HANDLE fd)
+mdb_env_pcbuf(mdb_pcopy *pc, mdb_pcsub *sub, mdb_pcbuf **ret)
 {
-	MDB_txn *txn = NULL;
-	mdb_mutexref_t wmutex = NULL;
-	int rc;
-	size_t wsize, w3;
-	char *ptr;
-#ifdef _WIN32
-	DWORD len, w2;
-#define DO_WRITE(rc, fd, ptr, w2, len)	rc = WriteFile(fd, ptr, w2, &len, NULL)
+	mdb_pcbuf *pb;
+	int head;
+
+	for (;;) {
+		if (pc->pc_error)
+			return pc->pc_error;
+		head = !sub || sub == pc->pc_subs + pc->pc_head;
+		if (head && sub && sub->ps_nbufs >= MDB_CPQUEUE) {
+			/* Let the writer catch up */
+		} else if (pc->pc_free) {
+			pb = pc->pc_free;
+			pc->pc_free = pb->pb_next;
+			break;
+		} else if (head || pc->pc_nbufs < pc->pc_maxbufs) {
+			void *p;
+			int rc;
+			if ((pb = malloc(sizeof(mdb_pcbuf))) == NULL)
+				return ENOMEM;
+#ifdef HAVE_MEMALIGN
+			if ((p = memalign(pc->pc_env->me_os_psize, MDB_WBUF)) == NULL)
+				rc = ENOMEM;
+			else
+				rc = MDB_SUCCESS;
 #else
-	ssize_t len;
-	size_t w2;
-#define DO_WRITE(rc, fd, ptr, w2, len)	len = write(fd, ptr, w2); rc = (len >= 0)
+			rc = posix_memalign(&p, pc->pc_env->me_os_psize, MDB_WBUF);
 #endif
+			if (rc) {
+				free(pb);
+				return rc;
+			}
+			pb->pb_buf = p;
+			pb->pb_link = pc->pc_bufs;
+			pc->pc_bufs = pb;
+			pc->pc_nbufs++;
+			break;
+		}
+		pthread_cond_wait(&pc->pc_cond, &pc->pc_mutex);
+	}
+	pb->pb_next = NULL;
+	pb->pb_over = NULL;
+	pb->pb_olen = 0;
+	pb->pb_wlen = 0;
+	*ret = pb;
+	return MDB_SUCCESS;
+}
 
-	/* Do the lock/unlock of the reader mutex before starting the
-	 * write txn.  Otherwise other read txns could block writers.
+	/** Queue a filled buffer of a subtree for the writer.
+	 *	Called with #mdb_pcopy.pc_mutex held.
 	 */
-	rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+static void ESECT
+mdb_env_pcqueue(mdb_pcopy *pc, mdb_pcsub *sub, mdb_pcbuf *pb)
+{
+	pb->pb_next = NULL;
+	*sub->ps_tail = pb;
+	sub->ps_tail = &pb->pb_next;
+	sub->ps_nbufs++;
+	pthread_cond_broadcast(&pc->pc_cond);
+}
+
+	/** Hand a filled buffer to the writer and get an empty one.
+	 *	This is #mdb_env_cthr_toggle() for the threads of a parallel copy.
+	 */
+static int ESECT
+mdb_env_pctoggle(mdb_copy *my)
+{
+	mdb_pcopy *pc = my->mc_pcopy;
+	mdb_pcbuf *pb = my->mc_buf;
+	int toggle = my->mc_toggle, rc;
+
+	pb->pb_wlen = my->mc_wlen[toggle];
+	pb->pb_over = my->mc_over[toggle];
+	pb->pb_olen = my->mc_olen[toggle];
+	my->mc_olen[toggle] = 0;
+	my->mc_buf = NULL;
+	pthread_mutex_lock(&pc->pc_mutex);
+	mdb_env_pcqueue(pc, my->mc_sub, pb);
+	rc = mdb_env_pcbuf(pc, my->mc_sub, &my->mc_buf);
+	pthread_mutex_unlock(&pc->pc_mutex);
 	if (rc)
 		return rc;
 
-	if (env->me_txns) {
-		/* We must start the actual read txn after blocking writers */
-		mdb_txn_end(txn, MDB_END_RESET_TMP);
+	toggle ^= 1;
+	my->mc_toggle = toggle;
+	my->mc_wbuf[toggle] = my->mc_buf->pb_buf;
+	my->mc_wlen[toggle] = 0;
+	my->mc_olen[toggle] = 0;
+	return MDB_SUCCESS;
+}
 
-		/* Temporarily block writers until we snapshot the meta pages */
-		wmutex = env->me_wmutex;
-		if (LOCK_MUTEX(rc, env, wmutex))
-			goto leave;
+	/** Walk subtrees for a parallel copy, until none are left. */
+static THREAD_RET ESECT CALL_CONV
+mdb_env_pcwalk(void *arg)
+{
+	mdb_pcopy *pc = arg;
+	mdb_copy my = {0};
+	mdb_pcsub *sub;
+	pgno_t root;
+	int rc;
 
-		rc = mdb_txn_renew0(txn);
-		if (rc) {
-			UNLOCK_MUTEX(wmutex);
-			goto leave;
-		}
-	}
+	my.mc_env = pc->pc_env;
+	my.mc_txn = pc->pc_txn;
+	my.mc_pcopy = pc;
 
-	wsize = env->me_psize * NUM_METAS;
-	ptr = env->me_map;
-	w2 = wsize;
-	while (w2 > 0) {
-		DO_WRITE(rc, fd, ptr, w2, len);
-		if (!rc) {
-			rc = ErrCode();
+	pthread_mutex_lock(&pc->pc_mutex);
+	while (!pc->pc_error && pc->pc_next < pc->pc_nsubs) {
+		sub = &pc->pc_subs[pc->pc_next++];
+		if ((rc = mdb_env_pcbuf(pc, sub, &my.mc_buf)) != 0) {
+			if (!pc->pc_error)
+				pc->pc_error = rc;
 			break;
-		} else if (len > 0) {
-			rc = MDB_SUCCESS;
-			ptr += len;
-			w2 -= len;
-			continue;
-		} else {
-			/* Non-blocking or async handles are not supported */
-			rc = EIO;
+		}
+		pthread_mutex_unlock(&pc->pc_mutex);
+
+		my.mc_sub = sub;
+		my.mc_toggle = 0;
+		my.mc_wbuf[0] = my.mc_buf->pb_buf;
+		my.mc_wlen[0] = 0;
+		my.mc_olen[0] = 0;
+		my.mc_next_pgno = 0;
+		root = sub->ps_pgno;
+		rc = mdb_env_cwalk(&my, &root, sub->ps_flags);
+
+		pthread_mutex_lock(&pc->pc_mutex);
+		if (my.mc_buf) {
+			my.mc_buf->pb_wlen = my.mc_wlen[my.mc_toggle];
+			mdb_env_pcqueue(pc, sub, my.mc_buf);
+			my.mc_buf = NULL;
+		}
+		sub->ps_root = root;
+		sub->ps_count = my.mc_next_pgno;
+		sub->ps_done = 1;
+		if (rc) {
+			if (!pc->pc_error)
+				pc->pc_error = rc;
 			break;
 		}
 	}
-	if (wmutex)
-		UNLOCK_MUTEX(wmutex);
+	pthread_cond_broadcast(&pc->pc_cond);
+	pthread_mutex_unlock(&pc->pc_mutex);
+	return (THREAD_RET)0;
+}
 
-	if (rc)
-		goto leave;
+	/** Write a buffer of a parallel copy, and empty it. */
+static int ESECT
+mdb_env_pcwrite(mdb_pcopy *pc, mdb_pcbuf *pb)
+{
+	char *ptr = pb->pb_buf;
+	size_t wsize = pb->pb_wlen;
+	ssize_t len;
+	int rc = MDB_SUCCESS;
 
-	w3 = txn->mt_next_pgno * env->me_psize;
-	{
-		size_t fsize = 0;
-		if ((rc = mdb_fsize(env->me_fd, &fsize)))
-			goto leave;
-		if (w3 > fsize)
-			w3 = fsize;
-	}
-	wsize = w3 - wsize;
+again:
 	while (wsize > 0) {
-		if (wsize > MAX_WRITE)
-			w2 = MAX_WRITE;
-		else
-			w2 = wsize;
-		DO_WRITE(rc, fd, ptr, w2, len);
-		if (!rc) {
+		len = write(pc->pc_fd, ptr, wsize > MAX_WRITE ? MAX_WRITE : wsize);
+		if (len < 0) {
 			rc = ErrCode();
-			break;
+#ifdef SIGPIPE
+			if (rc == EPIPE) {
+				/* Collect the pending SIGPIPE, like mdb_env_copythr() */
+				sigset_t set;
+				int tmp;
+				sigemptyset(&set);
+				sigaddset(&set, SIGPIPE);
+				sigwait(&set, &tmp);
+			}
+#endif
+			return rc;
 		} else if (len > 0) {
-			rc = MDB_SUCCESS;
 			ptr += len;
 			wsize -= len;
-			continue;
 		} else {
-			rc = EIO;
-			break;
+			return EIO;
 		}
 	}
-
-leave:
-	mdb_txn_abort(txn);
+	/* If there's an overflow page tail, write it too */
+	if (pb->pb_olen) {
+		ptr = pb->pb_over;
+		wsize = pb->pb_olen;
+		pb->pb_olen = 0;
+		goto again;
+	}
+	pb->pb_wlen = 0;
 	return rc;
 }
 
-int ESECT
-mdb_env_copyfd2(MDB_env *env, HANDLE fd, unsigned int flags)
-{
-	if (flags & MDB_CP_COMPACT)
-		return mdb_env_copyfd1(env, fd);
-	else
-		return mdb_env_copyfd0(env, fd);
-}
-
-int ESECT
-mdb_env_copyfd(MDB_env *env, HANDLE fd)
+	/** Renumber the pages of a subtree in a buffer, starting at \b base.
+	 *	Leaves of sorted-duplicate sub-DBs have no node flags, so
+	 *	checking the flags is enough to find the page numbers in leaves.
+	 */
+static void ESECT
+mdb_env_pcreloc(mdb_pcopy *pc, mdb_pcbuf *pb, pgno_t base)
 {
-	return mdb_env_copyfd2(env, fd, 0);
+	MDB_page *mp;
+	MDB_node *ni;
+	char *ptr, *end = pb->pb_buf + pb->pb_wlen;
+	pgno_t pg;
+	unsigned int i, n;
+
+	for (ptr = pb->pb_buf; ptr < end; ptr += pc->pc_env->me_psize) {
+		mp = (MDB_page *)ptr;
+		mp->mp_pgno += base;
+		if (IS_OVERFLOW(mp) || IS_LEAF2(mp))
+			continue;
+		n = NUMKEYS(mp);
+		for (i=0; i<n; i++) {
+			ni = NODEPTR(mp, i);
+			if (IS_BRANCH(mp)) {
+				SETPGNO(ni, NODEPGNO(ni) + base);
+			} else if (ni->mn_flags & F_BIGDATA) {
+				memcpy(&pg, NODEDATA(ni), sizeof(pg));
+				pg += base;
+				memcpy(NODEDATA(ni), &pg, sizeof(pg));
+			} else if (ni->mn_flags & F_SUBDATA) {
+				char *root = (char *)NODEDATA(ni) + offsetof(MDB_db, md_root);
+				memcpy(&pg, root, sizeof(pg));
+				if (pg != P_INVALID) {
+					pg += base;
+					memcpy(root, &pg, sizeof(pg));
+				}
+			}
+		}
+	}
 }
 
-int ESECT
-mdb_env_copy2(MDB_env *env, const char *path, unsigned int flags)
+	/** Write the pages above the subtrees, children first.
+	 * @param[in] pc control structure.
+	 * @param[in] ref the subtree (>0) or page (<0) to write.
+	 * @param[out] pg its page number in the copy.
+	 * @return 0 on success, non-zero on failure.
+	 */
+static int ESECT
+mdb_env_pcemit(mdb_pcopy *pc, int ref, pgno_t *pg)
 {
+	MDB_env *env = pc->pc_env;
+	MDB_cursor mc = {0};
+	mdb_pcbuf *pb = pc->pc_wbuf;
+	mdb_pctop *top;
+	MDB_page *mp, *mo, *omp;
+	MDB_node *ni;
+	pgno_t kid;
+	unsigned int i, n;
 	int rc;
-	MDB_name fname;
-	HANDLE newfd = INVALID_HANDLE_VALUE;
 
-	rc = mdb_fname_init(path, env->me_flags | MDB_NOLOCK, &fname);
-	if (rc == MDB_SUCCESS) {
-		rc = mdb_fopen(env, &fname, MDB_O_COPY, 0666, &newfd);
-		mdb_fname_destroy(fname);
-	}
-	if (rc == MDB_SUCCESS) {
-		rc = mdb_env_copyfd2(env, newfd, flags);
-		if (close(newfd) < 0 && rc == MDB_SUCCESS)
-			rc = ErrCode();
+	if (ref > 0) {
+		mdb_pcsub *sub = &pc->pc_subs[ref-1];
+		*pg = sub->ps_base + sub->ps_root;
+		return MDB_SUCCESS;
 	}
-	return rc;
+
+	mc.mc_txn = pc->pc_txn;
+	top = &pc->pc_tops[-ref-1];
+	mp = top->pt_page;
+	n = NUMKEYS(mp);
+	for (i=0; i<n; i++) {
+		ni = NODEPTR(mp, i);
+		if (top->pt_kids[i]) {
+			rc = mdb_env_pcemit(pc, top->pt_kids[i], &kid);
+			if (rc)
+				return rc;
+			if (IS_BRANCH(mp))
+				SETPGNO(ni, kid);
+			else
+				memcpy((char *)NODEDATA(ni) + offsetof(MDB_db, md_root),
+					&kid, sizeof(kid));
+		} else if (IS_LEAF(mp) && (ni->mn_flags & F_BIGDATA)) {
+			memcpy(&kid, NODEDATA(ni), sizeof(kid));
+			rc = mdb_page_get(&mc, kid, &omp, NULL);
+			if (rc)
+				return rc;
+			if (pb->pb_wlen >= MDB_WBUF && (rc = mdb_env_pcwrite(pc, pb)))
+				return rc;
+			mo = (MDB_page *)(pb->pb_buf + pb->pb_wlen);
+			memcpy(mo, omp, env->me_psize);
+			mo->mp_pgno = pc->pc_next_pgno;
+			memcpy(NODEDATA(ni), &pc->pc_next_pgno, sizeof(pgno_t));
+			pc->pc_next_pgno += omp->mp_pages;
+			pb->pb_wlen += env->me_psize;
+			if (omp->mp_pages > 1) {
+				pb->pb_olen = env->me_psize * (omp->mp_pages - 1);
+				pb->pb_over = (char *)omp + env->me_psize;
+				if ((rc = mdb_env_pcwrite(pc, pb)))
+					return rc;
+			}
+		}
+	}
+	if (pb->pb_wlen >= MDB_WBUF && (rc = mdb_env_pcwrite(pc, pb)))
+		return rc;
+	mo = (MDB_page *)(pb->pb_buf + pb->pb_wlen);
+	memcpy(mo, mp, env->me_psize);
+	mo->mp_pgno = pc->pc_next_pgno++;
+	pb->pb_wlen += env->me_psize;
+	*pg = mo->mp_pgno;
+	return MDB_SUCCESS;
+}
+
+	/** Writer thread for a parallel compacting copy.
+	 *	Writes the meta pages, then the subtrees in order as their
+	 *	buffers get filled, then the pages above them.
+	 */
+static THREAD_RET ESECT CALL_CONV
+mdb_env_pcwriter(void *arg)
+{
+	mdb_pcopy *pc = arg;
+	mdb_pcsub *sub;
+	mdb_pcbuf *pb;
+	pgno_t root;
+	int rc;
+#ifdef SIGPIPE
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGPIPE);
+	if ((rc = pthread_sigmask(SIG_BLOCK, &set, NULL)) != 0)
+		goto fail;
+#endif
+
+	if ((rc = mdb_env_pcwrite(pc, pc->pc_wbuf)) != 0)
+		goto fail;
+
+	pthread_mutex_lock(&pc->pc_mutex);
+	for (; pc->pc_head < pc->pc_nsubs; pc->pc_head++) {
+		sub = &pc->pc_subs[pc->pc_head];
+		sub->ps_base = pc->pc_next_pgno;
+		/* Its walker may be waiting to become the head */
+		pthread_cond_broadcast(&pc->pc_cond);
+		for (;;) {
+			if (pc->pc_error) {
+				pthread_mutex_unlock(&pc->pc_mutex);
+				return (THREAD_RET)0;
+			}
+			if ((pb = sub->ps_head) != NULL) {
+				if ((sub->ps_head = pb->pb_next) == NULL)
+					sub->ps_tail = &sub->ps_head;
+				sub->ps_nbufs--;
+				pthread_mutex_unlock(&pc->pc_mutex);
+				mdb_env_pcreloc(pc, pb, sub->ps_base);
+				rc = mdb_env_pcwrite(pc, pb);
+				pthread_mutex_lock(&pc->pc_mutex);
+				pb->pb_next = pc->pc_free;
+				pc->pc_free = pb;
+				pthread_cond_broadcast(&pc->pc_cond);
+				if (rc) {
+					pthread_mutex_unlock(&pc->pc_mutex);
+					goto fail;
+				}
+			} else if (sub->ps_done) {
+				break;
+			} else {
+				pthread_cond_wait(&pc->pc_cond, &pc->pc_mutex);
+			}
+		}
+		pc->pc_next_pgno += sub->ps_count;
+	}
+	pthread_mutex_unlock(&pc->pc_mutex);
+
+	if (pc->pc_root) {
+		rc = mdb_env_pcemit(pc, pc->pc_root, &root);
+		if (rc == MDB_SUCCESS)
+			rc = mdb_env_pcwrite(pc, pc->pc_wbuf);
+		if (rc == MDB_SUCCESS && root != pc->pc_last)
+			rc = MDB_INCOMPATIBLE;	/* page leak or corrupt DB */
+		if (rc)
+			goto fail;
+	}
+	return (THREAD_RET)0;
+
+fail:
+	pthread_mutex_lock(&pc->pc_mutex);
+	if (!pc->pc_error)
+		pc->pc_error = rc;
+	pthread_cond_broadcast(&pc->pc_cond);
+	pthread_mutex_unlock(&pc->pc_mutex);
+	return (THREAD_RET)0;
+}
+
+	/** Split a tree into subtrees for a parallel copy.
+	 *	Branch pages are kept in memory until they are down to about
+	 *	#MDB_CPTASK pages per subtree. Leaves of the main DB are kept
+	 *	too, so that each named DB in them is split in turn.
+	 * @param[in] pc control structure.
+	 * @param[in] pg the root of the tree.
+	 * @param[in] want the number of subtrees wanted for the tree.
+	 * @param[in] flags #F_SUBDATA for the main DB, #F_DUPDATA for a
+	 *	sorted-duplicate sub-DB.
+	 * @param[out] ref the subtree (>0) or page (<0) for \b pg.
+	 * @return 0 on success, non-zero on failure.
+	 */
+static int ESECT
+mdb_env_pcplan(mdb_pcopy *pc, pgno_t pg, pgno_t want, int flags, int *ref)
+{
+	MDB_env *env = pc->pc_env;
+	MDB_cursor mc = {0};
+	MDB_page *mp;
+	MDB_node *ni;
+	MDB_db db;
+	pgno_t npages;
+	unsigned int i, n, x;
+	int kid, rc;
+
+	mc.mc_txn = pc->pc_txn;
+	rc = mdb_page_get(&mc, pg, &mp, NULL);
+	if (rc)
+		return rc;
+
+	if (want <= 1 || (IS_LEAF(mp) && !(flags & F_SUBDATA))) {
+		mdb_pcsub *sub;
+		if (pc->pc_nsubs == pc->pc_maxsubs) {
+			x = pc->pc_maxsubs ? pc->pc_maxsubs * 2 : 64;
+			sub = realloc(pc->pc_subs, x * sizeof(mdb_pcsub));
+			if (!sub)
+				return ENOMEM;
+			pc->pc_subs = sub;
+			pc->pc_maxsubs = x;
+		}
+		sub = &pc->pc_subs[pc->pc_nsubs++];
+		memset(sub, 0, sizeof(*sub));
+		sub->ps_pgno = pg;
+		sub->ps_flags = flags & F_DUPDATA;
+		*ref = pc->pc_nsubs;
+		return MDB_SUCCESS;
+	}
+
+	if (pc->pc_ntops == pc->pc_maxtops) {
+		mdb_pctop *top;
+		x = pc->pc_maxtops ? pc->pc_maxtops * 2 : 64;
+		top = realloc(pc->pc_tops, x * sizeof(mdb_pctop));
+		if (!top)
+			return ENOMEM;
+		pc->pc_tops = top;
+		pc->pc_maxtops = x;
+	}
+	x = pc->pc_ntops;
+	n = NUMKEYS(mp);
+	pc->pc_tops[x].pt_page = malloc(env->me_psize);
+	pc->pc_tops[x].pt_kids = calloc(n ? n : 1, sizeof(int));
+	if (!pc->pc_tops[x].pt_page || !pc->pc_tops[x].pt_kids) {
+		free(pc->pc_tops[x].pt_page);
+		free(pc->pc_tops[x].pt_kids);
+		return ENOMEM;
+	}
+	mdb_page_copy(pc->pc_tops[x].pt_page, mp, env->me_psize);
+	pc->pc_ntops++;
+
+	for (i=0; i<n; i++) {
+		ni = NODEPTR(mp, i);
+		if (IS_BRANCH(mp)) {
+			rc = mdb_env_pcplan(pc, NODEPGNO(ni), (want - 1) / n + 1, flags, &kid);
+		} else if (ni->mn_flags & F_SUBDATA) {
+			memcpy(&db, NODEDATA(ni), sizeof(db));
+			if (db.md_root == P_INVALID)
+				continue;
+			if (ni->mn_flags & F_DUPDATA) {
+				/* Sorted-duplicate sub-DB of a DUPSORT main DB */
+				rc = mdb_env_pcplan(pc, db.md_root, 1, F_DUPDATA, &kid);
+			} else {
+				npages = db.md_branch_pages + db.md_leaf_pages +
+					db.md_overflow_pages;
+				rc = mdb_env_pcplan(pc, db.md_root, npages / MDB_CPTASK + 1, 0, &kid);
+			}
+		} else {
+			continue;
+		}
+		if (rc)
+			return rc;
+		pc->pc_tops[x].pt_kids[i] = kid;
+	}
+	*ref = -(int)(x + 1);
+	return MDB_SUCCESS;
+}
+
+	/** Copy environment with compaction, using several threads. */
+static int ESECT
+mdb_env_pcopy(MDB_env *env, HANDLE fd, unsigned int flags, int nthreads)
+{
+	mdb_pcopy pc = {0};
+	MDB_txn *txn = NULL;
+	MDB_db *db;
+	mdb_pcbuf *pb;
+	pthread_t *thr = NULL, wthr;
+	pgno_t npages;
+	unsigned int i;
+	int rc, n = 0;
+
+	if ((rc = pthread_mutex_init(&pc.pc_mutex, NULL)) != 0)
+		return rc;
+	if ((rc = pthread_cond_init(&pc.pc_cond, NULL)) != 0)
+		goto done2;
+	pc.pc_env = env;
+	pc.pc_fd = fd;
+
+	rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+	if (rc)
+		goto done;
+	pc.pc_txn = txn;
+
+	if ((rc = mdb_env_pcbuf(&pc, NULL, &pc.pc_wbuf)) != 0)
+		goto done;
+	rc = mdb_env_cmeta(txn, flags, pc.pc_wbuf->pb_buf, &pc.pc_last);
+	if (rc)
+		goto done;
+	pc.pc_wbuf->pb_wlen = env->me_psize * NUM_METAS;
+	pc.pc_next_pgno = NUM_METAS;
+
+	db = &txn->mt_dbs[MAIN_DBI];
+	if (db->md_root != P_INVALID) {
+		/* Keep all pages of a small main DB in memory, its named DBs
+		 * are usually what needs to be split.
+		 */
+		npages = db->md_branch_pages + db->md_leaf_pages + db->md_overflow_pages;
+		rc = mdb_env_pcplan(&pc, db->md_root,
+			npages > MDB_CPTASK ? npages / MDB_CPTASK + 1 : (pgno_t)-1,
+			F_SUBDATA, &pc.pc_root);
+		if (rc)
+			goto done;
+	}
+	for (i=0; i<pc.pc_nsubs; i++)
+		pc.pc_subs[i].ps_tail = &pc.pc_subs[i].ps_head;
+
+	if ((unsigned int)nthreads > pc.pc_nsubs)
+		nthreads = pc.pc_nsubs ? pc.pc_nsubs : 1;
+	pc.pc_maxbufs = nthreads * MDB_CPQUEUE;
+	if ((thr = malloc(nthreads * sizeof(pthread_t))) == NULL) {
+		rc = ENOMEM;
+		goto done;
+	}
+	if ((rc = THREAD_CREATE(wthr, mdb_env_pcwriter, &pc)) != 0)
+		goto done;
+	/* This thread walks subtrees too */
+	for (n=0; n<nthreads-1; n++) {
+		if ((rc = THREAD_CREATE(thr[n], mdb_env_pcwalk, &pc)) != 0) {
+			pthread_mutex_lock(&pc.pc_mutex);
+			pc.pc_error = rc;
+			pthread_cond_broadcast(&pc.pc_cond);
+			pthread_mutex_unlock(&pc.pc_mutex);
+			break;
+		}
+	}
+	mdb_env_pcwalk(&pc);
+	while (n > 0)
+		THREAD_FINISH(thr[--n]);
+	THREAD_FINISH(wthr);
+	rc = pc.pc_error;
+
+done:
+	mdb_txn_abort(txn);
+	free(thr);
+	for (i=0; i<pc.pc_ntops; i++) {
+		free(pc.pc_tops[i].pt_page);
+		free(pc.pc_tops[i].pt_kids);
+	}
+	free(pc.pc_tops);
+	free(pc.pc_subs);
+	while ((pb = pc.pc_bufs) != NULL) {
+		pc.pc_bufs = pb->pb_link;
+		free(pb->pb_buf);
+		free(pb);
+	}
+	pthread_cond_destroy(&pc.pc_cond);
+done2:
+	pthread_mutex_destroy(&pc.pc_mutex);
+	return rc;
+}
+#endif /* !_WIN32 */
+
+	/** Copy environment as-is. */
+static int ESECT
+mdb_env_copyfd0(MDB_env *env, HANDLE fd)
+{
+	MDB_txn *txn = NULL;
+	mdb_mutexref_t wmutex = NULL;
+	int rc;
+	size_t wsize, w3;
+	char *ptr;
+#ifdef _WIN32
+	DWORD len, w2;
+#define DO_WRITE(rc, fd, ptr, w2, len)	rc = WriteFile(fd, ptr, w2, &len, NULL)
+#else
+	ssize_t len;
+	size_t w2;
+#define DO_WRITE(rc, fd, ptr, w2, len)	len = write(fd, ptr, w2); rc = (len >= 0)
+#endif
+
+	/* Do the lock/unlock of the reader mutex before starting the
+	 * write txn.  Otherwise other read txns could block writers.
+	 */
+	rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+	if (rc)
+		return rc;
+
+	if (env->me_txns) {
+		/* We must start the actual read txn after blocking writers */
+		mdb_txn_end(txn, MDB_END_RESET_TMP);
+
+		/* Temporarily block writers until we snapshot the meta pages */
+		wmutex = env->me_wmutex;
+		if (LOCK_MUTEX(rc, env, wmutex))
+			goto leave;
+
+		rc = mdb_txn_renew0(txn, NULL);
+		if (rc) {
+			UNLOCK_MUTEX(wmutex);
+			goto leave;
+		}
+	}
+
+	wsize = env->me_psize * NUM_METAS;
+	ptr = env->me_map;
+	w2 = wsize;
+	while (w2 > 0) {
+		DO_WRITE(rc, fd, ptr, w2, len);
+		if (!rc) {
+			rc = ErrCode();
+			break;
+		} else if (len > 0) {
+			rc = MDB_SUCCESS;
+			ptr += len;
+			w2 -= len;
+			continue;
+		} else {
+			/* Non-blocking or async handles are not supported */
+			rc = EIO;
+			break;
+		}
+	}
+	if (wmutex)
+		UNLOCK_MUTEX(wmutex);
+
+	if (rc)
+		goto leave;
+
+	w3 = txn->mt_next_pgno * env->me_psize;
+	{
+		size_t fsize = 0;
+		if ((rc = mdb_fsize(env->me_fd, &fsize)))
+			goto leave;
+		if (w3 > fsize)
+			w3 = fsize;
+	}
+	wsize = w3 - wsize;
+	while (wsize > 0) {
+		if (wsize > MAX_WRITE)
+			w2 = MAX_WRITE;
+		else
+			w2 = wsize;
+		DO_WRITE(rc, fd, ptr, w2, len);
+		if (!rc) {
+			rc = ErrCode();
+			break;
+		} else if (len > 0) {
+			rc = MDB_SUCCESS;
+			ptr += len;
+			wsize -= len;
+			continue;
+		} else {
+			rc = EIO;
+			break;
+		}
+	}
+
+leave:
+	mdb_txn_abort(txn);
+	return rc;
+}
+
+int ESECT
+mdb_env_copyfd2(MDB_env *env, HANDLE fd, unsigned int flags)
+{
+	if (flags & MDB_CP_COMPACT)
+		return mdb_env_copyfd1(env, fd, flags);
+	else if (flags & MDB_CP_EXTFREE)
+		return EINVAL;	/* only a compacted copy can change the format */
+	else
+		return mdb_env_copyfd0(env, fd);
+}
+
+int ESECT
+mdb_env_copyfd3(MDB_env *env, HANDLE fd, unsigned int flags, int nthreads)
+{
+#ifndef _WIN32
+	if ((flags & MDB_CP_COMPACT) && nthreads > 1)
+		return mdb_env_pcopy(env, fd, flags, nthreads);
+#endif
+	return mdb_env_copyfd2(env, fd, flags);
+}
+
+int ESECT
+mdb_env_copyfd(MDB_env *env, HANDLE fd)
+{
+	return mdb_env_copyfd2(env, fd, 0);
+}
+
+int ESECT
+mdb_env_copy2(MDB_env *env, const char *path, unsigned int flags)
+{
+	return mdb_env_copy3(env, path, flags, 1);
+}
+
+int ESECT
+mdb_env_copy3(MDB_env *env, const char *path, unsigned int flags, int nthreads)
+{
+	int rc;
+	MDB_name fname;
+	HANDLE newfd = INVALID_HANDLE_VALUE;
+
+	rc = mdb_fname_init(path, env->me_flags | MDB_NOLOCK, &fname);
+	if (rc == MDB_SUCCESS) {
+		rc = mdb_fopen(env, &fname, MDB_O_COPY, 0666, &newfd);
+		mdb_fname_destroy(fname);
+	}
+	if (rc == MDB_SUCCESS) {
+		rc = mdb_env_copyfd3(env, newfd, flags, nthreads);
+		if (close(newfd) < 0 && rc == MDB_SUCCESS)
+			rc = ErrCode();
+	}
+	return rc;
+}
+
+int ESECT
+mdb_env_copy(MDB_env *env, const char *path)
+{
+	return mdb_env_copy2(env, path, 0);
+}
+
+/** @defgroup delta	Incremental copies
+ *	A delta holds the pages of a snapshot which differ from an
+ *	as-is copy, so applying it to that copy brings the copy up
+ *	to the snapshot. It starts with an #MDB_dhead, followed by
+ *	runs of pages, each preceded by an #MDB_drun. The run holding
+ *	the new meta page comes last, and an empty run ends the delta.
+ *	@{
+ */
+	/** Stamp identifying a delta written by #mdb_env_delta() */
+#define MDB_DMAGIC	0xBEEFDE17
+
+	/** Header of a delta */
+typedef struct MDB_dhead {
+	uint32_t	dh_magic;		/**< #MDB_DMAGIC */
+	uint32_t	dh_psize;		/**< page size of both environments */
+	txnid_t		dh_base;		/**< txnid of the copy it applies to */
+	txnid_t		dh_txnid;		/**< txnid of the snapshot it holds */
+} MDB_dhead;
+
+	/** A run of consecutive pages in a delta */
+typedef struct MDB_drun {
+	pgno_t		dr_pgno;		/**< first page of the run */
+	pgno_t		dr_count;		/**< number of pages, 0 at the end */
+} MDB_drun;
+
+	/** State of #mdb_env_delta() */
+typedef struct mdb_delta {
+	MDB_txn		*md_txn;		/**< the snapshot being written */
+	char		*md_base;		/**< map of the earlier copy */
+	pgno_t		md_bpages;		/**< pages of the earlier copy to compare */
+	HANDLE		md_fd;
+	char		*md_buf;		/**< #MDB_WBUF bytes of output */
+	size_t		md_wlen;
+	MDB_drun	*md_run;		/**< the last run in md_buf, if any */
+} mdb_delta;
+
+	/** Write a whole buffer to a file or pipe. */
+static int ESECT
+mdb_fd_write(HANDLE fd, const char *ptr, size_t len)
+{
+	int rc;
+#ifdef _WIN32
+	DWORD n, w2;
+#else
+	ssize_t n;
+	size_t w2;
+#endif
+
+	while (len > 0) {
+		w2 = len > MAX_WRITE ? MAX_WRITE : len;
+#ifdef _WIN32
+		rc = WriteFile(fd, ptr, w2, &n, NULL);
+#else
+		n = write(fd, ptr, w2);
+		rc = n >= 0;
+#endif
+		if (!rc)
+			return ErrCode();
+		if (n == 0)
+			return EIO;	/* Non-blocking or async handles are not supported */
+		ptr += n;
+		len -= n;
+	}
+	return MDB_SUCCESS;
+}
+
+	/** Fill a buffer from a file or pipe. */
+static int ESECT
+mdb_fd_read(HANDLE fd, char *ptr, size_t len)
+{
+	int rc;
+#ifdef _WIN32
+	DWORD n;
+#else
+	ssize_t n;
+#endif
+
+	while (len > 0) {
+#ifdef _WIN32
+		rc = ReadFile(fd, ptr, len > MAX_WRITE ? MAX_WRITE : len, &n, NULL);
+		if (!rc && ErrCode() == ERROR_BROKEN_PIPE)
+			rc = 1, n = 0;
+#else
+		n = read(fd, ptr, len > MAX_WRITE ? MAX_WRITE : len);
+		rc = n >= 0;
+#endif
+		if (!rc)
+			return ErrCode();
+		if (n == 0)
+			return MDB_INVALID;	/* truncated */
+		ptr += n;
+		len -= n;
+	}
+	return MDB_SUCCESS;
+}
+
+	/** Write a whole buffer at the given offset of a file. */
+static int ESECT
+mdb_fd_pwrite(HANDLE fd, const char *ptr, size_t len, size_t pos)
+{
+#ifdef _WIN32
+	DWORD n;
+	OVERLAPPED ov;
+#else
+	ssize_t n;
+#endif
+
+	while (len > 0) {
+#ifdef _WIN32
+		memset(&ov, 0, sizeof(ov));
+		ov.Offset = pos & 0xffffffff;
+		ov.OffsetHigh = pos >> 16 >> 16;
+		if (!WriteFile(fd, ptr, len > MAX_WRITE ? MAX_WRITE : len, &n, &ov))
+			return ErrCode();
+#else
+		n = pwrite(fd, ptr, len > MAX_WRITE ? MAX_WRITE : len, pos);
+		if (n < 0)
+			return ErrCode();
+#endif
+		if (n == 0)
+			return EIO;
+		ptr += n;
+		len -= n;
+		pos += n;
+	}
+	return MDB_SUCCESS;
+}
+
+	/** Add pages of the snapshot to a delta, unless the earlier
+	 *	copy has the same pages already.
+	 * @param[in] md the delta being written.
+	 * @param[in] pg the number of the first page.
+	 * @param[in] mp the first page.
+	 * @param[in] count the number of pages, more than 1 for overflow pages.
+	 * @return 0 on success, non-zero on failure.
+	 */
+static int ESECT
+mdb_env_demit(mdb_delta *md, pgno_t pg, MDB_page *mp, pgno_t count)
+{
+	size_t psize = md->md_txn->mt_env->me_psize;
+	size_t len = psize * count;
+	MDB_drun *dr = md->md_run;
+	int rc;
+
+	if (pg + count <= md->md_bpages &&
+		!memcmp(md->md_base + psize * pg, mp, len))
+		return MDB_SUCCESS;
+
+	/* Extend the last run if this follows it, else start a new one */
+	if (!dr || dr->dr_pgno + dr->dr_count != pg ||
+		md->md_wlen + len > MDB_WBUF) {
+		if (md->md_wlen + sizeof(MDB_drun) + len > MDB_WBUF) {
+			rc = mdb_fd_write(md->md_fd, md->md_buf, md->md_wlen);
+			if (rc)
+				return rc;
+			md->md_wlen = 0;
+		}
+		dr = (MDB_drun *)(md->md_buf + md->md_wlen);
+		dr->dr_pgno = pg;
+		dr->dr_count = 0;
+		md->md_wlen += sizeof(MDB_drun);
+		md->md_run = dr;
+	}
+	dr->dr_count += count;
+	if (md->md_wlen + len > MDB_WBUF) {
+		/* Long overflow runs go straight from the map */
+		md->md_run = NULL;
+		rc = mdb_fd_write(md->md_fd, md->md_buf, md->md_wlen);
+		md->md_wlen = 0;
+		if (rc == MDB_SUCCESS)
+			rc = mdb_fd_write(md->md_fd, (char *)mp, len);
+		return rc;
+	}
+	memcpy(md->md_buf + md->md_wlen, mp, len);
+	md->md_wlen += len;
+	return MDB_SUCCESS;
+}
+
+	/** Add a tree of the snapshot to a delta.
+	 * @param[in] md the delta being written.
+	 * @param[in] pg the root of the tree.
+	 * @param[in] flags #F_DUPDATA for a tree of sorted duplicates.
+	 * @return 0 on success, non-zero on failure.
+	 */
+static int ESECT
+mdb_env_dwalk(mdb_delta *md, pgno_t pg, int flags)
+{
+	MDB_cursor mc = {0};
+	MDB_page *mp, *omp;
+	MDB_node *ni;
+	MDB_db db;
+	unsigned int i, n;
+	int rc;
+
+	if (pg == P_INVALID)
+		return MDB_SUCCESS;
+	mc.mc_txn = md->md_txn;
+	if ((rc = mdb_page_get(&mc, pg, &mp, NULL)) != MDB_SUCCESS ||
+		(rc = mdb_env_demit(md, pg, mp, 1)) != MDB_SUCCESS)
+		return rc;
+
+	n = NUMKEYS(mp);
+	if (IS_BRANCH(mp)) {
+		for (i=0; i<n; i++) {
+			rc = mdb_env_dwalk(md, NODEPGNO(NODEPTR(mp, i)), flags);
+			if (rc)
+				return rc;
+		}
+	} else if (!IS_LEAF2(mp) && !(flags & F_DUPDATA)) {
+		for (i=0; i<n; i++) {
+			ni = NODEPTR(mp, i);
+			if (ni->mn_flags & F_BIGDATA) {
+				memcpy(&pg, NODEDATA(ni), sizeof(pg));
+				if ((rc = mdb_page_get(&mc, pg, &omp, NULL)) != MDB_SUCCESS ||
+					(rc = mdb_env_demit(md, pg, omp, omp->mp_pages)) != MDB_SUCCESS)
+					return rc;
+			} else if (ni->mn_flags & F_SUBDATA) {
+				memcpy(&db, NODEDATA(ni), sizeof(db));
+				rc = mdb_env_dwalk(md, db.md_root, ni->mn_flags & F_DUPDATA);
+				if (rc)
+					return rc;
+			}
+		}
+	}
+	return MDB_SUCCESS;
+}
+
+int ESECT
+mdb_env_delta(MDB_env *env, MDB_env *base, HANDLE fd)
+{
+	mdb_delta md = {0};
+	MDB_txn *txn = NULL;
+	MDB_meta *mm;
+	MDB_dhead *dh;
+	MDB_drun *dr;
+	MDB_page *mp;
+	size_t fsize = 0;
+	int rc;
+
+	if (!env || !base || !base->me_map)
+		return EINVAL;
+	if (base->me_psize != env->me_psize)
+		return MDB_INCOMPATIBLE;
+
+	/* The copy may be shorter than its last page, if the
+	 * freeDB lists the final pages.
+	 */
+	if ((rc = mdb_fsize(base->me_fd, &fsize)) != MDB_SUCCESS)
+		return rc;
+	mm = mdb_env_pick_meta(base);
+	md.md_base = base->me_map;
+	md.md_bpages = mm->mm_last_pg + 1;
+	if (md.md_bpages > fsize / base->me_psize)
+		md.md_bpages = fsize / base->me_psize;
+	md.md_fd = fd;
+	if ((md.md_buf = malloc(MDB_WBUF)) == NULL)
+		return ENOMEM;
+
+	rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+	if (rc)
+		goto leave;
+	md.md_txn = txn;
+
+	dh = (MDB_dhead *)md.md_buf;
+	dh->dh_magic = MDB_DMAGIC;
+	dh->dh_psize = env->me_psize;
+	dh->dh_base = mm->mm_txnid;
+	dh->dh_txnid = txn->mt_txnid;
+	md.md_wlen = sizeof(MDB_dhead);
+
+	rc = mdb_env_dwalk(&md, txn->mt_dbs[FREE_DBI].md_root, 0);
+	if (rc == MDB_SUCCESS)
+		rc = mdb_env_dwalk(&md, txn->mt_dbs[MAIN_DBI].md_root, 0);
+	if (rc == MDB_SUCCESS && md.md_wlen)
+		rc = mdb_fd_write(fd, md.md_buf, md.md_wlen);
+	if (rc)
+		goto leave;
+
+	/* The meta page of the snapshot, in the slot a commit would use */
+	dr = (MDB_drun *)md.md_buf;
+	dr->dr_pgno = txn->mt_txnid & 1;
+	dr->dr_count = 1;
+	mp = (MDB_page *)(dr + 1);
+	memset(mp, 0, env->me_psize);
+	mp->mp_pgno = dr->dr_pgno;
+	mp->mp_flags = P_META;
+	mm = (MDB_meta *)METADATA(mp);
+	mdb_env_init_meta0(env, mm);
+	mm->mm_address = env->me_metas[0]->mm_address;
+	mm->mm_dbs[FREE_DBI] = txn->mt_dbs[FREE_DBI];
+	mm->mm_dbs[MAIN_DBI] = txn->mt_dbs[MAIN_DBI];
+	mm->mm_last_pg = txn->mt_next_pgno - 1;
+	mm->mm_txnid = txn->mt_txnid;
+	dr = (MDB_drun *)((char *)mp + env->me_psize);
+	dr->dr_pgno = 0;
+	dr->dr_count = 0;
+	rc = mdb_fd_write(fd, md.md_buf, (char *)(dr + 1) - md.md_buf);
+
+leave:
+	mdb_txn_abort(txn);
+	free(md.md_buf);
+	return rc;
+}
+
+int ESECT
+mdb_env_apply(MDB_env *env, HANDLE fd)
+{
+	MDB_dhead dh;
+	MDB_drun dr;
+	MDB_page *meta = NULL;
+	txnid_t txnid;
+	char *buf;
+	size_t psize, bsize, len, n, pos;
+	int rc;
+
+	if (!env || !env->me_map)
+		return EINVAL;
+	if (env->me_flags & MDB_RDONLY)
+		return EACCES;
+	psize = env->me_psize;
+
+	if ((rc = mdb_fd_read(fd, (char *)&dh, sizeof(dh))) != MDB_SUCCESS)
+		return rc;
+	if (dh.dh_magic != MDB_DMAGIC)
+		return MDB_INVALID;
+	txnid = mdb_env_pick_meta(env)->mm_txnid;
+	if (dh.dh_psize != psize ||
+		(txnid != dh.dh_base && txnid != dh.dh_txnid))
+		return MDB_INCOMPATIBLE;
+
+	/* Whole pages, and the meta page at the end */
+	bsize = MDB_WBUF - MDB_WBUF % psize;
+	if ((buf = malloc(bsize + psize)) == NULL)
+		return ENOMEM;
+
+	while ((rc = mdb_fd_read(fd, (char *)&dr, sizeof(dr))) == MDB_SUCCESS &&
+		dr.dr_count) {
+		if (dr.dr_pgno < NUM_METAS) {
+			/* The meta page goes last, after the pages it refers to */
+			if (dr.dr_count != 1 || meta) {
+				rc = MDB_INVALID;
+				break;
+			}
+			meta = (MDB_page *)(buf + bsize);
+			if ((rc = mdb_fd_read(fd, (char *)meta, psize)) != MDB_SUCCESS)
+				break;
+			if (meta->mp_pgno != dr.dr_pgno || !F_ISSET(meta->mp_flags, P_META) ||
+				((MDB_meta *)METADATA(meta))->mm_magic != MDB_MAGIC ||
+				((MDB_meta *)METADATA(meta))->mm_txnid != dh.dh_txnid) {
+				rc = MDB_INVALID;
+				break;
+			}
+			continue;
+		}
+		pos = psize * dr.dr_pgno;
+		for (n = psize * dr.dr_count; n > 0; n -= len) {
+			len = n < bsize ? n : bsize;
+			if ((rc = mdb_fd_read(fd, buf, len)) != MDB_SUCCESS ||
+				(rc = mdb_fd_pwrite(env->me_fd, buf, len, pos)) != MDB_SUCCESS)
+				goto leave;
+			pos += len;
+		}
+	}
+	if (rc == MDB_SUCCESS && !meta)
+		rc = MDB_INVALID;
+	if (rc == MDB_SUCCESS && MDB_FDATASYNC(env->me_fd))
+		rc = ErrCode();
+	if (rc == MDB_SUCCESS)
+		rc = mdb_fd_pwrite(env->me_fd, (char *)meta, psize, psize * meta->mp_pgno);
+	if (rc == MDB_SUCCESS && MDB_FDATASYNC(env->me_fd))
+		rc = ErrCode();
+
+leave:
+	free(buf);
+	return rc;
+}
+/** @} */
+
+int ESECT
+mdb_env_set_flags(MDB_env *env, unsigned int flag, int onoff)
+{
+	if (flag & ~CHANGEABLE)
+		return EINVAL;
+	if (onoff)
+		env->me_flags |= flag;
+	else
+		env->me_flags &= ~flag;
+	return MDB_SUCCESS;
+}
+
+int ESECT
+mdb_env_get_flags(MDB_env *env, unsigned int *arg)
+{
+	if (!env || !arg)
+		return EINVAL;
+
+	*arg = env->me_flags & (CHANGEABLE|CHANGELESS);
+	return MDB_SUCCESS;
+}
+
+int ESECT
+mdb_env_set_userctx(MDB_env *env, void *ctx)
+{
+	if (!env)
+		return EINVAL;
+	env->me_userctx = ctx;
+	return MDB_SUCCESS;
+}
+
+void * ESECT
+mdb_env_get_userctx(MDB_env *env)
+{
+	return env ? env->me_userctx : NULL;
+}
+
+int ESECT
+mdb_env_set_assert(MDB_env *env, MDB_assert_func *func)
+{
+	if (!env)
+		return EINVAL;
+#ifndef NDEBUG
+	env->me_assert_func = func;
+#endif
+	return MDB_SUCCESS;
+}
+
+int ESECT
+mdb_env_get_path(MDB_env *env, const char **arg)
+{
+	if (!env || !arg)
+		return EINVAL;
+
+	*arg = env->me_path;
+	return MDB_SUCCESS;
+}
+
+int ESECT
+mdb_env_get_fd(MDB_env *env, mdb_filehandle_t *arg)
+{
+	if (!env || !arg)
+		return EINVAL;
+
+	*arg = env->me_fd;
+	return MDB_SUCCESS;
+}
+
+/** Common code for #mdb_stat() and #mdb_env_stat().
+ * @param[in] env the environment to operate in.
+ * @param[in] db the #MDB_db record containing the stats to return.
+ * @param[out] arg the address of an #MDB_stat structure to receive the stats.
+ * @return 0, this function always succeeds.
+ */
+static int ESECT
+mdb_stat0(MDB_env *env, MDB_db *db, MDB_stat *arg)
+{
+	arg->ms_psize = env->me_psize;
+	arg->ms_depth = db->md_depth;
+	arg->ms_branch_pages = db->md_branch_pages;
+	arg->ms_leaf_pages = db->md_leaf_pages;
+	arg->ms_overflow_pages = db->md_overflow_pages;
+	arg->ms_entries = db->md_entries;
+
+	return MDB_SUCCESS;
+}
+
+int ESECT
+mdb_env_stat(MDB_env *env, MDB_stat *arg)
+{
+	MDB_meta *meta;
+
+	if (env == NULL || arg == NULL)
+		return EINVAL;
+
+	meta = mdb_env_pick_meta(env);
+
+	return mdb_stat0(env, &meta->mm_dbs[MAIN_DBI], arg);
+}
+
+int ESECT
+mdb_env_info(MDB_env *env, MDB_envinfo *arg)
+{
+	MDB_meta *meta;
+
+	if (env == NULL || arg == NULL)
+		return EINVAL;
+
+	meta = mdb_env_pick_meta(env);
+	arg->me_mapaddr = meta->mm_address;
+	arg->me_last_pgno = meta->mm_last_pg;
+	arg->me_last_txnid = meta->mm_txnid;
+
+	arg->me_mapsize = env->me_mapsize;
+	arg->me_maxreaders = env->me_maxreaders;
+	arg->me_numreaders = env->me_txns ? env->me_txns->mti_numreaders : 0;
+	return MDB_SUCCESS;
+}
+
+/** Set the default comparison functions for a database.
+ * Called immediately after a database is opened to set the defaults.
+ * The user can then override them with #mdb_set_compare() or
+ * #mdb_set_dupsort().
+ * @param[in] txn A transaction handle returned by #mdb_txn_begin()
+ * @param[in] dbi A database handle returned by #mdb_dbi_open()
+ */
+static void
+mdb_default_cmp(MDB_txn *txn, MDB_dbi dbi)
+{
+	uint16_t f = txn->mt_dbs[dbi].md_flags;
+
+	txn->mt_dbxs[dbi].md_cmp =
+		(f & MDB_REVERSEKEY) ? mdb_cmp_memnr :
+		(f & MDB_INTEGERKEY) ? mdb_cmp_cint  : mdb_cmp_memn;
+
+	txn->mt_dbxs[dbi].md_dcmp =
+		!(f & MDB_DUPSORT) ? 0 :
+		((f & MDB_INTEGERDUP)
+		 ? ((f & MDB_DUPFIXED)   ? mdb_cmp_int   : mdb_cmp_cint)
+		 : ((f & MDB_REVERSEDUP) ? mdb_cmp_memnr : mdb_cmp_memn));
 }
 
-int ESECT
-mdb_env_copy(MDB_env *env, const char *path)
-{
-	return mdb_env_copy2(env, path, 0);
+int mdb_dbi_open(MDB_txn *txn, const char *name, unsigned int flags, MDB_dbi *dbi)
+{
+	MDB_val key, data;
+	MDB_dbi i;
+	MDB_cursor mc;
+	MDB_db dummy;
+	int rc, dbflag, exact;
+	unsigned int unused = 0, seq;
+	char *namedup;
+	size_t len;
+
+	if (flags & ~VALID_FLAGS)
+		return EINVAL;
+	if (txn->mt_flags & MDB_TXN_BLOCKED)
+		return MDB_BAD_TXN;
+	/* Key prefixes are only shared by keys in string order */
+	if ((flags & MDB_PREFIXKEYS) && (flags & (MDB_REVERSEKEY|MDB_INTEGERKEY)))
+		return EINVAL;
+	if ((flags & MDB_PREFIXKEYS) && ENV_MAXKEY(txn->mt_env) > MDB_KBUFSIZE)
+		return MDB_INCOMPATIBLE;
+
+	/* main DB? */
+	if (!name) {
+		*dbi = MAIN_DBI;
+		if (flags & PERSISTENT_FLAGS) {
+			uint16_t f2 = flags & PERSISTENT_FLAGS;
+			unsigned int f3 = txn->mt_dbs[MAIN_DBI].md_flags | f2;
+			if ((f3 & MDB_PREFIXKEYS) && (f3 & (MDB_REVERSEKEY|MDB_INTEGERKEY)))
+				return EINVAL;
+			/* make sure flag changes get committed */
+			if ((txn->mt_dbs[MAIN_DBI].md_flags | f2) != txn->mt_dbs[MAIN_DBI].md_flags) {
+				txn->mt_dbs[MAIN_DBI].md_flags |= f2;
+				txn->mt_flags |= MDB_TXN_DIRTY;
+			}
+		}
+		mdb_default_cmp(txn, MAIN_DBI);
+		return MDB_SUCCESS;
+	}
+
+	if (txn->mt_dbxs[MAIN_DBI].md_cmp == NULL) {
+		mdb_default_cmp(txn, MAIN_DBI);
+	}
+
+	/* Is the DB already open? */
+	len = strlen(name);
+	for (i=CORE_DBS; i<txn->mt_numdbs; i++) {
+		if (!txn->mt_dbxs[i].md_name.mv_size) {
+			/* Remember this free slot */
+			if (!unused) unused = i;
+			continue;
+		}
+		if (len == txn->mt_dbxs[i].md_name.mv_size &&
+			!strncmp(name, txn->mt_dbxs[i].md_name.mv_data, len)) {
+			*dbi = i;
+			return MDB_SUCCESS;
+		}
+	}
+
+	/* If no free slot and max hit, fail */
+	if (!unused && txn->mt_numdbs >= txn->mt_env->me_maxdbs)
+		return MDB_DBS_FULL;
+
+	/* Cannot mix named databases with some mainDB flags */
+	if (txn->mt_dbs[MAIN_DBI].md_flags & (MDB_DUPSORT|MDB_INTEGERKEY))
+		return (flags & MDB_CREATE) ? MDB_INCOMPATIBLE : MDB_NOTFOUND;
+
+	/* Find the DB info */
+	dbflag = DB_NEW|DB_VALID|DB_USRVALID;
+	exact = 0;
+	key.mv_size = len;
+	key.mv_data = (void *)name;
+	mdb_cursor_init(&mc, txn, MAIN_DBI, NULL);
+	rc = mdb_cursor_set(&mc, &key, &data, MDB_SET, &exact);
+	if (rc == MDB_SUCCESS) {
+		/* make sure this is actually a DB */
+		MDB_node *node = NODEPTR(mc.mc_pg[mc.mc_top], mc.mc_ki[mc.mc_top]);
+		if ((node->mn_flags & (F_DUPDATA|F_SUBDATA)) != F_SUBDATA)
+			return MDB_INCOMPATIBLE;
+	} else {
+		if (rc != MDB_NOTFOUND || !(flags & MDB_CREATE))
+			return rc;
+		if (F_ISSET(txn->mt_flags, MDB_TXN_RDONLY))
+			return EACCES;
+	}
+
+	/* Done here so we cannot fail after creating a new DB */
+	if ((namedup = strdup(name)) == NULL)
+		return ENOMEM;
+
+	if (rc) {
+		/* MDB_NOTFOUND and MDB_CREATE: Create new DB */
+		data.mv_size = sizeof(MDB_db);
+		data.mv_data = &dummy;
+		memset(&dummy, 0, sizeof(dummy));
+		dummy.md_root = P_INVALID;
+		dummy.md_flags = flags & PERSISTENT_FLAGS;
+		WITH_CURSOR_TRACKING(mc,
+			rc = mdb_cursor_put(&mc, &key, &data, F_SUBDATA));
+		dbflag |= DB_DIRTY;
+	}
+
+	if (rc) {
+		free(namedup);
+	} else {
+		/* Got info, register DBI in this txn */
+		unsigned int slot = unused ? unused : txn->mt_numdbs;
+		txn->mt_dbxs[slot].md_name.mv_data = namedup;
+		txn->mt_dbxs[slot].md_name.mv_size = len;
+		txn->mt_dbxs[slot].md_rel = NULL;
+		txn->mt_dbflags[slot] = dbflag;
+		/* txn-> and env-> are the same in read txns, use
+		 * tmp variable to avoid undefined assignment
+		 */
+		seq = ++txn->mt_env->me_dbiseqs[slot];
+		txn->mt_dbiseqs[slot] = seq;
+
+		memcpy(&txn->mt_dbs[slot], data.mv_data, sizeof(MDB_db));
+		*dbi = slot;
+		mdb_default_cmp(txn, slot);
+		if (!unused) {
+			txn->mt_numdbs++;
+		}
+	}
+
+	return rc;
 }
 
 int ESECT
-mdb_env_set_flags(MDB_env *env, unsigned int flag, int onoff)
+mdb_stat(MDB_txn *txn, MDB_dbi dbi, MDB_stat *arg)
 {
-	if (flag & ~CHANGEABLE)
+	if (!arg || !TXN_DBI_EXIST(txn, dbi, DB_VALID))
 		return EINVAL;
-	if (onoff)
-		env->me_flags |= flag;
-	else
-		env->me_flags &= ~flag;
-	return MDB_SUCCESS;
+
+	if (txn->mt_flags & MDB_TXN_BLOCKED)
+		return MDB_BAD_TXN;
+
+	if (txn->mt_dbflags[dbi] & DB_STALE) {
+		MDB_cursor mc;
+		MDB_xcursor mx;
+		/* Stale, must read the DB's root. cursor_init does it for us. */
+		mdb_cursor_init(&mc, txn, dbi, &mx);
+	}
+	return mdb_stat0(txn->mt_env, &txn->mt_dbs[dbi], arg);
 }
 
-int ESECT
-mdb_env_get_flags(MDB_env *env, unsigned int *arg)
+/** Visit the pages of one tree for #mdb_page_walk().
+ * @param[in] mc A cursor for the database being walked.
+ * @param[in] pg The root page of the tree.
+ * @param[in] depth The level of \b pg in the tree.
+ * @param[in] sub #MDB_PG_DUPSORT in sorted-duplicate subtrees, else 0.
+ * @param[in] func The function to call for each page.
+ * @param[in] ctx The context pointer for \b func.
+ * @return 0 on success, non-zero on failure or from \b func.
+ */
+static int ESECT
+mdb_page_walk0(MDB_cursor *mc, pgno_t pg, unsigned int depth,
+	unsigned int sub, MDB_pgwalk_func *func, void *ctx)
 {
-	if (!env || !arg)
-		return EINVAL;
+	MDB_pginfo pi;
+	MDB_page *mp, *omp;
+	MDB_node *ni;
+	MDB_db db;
+	unsigned int i, n;
+	int rc;
 
-	*arg = env->me_flags & (CHANGEABLE|CHANGELESS);
+	if (pg == P_INVALID)
+		return MDB_SUCCESS;
+	if ((rc = mdb_page_get(mc, pg, &mp, NULL)) != MDB_SUCCESS)
+		return rc;
+
+	n = NUMKEYS(mp);
+	pi.pi_pgno = pg;
+	pi.pi_type = (IS_BRANCH(mp) ? MDB_PG_BRANCH : MDB_PG_LEAF) | sub;
+	pi.pi_depth = depth;
+	pi.pi_nkeys = n;
+	pi.pi_pages = 1;
+	pi.pi_used = mc->mc_txn->mt_env->me_psize - SIZELEFT(mp);
+	if ((rc = func(&pi, ctx)) != 0 || IS_LEAF2(mp))
+		return rc;
+
+	for (i=0; i<n; i++) {
+		ni = NODEPTR(mp, i);
+		if (IS_BRANCH(mp)) {
+			rc = mdb_page_walk0(mc, NODEPGNO(ni), depth+1, sub, func, ctx);
+		} else if (ni->mn_flags & F_BIGDATA) {
+			memcpy(&pg, NODEDATA(ni), sizeof(pg));
+			if ((rc = mdb_page_get(mc, pg, &omp, NULL)) != MDB_SUCCESS)
+				return rc;
+			pi.pi_pgno = pg;
+			pi.pi_type = MDB_PG_OVERFLOW | sub;
+			pi.pi_depth = depth+1;
+			pi.pi_nkeys = 0;
+			pi.pi_pages = omp->mp_pages;
+			pi.pi_used = PAGEHDRSZ + NODEDSZ(ni);
+			rc = func(&pi, ctx);
+		} else if ((ni->mn_flags & (F_DUPDATA|F_SUBDATA)) ==
+			(F_DUPDATA|F_SUBDATA)) {
+			memcpy(&db, NODEDATA(ni), sizeof(db));
+			rc = mdb_page_walk0(mc, db.md_root, 0, MDB_PG_DUPSORT, func, ctx);
+		}
+		if (rc)
+			return rc;
+	}
 	return MDB_SUCCESS;
 }
 
 int ESECT
-mdb_env_set_userctx(MDB_env *env, void *ctx)
+mdb_page_walk(MDB_txn *txn, MDB_dbi dbi, MDB_pgwalk_func *func, void *ctx)
 {
-	if (!env)
+	MDB_cursor mc;
+	MDB_xcursor mx;
+
+	if (!func || !TXN_DBI_EXIST(txn, dbi, DB_VALID))
 		return EINVAL;
-	env->me_userctx = ctx;
-	return MDB_SUCCESS;
+
+	if (txn->mt_flags & MDB_TXN_BLOCKED)
+		return MDB_BAD_TXN;
+
+	/* cursor_init reads the root of a stale DB */
+	mdb_cursor_init(&mc, txn, dbi, &mx);
+	return mdb_page_walk0(&mc, txn->mt_dbs[dbi].md_root, 0, 0, func, ctx);
 }
 
-void * ESECT
-mdb_env_get_userctx(MDB_env *env)
+/** @defgroup verify	Integrity checks
+ *	#mdb_env_verify() walks every tree of a snapshot, checking each page
+ *	against the tree structure, and marks the pages it finds in a bitmap.
+ *	Pages listed in the freeDB are marked too, and at the end every page
+ *	must have been marked exactly once.
+ *	@{
+ */
+#ifndef MDB_VFYTASK
+/** Height of the subtrees that #mdb_env_verify() hands to its threads.
+ *	Branch pages higher up than this queue each of their children as
+ *	a new task, so threads need not wait for each other.
+ */
+#define MDB_VFYTASK	2
+#endif
+
+#ifdef _WIN32
+	/* Only one thread verifies, nothing to synchronize */
+#define VFY_LOCK(mv)
+#define VFY_UNLOCK(mv)
+#define VFY_WAIT(mv)
+#define VFY_WAKE(mv)
+#define VFY_WAKEALL(mv)
+#else
+#define VFY_LOCK(mv)	pthread_mutex_lock(&(mv)->mv_mutex)
+#define VFY_UNLOCK(mv)	pthread_mutex_unlock(&(mv)->mv_mutex)
+#define VFY_WAIT(mv)	pthread_cond_wait(&(mv)->mv_cond, &(mv)->mv_mutex)
+#define VFY_WAKE(mv)	pthread_cond_signal(&(mv)->mv_cond)
+#define VFY_WAKEALL(mv)	pthread_cond_broadcast(&(mv)->mv_cond)
+#endif
+
+	/** A tree being verified: a DB, or the sorted duplicates of a key */
+typedef struct mdb_vdb {
+	struct mdb_vdb *vd_next;	/**< Next in #mdb_verify.%mv_dbs */
+	MDB_db vd_db;				/**< The record of the tree */
+	MDB_cmp_func *vd_cmp;		/**< Key order, NULL if unknown */
+	MDB_cmp_func *vd_dcmp;		/**< Order of sorted duplicates */
+	int vd_dups;				/**< This is a sorted-duplicate tree */
+	size_t vd_pages[3];			/**< Branch, leaf and overflow pages found */
+	size_t vd_entries;			/**< Items found */
+	char vd_name[80];			/**< Name for messages */
+} mdb_vdb;
+
+	/** A subtree queued for a thread */
+typedef struct mdb_vtask {
+	mdb_vdb *vt_db;
+	pgno_t vt_pgno;
+	unsigned int vt_depth;		/**< Level of #vt_pgno in its tree */
+	MDB_val vt_lo, vt_hi;		/**< Bounds of its keys, if mv_data is set */
+} mdb_vtask;
+
+	/** Counts of one task, added to its tree when the task is done */
+typedef struct mdb_vcount {
+	size_t vc_pages[3];
+	size_t vc_entries;
+} mdb_vcount;
+
+	/** State of #mdb_env_verify() */
+typedef struct mdb_verify {
+	MDB_env *mv_env;
+	MDB_txn *mv_txn;
+	unsigned int *mv_map;		/**< A bit for each page found */
+	pgno_t mv_last;				/**< First page past the snapshot */
+	unsigned int mv_flags;
+	int mv_threads;
+	MDB_msg_func *mv_func;
+	void *mv_ctx;
+	mdb_vdb *mv_dbs;			/**< Trees to compare with their records */
+	mdb_vdb *mv_main;			/**< The main DB */
+	mdb_vtask *mv_tasks;		/**< Stack of subtrees left to check */
+	unsigned int mv_ntasks, mv_maxtasks;
+	int mv_busy;				/**< Threads checking a subtree */
+	size_t mv_problems;
+	int mv_error;				/**< Failure other than a problem found */
+#ifndef _WIN32
+	pthread_mutex_t mv_mutex;
+	pthread_cond_t mv_cond;
+#endif
+} mdb_verify;
+
+	/** Report a problem with page \b pg of tree \b vd, or with
+	 *	the whole environment if \b vd is NULL.
+	 */
+static void ESECT
+mdb_vfy_msg(mdb_verify *mv, mdb_vdb *vd, pgno_t pg, const char *what)
 {
-	return env ? env->me_userctx : NULL;
+	char buf[256];
+
+	if (!vd)
+		snprintf(buf, sizeof(buf), "%s\n", what);
+	else if (pg == P_INVALID)
+		snprintf(buf, sizeof(buf), "%s: %s\n", vd->vd_name, what);
+	else
+		snprintf(buf, sizeof(buf), "%s: page %"Z"u: %s\n",
+			vd->vd_name, pg, what);
+	VFY_LOCK(mv);
+	mv->mv_problems++;
+	if (mv->mv_func)
+		mv->mv_func(buf, mv->mv_ctx);
+	VFY_UNLOCK(mv);
 }
 
-int ESECT
-mdb_env_set_assert(MDB_env *env, MDB_assert_func *func)
+	/** Mark \b n pages from \b pg as found.
+	 * @return 0 on success, non-zero if they can not belong to \b vd.
+	 */
+static int ESECT
+mdb_vfy_mark(mdb_verify *mv, mdb_vdb *vd, pgno_t pg, pgno_t n)
 {
-	if (!env)
-		return EINVAL;
-#ifndef NDEBUG
-	env->me_assert_func = func;
-#endif
-	return MDB_SUCCESS;
+	unsigned int *p, old, bit;
+	char buf[80];
+	pgno_t i;
+
+	if (pg < NUM_METAS || pg >= mv->mv_last || n > mv->mv_last - pg) {
+		snprintf(buf, sizeof(buf), "%"Z"u pages out of range", n);
+		mdb_vfy_msg(mv, vd, pg, buf);
+		return -1;
+	}
+	for (i = pg; i < pg + n; i++) {
+		p = &mv->mv_map[i / (CHAR_BIT * sizeof(unsigned int))];
+		bit = 1U << (i % (CHAR_BIT * sizeof(unsigned int)));
+		do {
+			old = *p;
+			if (old & bit) {
+				mdb_vfy_msg(mv, vd, i, "already in use");
+				return -1;
+			}
+		} while (!MDB_CAS(p, old, old | bit));
+	}
+	return 0;
 }
 
-int ESECT
-mdb_env_get_path(MDB_env *env, const char **arg)
+	/** Compare what was found in a tree with its record */
+static void ESECT
+mdb_vfy_count(mdb_verify *mv, mdb_vdb *vd)
 {
-	if (!env || !arg)
-		return EINVAL;
+	static const char *const type[] = { "branch pages", "leaf pages", "overflow pages" };
+	size_t want[3];
+	char buf[128];
+	int i;
 
-	*arg = env->me_path;
-	return MDB_SUCCESS;
+	want[0] = vd->vd_db.md_branch_pages;
+	want[1] = vd->vd_db.md_leaf_pages;
+	want[2] = vd->vd_db.md_overflow_pages;
+	for (i=0; i<3; i++) {
+		if (vd->vd_pages[i] != want[i]) {
+			snprintf(buf, sizeof(buf), "%"Z"u %s found, %"Z"u recorded",
+				vd->vd_pages[i], type[i], want[i]);
+			mdb_vfy_msg(mv, vd, P_INVALID, buf);
+		}
+	}
+	if (vd->vd_entries != vd->vd_db.md_entries) {
+		snprintf(buf, sizeof(buf), "%"Z"u items found, %"Z"u recorded",
+			vd->vd_entries, vd->vd_db.md_entries);
+		mdb_vfy_msg(mv, vd, P_INVALID, buf);
+	}
 }
 
-int ESECT
-mdb_env_get_fd(MDB_env *env, mdb_filehandle_t *arg)
+	/** Queue a subtree for the next free thread */
+static void ESECT
+mdb_vfy_push(mdb_verify *mv, mdb_vdb *vd, pgno_t pg, unsigned int depth,
+	MDB_val *lo, MDB_val *hi)
+{
+	mdb_vtask *vt;
+
+	VFY_LOCK(mv);
+	if (mv->mv_ntasks == mv->mv_maxtasks) {
+		unsigned int n = mv->mv_maxtasks ? mv->mv_maxtasks * 2 : 256;
+		vt = realloc(mv->mv_tasks, n * sizeof(mdb_vtask));
+		if (!vt) {
+			if (!mv->mv_error)
+				mv->mv_error = ENOMEM;
+			VFY_UNLOCK(mv);
+			return;
+		}
+		mv->mv_tasks = vt;
+		mv->mv_maxtasks = n;
+	}
+	vt = &mv->mv_tasks[mv->mv_ntasks++];
+	vt->vt_db = vd;
+	vt->vt_pgno = pg;
+	vt->vt_depth = depth;
+	if (lo)
+		vt->vt_lo = *lo;
+	else
+		vt->vt_lo.mv_data = NULL;
+	if (hi)
+		vt->vt_hi = *hi;
+	else
+		vt->vt_hi.mv_data = NULL;
+	VFY_WAKE(mv);
+	VFY_UNLOCK(mv);
+}
+
+	/** Set up a tree found in a leaf of \b parent, or a named DB if
+	 *	\b parent is NULL.
+	 */
+static void ESECT
+mdb_vfy_init(mdb_verify *mv, mdb_vdb *vd, mdb_vdb *parent, MDB_db *db,
+	MDB_val *name)
 {
-	if (!env || !arg)
-		return EINVAL;
+	MDB_env *env = mv->mv_env;
+	MDB_dbi i;
+	uint16_t f = db->md_flags;
 
-	*arg = env->me_fd;
-	return MDB_SUCCESS;
+	memset(vd, 0, sizeof(*vd));
+	vd->vd_db = *db;
+	if (parent) {
+		snprintf(vd->vd_name, sizeof(vd->vd_name), "%.64s duplicates",
+			parent->vd_name);
+		vd->vd_cmp = parent->vd_dcmp;
+		vd->vd_dups = 1;
+		return;
+	}
+	snprintf(vd->vd_name, sizeof(vd->vd_name), "%.*s",
+		(int)name->mv_size, (char *)name->mv_data);
+	/* Use the comparison functions of a handle on this DB */
+	for (i = CORE_DBS; i < env->me_numdbs; i++) {
+		if (env->me_dbxs[i].md_name.mv_data &&
+			(env->me_dbflags[i] & PERSISTENT_FLAGS) == (f & PERSISTENT_FLAGS) &&
+			env->me_dbxs[i].md_name.mv_size == name->mv_size &&
+			!memcmp(env->me_dbxs[i].md_name.mv_data, name->mv_data, name->mv_size)) {
+			vd->vd_cmp = env->me_dbxs[i].md_cmp;
+			vd->vd_dcmp = env->me_dbxs[i].md_dcmp;
+			return;
+		}
+	}
+	if (mv->mv_flags & MDB_VERIFY_NOORDER)
+		return;
+	vd->vd_cmp = (f & MDB_REVERSEKEY) ? mdb_cmp_memnr :
+		(f & MDB_INTEGERKEY) ? mdb_cmp_cint : mdb_cmp_memn;
+	vd->vd_dcmp = !(f & MDB_DUPSORT) ? 0 :
+		((f & MDB_INTEGERDUP)
+		 ? ((f & MDB_DUPFIXED) ? mdb_cmp_int : mdb_cmp_cint)
+		 : ((f & MDB_REVERSEDUP) ? mdb_cmp_memnr : mdb_cmp_memn));
 }
 
-/** Common code for #mdb_stat() and #mdb_env_stat().
- * @param[in] env the environment to operate in.
- * @param[in] db the #MDB_db record containing the stats to return.
- * @param[out] arg the address of an #MDB_stat structure to receive the stats.
- * @return 0, this function always succeeds.
- */
-static int ESECT
-mdb_stat0(MDB_env *env, MDB_db *db, MDB_stat *arg)
-{
-	arg->ms_psize = env->me_psize;
-	arg->ms_depth = db->md_depth;
-	arg->ms_branch_pages = db->md_branch_pages;
-	arg->ms_leaf_pages = db->md_leaf_pages;
-	arg->ms_overflow_pages = db->md_overflow_pages;
-	arg->ms_entries = db->md_entries;
+static void mdb_vfy_page(mdb_verify *mv, mdb_vdb *vd, pgno_t pg,
+	unsigned int depth, MDB_val *lo, MDB_val *hi, mdb_vcount *vc);
 
-	return MDB_SUCCESS;
+	/** Check the first page of a tree, now or in another thread */
+static void ESECT
+mdb_vfy_tree(mdb_verify *mv, mdb_vdb *vd, mdb_vcount *vc)
+{
+	if (vd->vd_db.md_root == P_INVALID) {
+		if (vd->vd_db.md_depth || vd->vd_db.md_entries)
+			mdb_vfy_msg(mv, vd, P_INVALID, "no root page but not empty");
+	} else if (vd->vd_db.md_depth == 0 || vd->vd_db.md_depth > CURSOR_STACK) {
+		mdb_vfy_msg(mv, vd, vd->vd_db.md_root, "bad tree depth");
+	} else if (vc) {
+		mdb_vfy_page(mv, vd, vd->vd_db.md_root, 0, NULL, NULL, vc);
+	} else {
+		mdb_vfy_push(mv, vd, vd->vd_db.md_root, 0, NULL, NULL);
+	}
 }
 
-int ESECT
-mdb_env_stat(MDB_env *env, MDB_stat *arg)
+	/** Check that \b key is above the previous key and within bounds.
+	 * @param[in] i index of the key on its page.
+	 * @return 0 if it is, non-zero after reporting it.
+	 */
+static int ESECT
+mdb_vfy_order(mdb_verify *mv, mdb_vdb *vd, pgno_t pg, MDB_cmp_func *cmp,
+	MDB_val *prev, MDB_val *key, MDB_val *lo, MDB_val *hi, unsigned int i)
 {
-	MDB_meta *meta;
+	char buf[80];
 
-	if (env == NULL || arg == NULL)
-		return EINVAL;
+	if (!cmp)
+		return 0;
+	if (prev && cmp(prev, key) >= 0) {
+		snprintf(buf, sizeof(buf), "key %u out of order", i);
+	} else if ((lo && cmp(key, lo) < 0) || (hi && cmp(key, hi) >= 0)) {
+		snprintf(buf, sizeof(buf), "key %u outside of its parent's range", i);
+	} else {
+		return 0;
+	}
+	mdb_vfy_msg(mv, vd, pg, buf);
+	return 1;
+}
 
-	meta = mdb_env_pick_meta(env);
+	/** Check the overflow pages of a value of \b size bytes. A smaller
+	 *	value may have been written over a bigger one in place, so there
+	 *	may be more pages than it needs.
+	 */
+static void ESECT
+mdb_vfy_over(mdb_verify *mv, mdb_vdb *vd, pgno_t pg, size_t size,
+	mdb_vcount *vc)
+{
+	MDB_cursor mc = {0};
+	MDB_page *omp;
+	pgno_t n = OVPAGES(size, mv->mv_env->me_psize);
+	char buf[80];
+
+	mc.mc_txn = mv->mv_txn;
+	if (pg < NUM_METAS || mdb_page_get(&mc, pg, &omp, NULL) != MDB_SUCCESS ||
+		omp->mp_pgno != pg || !IS_OVERFLOW(omp)) {
+		mdb_vfy_msg(mv, vd, pg, "not an overflow page");
+		mdb_vfy_mark(mv, vd, pg, 1);
+		return;
+	}
+	if (omp->mp_pages < n) {
+		snprintf(buf, sizeof(buf), "%u overflow pages, %"Z"u needed",
+			omp->mp_pages, n);
+		mdb_vfy_msg(mv, vd, pg, buf);
+	} else {
+		n = omp->mp_pages;
+	}
+	if (!mdb_vfy_mark(mv, vd, pg, n))
+		vc->vc_pages[2] += n;
+}
 
-	return mdb_stat0(env, &meta->mm_dbs[MAIN_DBI], arg);
+	/** Check a sub-page of sorted duplicates in a leaf node */
+static void ESECT
+mdb_vfy_subpage(mdb_verify *mv, mdb_vdb *vd, pgno_t pg, MDB_node *ni,
+	mdb_vcount *vc)
+{
+	MDB_page *sp = NODEDATA(ni);
+	MDB_node *sn;
+	MDB_val key, prev;
+	size_t size = NODEDSZ(ni), off;
+	unsigned int i, n;
+
+	if (size < PAGEHDRSZ || !(sp->mp_flags & P_SUBP) || !IS_LEAF(sp) ||
+		sp->mp_lower < PAGEHDRSZ-PAGEBASE || sp->mp_lower > sp->mp_upper ||
+		sp->mp_upper + PAGEBASE > size) {
+		mdb_vfy_msg(mv, vd, pg, "bad sub-page of duplicates");
+		return;
+	}
+	n = NUMKEYS(sp);
+	if (!n)
+		mdb_vfy_msg(mv, vd, pg, "empty sub-page of duplicates");
+	vc->vc_entries += n;
+	if (IS_LEAF2(sp) && PAGEHDRSZ + (size_t)n * sp->mp_pad > size) {
+		mdb_vfy_msg(mv, vd, pg, "bad sub-page of duplicates");
+		return;
+	}
+	for (i=0; i<n; i++) {
+		if (IS_LEAF2(sp)) {
+			key.mv_size = sp->mp_pad;
+			key.mv_data = LEAF2KEY(sp, i, key.mv_size);
+		} else {
+			off = sp->mp_ptrs[i] + PAGEBASE;
+			sn = NODEPTR(sp, i);
+			if (off < sp->mp_upper + PAGEBASE || off + NODESIZE > size ||
+				off + NODESIZE + NODEKSZ(sn) > size) {
+				mdb_vfy_msg(mv, vd, pg, "bad node in sub-page of duplicates");
+				return;
+			}
+			key.mv_size = NODEKSZ(sn);
+			key.mv_data = NODEKEY(sn);
+		}
+		if (i && vd->vd_dcmp && vd->vd_dcmp(&prev, &key) >= 0) {
+			mdb_vfy_msg(mv, vd, pg, "duplicates out of order");
+			return;
+		}
+		prev = key;
+	}
 }
 
-int ESECT
-mdb_env_info(MDB_env *env, MDB_envinfo *arg)
+	/** Check a page of a tree and the pages below it.
+	 * @param[in] mv control structure.
+	 * @param[in] vd the tree.
+	 * @param[in] pg the page.
+	 * @param[in] depth the level of the page in the tree, 0 for the root.
+	 * @param[in] lo the lowest key allowed on the page, or NULL.
+	 * @param[in] hi the lowest key above the page, or NULL.
+	 * @param[in,out] vc counts of the tree to update.
+	 */
+static void ESECT
+mdb_vfy_page(mdb_verify *mv, mdb_vdb *vd, pgno_t pg, unsigned int depth,
+	MDB_val *lo, MDB_val *hi, mdb_vcount *vc)
 {
-	MDB_meta *meta;
+	MDB_env *env = mv->mv_env;
+	MDB_cursor mc = {0};
+	MDB_page *mp;
+	MDB_node *ni;
+	MDB_db db;
+	MDB_val key, prev, klo, khi, *kp;
+	char kbuf[2][MDB_KBUFSIZE];
+	unsigned int i, n, end, leaf = depth + 1 == vd->vd_db.md_depth;
+	size_t off, len;
+	int bad = 0;	/* a key was out of order */
+
+	if (mdb_vfy_mark(mv, vd, pg, 1))
+		return;
+	mc.mc_txn = mv->mv_txn;
+	if (mdb_page_get(&mc, pg, &mp, NULL) != MDB_SUCCESS ||
+		mp->mp_pgno != pg) {
+		mdb_vfy_msg(mv, vd, pg, "wrong page number in page header");
+		return;
+	}
+	if (leaf ? !IS_LEAF(mp) : !IS_BRANCH(mp)) {
+		mdb_vfy_msg(mv, vd, pg, leaf ? "not a leaf page" : "not a branch page");
+		return;
+	}
+	vc->vc_pages[leaf]++;
+	end = env->me_psize - (IS_PREFIX(mp) ? EVEN(mp->mp_pad) : 0);
+	if (mp->mp_lower < PAGEHDRSZ-PAGEBASE || mp->mp_lower > mp->mp_upper ||
+		mp->mp_upper + PAGEBASE > end || (IS_PREFIX(mp) && IS_LEAF2(mp))) {
+		mdb_vfy_msg(mv, vd, pg, "bad page layout");
+		return;
+	}
+	n = NUMKEYS(mp);
+	if (n < (leaf ? 1U : 2U))
+		mdb_vfy_msg(mv, vd, pg, "too few keys");
+
+	if (IS_LEAF2(mp)) {
+		if (!vd->vd_dups || mp->mp_pad != vd->vd_db.md_pad ||
+			PAGEHDRSZ + (size_t)n * mp->mp_pad > env->me_psize) {
+			mdb_vfy_msg(mv, vd, pg, "bad fixed-size key page");
+			return;
+		}
+		vc->vc_entries += n;
+		/* Report only the first misplaced key of a page */
+		for (i=0; i<n; i++) {
+			key.mv_size = mp->mp_pad;
+			key.mv_data = LEAF2KEY(mp, i, key.mv_size);
+			if (mdb_vfy_order(mv, vd, pg, vd->vd_cmp, i ? &prev : NULL, &key,
+				lo, hi, i))
+				break;
+			prev = key;
+		}
+		return;
+	}
 
-	if (env == NULL || arg == NULL)
-		return EINVAL;
+	for (i=0; i<n; i++) {
+		off = mp->mp_ptrs[i] + PAGEBASE;
+		ni = NODEPTR(mp, i);
+		if (off < mp->mp_upper + PAGEBASE || off + NODESIZE > end) {
+			mdb_vfy_msg(mv, vd, pg, "node outside of the page");
+			return;
+		}
+		len = NODESIZE + NODEKSZ(ni);
+		if (leaf)
+			len += (ni->mn_flags & F_BIGDATA) ? sizeof(pgno_t) : NODEDSZ(ni);
+		if (off + len > end) {
+			mdb_vfy_msg(mv, vd, pg, "node outside of the page");
+			return;
+		}
+	}
 
-	meta = mdb_env_pick_meta(env);
-	arg->me_mapaddr = meta->mm_address;
-	arg->me_last_pgno = meta->mm_last_pg;
-	arg->me_last_txnid = meta->mm_txnid;
+	if (!leaf) {
+		/* Child i holds the keys from key i up to key i+1. Branch
+		 * keys stay in the map, so tasks can keep pointing at them.
+		 */
+		for (i=0; i<n; i++) {
+			ni = NODEPTR(mp, i);
+			if (i) {
+				klo.mv_size = NODEKSZ(ni);
+				klo.mv_data = NODEKEY(ni);
+				if (!bad)
+					bad = mdb_vfy_order(mv, vd, pg, vd->vd_cmp,
+						i > 1 ? &prev : NULL, &klo, lo, hi, i);
+				prev = klo;
+			}
+			if (i + 1 < n) {
+				MDB_node *nx = NODEPTR(mp, i+1);
+				khi.mv_size = NODEKSZ(nx);
+				khi.mv_data = NODEKEY(nx);
+				kp = &khi;
+			} else {
+				kp = hi;
+			}
+			if (mv->mv_threads > 1 && vd->vd_db.md_depth - depth > MDB_VFYTASK)
+				mdb_vfy_push(mv, vd, NODEPGNO(ni), depth+1, i ? &klo : lo, kp);
+			else
+				mdb_vfy_page(mv, vd, NODEPGNO(ni), depth+1, i ? &klo : lo, kp, vc);
+		}
+		return;
+	}
 
-	arg->me_mapsize = env->me_mapsize;
-	arg->me_maxreaders = env->me_maxreaders;
-	arg->me_numreaders = env->me_txns ? env->me_txns->mti_numreaders : 0;
-	return MDB_SUCCESS;
+	for (i=0; i<n; i++) {
+		ni = NODEPTR(mp, i);
+		mdb_node_key(env, mp, ni, &key, kbuf[i & 1]);
+		if (!bad)
+			bad = mdb_vfy_order(mv, vd, pg, vd->vd_cmp, i ? &prev : NULL,
+				&key, lo, hi, i);
+		prev = key;
+		if (ni->mn_flags & F_BIGDATA) {
+			pgno_t opg;
+			memcpy(&opg, NODEDATA(ni), sizeof(opg));
+			mdb_vfy_over(mv, vd, opg, NODEDSZ(ni), vc);
+			vc->vc_entries++;
+		} else if (ni->mn_flags & F_SUBDATA) {
+			mdb_vdb *sub, tmp;
+			mdb_vcount svc;
+			if (NODEDSZ(ni) != sizeof(MDB_db)) {
+				mdb_vfy_msg(mv, vd, pg, "bad database record");
+				continue;
+			}
+			memcpy(&db, NODEDATA(ni), sizeof(db));
+			if (!(ni->mn_flags & F_DUPDATA)) {
+				/* A named DB, in the main DB */
+				vc->vc_entries++;
+				if (vd != mv->mv_main) {
+					mdb_vfy_msg(mv, vd, pg, "database record outside of the main DB");
+					continue;
+				}
+			} else {
+				vc->vc_entries += db.md_entries;
+				if (!vd->vd_dcmp && !(mv->mv_flags & MDB_VERIFY_NOORDER) &&
+					!(vd->vd_db.md_flags & MDB_DUPSORT)) {
+					mdb_vfy_msg(mv, vd, pg, "duplicates in a DB without MDB_DUPSORT");
+					continue;
+				}
+			}
+			/* Small trees of duplicates are checked right away */
+			if ((ni->mn_flags & F_DUPDATA) &&
+				(mv->mv_threads <= 1 || db.md_depth <= MDB_VFYTASK)) {
+				mdb_vfy_init(mv, &tmp, vd, &db, NULL);
+				memset(&svc, 0, sizeof(svc));
+				mdb_vfy_tree(mv, &tmp, &svc);
+				memcpy(tmp.vd_pages, svc.vc_pages, sizeof(tmp.vd_pages));
+				tmp.vd_entries = svc.vc_entries;
+				mdb_vfy_count(mv, &tmp);
+				continue;
+			}
+			if ((sub = malloc(sizeof(mdb_vdb))) == NULL) {
+				VFY_LOCK(mv);
+				if (!mv->mv_error)
+					mv->mv_error = ENOMEM;
+				VFY_UNLOCK(mv);
+				return;
+			}
+			mdb_vfy_init(mv, sub, (ni->mn_flags & F_DUPDATA) ? vd : NULL, &db, &key);
+			VFY_LOCK(mv);
+			sub->vd_next = mv->mv_dbs;
+			mv->mv_dbs = sub;
+			VFY_UNLOCK(mv);
+			mdb_vfy_tree(mv, sub, NULL);
+		} else if (ni->mn_flags & F_DUPDATA) {
+			mdb_vfy_subpage(mv, vd, pg, ni, vc);
+		} else {
+			vc->vc_entries++;
+		}
+	}
 }
 
-/** Set the default comparison functions for a database.
- * Called immediately after a database is opened to set the defaults.
- * The user can then override them with #mdb_set_compare() or
- * #mdb_set_dupsort().
- * @param[in] txn A transaction handle returned by #mdb_txn_begin()
- * @param[in] dbi A database handle returned by #mdb_dbi_open()
- */
-static void
-mdb_default_cmp(MDB_txn *txn, MDB_dbi dbi)
+	/** Check subtrees until none are left */
+static THREAD_RET ESECT CALL_CONV
+mdb_vfy_thr(void *arg)
 {
-	uint16_t f = txn->mt_dbs[dbi].md_flags;
-
-	txn->mt_dbxs[dbi].md_cmp =
-		(f & MDB_REVERSEKEY) ? mdb_cmp_memnr :
-		(f & MDB_INTEGERKEY) ? mdb_cmp_cint  : mdb_cmp_memn;
+	mdb_verify *mv = arg;
+	mdb_vtask vt;
+	mdb_vcount vc;
+	int i;
 
-	txn->mt_dbxs[dbi].md_dcmp =
-		!(f & MDB_DUPSORT) ? 0 :
-		((f & MDB_INTEGERDUP)
-		 ? ((f & MDB_DUPFIXED)   ? mdb_cmp_int   : mdb_cmp_cint)
-		 : ((f & MDB_REVERSEDUP) ? mdb_cmp_memnr : mdb_cmp_memn));
+	VFY_LOCK(mv);
+	for (;;) {
+		while (!mv->mv_ntasks && mv->mv_busy && !mv->mv_error)
+			VFY_WAIT(mv);
+		if (!mv->mv_ntasks || mv->mv_error)
+			break;
+		vt = mv->mv_tasks[--mv->mv_ntasks];
+		mv->mv_busy++;
+		VFY_UNLOCK(mv);
+		memset(&vc, 0, sizeof(vc));
+		mdb_vfy_page(mv, vt.vt_db, vt.vt_pgno, vt.vt_depth,
+			vt.vt_lo.mv_data ? &vt.vt_lo : NULL,
+			vt.vt_hi.mv_data ? &vt.vt_hi : NULL, &vc);
+		VFY_LOCK(mv);
+		for (i=0; i<3; i++)
+			vt.vt_db->vd_pages[i] += vc.vc_pages[i];
+		vt.vt_db->vd_entries += vc.vc_entries;
+		mv->mv_busy--;
+	}
+	/* Nothing left, let the other threads see it too */
+	VFY_WAKEALL(mv);
+	VFY_UNLOCK(mv);
+	return (THREAD_RET)0;
 }
 
-int mdb_dbi_open(MDB_txn *txn, const char *name, unsigned int flags, MDB_dbi *dbi)
+	/** Check the page lists in the freeDB and mark their pages */
+static int ESECT
+mdb_vfy_free(mdb_verify *mv, mdb_vdb *vd)
 {
-	MDB_val key, data;
-	MDB_dbi i;
+	MDB_env *env = mv->mv_env;
 	MDB_cursor mc;
-	MDB_db dummy;
-	int rc, dbflag, exact;
-	unsigned int unused = 0, seq;
-	char *namedup;
-	size_t len;
-
-	if (flags & ~VALID_FLAGS)
-		return EINVAL;
-	if (txn->mt_flags & MDB_TXN_BLOCKED)
-		return MDB_BAD_TXN;
+	MDB_val key, data;
+	MDB_ID *idl;
+	char buf[80];
+	size_t i, n;
+	int rc;
 
-	/* main DB? */
-	if (!name) {
-		*dbi = MAIN_DBI;
-		if (flags & PERSISTENT_FLAGS) {
-			uint16_t f2 = flags & PERSISTENT_FLAGS;
-			/* make sure flag changes get committed */
-			if ((txn->mt_dbs[MAIN_DBI].md_flags | f2) != txn->mt_dbs[MAIN_DBI].md_flags) {
-				txn->mt_dbs[MAIN_DBI].md_flags |= f2;
-				txn->mt_flags |= MDB_TXN_DIRTY;
-			}
+	mdb_cursor_init(&mc, mv->mv_txn, FREE_DBI, NULL);
+	while ((rc = mdb_cursor_get(&mc, &key, &data, MDB_NEXT)) == 0) {
+		txnid_t id;
+		if (key.mv_size != sizeof(txnid_t) || data.mv_size < sizeof(MDB_ID) ||
+			data.mv_size % sizeof(MDB_ID)) {
+			mdb_vfy_msg(mv, vd, P_INVALID, "bad record");
+			continue;
 		}
-		mdb_default_cmp(txn, MAIN_DBI);
-		return MDB_SUCCESS;
-	}
-
-	if (txn->mt_dbxs[MAIN_DBI].md_cmp == NULL) {
-		mdb_default_cmp(txn, MAIN_DBI);
-	}
-
-	/* Is the DB already open? */
-	len = strlen(name);
-	for (i=CORE_DBS; i<txn->mt_numdbs; i++) {
-		if (!txn->mt_dbxs[i].md_name.mv_size) {
-			/* Remember this free slot */
-			if (!unused) unused = i;
+		memcpy(&id, key.mv_data, sizeof(id));
+		idl = data.mv_data;
+		n = data.mv_size / sizeof(MDB_ID) - 1;
+		if (idl[0] != n || ((env->me_flags & MDB_EXTFREE) && (n & 1))) {
+			snprintf(buf, sizeof(buf), "bad page list of txn %"Z"u", id);
+			mdb_vfy_msg(mv, vd, P_INVALID, buf);
 			continue;
 		}
-		if (len == txn->mt_dbxs[i].md_name.mv_size &&
-			!strncmp(name, txn->mt_dbxs[i].md_name.mv_data, len)) {
-			*dbi = i;
-			return MDB_SUCCESS;
+		if (env->me_flags & MDB_EXTFREE) {
+			for (i=1; i<=MDB_EXT_NUM(idl); i++) {
+				if ((i > 1 && MDB_EXT_ID(idl, i) >= MDB_EXT_ID(idl, i-1)) ||
+					!MDB_EXT_LEN(idl, i)) {
+					snprintf(buf, sizeof(buf), "page list of txn %"Z"u out of order", id);
+					mdb_vfy_msg(mv, vd, P_INVALID, buf);
+					break;
+				}
+				if (mdb_vfy_mark(mv, vd, MDB_EXT_ID(idl, i), MDB_EXT_LEN(idl, i)))
+					break;
+			}
+		} else {
+			for (i=1; i<=n; i++) {
+				if (i > 1 && idl[i] >= idl[i-1]) {
+					snprintf(buf, sizeof(buf), "page list of txn %"Z"u out of order", id);
+					mdb_vfy_msg(mv, vd, P_INVALID, buf);
+					break;
+				}
+				if (mdb_vfy_mark(mv, vd, idl[i], 1))
+					break;
+			}
 		}
 	}
+	return rc == MDB_NOTFOUND ? MDB_SUCCESS : rc;
+}
 
-	/* If no free slot and max hit, fail */
-	if (!unused && txn->mt_numdbs >= txn->mt_env->me_maxdbs)
-		return MDB_DBS_FULL;
-
-	/* Cannot mix named databases with some mainDB flags */
-	if (txn->mt_dbs[MAIN_DBI].md_flags & (MDB_DUPSORT|MDB_INTEGERKEY))
-		return (flags & MDB_CREATE) ? MDB_INCOMPATIBLE : MDB_NOTFOUND;
+int ESECT
+mdb_env_verify(MDB_env *env, unsigned int flags, int nthreads,
+	MDB_msg_func *func, void *ctx)
+{
+	mdb_verify my;
+	mdb_vdb *vd, fdb, mdb;
+	MDB_val name;
+	pgno_t pg, first, leaked;
+	char buf[80];
+	int rc;
+#ifndef _WIN32
+	pthread_t *thr = NULL;
+	int n;
+#endif
 
-	/* Find the DB info */
-	dbflag = DB_NEW|DB_VALID|DB_USRVALID;
-	exact = 0;
-	key.mv_size = len;
-	key.mv_data = (void *)name;
-	mdb_cursor_init(&mc, txn, MAIN_DBI, NULL);
-	rc = mdb_cursor_set(&mc, &key, &data, MDB_SET, &exact);
-	if (rc == MDB_SUCCESS) {
-		/* make sure this is actually a DB */
-		MDB_node *node = NODEPTR(mc.mc_pg[mc.mc_top], mc.mc_ki[mc.mc_top]);
-		if ((node->mn_flags & (F_DUPDATA|F_SUBDATA)) != F_SUBDATA)
-			return MDB_INCOMPATIBLE;
-	} else {
-		if (rc != MDB_NOTFOUND || !(flags & MDB_CREATE))
-			return rc;
-		if (F_ISSET(txn->mt_flags, MDB_TXN_RDONLY))
-			return EACCES;
+	memset(&my, 0, sizeof(my));
+	rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &my.mv_txn);
+	if (rc)
+		return rc;
+	my.mv_env = env;
+	my.mv_flags = flags;
+	my.mv_func = func;
+	my.mv_ctx = ctx;
+	my.mv_last = my.mv_txn->mt_next_pgno;
+#if defined(_WIN32) || !MDB_RCAS
+	nthreads = 1;
+#endif
+	my.mv_threads = nthreads < 1 ? 1 : nthreads;
+	my.mv_map = calloc(my.mv_last / (CHAR_BIT * sizeof(unsigned int)) + 1,
+		sizeof(unsigned int));
+	if (!my.mv_map) {
+		rc = ENOMEM;
+		goto done;
+	}
+#ifndef _WIN32
+	if ((thr = malloc(my.mv_threads * sizeof(pthread_t))) == NULL) {
+		rc = ENOMEM;
+		goto done;
 	}
+	if ((rc = pthread_mutex_init(&my.mv_mutex, NULL)) != 0) {
+		free(thr);
+		thr = NULL;
+		goto done;
+	}
+	if ((rc = pthread_cond_init(&my.mv_cond, NULL)) != 0) {
+		pthread_mutex_destroy(&my.mv_mutex);
+		free(thr);
+		thr = NULL;
+		goto done;
+	}
+#endif
 
-	/* Done here so we cannot fail after creating a new DB */
-	if ((namedup = strdup(name)) == NULL)
-		return ENOMEM;
+	name.mv_size = sizeof("main DB") - 1;
+	name.mv_data = "main DB";
+	mdb_vfy_init(&my, &mdb, NULL, &my.mv_txn->mt_dbs[MAIN_DBI], &name);
+	mdb.vd_cmp = env->me_dbxs[MAIN_DBI].md_cmp;
+	mdb.vd_dcmp = env->me_dbxs[MAIN_DBI].md_dcmp;
+	name.mv_size = sizeof("free DB") - 1;
+	name.mv_data = "free DB";
+	mdb_vfy_init(&my, &fdb, NULL, &my.mv_txn->mt_dbs[FREE_DBI], &name);
+	fdb.vd_cmp = env->me_dbxs[FREE_DBI].md_cmp;
+	fdb.vd_dcmp = NULL;
+	fdb.vd_next = &mdb;
+	my.mv_dbs = &fdb;
+	my.mv_main = &mdb;
+	mdb_vfy_tree(&my, &fdb, NULL);
+	mdb_vfy_tree(&my, &mdb, NULL);
 
-	if (rc) {
-		/* MDB_NOTFOUND and MDB_CREATE: Create new DB */
-		data.mv_size = sizeof(MDB_db);
-		data.mv_data = &dummy;
-		memset(&dummy, 0, sizeof(dummy));
-		dummy.md_root = P_INVALID;
-		dummy.md_flags = flags & PERSISTENT_FLAGS;
-		WITH_CURSOR_TRACKING(mc,
-			rc = mdb_cursor_put(&mc, &key, &data, F_SUBDATA));
-		dbflag |= DB_DIRTY;
+#ifndef _WIN32
+	/* Fewer threads will do if some can't be started */
+	for (n=0; n+1 < my.mv_threads; n++) {
+		if (THREAD_CREATE(thr[n], mdb_vfy_thr, &my))
+			break;
 	}
+#endif
+	mdb_vfy_thr(&my);
+#ifndef _WIN32
+	while (n)
+		THREAD_FINISH(thr[--n]);
+#endif
+	rc = my.mv_error;
+	if (!rc)
+		rc = mdb_vfy_free(&my, &fdb);
+	if (rc)
+		goto done;
 
-	if (rc) {
-		free(namedup);
-	} else {
-		/* Got info, register DBI in this txn */
-		unsigned int slot = unused ? unused : txn->mt_numdbs;
-		txn->mt_dbxs[slot].md_name.mv_data = namedup;
-		txn->mt_dbxs[slot].md_name.mv_size = len;
-		txn->mt_dbxs[slot].md_rel = NULL;
-		txn->mt_dbflags[slot] = dbflag;
-		/* txn-> and env-> are the same in read txns, use
-		 * tmp variable to avoid undefined assignment
-		 */
-		seq = ++txn->mt_env->me_dbiseqs[slot];
-		txn->mt_dbiseqs[slot] = seq;
-
-		memcpy(&txn->mt_dbs[slot], data.mv_data, sizeof(MDB_db));
-		*dbi = slot;
-		mdb_default_cmp(txn, slot);
-		if (!unused) {
-			txn->mt_numdbs++;
+	for (vd = my.mv_dbs; vd; vd = vd->vd_next)
+		mdb_vfy_count(&my, vd);
+	/* Every page must be in use or free */
+	leaked = 0;
+	first = 0;
+	for (pg = NUM_METAS; pg < my.mv_last; pg++) {
+		if (!(my.mv_map[pg / (CHAR_BIT * sizeof(unsigned int))] &
+			(1U << (pg % (CHAR_BIT * sizeof(unsigned int)))))) {
+			if (!leaked++)
+				first = pg;
 		}
 	}
+	if (leaked) {
+		snprintf(buf, sizeof(buf), "%"Z"u pages neither used nor free, the first is page %"Z"u",
+			leaked, first);
+		mdb_vfy_msg(&my, NULL, P_INVALID, buf);
+	}
 
+done:
+#ifndef _WIN32
+	if (thr) {
+		pthread_cond_destroy(&my.mv_cond);
+		pthread_mutex_destroy(&my.mv_mutex);
+		free(thr);
+	}
+#endif
+	/* Trees found in leaves come before the freeDB */
+	while ((vd = my.mv_dbs) && vd != &fdb) {
+		my.mv_dbs = vd->vd_next;
+		free(vd);
+	}
+	free(my.mv_tasks);
+	free(my.mv_map);
+	mdb_txn_abort(my.mv_txn);
+	if (!rc && my.mv_problems)
+		rc = MDB_CORRUPTED;
 	return rc;
 }
-
-int ESECT
-mdb_stat(MDB_txn *txn, MDB_dbi dbi, MDB_stat *arg)
-{
-	if (!arg || !TXN_DBI_EXIST(txn, dbi, DB_VALID))
-		return EINVAL;
-
-	if (txn->mt_flags & MDB_TXN_BLOCKED)
-		return MDB_BAD_TXN;
-
-	if (txn->mt_dbflags[dbi] & DB_STALE) {
-		MDB_cursor mc;
-		MDB_xcursor mx;
-		/* Stale, must read the DB's root. cursor_init does it for us. */
-		mdb_cursor_init(&mc, txn, dbi, &mx);
-	}
-	return mdb_stat0(txn->mt_env, &txn->mt_dbs[dbi], arg);
-}
+/** @} */
 
 void mdb_dbi_close(MDB_env *env, MDB_dbi dbi)
 {
@@ -10006,6 +14203,8 @@ int mdb_set_compare(MDB_txn *txn, MDB_dbi dbi, MDB_cmp_func *cmp)
 {
 	if (!TXN_DBI_EXIST(txn, dbi, DB_USRVALID))
 		return EINVAL;
+	if (txn->mt_dbs[dbi].md_flags & MDB_PREFIXKEYS)
+		return EINVAL;
 
 	txn->mt_dbxs[dbi].md_cmp = cmp;
 	return MDB_SUCCESS;
@@ -10082,44 +14281,21 @@ mdb_reader_list(MDB_env *env, MDB_msg_func *func, void *ctx)
 	return rc;
 }
 
-/** Insert pid into list if not already present.
- * return -1 if already present.
- */
+	/** A reader slot and the pid that held it, for #mdb_reader_check0() */
+typedef struct MDB_rslot {
+	MDB_PID_T	rs_pid;
+	unsigned	rs_slot;
+} MDB_rslot;
+
+/** Order reader slots by pid, then by slot number. */
 static int ESECT
-mdb_pid_insert(MDB_PID_T *ids, MDB_PID_T pid)
+mdb_rslot_cmp(const void *a, const void *b)
 {
-	/* binary search of pid in list */
-	unsigned base = 0;
-	unsigned cursor = 1;
-	int val = 0;
-	unsigned n = ids[0];
-
-	while( 0 < n ) {
-		unsigned pivot = n >> 1;
-		cursor = base + pivot + 1;
-		val = pid - ids[cursor];
+	const MDB_rslot *x = a, *y = b;
 
-		if( val < 0 ) {
-			n = pivot;
-
-		} else if ( val > 0 ) {
-			base = cursor;
-			n -= pivot + 1;
-
-		} else {
-			/* found, so it's a duplicate */
-			return -1;
-		}
-	}
-
-	if( val > 0 ) {
-		++cursor;
-	}
-	ids[0]++;
-	for (n = ids[0]; n > cursor; n--)
-		ids[n] = ids[n-1];
-	ids[n] = pid;
-	return 0;
+	if (x->rs_pid != y->rs_pid)
+		return x->rs_pid < y->rs_pid ? -1 : 1;
+	return (x->rs_slot > y->rs_slot) - (x->rs_slot < y->rs_slot);
 }
 
 int ESECT
@@ -10132,54 +14308,72 @@ mdb_reader_check(MDB_env *env, int *dead)
 	return env->me_txns ? mdb_reader_check0(env, 0, dead) : MDB_SUCCESS;
 }
 
-/** As #mdb_reader_check(). \b rlocked is set if caller locked #me_rmutex. */
+/** As #mdb_reader_check(). \b rlocked is set if caller locked #me_rmutex.
+ *	The slots of other processes are sorted by pid, so that each
+ *	process is checked once however large the table is.
+ */
 static int ESECT
 mdb_reader_check0(MDB_env *env, int rlocked, int *dead)
 {
 	mdb_mutexref_t rmutex = rlocked ? NULL : env->me_rmutex;
-	unsigned int i, j, rdrs;
+	MDB_txninfo *ti = env->me_txns;
+	unsigned int i, j, k, n, rdrs;
 	MDB_reader *mr;
-	MDB_PID_T *pids, pid;
+	MDB_rslot *slots;
+	MDB_PID_T pid;
 	int rc = MDB_SUCCESS, count = 0;
 
-	rdrs = env->me_txns->mti_numreaders;
-	pids = malloc((rdrs+1) * sizeof(MDB_PID_T));
-	if (!pids)
+	rdrs = ti->mti_numreaders;
+	slots = malloc((rdrs+1) * sizeof(MDB_rslot));
+	if (!slots)
 		return ENOMEM;
-	pids[0] = 0;
-	mr = env->me_txns->mti_readers;
-	for (i=0; i<rdrs; i++) {
+	mr = ti->mti_readers;
+	for (i = n = 0; i < rdrs; i++) {
 		pid = mr[i].mr_pid;
 		if (pid && pid != env->me_pid) {
-			if (mdb_pid_insert(pids, pid) == 0) {
-				if (!mdb_reader_pid(env, Pidcheck, pid)) {
-					/* Stale reader found */
-					j = i;
-					if (rmutex) {
-						if ((rc = LOCK_MUTEX0(rmutex)) != 0) {
-							if ((rc = mdb_mutex_failed(env, rmutex, rc)))
-								break;
-							rdrs = 0; /* the above checked all readers */
-						} else {
-							/* Recheck, a new process may have reused pid */
-							if (mdb_reader_pid(env, Pidcheck, pid))
-								j = rdrs;
-						}
-					}
-					for (; j<rdrs; j++)
-							if (mr[j].mr_pid == pid) {
-								DPRINTF(("clear stale reader pid %u txn %"Z"d",
-									(unsigned) pid, mr[j].mr_txnid));
-								mr[j].mr_pid = 0;
-								count++;
-							}
-					if (rmutex)
-						UNLOCK_MUTEX(rmutex);
-				}
+			slots[n].rs_pid = pid;
+			slots[n++].rs_slot = i;
+		}
+	}
+	qsort(slots, n, sizeof(MDB_rslot), mdb_rslot_cmp);
+
+	for (i = 0; i < n; i = j) {
+		pid = slots[i].rs_pid;
+		for (j = i+1; j < n && slots[j].rs_pid == pid; j++) ;
+		if (mdb_reader_pid(env, Pidcheck, pid))
+			continue;
+		/* Stale reader found */
+		if (rmutex) {
+			if ((rc = LOCK_MUTEX0(rmutex)) != 0) {
+				if ((rc = mdb_mutex_failed(env, rmutex, rc)))
+					break;
+				/* the above checked all readers */
+				UNLOCK_MUTEX(rmutex);
+				break;
+			}
+			/* Recheck, a new process may have reused pid */
+			if (mdb_reader_pid(env, Pidcheck, pid)) {
+				UNLOCK_MUTEX(rmutex);
+				continue;
+			}
+		}
+		/* Only clear the slots seen with this pid. Any other slot
+		 * with it was claimed since, by a process that reused it.
+		 */
+		for (k = i; k < j; k++) {
+			MDB_reader *r = &mr[slots[k].rs_slot];
+			if (MDB_CAS(&r->mr_pid, pid, 0)) {
+				DPRINTF(("clear stale reader pid %u txn %"Z"d",
+					(unsigned) pid, r->mr_txnid));
+				if (slots[k].rs_slot < ti->mti_rfree)
+					ti->mti_rfree = slots[k].rs_slot;
+				count++;
 			}
 		}
+		if (rmutex)
+			UNLOCK_MUTEX(rmutex);
 	}
-	free(pids);
+	free(slots);
 	if (dead)
 		*dead = count;
 	return rc;
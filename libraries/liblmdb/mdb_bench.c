@@ -0,0 +1,611 @@
+/* mdb_bench.c - memory-mapped database benchmark */
+/*
+ * Copyright 2011-2018 Howard Chu, Symas Corp.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Runs a list of workloads against the environment in dbpath, which
+ * must exist, and prints one tab separated line per workload:
+ *
+ *	workload threads ops secs ops/s p50 p90 p99 p99.9 max pages
+ *
+ * Latencies are in nanoseconds and include the commit of a write
+ * transaction in the operation that ends it. pages is the size of
+ * the database in pages after the workload. Keys and random choices
+ * come from a seeded generator, so runs with the same options do the
+ * same operations.
+ *
+ * Workloads, run in the given order:
+ *	fillseq		put records in key order
+ *	fillappend	the same with #MDB_APPEND
+ *	fillrandom	put records in random order
+ *	readseq		read all records with a cursor
+ *	readrandom	get random records
+ *	dupput		put random duplicates in a #MDB_DUPSORT DB
+ *	dupdel		delete them again in another random order
+ *	mixed		get random records in several threads while
+ *			one thread overwrites random records
+ *	overwrite	overwrite random records
+ *	longread	overwrite random records while an old reader
+ *			keeps their pages from being reused
+ *
+ * The fill workloads start from an empty DB, the others use the
+ * records left by an earlier fill workload.
+ *
+ * Usage: mdb_bench [-V] [-S] [-W] [-n records] [-k keysize]
+ *	[-v valsize] [-b batch] [-d dups] [-t threads] [-m mapsize]
+ *	[-r seed] [-w workload,...] dbpath
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "lmdb.h"
+
+#ifdef	_WIN32
+#define	Z	"I"
+#else
+#define	Z	"z"
+#endif
+
+#define E(expr) CHECK((rc = (expr)) == MDB_SUCCESS, #expr)
+#define CHECK(test, msg) ((test) ? (void)0 : ((void)fprintf(stderr, \
+	"%s: %s: %s\n", prog, msg, mdb_strerror(rc)), exit(EXIT_FAILURE)))
+
+static char *prog;
+static MDB_env *env;
+static MDB_dbi dbi, dupdbi;
+static unsigned int nrecs = 100000, ksize = 16, vsize = 100;
+static unsigned int batch = 1000, ndups = 50, nthreads = 4;
+static unsigned long seed = 1;
+static unsigned int *order;
+
+/* Latencies of one thread */
+typedef struct lat {
+	unsigned int *l_ns;
+	size_t l_num, l_max;
+} lat;
+
+static unsigned long long
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+lat_add(lat *l, unsigned long long ns)
+{
+	if (l->l_num == l->l_max) {
+		l->l_max = l->l_max ? l->l_max * 2 : 1024;
+		l->l_ns = realloc(l->l_ns, l->l_max * sizeof(unsigned int));
+		if (!l->l_ns) {
+			fprintf(stderr, "%s: out of memory\n", prog);
+			exit(EXIT_FAILURE);
+		}
+	}
+	l->l_ns[l->l_num++] = ns > ~0U ? ~0U : (unsigned int)ns;
+}
+
+static int
+uintcmp(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+	return x < y ? -1 : x > y;
+}
+
+/* Print the line of a workload from the latencies of its threads */
+static void
+report(const char *name, lat *l, int nl, double secs)
+{
+	int rc, i;
+	lat all = {0};
+	MDB_envinfo info;
+	static const double pct[] = { 0.5, 0.9, 0.99, 0.999, 1 };
+
+	for (i=0; i<nl; i++) {
+		size_t j;
+		for (j=0; j<l[i].l_num; j++)
+			lat_add(&all, l[i].l_ns[j]);
+		free(l[i].l_ns);
+		l[i].l_ns = NULL;
+		l[i].l_num = l[i].l_max = 0;
+	}
+	E(mdb_env_info(env, &info));
+	qsort(all.l_ns, all.l_num, sizeof(unsigned int), uintcmp);
+	printf("%s\t%d\t%"Z"u\t%.3f\t%.0f", name, nl, all.l_num, secs,
+		secs > 0 ? all.l_num / secs : 0);
+	for (i=0; i<5; i++)
+		printf("\t%u", all.l_num ?
+			all.l_ns[(size_t)(pct[i] * (all.l_num - 1))] : 0);
+	printf("\t%"Z"u\n", info.me_last_pgno + 1);
+	fflush(stdout);
+	free(all.l_ns);
+}
+
+/* xorshift64*, with one state per thread */
+static unsigned int
+rnd(unsigned long long *state)
+{
+	unsigned long long x = *state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return (unsigned int)((x * 2685821657736338717ULL) >> 32);
+}
+
+static unsigned long long
+rnd_init(int thread)
+{
+	return (seed + 1) * 0x9E3779B97F4A7C15ULL + thread;
+}
+
+static void
+mkkey(MDB_val *key, char *buf, unsigned int i)
+{
+	key->mv_size = ksize;
+	key->mv_data = buf;
+	sprintf(buf, "%0*u", ksize, i);
+}
+
+static void
+mkval(MDB_val *data, char *buf, unsigned int i)
+{
+	data->mv_size = vsize;
+	data->mv_data = buf;
+	memset(buf, 'a' + i % 26, vsize);
+}
+
+/* Put the records in the given order, \b batch to a transaction */
+static void
+fill(const char *name, unsigned int *keys, unsigned int flags)
+{
+	int rc;
+	unsigned int i;
+	MDB_txn *txn = NULL;
+	MDB_val key, data;
+	char kbuf[512], *vbuf = malloc(vsize);
+	unsigned long long t0, start;
+	lat l = {0};
+
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	E(mdb_drop(txn, dbi, 0));
+	E(mdb_txn_commit(txn));
+
+	start = now();
+	for (i=0; i<nrecs; i++) {
+		t0 = now();
+		if (i % batch == 0)
+			E(mdb_txn_begin(env, NULL, 0, &txn));
+		mkkey(&key, kbuf, keys ? keys[i] : i);
+		mkval(&data, vbuf, keys ? keys[i] : i);
+		E(mdb_put(txn, dbi, &key, &data, flags));
+		if ((i + 1) % batch == 0 || i + 1 == nrecs)
+			E(mdb_txn_commit(txn));
+		lat_add(&l, now() - t0);
+	}
+	report(name, &l, 1, (now() - start) / 1e9);
+	free(vbuf);
+}
+
+static void
+wl_fillseq(const char *name)
+{
+	fill(name, NULL, 0);
+}
+
+static void
+wl_fillappend(const char *name)
+{
+	fill(name, NULL, MDB_APPEND);
+}
+
+static void
+wl_fillrandom(const char *name)
+{
+	fill(name, order, 0);
+}
+
+/* The records of the fill workloads must be there */
+static void
+check_filled(void)
+{
+	int rc;
+	MDB_txn *txn;
+	MDB_stat st;
+
+	E(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn));
+	E(mdb_stat(txn, dbi, &st));
+	mdb_txn_abort(txn);
+	if (st.ms_entries != nrecs) {
+		fprintf(stderr, "%s: DB has %"Z"u records instead of %u, "
+			"run a fill workload first\n", prog, st.ms_entries, nrecs);
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void
+wl_readseq(const char *name)
+{
+	int rc;
+	MDB_txn *txn;
+	MDB_cursor *mc;
+	MDB_val key, data;
+	unsigned long long t0, start;
+	lat l = {0};
+
+	check_filled();
+	E(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn));
+	E(mdb_cursor_open(txn, dbi, &mc));
+	start = now();
+	for (;;) {
+		t0 = now();
+		rc = mdb_cursor_get(mc, &key, &data, MDB_NEXT);
+		if (rc == MDB_NOTFOUND)
+			break;
+		E(rc);
+		lat_add(&l, now() - t0);
+	}
+	report(name, &l, 1, (now() - start) / 1e9);
+	mdb_cursor_close(mc);
+	mdb_txn_abort(txn);
+}
+
+/* Get random records until \b n are read or \b *stop is set,
+ * renewing the read transaction every \b batch gets.
+ */
+static void
+readrandom(lat *l, int thread, unsigned int n, volatile int *stop)
+{
+	int rc;
+	unsigned int i;
+	MDB_txn *txn;
+	MDB_val key, data;
+	char kbuf[512];
+	unsigned long long t0, state = rnd_init(thread);
+
+	E(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn));
+	for (i=0; n ? i < n : !*stop; i++) {
+		t0 = now();
+		if (i && i % batch == 0) {
+			mdb_txn_reset(txn);
+			E(mdb_txn_renew(txn));
+		}
+		mkkey(&key, kbuf, rnd(&state) % nrecs);
+		E(mdb_get(txn, dbi, &key, &data));
+		lat_add(l, now() - t0);
+	}
+	mdb_txn_abort(txn);
+}
+
+static void
+wl_readrandom(const char *name)
+{
+	unsigned long long start;
+	lat l = {0};
+
+	check_filled();
+	start = now();
+	readrandom(&l, 0, nrecs, NULL);
+	report(name, &l, 1, (now() - start) / 1e9);
+}
+
+/* Duplicate \b j is data j % ndups of key j / ndups */
+static void
+mkdup(MDB_val *key, char *kbuf, MDB_val *data, char *dbuf, unsigned int j)
+{
+	mkkey(key, kbuf, j / ndups);
+	data->mv_size = sprintf(dbuf, "%08u", j % ndups);
+	data->mv_data = dbuf;
+}
+
+static void
+dups(const char *name, int del)
+{
+	int rc;
+	unsigned int i, j;
+	MDB_txn *txn = NULL;
+	MDB_val key, data;
+	char kbuf[512], dbuf[16];
+	unsigned long long t0, start;
+	lat l = {0};
+
+	if (!del) {
+		E(mdb_txn_begin(env, NULL, 0, &txn));
+		E(mdb_drop(txn, dupdbi, 0));
+		E(mdb_txn_commit(txn));
+	}
+	start = now();
+	for (i=0; i<nrecs; i++) {
+		t0 = now();
+		if (i % batch == 0)
+			E(mdb_txn_begin(env, NULL, 0, &txn));
+		/* Delete in the reverse of the put order, which is
+		 * just as random but not the same
+		 */
+		j = order[del ? nrecs - 1 - i : i];
+		mkdup(&key, kbuf, &data, dbuf, j);
+		if (del)
+			E(mdb_del(txn, dupdbi, &key, &data));
+		else
+			E(mdb_put(txn, dupdbi, &key, &data, 0));
+		if ((i + 1) % batch == 0 || i + 1 == nrecs)
+			E(mdb_txn_commit(txn));
+		lat_add(&l, now() - t0);
+	}
+	report(name, &l, 1, (now() - start) / 1e9);
+}
+
+static void
+wl_dupput(const char *name)
+{
+	dups(name, 0);
+}
+
+static void
+wl_dupdel(const char *name)
+{
+	dups(name, 1);
+}
+
+/* Overwrite \b n random records, \b batch to a transaction */
+static void
+overwrite(lat *l, int thread, unsigned int n)
+{
+	int rc;
+	unsigned int i, k;
+	MDB_txn *txn = NULL;
+	MDB_val key, data;
+	char kbuf[512], *vbuf = malloc(vsize);
+	unsigned long long t0, state = rnd_init(thread);
+
+	for (i=0; i<n; i++) {
+		t0 = now();
+		if (i % batch == 0)
+			E(mdb_txn_begin(env, NULL, 0, &txn));
+		k = rnd(&state) % nrecs;
+		mkkey(&key, kbuf, k);
+		mkval(&data, vbuf, k + 1);
+		E(mdb_put(txn, dbi, &key, &data, 0));
+		if ((i + 1) % batch == 0 || i + 1 == n)
+			E(mdb_txn_commit(txn));
+		lat_add(l, now() - t0);
+	}
+	free(vbuf);
+}
+
+typedef struct reader {
+	pthread_t r_thr;
+	int r_num;
+	lat r_lat;
+} reader;
+
+static volatile int writing;
+
+static void *
+reader_thr(void *arg)
+{
+	reader *r = arg;
+
+	readrandom(&r->r_lat, r->r_num, 0, &writing);
+	return NULL;
+}
+
+static void
+wl_mixed(const char *name)
+{
+	unsigned int i;
+	unsigned long long start;
+	reader *r = calloc(nthreads, sizeof(reader));
+	lat wl = {0}, *rl = calloc(nthreads, sizeof(lat));
+	char rname[64];
+
+	check_filled();
+	writing = 0;
+	start = now();
+	for (i=0; i<nthreads; i++) {
+		r[i].r_num = i + 1;
+		pthread_create(&r[i].r_thr, NULL, reader_thr, &r[i]);
+	}
+	overwrite(&wl, 0, nrecs / 10);
+	writing = 1;
+	for (i=0; i<nthreads; i++) {
+		pthread_join(r[i].r_thr, NULL);
+		rl[i] = r[i].r_lat;
+	}
+	sprintf(rname, "%s.read", name);
+	report(rname, rl, nthreads, (now() - start) / 1e9);
+	sprintf(rname, "%s.write", name);
+	report(rname, &wl, 1, (now() - start) / 1e9);
+	free(rl);
+	free(r);
+}
+
+static void
+wl_overwrite(const char *name)
+{
+	unsigned long long start;
+	lat l = {0};
+
+	check_filled();
+	start = now();
+	overwrite(&l, 0, nrecs);
+	report(name, &l, 1, (now() - start) / 1e9);
+}
+
+static void
+wl_longread(const char *name)
+{
+	int rc;
+	MDB_txn *txn;
+	MDB_val key, data;
+	char kbuf[512];
+	unsigned long long start;
+	lat l = {0};
+
+	check_filled();
+	/* Pin the current snapshot, MDB_NOTLS lets this thread write too */
+	E(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn));
+	mkkey(&key, kbuf, 0);
+	E(mdb_get(txn, dbi, &key, &data));
+	start = now();
+	overwrite(&l, 0, nrecs);
+	report(name, &l, 1, (now() - start) / 1e9);
+	mdb_txn_abort(txn);
+}
+
+static const struct workload {
+	const char *w_name;
+	void (*w_func)(const char *name);
+} workloads[] = {
+	{ "fillseq", wl_fillseq },
+	{ "fillappend", wl_fillappend },
+	{ "fillrandom", wl_fillrandom },
+	{ "readseq", wl_readseq },
+	{ "readrandom", wl_readrandom },
+	{ "dupput", wl_dupput },
+	{ "dupdel", wl_dupdel },
+	{ "mixed", wl_mixed },
+	{ "overwrite", wl_overwrite },
+	{ "longread", wl_longread },
+	{ NULL, NULL }
+};
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: %s [-V] [-S] [-W] [-n records] [-k keysize] "
+		"[-v valsize] [-b batch] [-d dups] [-t threads] [-m mapsize] "
+		"[-r seed] [-w workload,...] dbpath\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	int i, rc;
+	MDB_txn *txn;
+	unsigned int envflags = MDB_NOTLS|MDB_NOSYNC, j, k;
+	size_t mapsize = 1024;
+	char *list = NULL, *name, *last;
+	const struct workload *w;
+
+	prog = argv[0];
+
+	while ((i = getopt(argc, argv, "SVWb:d:k:m:n:r:t:v:w:")) != EOF) {
+		switch(i) {
+		case 'V':
+			printf("%s\n", MDB_VERSION_STRING);
+			exit(0);
+			break;
+		case 'S':
+			envflags &= ~MDB_NOSYNC;
+			break;
+		case 'W':
+			envflags |= MDB_WRITEMAP;
+			break;
+		case 'b':
+			batch = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			ndups = strtoul(optarg, NULL, 0);
+			break;
+		case 'k':
+			ksize = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			mapsize = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			nrecs = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			nthreads = strtoul(optarg, NULL, 0);
+			break;
+		case 'v':
+			vsize = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			list = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (optind != argc - 1 || !nrecs || !batch || !ndups || !nthreads ||
+		!mapsize || ksize < 10 || ksize > 511 || !vsize)
+		usage();
+
+	/* The same random order for every run with this seed */
+	order = malloc(nrecs * sizeof(unsigned int));
+	if (!order) {
+		fprintf(stderr, "%s: out of memory\n", prog);
+		exit(EXIT_FAILURE);
+	}
+	{
+		unsigned long long state = rnd_init(0);
+		for (j=0; j<nrecs; j++)
+			order[j] = j;
+		for (j=nrecs-1; j>0; j--) {
+			unsigned int t = order[j];
+			k = rnd(&state) % (j + 1);
+			order[j] = order[k];
+			order[k] = t;
+		}
+	}
+
+	E(mdb_env_create(&env));
+	E(mdb_env_set_mapsize(env, mapsize * 1024 * 1024));
+	E(mdb_env_set_maxdbs(env, 2));
+	E(mdb_env_set_maxreaders(env, nthreads + 2));
+	rc = mdb_env_open(env, argv[optind], envflags, 0664);
+	CHECK(rc == MDB_SUCCESS, argv[optind]);
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	E(mdb_dbi_open(txn, "bench", MDB_CREATE, &dbi));
+	E(mdb_dbi_open(txn, "dups", MDB_CREATE|MDB_DUPSORT, &dupdbi));
+	E(mdb_txn_commit(txn));
+
+	printf("# %s records=%u keysize=%u valsize=%u batch=%u dups=%u "
+		"threads=%u seed=%lu%s%s\n", MDB_VERSION_STRING, nrecs, ksize,
+		vsize, batch, ndups, nthreads, seed,
+		envflags & MDB_NOSYNC ? "" : " sync",
+		envflags & MDB_WRITEMAP ? " writemap" : "");
+	printf("# workload\tthreads\tops\tsecs\tops/s\tp50\tp90\tp99\tp99.9\tmax\tpages\n");
+
+	if (list) {
+		for (name = strtok_r(list, ",", &last); name;
+			name = strtok_r(NULL, ",", &last)) {
+			for (w = workloads; w->w_name; w++)
+				if (!strcmp(w->w_name, name))
+					break;
+			if (!w->w_name) {
+				fprintf(stderr, "%s: unknown workload %s\n", prog, name);
+				exit(EXIT_FAILURE);
+			}
+			w->w_func(name);
+		}
+	} else {
+		for (w = workloads; w->w_name; w++)
+			w->w_func(w->w_name);
+	}
+
+	mdb_env_close(env);
+	free(order);
+	return 0;
+}
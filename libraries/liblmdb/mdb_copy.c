@@ -19,6 +19,7 @@
 #endif
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <signal.h>
 #include "lmdb.h"
 
@@ -30,17 +31,26 @@ sighandle(int sig)
 int main(int argc,char * argv[])
 {
 	int rc;
-	MDB_env *env;
-	const char *progname = argv[0], *act;
+	MDB_env *env, *base = NULL;
+	const char *progname = argv[0], *act, *basepath = NULL;
 	unsigned flags = MDB_RDONLY;
 	unsigned cpflags = 0;
+	int nthreads = 1;
 
 	for (; argc > 1 && argv[1][0] == '-'; argc--, argv++) {
 		if (argv[1][1] == 'n' && argv[1][2] == '\0')
 			flags |= MDB_NOSUBDIR;
 		else if (argv[1][1] == 'c' && argv[1][2] == '\0')
 			cpflags |= MDB_CP_COMPACT;
-		else if (argv[1][1] == 'V' && argv[1][2] == '\0') {
+		else if (argv[1][1] == 'x' && argv[1][2] == '\0')
+			cpflags |= MDB_CP_COMPACT|MDB_CP_EXTFREE;
+		else if (argv[1][1] == 'j' && argv[1][2] == '\0' && argc > 2) {
+			nthreads = atoi(argv[2]);
+			argc--, argv++;
+		} else if (argv[1][1] == 'd' && argv[1][2] == '\0' && argc > 2) {
+			basepath = argv[2];
+			argc--, argv++;
+		} else if (argv[1][1] == 'V' && argv[1][2] == '\0') {
 			printf("%s\n", MDB_VERSION_STRING);
 			exit(0);
 		} else
@@ -48,7 +58,7 @@ int main(int argc,char * argv[])
 	}
 
 	if (argc<2 || argc>3) {
-		fprintf(stderr, "usage: %s [-V] [-c] [-n] srcpath [dstpath]\n", progname);
+		fprintf(stderr, "usage: %s [-V] [-c] [-x] [-j threads] [-d basepath] [-n] srcpath [dstpath]\n", progname);
 		exit(EXIT_FAILURE);
 	}
 
@@ -66,12 +76,26 @@ int main(int argc,char * argv[])
 	if (rc == MDB_SUCCESS) {
 		rc = mdb_env_open(env, argv[1], flags, 0600);
 	}
-	if (rc == MDB_SUCCESS) {
+	if (rc == MDB_SUCCESS && basepath) {
+		act = "opening earlier copy";
+		rc = mdb_env_create(&base);
+		if (rc == MDB_SUCCESS)
+			rc = mdb_env_open(base, basepath,
+				(flags & MDB_NOSUBDIR) | MDB_RDONLY | MDB_NOLOCK, 0600);
+		if (rc == MDB_SUCCESS) {
+			act = "writing delta";
+			if (argc == 3 && !freopen(argv[2], "wb", stdout))
+				rc = errno;
+			else
+				rc = mdb_env_delta(env, base, MDB_STDOUT);
+		}
+		mdb_env_close(base);
+	} else if (rc == MDB_SUCCESS) {
 		act = "copying";
 		if (argc == 2)
-			rc = mdb_env_copyfd2(env, MDB_STDOUT, cpflags);
+			rc = mdb_env_copyfd3(env, MDB_STDOUT, cpflags, nthreads);
 		else
-			rc = mdb_env_copy2(env, argv[2], cpflags);
+			rc = mdb_env_copy3(env, argv[2], cpflags, nthreads);
 	}
 	if (rc)
 		fprintf(stderr, "%s: %s failed, error %d (%s)\n",
@@ -41,6 +41,7 @@ flagbit dbflags[] = {
 	{ MDB_DUPFIXED, "dupfixed" },
 	{ MDB_INTEGERDUP, "integerdup" },
 	{ MDB_REVERSEDUP, "reversedup" },
+	{ MDB_PREFIXKEYS, "prefixkeys" },
 	{ 0, NULL }
 };
 
@@ -61,6 +61,7 @@ flagbit dbflags[] = {
 	{ MDB_DUPFIXED, S("dupfixed") },
 	{ MDB_INTEGERDUP, S("integerdup") },
 	{ MDB_REVERSEDUP, S("reversedup") },
+	{ MDB_PREFIXKEYS, S("prefixkeys") },
 	{ 0, NULL, 0 }
 };
 
@@ -68,6 +69,7 @@ static void readhdr(void)
 {
 	char *ptr;
 
+	flags = 0;
 	while (fgets(dbuf.mv_data, dbuf.mv_size, stdin) != NULL) {
 		lineno++;
 		if (!strncmp(dbuf.mv_data, "VERSION=", STRLENOF("VERSION="))) {
@@ -277,7 +279,7 @@ badend:
 
 static void usage(void)
 {
-	fprintf(stderr, "usage: %s [-V] [-f input] [-n] [-s name] [-N] [-T] dbpath\n", prog);
+	fprintf(stderr, "usage: %s [-V] [-a] [-f input] [-n] [-s name] [-N] [-T] dbpath\n", prog);
 	exit(EXIT_FAILURE);
 }
 
@@ -286,11 +288,12 @@ int main(int argc, char *argv[])
 	int i, rc;
 	MDB_env *env;
 	MDB_txn *txn;
-	MDB_cursor *mc;
+	MDB_cursor *mc = NULL;
+	MDB_bulk *mb = NULL;
 	MDB_dbi dbi;
 	char *envname;
 	int envflags = 0, putflags = 0;
-	int dohdr = 0;
+	int dohdr = 0, append = 0;
 
 	prog = argv[0];
 
@@ -298,15 +301,19 @@ int main(int argc, char *argv[])
 		usage();
 	}
 
-	/* -f: load file instead of stdin
+	/* -a: input is sorted, build the DB with mdb_bulk_put
+	 * -f: load file instead of stdin
 	 * -n: use NOSUBDIR flag on env_open
 	 * -s: load into named subDB
 	 * -N: use NOOVERWRITE on puts
 	 * -T: read plaintext
 	 * -V: print version and exit
 	 */
-	while ((i = getopt(argc, argv, "f:ns:NTV")) != EOF) {
+	while ((i = getopt(argc, argv, "af:ns:NTV")) != EOF) {
 		switch(i) {
+		case 'a':
+			append = 1;
+			break;
 		case 'V':
 			printf("%s\n", MDB_VERSION_STRING);
 			exit(0);
@@ -374,7 +381,6 @@ int main(int argc, char *argv[])
 	while(!Eof) {
 		MDB_val key, data;
 		int batch = 0;
-		flags = 0;
 
 		if (!dohdr) {
 			dohdr = 1;
@@ -393,10 +399,18 @@ int main(int argc, char *argv[])
 			goto txn_abort;
 		}
 
-		rc = mdb_cursor_open(txn, dbi, &mc);
-		if (rc) {
-			fprintf(stderr, "mdb_cursor_open failed, error %d %s\n", rc, mdb_strerror(rc));
-			goto txn_abort;
+		if (append) {
+			rc = mdb_bulk_open(txn, dbi, &mb);
+			if (rc) {
+				fprintf(stderr, "mdb_bulk_open failed, error %d %s\n", rc, mdb_strerror(rc));
+				goto txn_abort;
+			}
+		} else {
+			rc = mdb_cursor_open(txn, dbi, &mc);
+			if (rc) {
+				fprintf(stderr, "mdb_cursor_open failed, error %d %s\n", rc, mdb_strerror(rc));
+				goto txn_abort;
+			}
 		}
 
 		while(1) {
@@ -410,6 +424,20 @@ int main(int argc, char *argv[])
 				goto txn_abort;
 			}
 
+			if (append) {
+				/* With -N, skip anything at or before the last key */
+				rc = mdb_bulk_put(mb, &key, &data, 0);
+				if (rc == MDB_KEYEXIST && putflags)
+					continue;
+				if (rc) {
+					fprintf(stderr, "%s: line %" Z "d: mdb_bulk_put failed, error %d %s\n",
+						prog, lineno, rc, rc == MDB_KEYEXIST ? "input is not sorted" :
+						mdb_strerror(rc));
+					goto txn_abort;
+				}
+				/* A bulk load is done in a single txn */
+				continue;
+			}
 			rc = mdb_cursor_put(mc, &key, &data, putflags);
 			if (rc == MDB_KEYEXIST && putflags)
 				continue;
@@ -438,6 +466,14 @@ int main(int argc, char *argv[])
 				batch = 0;
 			}
 		}
+		if (mb) {
+			rc = mdb_bulk_close(mb);
+			mb = NULL;
+			if (rc) {
+				fprintf(stderr, "mdb_bulk_close failed, error %d %s\n", rc, mdb_strerror(rc));
+				goto txn_abort;
+			}
+		}
 		rc = mdb_txn_commit(txn);
 		txn = NULL;
 		if (rc) {
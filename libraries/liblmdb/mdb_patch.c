@@ -0,0 +1,85 @@
+/* mdb_patch.c - memory-mapped database incremental restore tool */
+/*
+ * Copyright 2012-2018 Howard Chu, Symas Corp.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+#ifdef _WIN32
+#include <windows.h>
+#define	MDB_STDIN	GetStdHandle(STD_INPUT_HANDLE)
+#else
+#define	MDB_STDIN	0
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include "lmdb.h"
+
+static void
+sighandle(int sig)
+{
+}
+
+int main(int argc,char * argv[])
+{
+	int i, rc;
+	MDB_env *env;
+	const char *progname = argv[0], *act;
+	unsigned flags = MDB_NOLOCK;
+
+	for (; argc > 1 && argv[1][0] == '-'; argc--, argv++) {
+		if (argv[1][1] == 'n' && argv[1][2] == '\0')
+			flags |= MDB_NOSUBDIR;
+		else if (argv[1][1] == 'V' && argv[1][2] == '\0') {
+			printf("%s\n", MDB_VERSION_STRING);
+			exit(0);
+		} else
+			argc = 0;
+	}
+
+	if (argc<2) {
+		fprintf(stderr, "usage: %s [-V] [-n] dbpath [delta ...]\n", progname);
+		exit(EXIT_FAILURE);
+	}
+
+#ifdef SIGPIPE
+	signal(SIGPIPE, sighandle);
+#endif
+#ifdef SIGHUP
+	signal(SIGHUP, sighandle);
+#endif
+	signal(SIGINT, sighandle);
+	signal(SIGTERM, sighandle);
+
+	/* Each delta changes the meta page, so reopen the copy for each */
+	i = 2;
+	do {
+		act = "opening environment";
+		rc = mdb_env_create(&env);
+		if (rc == MDB_SUCCESS)
+			rc = mdb_env_open(env, argv[1], flags, 0600);
+		if (rc == MDB_SUCCESS) {
+			act = "applying delta";
+			if (i < argc && !freopen(argv[i], "rb", stdin))
+				rc = errno;
+			else
+				rc = mdb_env_apply(env, MDB_STDIN);
+		}
+		mdb_env_close(env);
+		if (rc) {
+			fprintf(stderr, "%s: %s %s failed, error %d (%s)\n",
+				progname, act, i < argc ? argv[i] : "", rc, mdb_strerror(rc));
+			break;
+		}
+	} while (++i < argc);
+
+	return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+}
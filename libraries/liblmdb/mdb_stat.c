@@ -35,9 +35,236 @@ static void prstat(MDB_stat *ms)
 	printf("  Entries: %"Z"u\n", ms->ms_entries);
 }
 
+/* Space usage of a DB, gathered by mdb_page_walk() */
+typedef struct pgstat {
+	size_t ps_pages[3];		/* branch, leaf and overflow pages */
+	size_t ps_used[3];		/* bytes in use in them */
+	size_t ps_fill[2][10];	/* branch and leaf pages by tenths full */
+	size_t ps_ovvals;		/* values on overflow pages */
+	size_t ps_ovsize[32];	/* and by log2 of their number of pages */
+	size_t ps_dups;			/* pages of sorted-duplicate subtrees */
+} pgstat;
+
+static unsigned int psize;
+
+static int pgcount(const MDB_pginfo *pi, void *ctx)
+{
+	pgstat *ps = ctx;
+	size_t i;
+	int t;
+
+	if (pi->pi_type & MDB_PG_DUPSORT)
+		ps->ps_dups += pi->pi_pages;
+	if (pi->pi_type & MDB_PG_OVERFLOW) {
+		t = 2;
+		ps->ps_ovvals++;
+		for (i = 0; (size_t)2 << i <= pi->pi_pages; i++) ;
+		ps->ps_ovsize[i]++;
+	} else {
+		t = (pi->pi_type & MDB_PG_BRANCH) ? 0 : 1;
+		i = pi->pi_used * 10 / psize;
+		ps->ps_fill[t][i > 9 ? 9 : i]++;
+	}
+	ps->ps_pages[t] += pi->pi_pages;
+	ps->ps_used[t] += pi->pi_used;
+	return 0;
+}
+
+static void prpages(pgstat *ps, MDB_stat *ms)
+{
+	static const char *type[] = { "Branch", "Leaf", "Overflow" };
+	size_t i, j, total;
+
+	total = ps->ps_pages[0] + ps->ps_pages[1] + ps->ps_pages[2];
+	if (!total)
+		return;
+	printf("  Page usage:\n");
+	for (i=0; i<3; i++) {
+		if (!ps->ps_pages[i])
+			continue;
+		printf("    %s pages: %"Z"u", type[i], ps->ps_pages[i]);
+		if (i == 2)
+			printf(" for %"Z"u values", ps->ps_ovvals);
+		printf(", %.1f%% full\n",
+			100.0 * ps->ps_used[i] / ((double)ps->ps_pages[i] * psize));
+	}
+	if (ps->ps_dups)
+		printf("    Sorted-duplicate subtree pages: %"Z"u\n", ps->ps_dups);
+	if (ms->ms_entries)
+		printf("    Bytes per entry: %.1f\n",
+			(double)total * psize / ms->ms_entries);
+	printf("    Fill    ");
+	for (j=0; j<10; j++)
+		printf("%6"Z"u%%", j * 10);
+	printf("\n");
+	for (i=0; i<2; i++) {
+		printf("      %-6s", type[i]);
+		for (j=0; j<10; j++)
+			printf("%7"Z"u", ps->ps_fill[i][j]);
+		printf("\n");
+	}
+	if (ps->ps_ovvals) {
+		printf("    Overflow values by pages:");
+		for (i=0; i<32; i++) {
+			if (!ps->ps_ovsize[i])
+				continue;
+			if (i)
+				printf(" %"Z"u-%"Z"u: %"Z"u", (size_t)1 << i,
+					((size_t)2 << i) - 1, ps->ps_ovsize[i]);
+			else
+				printf(" 1: %"Z"u", ps->ps_ovsize[i]);
+		}
+		printf("\n");
+	}
+}
+
+/* Runs of free pages */
+typedef struct extent {
+	size_t e_pg, e_n;
+} extent;
+
+static extent *exts;
+static size_t nexts, maxexts;
+
+static void addext(size_t pg, size_t n)
+{
+	if (nexts == maxexts) {
+		maxexts = maxexts ? maxexts * 2 : 1024;
+		exts = realloc(exts, maxexts * sizeof(extent));
+		if (!exts) {
+			fprintf(stderr, "out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	exts[nexts].e_pg = pg;
+	exts[nexts++].e_n = n;
+}
+
+static int extcmp(const void *a, const void *b)
+{
+	size_t x = ((const extent *)a)->e_pg, y = ((const extent *)b)->e_pg;
+	return x < y ? -1 : x > y;
+}
+
+/* Merge adjacent free pages of all transactions, and print how
+ * many runs of each length there are.
+ */
+static void prextents(void)
+{
+	size_t i, j, n, max = 0, hist[64] = {0};
+
+	if (!nexts)
+		return;
+	qsort(exts, nexts, sizeof(extent), extcmp);
+	for (i=0, j=0; i<nexts; i++) {
+		if (j && exts[j-1].e_pg + exts[j-1].e_n == exts[i].e_pg)
+			exts[j-1].e_n += exts[i].e_n;
+		else
+			exts[j++] = exts[i];
+	}
+	for (i=0; i<j; i++) {
+		n = exts[i].e_n;
+		if (n > max)
+			max = n;
+		for (n = 0; (size_t)2 << n <= exts[i].e_n; n++) ;
+		hist[n]++;
+	}
+	printf("  Free extents: %"Z"u, largest %"Z"u pages\n", j, max);
+	printf("   ");
+	for (i=0; i<64; i++) {
+		if (!hist[i])
+			continue;
+		if (i)
+			printf(" %"Z"u-%"Z"u: %"Z"u", (size_t)1 << i,
+				((size_t)2 << i) - 1, hist[i]);
+		else
+			printf(" 1: %"Z"u", hist[i]);
+	}
+	printf("\n");
+	free(exts);
+}
+
+/* back-mdb names its indices after their attribute */
+static const char *const backmdb[][2] = {
+	{ "ad2i", "attribute descriptions" },
+	{ "dn2i", "DN index" },
+	{ "id2e", "entries" },
+	{ "id2v", "multi-valued attributes" },
+	{ NULL, "attribute index" }
+};
+static int isbackmdb;
+
+static void prname(const char *name)
+{
+	int i;
+
+	printf("Status of %s", name);
+	if (isbackmdb) {
+		for (i=0; backmdb[i][0] && strcmp(backmdb[i][0], name); i++) ;
+		printf(" (%s)", backmdb[i][1]);
+	}
+	printf("\n");
+}
+
+/* Estimate the size of a compacting copy, which only keeps the
+ * pages of the main DB and the named DBs, and the meta pages.
+ */
+static int prcompact(MDB_env *env, MDB_txn *txn, MDB_dbi dbi)
+{
+	MDB_cursor *cursor;
+	MDB_envinfo mei;
+	MDB_val key;
+	pgstat ps;
+	size_t used;
+	int rc;
+
+	memset(&ps, 0, sizeof(ps));
+	rc = mdb_page_walk(txn, dbi, pgcount, &ps);
+	if (rc) {
+		fprintf(stderr, "mdb_page_walk failed, error %d %s\n", rc, mdb_strerror(rc));
+		return rc;
+	}
+	rc = mdb_cursor_open(txn, dbi, &cursor);
+	if (rc) {
+		fprintf(stderr, "mdb_cursor_open failed, error %d %s\n", rc, mdb_strerror(rc));
+		return rc;
+	}
+	while ((rc = mdb_cursor_get(cursor, &key, NULL, MDB_NEXT_NODUP)) == 0) {
+		char *str;
+		MDB_dbi db2;
+		if (memchr(key.mv_data, '\0', key.mv_size))
+			continue;
+		str = malloc(key.mv_size+1);
+		memcpy(str, key.mv_data, key.mv_size);
+		str[key.mv_size] = '\0';
+		rc = mdb_open(txn, str, 0, &db2);
+		free(str);
+		if (rc) continue;
+		rc = mdb_page_walk(txn, db2, pgcount, &ps);
+		mdb_close(env, db2);
+		if (rc) {
+			fprintf(stderr, "mdb_page_walk failed, error %d %s\n", rc, mdb_strerror(rc));
+			break;
+		}
+	}
+	mdb_cursor_close(cursor);
+	if (rc != MDB_NOTFOUND)
+		return rc;
+
+	(void)mdb_env_info(env, &mei);
+	used = 2 + ps.ps_pages[0] + ps.ps_pages[1] + ps.ps_pages[2];
+	if (used > mei.me_last_pgno+1)
+		used = mei.me_last_pgno+1;
+	printf("Compacting copy\n");
+	printf("  Pages in use: %"Z"u\n", used);
+	printf("  Pages reclaimed: %"Z"u (%"Z"u bytes)\n",
+		mei.me_last_pgno+1 - used, (mei.me_last_pgno+1 - used) * psize);
+	return MDB_SUCCESS;
+}
+
 static void usage(char *prog)
 {
-	fprintf(stderr, "usage: %s [-V] [-n] [-e] [-r[r]] [-f[f[f]]] [-a|-s subdb] dbpath\n", prog);
+	fprintf(stderr, "usage: %s [-V] [-n] [-e] [-p] [-r[r]] [-f[f[f]]] [-a|-s subdb] dbpath\n", prog);
 	exit(EXIT_FAILURE);
 }
 
@@ -53,6 +280,8 @@ int main(int argc, char *argv[])
 	char *envname;
 	char *subname = NULL;
 	int alldbs = 0, envinfo = 0, envflags = 0, freinfo = 0, rdrinfo = 0;
+	int pginfo = 0;
+	pgstat ps;
 
 	if (argc < 2) {
 		usage(prog);
@@ -64,10 +293,11 @@ int main(int argc, char *argv[])
 	 * -f: print freelist info
 	 * -r: print reader info
 	 * -n: use NOSUBDIR flag on env_open
+	 * -p: print page usage, free extents and compaction estimate
 	 * -V: print version and exit
 	 * (default) print stat of only the main DB
 	 */
-	while ((i = getopt(argc, argv, "Vaefnrs:")) != EOF) {
+	while ((i = getopt(argc, argv, "Vaefnprs:")) != EOF) {
 		switch(i) {
 		case 'V':
 			printf("%s\n", MDB_VERSION_STRING);
@@ -87,6 +317,9 @@ int main(int argc, char *argv[])
 		case 'n':
 			envflags |= MDB_NOSUBDIR;
 			break;
+		case 'p':
+			pginfo++;
+			break;
 		case 'r':
 			rdrinfo++;
 			break;
@@ -110,7 +343,7 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
-	if (alldbs || subname) {
+	if (alldbs || subname || pginfo) {
 		mdb_env_set_maxdbs(env, 4);
 	}
 
@@ -119,6 +352,11 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "mdb_env_open failed, error %d %s\n", rc, mdb_strerror(rc));
 		goto env_close;
 	}
+	{
+		MDB_stat st;
+		(void)mdb_env_stat(env, &st);
+		psize = st.ms_psize;
+	}
 
 	if (envinfo) {
 		(void)mdb_env_stat(env, &mst);
@@ -157,8 +395,14 @@ int main(int argc, char *argv[])
 		MDB_cursor *cursor;
 		MDB_val key, data;
 		size_t pages = 0, *iptr;
+		unsigned int eflags;
+		int extfree;
 
 		printf("Freelist Status\n");
+		(void)mdb_env_get_flags(env, &eflags);
+		extfree = (eflags & MDB_EXTFREE) != 0;
+		if (extfree)
+			printf("  Format: extents\n");
 		dbi = 0;
 		rc = mdb_cursor_open(txn, dbi, &cursor);
 		if (rc) {
@@ -173,6 +417,44 @@ int main(int argc, char *argv[])
 		prstat(&mst);
 		while ((rc = mdb_cursor_get(cursor, &key, &data, MDB_NEXT)) == 0) {
 			iptr = data.mv_data;
+			if (pginfo) {
+				size_t k;
+				if (extfree)
+					for (k = 0; k < iptr[0] / 2; k++)
+						addext(iptr[2*k+1], iptr[2*k+2]);
+				else
+					for (k = 0; k < iptr[0]; k++)
+						addext(iptr[k+1], 1);
+			}
+			if (extfree) {
+				/* (first page, count) pairs in descending order */
+				char *bad = "";
+				size_t pg, n, prev = 0;
+				ssize_t i, j, span = 0;
+				j = *iptr++ / 2;
+				for (i = 0, n = 0; i < j; i++) {
+					if (prev && iptr[2*i] + iptr[2*i+1] >= prev)
+						bad = " [bad sequence]";
+					prev = iptr[2*i];
+					n += iptr[2*i+1];
+					if ((ssize_t)iptr[2*i+1] > span)
+						span = iptr[2*i+1];
+				}
+				pages += n;
+				if (freinfo > 1) {
+					printf("    Transaction %"Z"u, %"Z"u pages in %"Z"d extents, maxspan %"Z"d%s\n",
+						*(size_t *)key.mv_data, n, j, span, bad);
+					if (freinfo > 2) {
+						for (i = j; --i >= 0; ) {
+							pg = iptr[2*i];
+							n = iptr[2*i+1];
+							printf(n>1 ? "     %9"Z"u[%"Z"u]\n" : "     %9"Z"u\n",
+								pg, n);
+						}
+					}
+				}
+				continue;
+			}
 			pages += *iptr;
 			if (freinfo > 1) {
 				char *bad = "";
@@ -201,6 +483,8 @@ int main(int argc, char *argv[])
 		}
 		mdb_cursor_close(cursor);
 		printf("  Free pages: %"Z"u\n", pages);
+		if (pginfo)
+			prextents();
 	}
 
 	rc = mdb_open(txn, subname, 0, &dbi);
@@ -214,8 +498,33 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "mdb_stat failed, error %d %s\n", rc, mdb_strerror(rc));
 		goto txn_abort;
 	}
-	printf("Status of %s\n", subname ? subname : "Main DB");
+	if (pginfo) {
+		/* Does this look like a back-mdb database? */
+		MDB_dbi main;
+		MDB_val key, data;
+		if (mdb_open(txn, NULL, 0, &main) == MDB_SUCCESS) {
+			key.mv_size = 4;
+			key.mv_data = "id2e";
+			if (mdb_get(txn, main, &key, &data) == MDB_SUCCESS) {
+				key.mv_data = "dn2i";
+				isbackmdb = mdb_get(txn, main, &key, &data) == MDB_SUCCESS;
+			}
+		}
+	}
+	if (subname)
+		prname(subname);
+	else
+		printf("Status of Main DB\n");
 	prstat(&mst);
+	if (pginfo) {
+		memset(&ps, 0, sizeof(ps));
+		rc = mdb_page_walk(txn, dbi, pgcount, &ps);
+		if (rc) {
+			fprintf(stderr, "mdb_page_walk failed, error %d %s\n", rc, mdb_strerror(rc));
+			goto txn_abort;
+		}
+		prpages(&ps, &mst);
+	}
 
 	if (alldbs) {
 		MDB_cursor *cursor;
@@ -236,7 +545,7 @@ int main(int argc, char *argv[])
 			str[key.mv_size] = '\0';
 			rc = mdb_open(txn, str, 0, &db2);
 			if (rc == MDB_SUCCESS)
-				printf("Status of %s\n", str);
+				prname(str);
 			free(str);
 			if (rc) continue;
 			rc = mdb_stat(txn, db2, &mst);
@@ -245,6 +554,15 @@ int main(int argc, char *argv[])
 				goto txn_abort;
 			}
 			prstat(&mst);
+			if (pginfo) {
+				memset(&ps, 0, sizeof(ps));
+				rc = mdb_page_walk(txn, db2, pgcount, &ps);
+				if (rc) {
+					fprintf(stderr, "mdb_page_walk failed, error %d %s\n", rc, mdb_strerror(rc));
+					goto txn_abort;
+				}
+				prpages(&ps, &mst);
+			}
 			mdb_close(env, db2);
 		}
 		mdb_cursor_close(cursor);
@@ -253,6 +571,13 @@ int main(int argc, char *argv[])
 	if (rc == MDB_NOTFOUND)
 		rc = MDB_SUCCESS;
 
+	if (pginfo && rc == MDB_SUCCESS) {
+		MDB_dbi main;
+		rc = mdb_open(txn, NULL, 0, &main);
+		if (rc == MDB_SUCCESS)
+			rc = prcompact(env, txn, main);
+	}
+
 	mdb_close(env, dbi);
 txn_abort:
 	mdb_txn_abort(txn);
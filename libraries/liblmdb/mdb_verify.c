@@ -0,0 +1,108 @@
+/* mdb_verify.c - memory-mapped database integrity checker */
+/*
+ * Copyright 2012-2018 Howard Chu, Symas Corp.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "lmdb.h"
+
+#ifdef	_WIN32
+#define	Z	"I"
+#else
+#define	Z	"z"
+#endif
+
+static size_t problems;
+
+static int
+prmsg(const char *msg, void *ctx)
+{
+	problems++;
+	return fputs(msg, stdout);
+}
+
+static void usage(char *prog)
+{
+	fprintf(stderr, "usage: %s [-V] [-n] [-u] [-j threads] dbpath\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	int i, rc;
+	MDB_env *env;
+	char *prog = argv[0];
+	char *envname;
+	int envflags = MDB_RDONLY, vflags = 0, nthreads = 1;
+
+	if (argc < 2) {
+		usage(prog);
+	}
+
+	/* -n: use NOSUBDIR flag on env_open
+	 * -u: don't check key order of named DBs
+	 * -j: check with this many threads
+	 * -V: print version and exit
+	 * (default) check the whole environment
+	 */
+	while ((i = getopt(argc, argv, "Vj:nu")) != EOF) {
+		switch(i) {
+		case 'V':
+			printf("%s\n", MDB_VERSION_STRING);
+			exit(0);
+			break;
+		case 'j':
+			nthreads = atoi(optarg);
+			break;
+		case 'n':
+			envflags |= MDB_NOSUBDIR;
+			break;
+		case 'u':
+			vflags |= MDB_VERIFY_NOORDER;
+			break;
+		default:
+			usage(prog);
+		}
+	}
+
+	if (optind != argc - 1)
+		usage(prog);
+
+	envname = argv[optind];
+	rc = mdb_env_create(&env);
+	if (rc) {
+		fprintf(stderr, "mdb_env_create failed, error %d %s\n", rc, mdb_strerror(rc));
+		return EXIT_FAILURE;
+	}
+
+	rc = mdb_env_open(env, envname, envflags, 0664);
+	if (rc) {
+		fprintf(stderr, "mdb_env_open failed, error %d %s\n", rc, mdb_strerror(rc));
+		goto env_close;
+	}
+
+	rc = mdb_env_verify(env, vflags, nthreads, prmsg, NULL);
+	if (rc == MDB_CORRUPTED) {
+		printf("%"Z"u problems found\n", problems);
+	} else if (rc) {
+		fprintf(stderr, "mdb_env_verify failed, error %d %s\n", rc, mdb_strerror(rc));
+	} else {
+		printf("No problems found\n");
+	}
+
+env_close:
+	mdb_env_close(env);
+
+	return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+}
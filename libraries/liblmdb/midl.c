@@ -278,6 +278,148 @@ mdb_midl_sort( MDB_IDL ids )
 	}
 }
 
+#define XCMP(xl, x, id, len) \
+	( MDB_EXT_ID(xl, x) != (id) ? CMP(MDB_EXT_ID(xl, x), id) : \
+	CMP(MDB_EXT_LEN(xl, x), len) )
+
+unsigned mdb_mext_search( MDB_IDL xl, MDB_ID id, MDB_ID len )
+{
+	/*
+	 * binary search of (id,len) in xl
+	 * if found, returns position of (id,len)
+	 * if not found, returns first position less than (id,len)
+	 */
+	unsigned base = 0;
+	unsigned cursor = 1;
+	int val = 0;
+	unsigned n = MDB_EXT_NUM(xl);
+
+	while( 0 < n ) {
+		unsigned pivot = n >> 1;
+		cursor = base + pivot + 1;
+		val = XCMP( xl, cursor, id, len );
+
+		if( val < 0 ) {
+			n = pivot;
+
+		} else if ( val > 0 ) {
+			base = cursor;
+			n -= pivot + 1;
+
+		} else {
+			return cursor;
+		}
+	}
+
+	if( val > 0 ) {
+		++cursor;
+	}
+	return cursor;
+}
+
+void mdb_mext_insert( MDB_IDL xl, unsigned x, MDB_ID id, MDB_ID len )
+{
+	unsigned n = MDB_EXT_NUM(xl);
+	if (x <= n)
+		memmove(&MDB_EXT_ID(xl, x+1), &MDB_EXT_ID(xl, x),
+			(n - x + 1) * 2 * sizeof(MDB_ID));
+	MDB_EXT_ID(xl, x) = id;
+	MDB_EXT_LEN(xl, x) = len;
+	xl[0] += 2;
+}
+
+void mdb_mext_delete( MDB_IDL xl, unsigned x )
+{
+	unsigned n = MDB_EXT_NUM(xl);
+	if (x < n)
+		memmove(&MDB_EXT_ID(xl, x), &MDB_EXT_ID(xl, x+1),
+			(n - x) * 2 * sizeof(MDB_ID));
+	xl[0] -= 2;
+}
+
+void mdb_mext_merge( MDB_IDL xl, MDB_IDL merge )
+{
+	/* Walk both lists up from their lowest IDs and fill xl from
+	 * the top down. Holding back the pending run keeps the output
+	 * above any pair of xl which is still unread.
+	 */
+	MDB_ID i = MDB_EXT_NUM(merge), j = MDB_EXT_NUM(xl), k = i+j, total = k;
+	MDB_ID id, len, pid = 0, plen = 0;
+
+	while (i || j) {
+		if (!j || (i && MDB_EXT_ID(merge, i) < MDB_EXT_ID(xl, j))) {
+			id = MDB_EXT_ID(merge, i);
+			len = MDB_EXT_LEN(merge, i);
+			i--;
+		} else {
+			id = MDB_EXT_ID(xl, j);
+			len = MDB_EXT_LEN(xl, j);
+			j--;
+		}
+		if (plen && pid + plen == id) {
+			plen += len;
+			continue;
+		}
+		if (plen) {
+			MDB_EXT_ID(xl, k) = pid;
+			MDB_EXT_LEN(xl, k) = plen;
+			k--;
+		}
+		pid = id;
+		plen = len;
+	}
+	if (plen) {
+		MDB_EXT_ID(xl, k) = pid;
+		MDB_EXT_LEN(xl, k) = plen;
+		k--;
+	}
+	if (k)
+		memmove(&MDB_EXT_ID(xl, 1), &MDB_EXT_ID(xl, k+1),
+			(total - k) * 2 * sizeof(MDB_ID));
+	xl[0] = (total - k) * 2;
+}
+
+unsigned mdb_mext_runs( MDB_IDL ids )
+{
+	unsigned i, n = ids[0], runs = 0;
+
+	for (i = 1; i <= n; i++)
+		if (i == 1 || ids[i] + 1 != ids[i-1])
+			runs++;
+	return runs;
+}
+
+void mdb_mext_encode( MDB_IDL xl, MDB_IDL ids )
+{
+	MDB_ID i, n = ids[0], x = 0;
+
+	for (i = 1; i <= n; i++) {
+		if (i == 1 || ids[i] + 1 != ids[i-1]) {
+			x++;
+			MDB_EXT_LEN(xl, x) = 0;
+		}
+		MDB_EXT_ID(xl, x) = ids[i];
+		MDB_EXT_LEN(xl, x)++;
+	}
+	xl[0] = x * 2;
+}
+
+static int
+mdb_mext_cmp(const void *a, const void *b)
+{
+	const MDB_ID *p = a, *q = b;
+	/* descending order */
+	if (p[0] != q[0])
+		return CMP(q[0], p[0]);
+	return CMP(q[1], p[1]);
+}
+
+void mdb_mext_sort( MDB_IDL xl )
+{
+	qsort(&MDB_EXT_ID(xl, 1), MDB_EXT_NUM(xl), 2 * sizeof(MDB_ID),
+		mdb_mext_cmp);
+}
+
 unsigned mdb_mid2l_search( MDB_ID2L ids, MDB_ID id )
 {
 	/*
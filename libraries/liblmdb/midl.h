@@ -142,6 +142,62 @@ void mdb_midl_xmerge( MDB_IDL idl, MDB_IDL merge );
 	 */
 void mdb_midl_sort( MDB_IDL ids );
 
+	/** An extent list is an IDL of ID pairs. Usually a pair is
+	 * the first ID and the length of a run of consecutive IDs.
+	 * Element 0 counts IDs, not pairs, so the IDL allocation
+	 * macros and functions work unchanged. Pairs are sorted in
+	 * descending order by their first member, then their second.
+	 */
+#define MDB_EXT_NUM(xl)			((xl)[0] >> 1)
+#define MDB_EXT_ID(xl, x)		((xl)[2*(x)-1])
+#define MDB_EXT_LEN(xl, x)		((xl)[2*(x)])
+
+	/** Search for a pair in an extent list.
+	 * @param[in] xl	The extent list to search.
+	 * @param[in] id	The first member of the pair.
+	 * @param[in] len	The second member of the pair.
+	 * @return	The index of the first pair less than or equal to (\b id, \b len).
+	 */
+unsigned mdb_mext_search( MDB_IDL xl, MDB_ID id, MDB_ID len );
+
+	/** Insert a pair into an extent list. The list must be big enough.
+	 * @param[in] xl	The extent list to insert into.
+	 * @param[in] x		The index to insert at, from #mdb_mext_search().
+	 * @param[in] id	The first member of the pair.
+	 * @param[in] len	The second member of the pair.
+	 */
+void mdb_mext_insert( MDB_IDL xl, unsigned x, MDB_ID id, MDB_ID len );
+
+	/** Delete a pair from an extent list.
+	 * @param[in] xl	The extent list to delete from.
+	 * @param[in] x		The index of the pair to delete.
+	 */
+void mdb_mext_delete( MDB_IDL xl, unsigned x );
+
+	/** Merge an extent list onto an extent list, coalescing runs which
+	 * touch. The destination list must be big enough for both lists.
+	 * @param[in] xl	The extent list to merge into.
+	 * @param[in] merge	The extent list to merge.
+	 */
+void mdb_mext_merge( MDB_IDL xl, MDB_IDL merge );
+
+	/** Count the runs of consecutive IDs in a sorted IDL.
+	 * @param[in] ids	The IDL to scan.
+	 * @return	The number of pairs #mdb_mext_encode() will produce.
+	 */
+unsigned mdb_mext_runs( MDB_IDL ids );
+
+	/** Convert a sorted IDL into an extent list of its runs.
+	 * @param[out] xl	The extent list to fill. It must be big enough.
+	 * @param[in] ids	The IDL to convert.
+	 */
+void mdb_mext_encode( MDB_IDL xl, MDB_IDL ids );
+
+	/** Sort an extent list.
+	 * @param[in,out] xl	The extent list to sort.
+	 */
+void mdb_mext_sort( MDB_IDL xl );
+
 	/** An ID2 is an ID/pointer pair.
 	 */
 typedef struct MDB_ID2 {
@@ -0,0 +1,224 @@
+/* mtest10.c - memory-mapped database tester/toy */
+/*
+ * Copyright 2011-2018 Howard Chu, Symas Corp.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Tests for bulk loading with mdb_bulk_put */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lmdb.h"
+
+#define E(expr) CHECK((rc = (expr)) == MDB_SUCCESS, #expr)
+#define RES(err, expr) ((rc = expr) == (err) || (CHECK(!rc, #expr), 0))
+#define CHECK(test, msg) ((test) ? (void)0 : ((void)fprintf(stderr, \
+	"%s:%d: %s: %s\n", __FILE__, __LINE__, msg, mdb_strerror(rc)), abort()))
+
+#define NKEYS	20000
+
+/* Number of data items for key i, from a single item up to a
+ * sub-DB of a few levels */
+static int
+ndups(int i)
+{
+	switch (i % 7) {
+	case 0: return 1;
+	case 1: return 3;
+	case 2: return 40;
+	case 3: return i % 1000 == 3 ? 30000 : 300;
+	default: return 2;
+	}
+}
+
+static void
+mkval(char *buf, int i, int j, int big)
+{
+	int n = sprintf(buf, "%08d-%06d", i, j);
+	if (big && i % 100 == 0) {
+		memset(buf+n, 'a' + i % 26, 5000);
+		n += 5000;
+	}
+	buf[n] = '\0';
+}
+
+/* Load key i with the given dups, into dbi[0] by bulk and into
+ * dbi[1] by mdb_put, then check that both hold the same items */
+static void
+load(MDB_env *env, const char *name, unsigned int flags, int from, int to)
+{
+	int i, j, rc;
+	char kbuf[16], dbuf[5100];
+	size_t dfix;
+	MDB_dbi dbi[2];
+	MDB_txn *txn;
+	MDB_bulk *bulk;
+	MDB_cursor *cur[2];
+	MDB_val key, data, k2, d2;
+	MDB_stat st[2];
+	char n2[16];
+
+	sprintf(n2, "%s.put", name);
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	E(mdb_dbi_open(txn, name, flags|MDB_CREATE, &dbi[0]));
+	E(mdb_dbi_open(txn, n2, flags|MDB_CREATE, &dbi[1]));
+	E(mdb_bulk_open(txn, dbi[0], &bulk));
+	key.mv_data = kbuf;
+	for (i = from; i < to; i++) {
+		key.mv_size = sprintf(kbuf, "%08d", i);
+		for (j = 0; j < ((flags & MDB_DUPSORT) ? ndups(i) : 1); j++) {
+			if (flags & MDB_DUPFIXED) {
+				dfix = (size_t)i * 100000 + j;
+				data.mv_size = sizeof(dfix);
+				data.mv_data = &dfix;
+			} else {
+				mkval(dbuf, i, j, !(flags & MDB_DUPSORT));
+				data.mv_size = strlen(dbuf);
+				data.mv_data = dbuf;
+			}
+			E(mdb_put(txn, dbi[1], &key, &data, 0));
+			if (flags & MDB_DUPSORT) {
+				E(mdb_bulk_put(bulk, &key, &data, 0));
+				/* repeated data item */
+				CHECK(RES(MDB_KEYEXIST, mdb_bulk_put(bulk, &key, &data, 0)),
+					"repeated data item");
+			} else {
+				E(mdb_bulk_put(bulk, &key, &data, MDB_RESERVE));
+				memcpy(data.mv_data, dbuf, data.mv_size);
+			}
+		}
+		/* out of order key */
+		key.mv_size = sprintf(kbuf, "%08d", i - 1);
+		CHECK(RES(MDB_KEYEXIST, mdb_bulk_put(bulk, &key, &data, 0)),
+			"out of order key");
+		/* reads see the loaded keys */
+		if (i > from && i % 97 == 0) {
+			E(mdb_get(txn, dbi[0], &key, &d2));
+			E(mdb_get(txn, dbi[1], &key, &data));
+			CHECK(data.mv_size == d2.mv_size &&
+				!memcmp(data.mv_data, d2.mv_data, data.mv_size), "mdb_get");
+		}
+	}
+	E(mdb_bulk_close(bulk));
+
+	E(mdb_stat(txn, dbi[0], &st[0]));
+	E(mdb_stat(txn, dbi[1], &st[1]));
+	CHECK(st[0].ms_entries == st[1].ms_entries, "entry count");
+	CHECK(st[0].ms_leaf_pages <= st[1].ms_leaf_pages, "leaf pages");
+	printf("%s: %d keys, %zu items: %zu leaf pages bulk, %zu put\n",
+		name, to - from, st[0].ms_entries,
+		st[0].ms_leaf_pages, st[1].ms_leaf_pages);
+
+	E(mdb_cursor_open(txn, dbi[0], &cur[0]));
+	E(mdb_cursor_open(txn, dbi[1], &cur[1]));
+	while ((rc = mdb_cursor_get(cur[1], &key, &data, MDB_NEXT)) == 0) {
+		E(mdb_cursor_get(cur[0], &k2, &d2, MDB_NEXT));
+		CHECK(key.mv_size == k2.mv_size &&
+			!memcmp(key.mv_data, k2.mv_data, key.mv_size), "key");
+		CHECK(data.mv_size == d2.mv_size &&
+			!memcmp(data.mv_data, d2.mv_data, data.mv_size), "data");
+	}
+	CHECK(rc == MDB_NOTFOUND, "mdb_cursor_get");
+	CHECK(mdb_cursor_get(cur[0], &k2, &d2, MDB_NEXT) == MDB_NOTFOUND,
+		"extra items");
+	mdb_cursor_close(cur[0]);
+	mdb_cursor_close(cur[1]);
+	E(mdb_txn_commit(txn));
+}
+
+/* Delete every other key through the normal API, the tree must
+ * still be consistent afterwards */
+static void
+thin(MDB_env *env, const char *name)
+{
+	int rc, n = 0;
+	MDB_dbi dbi;
+	MDB_txn *txn;
+	MDB_cursor *cur;
+	MDB_val key, data;
+	MDB_stat st;
+	size_t count, total = 0;
+
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	E(mdb_dbi_open(txn, name, 0, &dbi));
+	E(mdb_cursor_open(txn, dbi, &cur));
+	while ((rc = mdb_cursor_get(cur, &key, &data, MDB_NEXT_NODUP)) == 0) {
+		if (n++ & 1) {
+			E(mdb_cursor_del(cur, MDB_NODUPDATA));
+		} else {
+			/* fails on plain DBs */
+			if (mdb_cursor_count(cur, &count))
+				count = 1;
+			total += count;
+		}
+	}
+	CHECK(rc == MDB_NOTFOUND, "mdb_cursor_get");
+	mdb_cursor_close(cur);
+	E(mdb_stat(txn, dbi, &st));
+	CHECK(st.ms_entries == total, "entries after delete");
+	E(mdb_txn_commit(txn));
+}
+
+struct iter {
+	int i, n;
+	char kbuf[16];
+};
+
+static int
+next(void *ctx, MDB_val *key, MDB_val *data)
+{
+	struct iter *it = ctx;
+
+	if (it->i == it->n)
+		return MDB_NOTFOUND;
+	key->mv_size = sprintf(it->kbuf, "%08d", it->i++);
+	key->mv_data = it->kbuf;
+	*data = *key;
+	return 0;
+}
+
+int main(int argc,char * argv[])
+{
+	int rc;
+	MDB_env *env;
+	MDB_txn *txn;
+	MDB_dbi dbi;
+	MDB_stat st;
+	struct iter it;
+
+	E(mdb_env_create(&env));
+	E(mdb_env_set_maxdbs(env, 8));
+	E(mdb_env_set_mapsize(env, 1073741824));
+	E(mdb_env_open(env, "./testdb", MDB_NOSYNC, 0664));
+
+	/* Load into empty DBs, then append to them */
+	load(env, "plain", 0, 0, NKEYS);
+	load(env, "plain", 0, NKEYS, NKEYS + NKEYS/2);
+	load(env, "dupsort", MDB_DUPSORT, 0, NKEYS/4);
+	load(env, "dupsort", MDB_DUPSORT, NKEYS/4, NKEYS/2);
+	load(env, "dupfixed", MDB_DUPSORT|MDB_DUPFIXED|MDB_INTEGERDUP, 0, NKEYS/4);
+	load(env, "dupfixed", MDB_DUPSORT|MDB_DUPFIXED|MDB_INTEGERDUP, NKEYS/4, NKEYS/2);
+	thin(env, "plain");
+	thin(env, "dupsort");
+	thin(env, "dupfixed");
+
+	it.i = 0;
+	it.n = NKEYS;
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	E(mdb_dbi_open(txn, "iter", MDB_CREATE, &dbi));
+	E(mdb_bulk_load(txn, dbi, next, &it));
+	E(mdb_stat(txn, dbi, &st));
+	CHECK(st.ms_entries == NKEYS, "mdb_bulk_load");
+	E(mdb_txn_commit(txn));
+
+	mdb_env_close(env);
+	return 0;
+}
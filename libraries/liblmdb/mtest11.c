@@ -0,0 +1,199 @@
+/* mtest11.c - memory-mapped database tester/toy */
+/*
+ * Copyright 2011-2018 Howard Chu, Symas Corp.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Compare sorted lookups with mdb_get_batch against MDB_SET.
+ * Usage: mtest11 [keys [keys per batch]]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "lmdb.h"
+
+#define E(expr) CHECK((rc = (expr)) == MDB_SUCCESS, #expr)
+#define CHECK(test, msg) ((test) ? (void)0 : ((void)fprintf(stderr, \
+	"%s:%d: %s: %s\n", __FILE__, __LINE__, msg, mdb_strerror(rc)), abort()))
+
+#define NBATCH	2000
+
+static double
+now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int
+cmpint(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+/* Only even numbers are stored, odd ones are misses */
+static void
+mkkey(char *buf, MDB_val *key, int i)
+{
+	key->mv_size = sprintf(buf, "%012d", i);
+	key->mv_data = buf;
+}
+
+static int
+same(MDB_val *a, MDB_val *b)
+{
+	return a->mv_size == b->mv_size && (!a->mv_size ||
+		!memcmp(a->mv_data, b->mv_data, a->mv_size));
+}
+
+/* Look up batches of random sorted keys both ways, spread over
+ * the whole DB or bunched in a part of it */
+static void
+run(MDB_env *env, MDB_dbi dbi, const char *mode, int nkeys, int nbatch,
+	int span)
+{
+	int i, j, k, rc, *ids;
+	char *kbuf;
+	double t, tset = 0, tbatch = 0;
+	size_t found = 0;
+	MDB_txn *txn;
+	MDB_cursor *cur;
+	MDB_val *keys, *data, d2;
+
+	ids = malloc(nbatch * sizeof(int));
+	kbuf = malloc(nbatch * 16);
+	keys = malloc(nbatch * sizeof(MDB_val));
+	data = malloc(nbatch * sizeof(MDB_val));
+	E(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn));
+	E(mdb_cursor_open(txn, dbi, &cur));
+	srand(span);
+	for (i = 0; i < NBATCH; i++) {
+		int base = rand() % (2 * nkeys - span + 1);
+		for (j = 0; j < nbatch; j++)
+			ids[j] = base + rand() % span;
+		qsort(ids, nbatch, sizeof(int), cmpint);
+		for (j = 0; j < nbatch; j++)
+			mkkey(kbuf + j * 16, &keys[j], ids[j]);
+
+		/* Take turns going first, so neither gets all the warm pages */
+		for (k = 0; k < 2; k++) {
+			t = now();
+			if ((i + k) & 1) {
+				for (j = 0; j < nbatch; j++) {
+					rc = mdb_cursor_get(cur, &keys[j], &d2, MDB_SET);
+					CHECK(rc == MDB_SUCCESS || rc == MDB_NOTFOUND, "MDB_SET");
+					found += !rc;
+				}
+				tset += now() - t;
+			} else {
+				E(mdb_get_batch(txn, dbi, keys, data, nbatch));
+				tbatch += now() - t;
+			}
+		}
+
+		for (j = 0; j < nbatch; j++) {
+			rc = mdb_get(txn, dbi, &keys[j], &d2);
+			if (rc == MDB_NOTFOUND) {
+				d2.mv_size = 0;
+				d2.mv_data = NULL;
+			}
+			CHECK(same(&data[j], &d2) && (rc || data[j].mv_data), "data");
+		}
+	}
+	printf("%s: %d batches of %d keys, %zu found: MDB_SET %.3fs, "
+		"mdb_get_batch %.3fs\n", mode, NBATCH, nbatch, found, tset, tbatch);
+	mdb_cursor_close(cur);
+	mdb_txn_abort(txn);
+	free(data);
+	free(keys);
+	free(kbuf);
+	free(ids);
+}
+
+int main(int argc,char * argv[])
+{
+	int i, j, rc;
+	int nkeys = argc > 1 ? atoi(argv[1]) : 500000;
+	int nbatch = argc > 2 ? atoi(argv[2]) : 100;
+	char kbuf[16], val[64];
+	MDB_env *env;
+	MDB_dbi dbi, dbi2;
+	MDB_txn *txn;
+	MDB_cursor *cur;
+	MDB_val key, data, keys[4], dv[4];
+
+	if (nkeys < 1 || nbatch < 1) {
+		fprintf(stderr, "usage: %s [keys [keys per batch]]\n", argv[0]);
+		return 1;
+	}
+	E(mdb_env_create(&env));
+	E(mdb_env_set_maxdbs(env, 4));
+	E(mdb_env_set_mapsize(env, 1073741824));
+	E(mdb_env_open(env, "./testdb", MDB_NOSYNC, 0664));
+
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	E(mdb_dbi_open(txn, "plain", MDB_CREATE, &dbi));
+	E(mdb_dbi_open(txn, "dupsort", MDB_CREATE|MDB_DUPSORT, &dbi2));
+
+	/* Nothing is found in an empty DB */
+	mkkey(kbuf, &keys[0], 0);
+	E(mdb_get_batch(txn, dbi, keys, dv, 1));
+	CHECK(dv[0].mv_data == NULL, "empty DB");
+
+	data.mv_data = val;
+	for (i = 0; i < nkeys; i++) {
+		mkkey(kbuf, &key, 2 * i);
+		data.mv_size = sprintf(val, "%d-%.*s", i, i % 40, kbuf);
+		E(mdb_put(txn, dbi, &key, &data, MDB_APPEND));
+		if (i % 10 == 0) {
+			for (j = 0; j < i % 7; j++) {
+				data.mv_size = sprintf(val, "dup-%d-%d", i, 6 - j);
+				E(mdb_put(txn, dbi2, &key, &data, 0));
+			}
+		}
+	}
+	E(mdb_txn_commit(txn));
+
+	run(env, dbi, "spread", nkeys, nbatch, 2 * nkeys);
+	run(env, dbi, "bunched", nkeys, nbatch, nbatch * 20 < 2 * nkeys ?
+		nbatch * 20 : 2 * nkeys);
+
+	/* DUPSORT gives the first data item, keys out of order work,
+	 * and the cursor is left on the last key */
+	E(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn));
+	E(mdb_cursor_open(txn, dbi2, &cur));
+	{
+		static const int ids[4] = { 2000, 20, 21, 1220 };
+		char kb[4][16];
+		for (i = 0; i < 4; i++)
+			mkkey(kb[i], &keys[i], ids[i] < 2 * nkeys ? ids[i] : 0);
+		E(mdb_cursor_get_batch(cur, keys, dv, 4));
+		for (i = 0; i < 4; i++) {
+			rc = mdb_get(txn, dbi2, &keys[i], &data);
+			if (rc == MDB_NOTFOUND) {
+				data.mv_size = 0;
+				data.mv_data = NULL;
+			}
+			CHECK(same(&dv[i], &data), "dupsort data");
+		}
+		if (dv[3].mv_data) {
+			E(mdb_cursor_get(cur, &key, &data, MDB_GET_CURRENT));
+			CHECK(same(&key, &keys[3]) && same(&data, &dv[3]), "position");
+		}
+	}
+	mdb_cursor_close(cur);
+	mdb_txn_abort(txn);
+
+	mdb_env_close(env);
+	return 0;
+}
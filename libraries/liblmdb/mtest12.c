@@ -0,0 +1,159 @@
+/* mtest12.c - memory-mapped database tester/toy */
+/*
+ * Copyright 2011-2018 Howard Chu, Symas Corp.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Tests for reader table slots: many short read txns in parallel
+ * with a writer, stale readers of a dead process, and a full table.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include "lmdb.h"
+
+#define E(expr) CHECK((rc = (expr)) == MDB_SUCCESS, #expr)
+#define CHECK(test, msg) ((test) ? (void)0 : ((void)fprintf(stderr, \
+	"%s:%d: %s: %s\n", __FILE__, __LINE__, msg, mdb_strerror(rc)), abort()))
+
+#define NTHREADS	16
+#define NTXNS	20000
+
+static MDB_env *env;
+static MDB_dbi dbi;
+static volatile int done;
+
+/* Keep rewriting two keys with the same value. Pages a reader
+ * still uses must not be reused, or it sees them differ.
+ */
+static void *
+writer(void *arg)
+{
+	int i = 0, rc;
+	char val[1000];
+	MDB_txn *txn;
+	MDB_val key, data;
+
+	data.mv_size = sizeof(val);
+	data.mv_data = val;
+	while (!done) {
+		memset(val, 'a' + i++ % 26, sizeof(val));
+		E(mdb_txn_begin(env, NULL, 0, &txn));
+		key.mv_size = 1;
+		key.mv_data = "a";
+		E(mdb_put(txn, dbi, &key, &data, 0));
+		key.mv_data = "b";
+		E(mdb_put(txn, dbi, &key, &data, 0));
+		E(mdb_txn_commit(txn));
+	}
+	return NULL;
+}
+
+static void *
+reader(void *arg)
+{
+	int i, rc;
+	MDB_txn *txn;
+	MDB_val key, a, b;
+
+	key.mv_size = 1;
+	for (i = 0; i < NTXNS; i++) {
+		E(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn));
+		key.mv_data = "a";
+		E(mdb_get(txn, dbi, &key, &a));
+		key.mv_data = "b";
+		E(mdb_get(txn, dbi, &key, &b));
+		CHECK(a.mv_size == b.mv_size &&
+			!memcmp(a.mv_data, b.mv_data, a.mv_size), "snapshot changed");
+		mdb_txn_abort(txn);
+	}
+	return NULL;
+}
+
+int main(int argc,char * argv[])
+{
+	int i, rc, dead, status;
+	pid_t pid;
+	pthread_t wthr, thr[NTHREADS];
+	struct timeval beg, end;
+	MDB_txn *txn, *txns[NTHREADS+1];
+	MDB_envinfo info;
+	MDB_val key, data;
+
+	E(mdb_env_create(&env));
+	E(mdb_env_set_maxreaders(env, NTHREADS));
+	E(mdb_env_set_mapsize(env, 10485760));
+	E(mdb_env_open(env, "./testdb", MDB_NOTLS|MDB_NOSYNC, 0664));
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	E(mdb_dbi_open(txn, NULL, 0, &dbi));
+	key.mv_size = 1;
+	data.mv_size = 1;
+	data.mv_data = "x";
+	key.mv_data = "a";
+	E(mdb_put(txn, dbi, &key, &data, 0));
+	key.mv_data = "b";
+	E(mdb_put(txn, dbi, &key, &data, 0));
+	E(mdb_txn_commit(txn));
+	E(mdb_env_info(env, &info));
+	CHECK(info.me_maxreaders >= NTHREADS, "mdb_env_info");
+
+	/* With MDB_NOTLS every txn claims and releases a slot, and the
+	 * table has exactly one slot per reader thread.
+	 */
+	done = 0;
+	CHECK(!pthread_create(&wthr, NULL, writer, NULL), "pthread_create");
+	gettimeofday(&beg, NULL);
+	for (i = 0; i < NTHREADS; i++)
+		CHECK(!pthread_create(&thr[i], NULL, reader, NULL), "pthread_create");
+	for (i = 0; i < NTHREADS; i++)
+		pthread_join(thr[i], NULL);
+	gettimeofday(&end, NULL);
+	done = 1;
+	pthread_join(wthr, NULL);
+	printf("%d read txns in %d threads: %.3fs\n", NTHREADS*NTXNS, NTHREADS,
+		(end.tv_sec - beg.tv_sec) + (end.tv_usec - beg.tv_usec) / 1e6);
+
+	/* A process that dies in a read txn leaves its slots behind */
+	pid = fork();
+	CHECK(pid >= 0, "fork");
+	if (!pid) {
+		MDB_env *env2;
+		E(mdb_env_create(&env2));
+		E(mdb_env_set_maxreaders(env2, NTHREADS));
+		E(mdb_env_open(env2, "./testdb", MDB_NOTLS, 0664));
+		for (i = 0; i < 3; i++)
+			E(mdb_txn_begin(env2, NULL, MDB_RDONLY, &txn));
+		_exit(0);
+	}
+	CHECK(waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+		!WEXITSTATUS(status), "child");
+	E(mdb_reader_check(env, &dead));
+	CHECK(dead == 3, "stale readers");
+	E(mdb_reader_check(env, &dead));
+	CHECK(dead == 0, "stale readers");
+
+	/* All slots are free again, and no more than that */
+	for (i = 0; i < NTHREADS; i++)
+		E(mdb_txn_begin(env, NULL, MDB_RDONLY, &txns[i]));
+	rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txns[i]);
+	CHECK(rc == MDB_READERS_FULL, "table not full");
+	for (i = 0; i < NTHREADS; i++)
+		mdb_txn_abort(txns[i]);
+	E(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn));
+	mdb_txn_abort(txn);
+
+	mdb_env_close(env);
+	return 0;
+}
@@ -0,0 +1,195 @@
+/* mtest13.c - memory-mapped database tester/toy */
+/*
+ * Copyright 2011-2018 Howard Chu, Symas Corp.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Tests for write txns dirtying more pages than the dirty list
+ * holds: pages get spilled, reused from the freelist out of order,
+ * unspilled, and copied into nested txns.
+ * Usage: mtest13 [keys]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "lmdb.h"
+
+#define E(expr) CHECK((rc = (expr)) == MDB_SUCCESS, #expr)
+#define CHECK(test, msg) ((test) ? (void)0 : ((void)fprintf(stderr, \
+	"%s:%d: %s: %s\n", __FILE__, __LINE__, msg, mdb_strerror(rc)), abort()))
+
+static MDB_env *env;
+static MDB_dbi dbi;
+static int nkeys;
+/* Generation of the value stored under each key, 0 if none */
+static unsigned char *gen;
+
+static double
+now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* Odd generations take an overflow page, even ones share a leaf */
+static void
+mkval(char *buf, MDB_val *data, int i, int g)
+{
+	data->mv_size = g & 1 ? 2100 : 900;
+	memset(buf, 'a' + g % 26, data->mv_size);
+	sprintf(buf, "%d", i);
+	data->mv_data = buf;
+}
+
+static void
+put(MDB_txn *txn, int i, int g)
+{
+	int rc;
+	char kbuf[16], vbuf[2100];
+	MDB_val key, data;
+
+	key.mv_size = sprintf(kbuf, "%010d", i);
+	key.mv_data = kbuf;
+	mkval(vbuf, &data, i, g);
+	E(mdb_put(txn, dbi, &key, &data, 0));
+	gen[i] = g;
+}
+
+/* Keys in an order which scatters the pages being touched */
+static int
+scramble(int i)
+{
+	return (int)((i * 7919UL) % nkeys);
+}
+
+static void
+verify(MDB_txn *txn, const char *what)
+{
+	int i = 0, n = 0, rc;
+	char kbuf[16], vbuf[2100];
+	MDB_cursor *cur;
+	MDB_val key, data, d2;
+	MDB_stat st;
+
+	E(mdb_cursor_open(txn, dbi, &cur));
+	while ((rc = mdb_cursor_get(cur, &key, &data, MDB_NEXT)) == 0) {
+		for (; !gen[i]; i++)
+			CHECK(i < nkeys, what);
+		CHECK(key.mv_size == 10, what);
+		memcpy(kbuf, key.mv_data, 10);
+		kbuf[10] = '\0';
+		CHECK(atoi(kbuf) == i, what);
+		mkval(vbuf, &d2, i, gen[i]);
+		CHECK(data.mv_size == d2.mv_size &&
+			!memcmp(data.mv_data, d2.mv_data, d2.mv_size), what);
+		i++;
+		n++;
+	}
+	CHECK(rc == MDB_NOTFOUND, what);
+	for (; i < nkeys; i++)
+		CHECK(!gen[i], what);
+	mdb_cursor_close(cur);
+	E(mdb_stat(txn, dbi, &st));
+	CHECK(st.ms_entries == (size_t)n, what);
+}
+
+int main(int argc,char * argv[])
+{
+	int i, rc;
+	double t;
+	unsigned char *saved;
+	MDB_txn *txn, *child;
+	MDB_val key;
+	MDB_stat st;
+	char kbuf[16];
+
+	nkeys = argc > 1 ? atoi(argv[1]) : 150000;
+	if (nkeys < 1) {
+		fprintf(stderr, "usage: %s [keys]\n", argv[0]);
+		return 1;
+	}
+	gen = calloc(nkeys, 1);
+	saved = malloc(nkeys);
+	E(mdb_env_create(&env));
+	E(mdb_env_set_mapsize(env, 4UL * 1073741824));
+	E(mdb_env_open(env, "./testdb", MDB_NOSYNC, 0664));
+
+	/* A page per key, more than fit in the dirty list */
+	t = now();
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	E(mdb_dbi_open(txn, NULL, 0, &dbi));
+	for (i = 0; i < nkeys; i++)
+		put(txn, i, 1);
+	verify(txn, "load");
+	E(mdb_txn_commit(txn));
+	E(mdb_env_stat(env, &st));
+	printf("load %d keys, %zu overflow pages: %.3fs\n", nkeys,
+		st.ms_overflow_pages, now() - t);
+
+	/* Free every other page */
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	key.mv_data = kbuf;
+	for (i = 0; i < nkeys; i += 2) {
+		key.mv_size = sprintf(kbuf, "%010d", i);
+		E(mdb_del(txn, dbi, &key, NULL));
+		gen[i] = 0;
+	}
+	E(mdb_txn_commit(txn));
+
+	/* Rewrite everything in scattered order, so pages come from the
+	 * freelist and spilled pages get dirtied again */
+	t = now();
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	for (i = 0; i < nkeys; i++)
+		put(txn, scramble(i), 3);
+	for (i = 0; i < nkeys; i += 3)
+		put(txn, scramble(i), 2);
+	verify(txn, "rewrite");
+	E(mdb_txn_commit(txn));
+	printf("rewrite %d keys: %.3fs\n", nkeys, now() - t);
+
+	/* A child txn copies the parent's dirty pages in any order */
+	t = now();
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	for (i = 0; i < nkeys / 8; i++)
+		put(txn, scramble(i * 3), 4);
+	memcpy(saved, gen, nkeys);
+	E(mdb_txn_begin(env, txn, 0, &child));
+	for (i = 0; i < nkeys; i++)
+		put(child, scramble(i), 5 + !(i & 7));
+	verify(child, "child");
+	mdb_txn_abort(child);
+	memcpy(gen, saved, nkeys);
+	verify(txn, "child abort");
+	E(mdb_txn_begin(env, txn, 0, &child));
+	for (i = 0; i < nkeys; i++)
+		put(child, scramble(i * 5), 7 + !(i & 3));
+	for (i = 1; i < nkeys; i += 20) {
+		key.mv_size = sprintf(kbuf, "%010d", i);
+		E(mdb_del(child, dbi, &key, NULL));
+		gen[i] = 0;
+	}
+	E(mdb_txn_commit(child));
+	verify(txn, "child commit");
+	E(mdb_txn_commit(txn));
+	printf("nested txns: %.3fs\n", now() - t);
+
+	E(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn));
+	verify(txn, "final");
+	mdb_txn_abort(txn);
+
+	mdb_env_close(env);
+	free(saved);
+	free(gen);
+	return 0;
+}
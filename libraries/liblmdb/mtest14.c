@@ -0,0 +1,366 @@
+/* mtest14.c - memory-mapped database tester/toy */
+/*
+ * Copyright 2011-2018 Howard Chu, Symas Corp.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Tests for MDB_PREFIXKEYS: keys sharing long prefixes, and keys
+ * that break them, put in random order, replaced, deleted through
+ * cursors, appended, bulk loaded and stored with sorted duplicates.
+ * Every step is checked against a copy of the expected contents.
+ * Usage: mtest14 [keys]
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lmdb.h"
+
+#define E(expr) CHECK((rc = (expr)) == MDB_SUCCESS, #expr)
+#define RES(err, expr) ((rc = expr) == (err) || (CHECK(!rc, #expr), 0))
+#define CHECK(test, msg) ((test) ? (void)0 : ((void)fprintf(stderr, \
+	"%s:%d: %s: %s\n", __FILE__, __LINE__, msg, mdb_strerror(rc)), abort()))
+
+static MDB_env *env;
+static int nkeys;
+/* Generation of the value stored under each key, 0 if none */
+static int *gen;
+/* Key ids in key order, and the position of each id in it */
+static int *order, *pos;
+
+/* Most keys share one of a few long prefixes, some share little
+ * with anything else, and a few are close to the maximum size.
+ */
+static void
+mkkey(char *buf, MDB_val *key, int i)
+{
+	int g = i % 8;
+
+	if (g < 6)
+		sprintf(buf, "dc=com,dc=example,ou=people%d,uid=%07d",
+			g, (int)((i * 2654435761u) % 10000000));
+	else if (g == 6)
+		sprintf(buf, "dc=com,dc=example,cn=%d", i);
+	else
+		sprintf(buf, "z%d", i);
+	if (i % 100 == 5) {
+		size_t len = strlen(buf);
+		memset(buf + len, 'x', 400);
+		buf[len + 400] = '\0';
+	}
+	key->mv_size = strlen(buf);
+	key->mv_data = buf;
+}
+
+/* Every fifth generation goes on an overflow page */
+static void
+mkval(char *buf, MDB_val *data, int i, int g)
+{
+	data->mv_size = g % 5 ? 20 + (i * g) % 200 : 2500;
+	memset(buf, 'a' + g % 26, data->mv_size);
+	sprintf(buf, "%d:%d", i, g);
+	data->mv_data = buf;
+}
+
+static int
+keycmp(const void *a, const void *b)
+{
+	char ka[512], kb[512];
+	MDB_val va, vb;
+	int rc;
+
+	mkkey(ka, &va, *(int *)a);
+	mkkey(kb, &vb, *(int *)b);
+	rc = memcmp(va.mv_data, vb.mv_data,
+		va.mv_size < vb.mv_size ? va.mv_size : vb.mv_size);
+	return rc ? rc : (int)va.mv_size - (int)vb.mv_size;
+}
+
+static void
+put(MDB_txn *txn, MDB_dbi dbi, int i, int g)
+{
+	int rc;
+	char kbuf[512], vbuf[2500];
+	MDB_val key, data;
+
+	mkkey(kbuf, &key, i);
+	mkval(vbuf, &data, i, g);
+	E(mdb_put(txn, dbi, &key, &data, 0));
+	gen[i] = g;
+}
+
+static void
+del(MDB_txn *txn, MDB_dbi dbi, int i)
+{
+	int rc;
+	char kbuf[512];
+	MDB_val key;
+
+	mkkey(kbuf, &key, i);
+	if (RES(MDB_NOTFOUND, mdb_del(txn, dbi, &key, NULL)))
+		CHECK(!gen[i], "key not deleted");
+	gen[i] = 0;
+}
+
+static void
+same(int i, MDB_val *key, MDB_val *data)
+{
+	int rc = 0;
+	char kbuf[512], vbuf[2500];
+	MDB_val k, d;
+
+	mkkey(kbuf, &k, i);
+	mkval(vbuf, &d, i, gen[i]);
+	CHECK(key->mv_size == k.mv_size &&
+		!memcmp(key->mv_data, k.mv_data, k.mv_size), "wrong key");
+	CHECK(data->mv_size == d.mv_size &&
+		!memcmp(data->mv_data, d.mv_data, d.mv_size), "wrong data");
+}
+
+/* Walk the DB both ways and look up keys at random */
+static void
+verify(MDB_txn *txn, MDB_dbi dbi)
+{
+	int i, j, n, rc;
+	char kbuf[512];
+	MDB_cursor *mc;
+	MDB_val key, data, k2, d2;
+	MDB_stat st;
+
+	E(mdb_cursor_open(txn, dbi, &mc));
+	for (i = 0, n = 0; i < nkeys; i++) {
+		if (!gen[order[i]])
+			continue;
+		E(mdb_cursor_get(mc, &key, &data, MDB_NEXT));
+		same(order[i], &key, &data);
+		n++;
+	}
+	CHECK(RES(MDB_NOTFOUND, mdb_cursor_get(mc, &key, &data, MDB_NEXT)),
+		"extra keys");
+	E(mdb_stat(txn, dbi, &st));
+	CHECK(st.ms_entries == (size_t)n, "wrong count");
+	for (i = nkeys-1, j = MDB_LAST; i >= 0; i--) {
+		if (!gen[order[i]])
+			continue;
+		E(mdb_cursor_get(mc, &key, &data, j));
+		same(order[i], &key, &data);
+		j = MDB_PREV;
+	}
+	CHECK(RES(MDB_NOTFOUND, mdb_cursor_get(mc, &key, &data, MDB_PREV)),
+		"extra keys");
+
+	for (j = 0; j < 2000; j++) {
+		i = rand() % nkeys;
+		mkkey(kbuf, &key, i);
+		if (gen[i]) {
+			E(mdb_get(txn, dbi, &key, &data));
+			same(i, &key, &data);
+		} else {
+			CHECK(RES(MDB_NOTFOUND, mdb_get(txn, dbi, &key, &data)),
+				"deleted key found");
+		}
+		for (n = pos[i]; n < nkeys && !gen[order[n]]; n++) ;
+		if (RES(MDB_NOTFOUND, mdb_cursor_get(mc, &key, &data, MDB_SET_RANGE))) {
+			CHECK(n == nkeys, "SET_RANGE missed a key");
+			continue;
+		}
+		CHECK(n < nkeys, "SET_RANGE past the end");
+		same(order[n], &key, &data);
+		E(mdb_cursor_get(mc, &k2, &d2, MDB_GET_CURRENT));
+		same(order[n], &k2, &d2);
+	}
+	mdb_cursor_close(mc);
+}
+
+int main(int argc, char *argv[])
+{
+	int i, j, n, rc;
+	char kbuf[512], vbuf[2500];
+	MDB_dbi dbi, dbp, dba, dbb, dbd;
+	MDB_txn *txn, *child;
+	MDB_cursor *mc;
+	MDB_bulk *mb;
+	MDB_val key, data, k2, d2;
+	MDB_stat sp, sa, sb;
+	size_t cnt;
+
+	nkeys = argc > 1 ? atoi(argv[1]) : 20000;
+	srand(14);
+	gen = calloc(nkeys, sizeof(int));
+	order = malloc(nkeys * sizeof(int));
+	pos = malloc(nkeys * sizeof(int));
+	for (i = 0; i < nkeys; i++)
+		order[i] = i;
+	qsort(order, nkeys, sizeof(int), keycmp);
+	for (i = 0; i < nkeys; i++)
+		pos[order[i]] = i;
+
+	E(mdb_env_create(&env));
+	E(mdb_env_set_maxdbs(env, 8));
+	E(mdb_env_set_mapsize(env, 1UL << 30));
+	E(mdb_env_open(env, "./testdb", MDB_NOSYNC, 0664));
+
+	/* Bad flags */
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	CHECK(RES(EINVAL, mdb_dbi_open(txn, "bad", MDB_CREATE|MDB_PREFIXKEYS|MDB_INTEGERKEY, &dbi)),
+		"PREFIXKEYS with INTEGERKEY");
+	CHECK(RES(EINVAL, mdb_dbi_open(txn, "bad", MDB_CREATE|MDB_PREFIXKEYS|MDB_REVERSEKEY, &dbi)),
+		"PREFIXKEYS with REVERSEKEY");
+	E(mdb_dbi_open(txn, "id", MDB_CREATE|MDB_PREFIXKEYS, &dbi));
+	CHECK(RES(EINVAL, mdb_set_compare(txn, dbi, NULL)), "set_compare on PREFIXKEYS");
+	E(mdb_txn_commit(txn));
+
+	/* Random puts and replaces, each txn checked after commit */
+	for (j = 1; j <= 4; j++) {
+		E(mdb_txn_begin(env, NULL, 0, &txn));
+		for (i = 0; i < nkeys; i++)
+			if (rand() % 4)
+				put(txn, dbi, rand() % nkeys, j);
+		E(mdb_txn_commit(txn));
+		E(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn));
+		verify(txn, dbi);
+		mdb_txn_abort(txn);
+	}
+
+	/* Random deletes, in a nested txn that is aborted first */
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	{
+		int *saved = malloc(nkeys * sizeof(int));
+		memcpy(saved, gen, nkeys * sizeof(int));
+		E(mdb_txn_begin(env, txn, 0, &child));
+		for (i = 0; i < nkeys / 2; i++)
+			del(child, dbi, rand() % nkeys);
+		verify(child, dbi);
+		mdb_txn_abort(child);
+		memcpy(gen, saved, nkeys * sizeof(int));
+		free(saved);
+	}
+	verify(txn, dbi);
+	E(mdb_txn_begin(env, txn, 0, &child));
+	for (i = 0; i < nkeys / 2; i++)
+		del(child, dbi, rand() % nkeys);
+	E(mdb_txn_commit(child));
+	verify(txn, dbi);
+	E(mdb_txn_commit(txn));
+
+	/* Replace and delete through a cursor while walking */
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	E(mdb_cursor_open(txn, dbi, &mc));
+	for (i = 0, n = 0; i < nkeys; i++) {
+		int id = order[i];
+		if (!gen[id])
+			continue;
+		E(mdb_cursor_get(mc, &key, &data, MDB_NEXT));
+		same(id, &key, &data);
+		if (++n % 3 == 0) {
+			E(mdb_cursor_del(mc, 0));
+			gen[id] = 0;
+		} else if (n % 3 == 1) {
+			mkkey(kbuf, &key, id);
+			mkval(vbuf, &data, id, gen[id] + 7);
+			E(mdb_cursor_put(mc, &key, &data, MDB_CURRENT));
+			gen[id] += 7;
+			E(mdb_cursor_get(mc, &k2, &d2, MDB_GET_CURRENT));
+			same(id, &k2, &d2);
+		}
+	}
+	mdb_cursor_close(mc);
+	verify(txn, dbi);
+	E(mdb_txn_commit(txn));
+
+	/* The same keys appended, bulk loaded, and in a plain DB */
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	E(mdb_dbi_open(txn, "plain", MDB_CREATE, &dbp));
+	E(mdb_dbi_open(txn, "append", MDB_CREATE|MDB_PREFIXKEYS, &dba));
+	E(mdb_dbi_open(txn, "bulk", MDB_CREATE|MDB_PREFIXKEYS, &dbb));
+	E(mdb_bulk_open(txn, dbb, &mb));
+	for (i = 0; i < nkeys; i++)
+		gen[i] = 1;
+	for (i = 0; i < nkeys; i++) {
+		mkkey(kbuf, &key, order[i]);
+		mkval(vbuf, &data, order[i], 1);
+		E(mdb_put(txn, dbp, &key, &data, MDB_APPEND));
+		E(mdb_put(txn, dba, &key, &data, MDB_APPEND));
+		E(mdb_bulk_put(mb, &key, &data, 0));
+	}
+	E(mdb_bulk_close(mb));
+	verify(txn, dba);
+	verify(txn, dbb);
+	E(mdb_stat(txn, dbp, &sp));
+	E(mdb_stat(txn, dba, &sa));
+	E(mdb_stat(txn, dbb, &sb));
+	printf("leaf pages: plain %zu, appended %zu, bulk loaded %zu\n",
+		sp.ms_leaf_pages, sa.ms_leaf_pages, sb.ms_leaf_pages);
+	CHECK(sa.ms_leaf_pages <= sp.ms_leaf_pages, "prefixes not shared");
+	CHECK(sb.ms_leaf_pages <= sp.ms_leaf_pages, "prefixes not shared");
+	E(mdb_txn_commit(txn));
+
+	/* Delete everything in random order */
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	for (j = 0; j < 4; j++) {
+		for (i = 0; i < nkeys; i++)
+			if (rand() % 2)
+				del(txn, dba, i);
+		verify(txn, dba);
+	}
+	for (i = 0; i < nkeys; i++)
+		del(txn, dba, i);
+	verify(txn, dba);
+	E(mdb_stat(txn, dba, &sa));
+	CHECK(sa.ms_depth == 0, "DB not empty");
+	E(mdb_txn_commit(txn));
+
+	/* Sorted duplicates under shared prefixes */
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	E(mdb_dbi_open(txn, "dups", MDB_CREATE|MDB_DUPSORT|MDB_PREFIXKEYS, &dbd));
+	for (i = 0; i < nkeys; i++) {
+		int id = rand() % nkeys;
+		mkkey(kbuf, &key, id);
+		for (j = 0; j <= id % 5; j++) {
+			data.mv_size = sprintf(vbuf, "dup%03d", j * 37 % 100);
+			data.mv_data = vbuf;
+			E(mdb_put(txn, dbd, &key, &data, 0));
+		}
+		gen[id] = 1;
+	}
+	for (i = 0; i < nkeys; i++)
+		if (i % 3 == 0 && gen[i]) {
+			mkkey(kbuf, &key, i);
+			E(mdb_del(txn, dbd, &key, NULL));
+			gen[i] = 0;
+		}
+	E(mdb_txn_commit(txn));
+	E(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn));
+	E(mdb_cursor_open(txn, dbd, &mc));
+	for (i = 0; i < nkeys; i++) {
+		int id = order[i];
+		if (!gen[id])
+			continue;
+		E(mdb_cursor_get(mc, &key, &data, MDB_NEXT_NODUP));
+		mkkey(kbuf, &k2, id);
+		CHECK(key.mv_size == k2.mv_size &&
+			!memcmp(key.mv_data, k2.mv_data, key.mv_size), "wrong dup key");
+		E(mdb_cursor_count(mc, &cnt));
+		CHECK(cnt == (size_t)(id % 5 + 1), "wrong dup count");
+		E(mdb_cursor_get(mc, &k2, &d2, MDB_LAST_DUP));
+		CHECK(d2.mv_size == 6, "wrong dup data");
+	}
+	CHECK(RES(MDB_NOTFOUND, mdb_cursor_get(mc, &key, &data, MDB_NEXT_NODUP)),
+		"extra dup keys");
+	mdb_cursor_close(mc);
+	mdb_txn_abort(txn);
+
+	mdb_env_close(env);
+	free(gen);
+	free(order);
+	free(pos);
+	return 0;
+}
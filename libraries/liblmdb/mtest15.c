@@ -0,0 +1,226 @@
+/* mtest15.c - memory-mapped database tester/toy */
+/*
+ * Copyright 2011-2018 Howard Chu, Symas Corp.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Tests for compacting copies with several threads: a small main DB
+ * with overflow values next to named DBs big enough to be split,
+ * sorted duplicates in sub-DBs, an empty DB, and a big main DB.
+ * Every copy must hold the same data as its source, and be exactly
+ * as compact as a single-threaded copy.
+ * Usage: mtest15 [keys]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "lmdb.h"
+
+#define E(expr) CHECK((rc = (expr)) == MDB_SUCCESS, #expr)
+#define CHECK(test, msg) ((test) ? (void)0 : ((void)fprintf(stderr, \
+	"%s:%d: %s: %s\n", __FILE__, __LINE__, msg, mdb_strerror(rc)), abort()))
+
+static const char *names[] = { "plain", "big", "dups", "fixed", "empty", NULL };
+static unsigned int dbflags[] = { 0, 0, MDB_DUPSORT, MDB_DUPSORT|MDB_DUPFIXED, 0 };
+
+static int
+isname(MDB_val *key)
+{
+	int i;
+	for (i=0; names[i]; i++)
+		if (key->mv_size == strlen(names[i]) &&
+			!memcmp(key->mv_data, names[i], key->mv_size))
+			return 1;
+	return 0;
+}
+
+static MDB_env *
+open_env(const char *path)
+{
+	int rc;
+	MDB_env *env;
+
+	E(mdb_env_create(&env));
+	E(mdb_env_set_maxdbs(env, 8));
+	E(mdb_env_set_mapsize(env, 256*1024*1024));
+	E(mdb_env_open(env, path, MDB_NOSYNC, 0664));
+	return env;
+}
+
+static void
+put(MDB_txn *txn, MDB_dbi dbi, int i, size_t size)
+{
+	int rc;
+	char kbuf[16], vbuf[9000];
+	MDB_val key, data;
+
+	key.mv_size = sprintf(kbuf, "%08d", i);
+	key.mv_data = kbuf;
+	data.mv_size = size;
+	data.mv_data = vbuf;
+	memset(vbuf, 'a' + i % 26, size);
+	memcpy(vbuf, kbuf, key.mv_size);
+	E(mdb_put(txn, dbi, &key, &data, 0));
+}
+
+/* Named DBs, with free pages left behind by deletes */
+static void
+fill(MDB_env *env, int nkeys)
+{
+	int i, j, rc;
+	MDB_txn *txn;
+	MDB_dbi maindbi, dbi[5];
+	MDB_val key, data;
+	char kbuf[16];
+
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	E(mdb_dbi_open(txn, NULL, 0, &maindbi));
+	for (i=0; names[i]; i++)
+		E(mdb_dbi_open(txn, names[i], MDB_CREATE|dbflags[i], &dbi[i]));
+	/* Main DB values, some on overflow pages */
+	for (i=0; i<16; i++)
+		put(txn, maindbi, i, i & 1 ? 5000 : 50);
+	for (i=0; i<nkeys; i++)
+		put(txn, dbi[0], i, 100 + i % 50);
+	for (i=0; i<400; i++)
+		put(txn, dbi[1], i, 3000 + i * 15);
+	for (i=0; i<300; i++) {
+		key.mv_size = sprintf(kbuf, "%05d", i);
+		key.mv_data = kbuf;
+		for (j=0; j<(i % 40) * 30 + 1; j++) {
+			unsigned int v = j * 7 + i;
+			char dbuf[32];
+			data.mv_size = sprintf(dbuf, "dup%010u", v);
+			data.mv_data = dbuf;
+			E(mdb_put(txn, dbi[2], &key, &data, 0));
+			data.mv_size = sizeof(v);
+			data.mv_data = &v;
+			E(mdb_put(txn, dbi[3], &key, &data, 0));
+		}
+	}
+	E(mdb_txn_commit(txn));
+
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	for (i=0; i<nkeys; i+=3) {
+		key.mv_size = sprintf(kbuf, "%08d", i);
+		key.mv_data = kbuf;
+		E(mdb_del(txn, dbi[0], &key, NULL));
+	}
+	for (i=0; i<400; i+=4) {
+		key.mv_size = sprintf(kbuf, "%08d", i);
+		key.mv_data = kbuf;
+		E(mdb_del(txn, dbi[1], &key, NULL));
+	}
+	E(mdb_txn_commit(txn));
+}
+
+/* Compare one DB of both environments, return its number of records */
+static size_t
+compare_db(MDB_txn *t1, MDB_txn *t2, const char *name)
+{
+	int rc, rc2;
+	MDB_dbi d1, d2;
+	MDB_cursor *c1, *c2;
+	MDB_val k1, v1, k2, v2;
+	size_t n = 0;
+
+	E(mdb_dbi_open(t1, name, 0, &d1));
+	E(mdb_dbi_open(t2, name, 0, &d2));
+	E(mdb_cursor_open(t1, d1, &c1));
+	E(mdb_cursor_open(t2, d2, &c2));
+	for (;;) {
+		rc = mdb_cursor_get(c1, &k1, &v1, MDB_NEXT);
+		rc2 = mdb_cursor_get(c2, &k2, &v2, MDB_NEXT);
+		CHECK(rc == rc2, "same number of records");
+		if (rc == MDB_NOTFOUND)
+			break;
+		E(rc);
+		CHECK(k1.mv_size == k2.mv_size &&
+			!memcmp(k1.mv_data, k2.mv_data, k1.mv_size), "same key");
+		n++;
+		/* Named DB records hold page numbers */
+		if (!name && isname(&k1))
+			continue;
+		CHECK(v1.mv_size == v2.mv_size &&
+			!memcmp(v1.mv_data, v2.mv_data, v1.mv_size), "same data");
+	}
+	mdb_cursor_close(c1);
+	mdb_cursor_close(c2);
+	return n;
+}
+
+/* Copy the environment at \b src and check the copy against it */
+static size_t
+copy(MDB_env *env, const char *src, const char *dst, unsigned int flags,
+	int nthreads, int named)
+{
+	int i, rc;
+	MDB_env *env2;
+	MDB_txn *t1, *t2;
+	MDB_envinfo info;
+	size_t n = 0;
+
+	mkdir(dst, 0775);
+	E(mdb_env_copy3(env, dst, flags, nthreads));
+	env2 = open_env(dst);
+	E(mdb_txn_begin(env, NULL, MDB_RDONLY, &t1));
+	E(mdb_txn_begin(env2, NULL, MDB_RDONLY, &t2));
+	n = compare_db(t1, t2, NULL);
+	if (named)
+		for (i=0; names[i]; i++)
+			n += compare_db(t1, t2, names[i]);
+	mdb_txn_abort(t1);
+	mdb_txn_abort(t2);
+	E(mdb_env_info(env2, &info));
+	mdb_env_close(env2);
+	printf("%s to %s with %d threads: %zu records, last page %zu\n",
+		src, dst, nthreads, n, info.me_last_pgno);
+	return info.me_last_pgno;
+}
+
+int main(int argc,char * argv[])
+{
+	int i, rc = 0;
+	MDB_env *env;
+	MDB_txn *txn;
+	MDB_dbi dbi;
+	int nkeys = argc > 1 ? atoi(argv[1]) : 100000;
+	size_t last, last2;
+
+	env = open_env("./testdb");
+	fill(env, nkeys);
+	last = copy(env, "testdb", "testdb/c1", MDB_CP_COMPACT, 1, 1);
+	last2 = copy(env, "testdb", "testdb/c4", MDB_CP_COMPACT, 4, 1);
+	CHECK(last == last2, "as compact as a single-threaded copy");
+	last2 = copy(env, "testdb", "testdb/c16", MDB_CP_COMPACT|MDB_CP_EXTFREE, 16, 1);
+	CHECK(last == last2, "as compact as a single-threaded copy");
+	mdb_env_close(env);
+
+	/* A big main DB is split like any other */
+	mkdir("testdb/m", 0775);
+	env = open_env("testdb/m");
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	E(mdb_dbi_open(txn, NULL, 0, &dbi));
+	for (i=0; i<nkeys; i++)
+		put(txn, dbi, i, i % 100 ? 200 : 4000);
+	E(mdb_txn_commit(txn));
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	for (i=0; i<nkeys; i+=2)
+		put(txn, dbi, i, 20);
+	E(mdb_txn_commit(txn));
+	last = copy(env, "testdb/m", "testdb/m1", MDB_CP_COMPACT, 1, 0);
+	last2 = copy(env, "testdb/m", "testdb/m4", MDB_CP_COMPACT, 4, 0);
+	CHECK(last == last2, "as compact as a single-threaded copy");
+	mdb_env_close(env);
+
+	return 0;
+}
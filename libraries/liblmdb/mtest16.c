@@ -0,0 +1,228 @@
+/* mtest16.c - memory-mapped database tester/toy */
+/*
+ * Copyright 2011-2018 Howard Chu, Symas Corp.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Tests for incremental copies: an as-is copy is brought up to date
+ * by a chain of deltas, through updates which free and reuse pages,
+ * replace overflow values and drop a named DB. Deltas must only apply
+ * to the state of the copy they were written against.
+ * Usage: mtest16 [keys]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "lmdb.h"
+
+#define E(expr) CHECK((rc = (expr)) == MDB_SUCCESS, #expr)
+#define CHECK(test, msg) ((test) ? (void)0 : ((void)fprintf(stderr, \
+	"%s:%d: %s: %s\n", __FILE__, __LINE__, msg, mdb_strerror(rc)), abort()))
+
+static const char *names[] = { "plain", "dups", "gone", NULL };
+
+static MDB_env *
+open_env(const char *path, unsigned int flags)
+{
+	int rc;
+	MDB_env *env;
+
+	E(mdb_env_create(&env));
+	E(mdb_env_set_maxdbs(env, 4));
+	E(mdb_env_set_mapsize(env, 64*1024*1024));
+	E(mdb_env_open(env, path, flags, 0664));
+	return env;
+}
+
+/* One round of updates: overwrite a slice of the keys, some of them
+ * with overflow values, delete another slice, and add duplicates.
+ */
+static void
+update(MDB_env *env, int nkeys, int round)
+{
+	int i, rc;
+	MDB_txn *txn;
+	MDB_dbi dbi[3];
+	MDB_val key, data;
+	char kbuf[16], vbuf[6000];
+
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	for (i=0; names[i]; i++)
+		E(mdb_dbi_open(txn, names[i],
+			MDB_CREATE|(i == 1 ? MDB_DUPSORT : 0), &dbi[i]));
+	for (i=round; i<nkeys; i+=7) {
+		key.mv_size = sprintf(kbuf, "%08d", i);
+		key.mv_data = kbuf;
+		data.mv_size = (i + round) % 11 ? 40 + round : 3000 + 100 * round;
+		data.mv_data = vbuf;
+		memset(vbuf, 'a' + (i + round) % 26, data.mv_size);
+		E(mdb_put(txn, dbi[0], &key, &data, 0));
+		data.mv_size = sprintf(vbuf, "%d-%d", round, i);
+		E(mdb_put(txn, dbi[1], &key, &data, 0));
+		if (!round)
+			E(mdb_put(txn, dbi[2], &key, &data, 0));
+	}
+	for (i=round*3; i<nkeys; i+=13) {
+		key.mv_size = sprintf(kbuf, "%08d", i);
+		key.mv_data = kbuf;
+		rc = mdb_del(txn, dbi[0], &key, NULL);
+		CHECK(rc == MDB_SUCCESS || rc == MDB_NOTFOUND, "mdb_del");
+	}
+	if (round == 2)
+		E(mdb_drop(txn, dbi[2], 1));
+	E(mdb_txn_commit(txn));
+}
+
+/* Compare one DB of both environments */
+static void
+compare_db(MDB_txn *t1, MDB_txn *t2, const char *name)
+{
+	int rc, rc2;
+	MDB_dbi d1, d2;
+	MDB_cursor *c1, *c2;
+	MDB_val k1, v1, k2, v2;
+
+	rc = mdb_dbi_open(t1, name, 0, &d1);
+	rc2 = mdb_dbi_open(t2, name, 0, &d2);
+	CHECK(rc == rc2, "same named DBs");
+	if (rc == MDB_NOTFOUND)
+		return;
+	E(rc);
+	E(mdb_cursor_open(t1, d1, &c1));
+	E(mdb_cursor_open(t2, d2, &c2));
+	for (;;) {
+		rc = mdb_cursor_get(c1, &k1, &v1, MDB_NEXT);
+		rc2 = mdb_cursor_get(c2, &k2, &v2, MDB_NEXT);
+		CHECK(rc == rc2, "same number of records");
+		if (rc == MDB_NOTFOUND)
+			break;
+		E(rc);
+		CHECK(k1.mv_size == k2.mv_size &&
+			!memcmp(k1.mv_data, k2.mv_data, k1.mv_size), "same key");
+		CHECK(v1.mv_size == v2.mv_size &&
+			!memcmp(v1.mv_data, v2.mv_data, v1.mv_size), "same data");
+	}
+	mdb_cursor_close(c1);
+	mdb_cursor_close(c2);
+}
+
+static void
+compare(MDB_env *env, const char *path)
+{
+	int i, rc;
+	MDB_env *env2;
+	MDB_txn *t1, *t2;
+	MDB_stat st1, st2;
+
+	env2 = open_env(path, MDB_RDONLY|MDB_NOLOCK);
+	E(mdb_txn_begin(env, NULL, MDB_RDONLY, &t1));
+	E(mdb_txn_begin(env2, NULL, MDB_RDONLY, &t2));
+	CHECK(mdb_txn_id(t1) == mdb_txn_id(t2), "same txnid");
+	for (i=0; names[i]; i++)
+		compare_db(t1, t2, names[i]);
+	E(mdb_stat(t1, 0, &st1));
+	E(mdb_stat(t2, 0, &st2));
+	CHECK(st1.ms_leaf_pages == st2.ms_leaf_pages &&
+		st1.ms_overflow_pages == st2.ms_overflow_pages, "same free pages");
+	mdb_txn_abort(t1);
+	mdb_txn_abort(t2);
+	mdb_env_close(env2);
+}
+
+/* Write a delta of \b env against the copy at \b base */
+static off_t
+delta(MDB_env *env, const char *base, const char *file)
+{
+	int fd, rc = 0;
+	MDB_env *env2;
+	struct stat st;
+
+	env2 = open_env(base, MDB_RDONLY|MDB_NOLOCK);
+	fd = open(file, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	CHECK(fd >= 0, file);
+	E(mdb_env_delta(env, env2, fd));
+	close(fd);
+	mdb_env_close(env2);
+	stat(file, &st);
+	return st.st_size;
+}
+
+static int
+apply(const char *base, const char *file)
+{
+	int fd, rc = 0;
+	MDB_env *env2;
+
+	env2 = open_env(base, MDB_NOLOCK);
+	fd = open(file, O_RDONLY);
+	CHECK(fd >= 0, file);
+	rc = mdb_env_apply(env2, fd);
+	close(fd);
+	mdb_env_close(env2);
+	return rc;
+}
+
+int main(int argc,char * argv[])
+{
+	int i, rc;
+	MDB_env *env;
+	MDB_envinfo info;
+	int nkeys = argc > 1 ? atoi(argv[1]) : 20000;
+	char file[32];
+	off_t size, dsize;
+
+	env = open_env("./testdb", MDB_NOSYNC);
+	update(env, nkeys, 0);
+	mkdir("testdb/b", 0775);
+	E(mdb_env_copy(env, "testdb/b"));
+
+	/* Unchanged: only the meta page */
+	size = delta(env, "testdb/b", "testdb/d0");
+	E(apply("testdb/b", "testdb/d0"));
+	compare(env, "testdb/b");
+	printf("unchanged: delta of %ld bytes\n", (long)size);
+
+	for (i=1; i<5; i++) {
+		update(env, nkeys, i);
+		/* Let the next round reuse the pages this one freed */
+		update(env, nkeys / 10, i + 10);
+		sprintf(file, "testdb/d%d", i);
+		dsize = delta(env, "testdb/b", file);
+		E(apply("testdb/b", file));
+		compare(env, "testdb/b");
+		E(mdb_env_info(env, &info));
+		printf("round %d: delta of %ld bytes for %ld bytes in use\n",
+			i, (long)dsize, (long)((info.me_last_pgno + 1) * 4096));
+		CHECK((size_t)dsize < (info.me_last_pgno + 1) * 4096, "delta smaller than a copy");
+	}
+
+	/* Applying again is harmless, an older delta is refused */
+	E(apply("testdb/b", "testdb/d4"));
+	rc = apply("testdb/b", "testdb/d3");
+	CHECK(rc == MDB_INCOMPATIBLE, "stale delta refused");
+	compare(env, "testdb/b");
+
+	/* A truncated delta is refused, and leaves the copy alone */
+	update(env, nkeys, 5);
+	dsize = delta(env, "testdb/b", "testdb/d5");
+	E(truncate("testdb/d5", dsize / 2));
+	rc = apply("testdb/b", "testdb/d5");
+	CHECK(rc == MDB_INVALID, "truncated delta refused");
+	dsize = delta(env, "testdb/b", "testdb/d5");
+	E(apply("testdb/b", "testdb/d5"));
+	compare(env, "testdb/b");
+	mdb_env_close(env);
+
+	return 0;
+}
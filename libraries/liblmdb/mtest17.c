@@ -0,0 +1,194 @@
+/* mtest17.c - memory-mapped database tester/toy */
+/*
+ * Copyright 2011-2018 Howard Chu, Symas Corp.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Tests for map hints and background warm-up: the warm-up must
+ * survive writers, a map resize, being restarted and the environment
+ * being closed while it runs. Cursors walking in either direction
+ * read ahead, and must still see every record.
+ * Usage: mtest17 [keys]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "lmdb.h"
+
+#define E(expr) CHECK((rc = (expr)) == MDB_SUCCESS, #expr)
+#define CHECK(test, msg) ((test) ? (void)0 : ((void)fprintf(stderr, \
+	"%s:%d: %s: %s\n", __FILE__, __LINE__, msg, mdb_strerror(rc)), abort()))
+
+static const char *names[] = { "one", "two", "three", NULL };
+
+static MDB_env *
+open_env(unsigned int hints)
+{
+	int rc;
+	MDB_env *env;
+
+	E(mdb_env_create(&env));
+	E(mdb_env_set_maxdbs(env, 4));
+	E(mdb_env_set_mapsize(env, 64*1024*1024));
+	E(mdb_env_set_prefault(env, hints));
+	E(mdb_env_open(env, "./testdb", MDB_NOSYNC, 0664));
+	rc = mdb_env_set_prefault(env, 0);
+	CHECK(rc == EINVAL, "hints only before opening");
+	return env;
+}
+
+static void
+fill(MDB_env *env, int nkeys, int round)
+{
+	int i, j, rc;
+	MDB_txn *txn;
+	MDB_dbi dbi;
+	MDB_val key, data;
+	char kbuf[16], vbuf[200];
+
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	for (j=0; names[j]; j++) {
+		E(mdb_dbi_open(txn, names[j], MDB_CREATE, &dbi));
+		for (i=0; i<nkeys; i++) {
+			key.mv_size = sprintf(kbuf, "%08d", i * 3 + round);
+			key.mv_data = kbuf;
+			data.mv_size = 50 + i % 150;
+			data.mv_data = vbuf;
+			memset(vbuf, 'a' + j, data.mv_size);
+			E(mdb_put(txn, dbi, &key, &data, 0));
+		}
+	}
+	E(mdb_txn_commit(txn));
+}
+
+/* All the named DBs hold the same records */
+static void
+check(MDB_env *env, size_t nrecs)
+{
+	int i, rc;
+	MDB_txn *txn;
+	MDB_dbi dbi;
+	MDB_stat st;
+
+	E(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn));
+	for (i=0; names[i]; i++) {
+		E(mdb_dbi_open(txn, names[i], 0, &dbi));
+		E(mdb_stat(txn, dbi, &st));
+		CHECK(st.ms_entries == nrecs, "all records");
+	}
+	mdb_txn_abort(txn);
+}
+
+/* Walk all records of \b dbi in one direction, checking the values */
+static int
+walk(MDB_txn *txn, MDB_dbi dbi, MDB_cursor_op op)
+{
+	int rc, i, n = 0;
+	MDB_cursor *mc;
+	MDB_val key, data;
+	char kbuf[9], *p;
+
+	E(mdb_cursor_open(txn, dbi, &mc));
+	while ((rc = mdb_cursor_get(mc, &key, &data, op)) == MDB_SUCCESS) {
+		memcpy(kbuf, key.mv_data, 8);
+		kbuf[8] = '\0';
+		i = atoi(kbuf);
+		p = data.mv_data;
+		CHECK(data.mv_size == (size_t)(i % 10 ? 100 : 3000 + i % 5000),
+			"value size");
+		CHECK(p[0] == 'a' + i % 26 && p[data.mv_size-1] == p[0],
+			"value data");
+		n++;
+	}
+	CHECK(rc == MDB_NOTFOUND, "mdb_cursor_get");
+	mdb_cursor_close(mc);
+	return n;
+}
+
+/* Sequential walks over small and overflow values, without the
+ * OS readahead, from dirty pages and from the map.
+ */
+static void
+walks(int nkeys)
+{
+	int i, rc;
+	MDB_env *env;
+	MDB_txn *txn;
+	MDB_dbi dbi;
+	MDB_val key, data;
+	char kbuf[16], vbuf[8000];
+
+	mkdir("testdb/w", 0775);
+	E(mdb_env_create(&env));
+	E(mdb_env_set_mapsize(env, 256*1024*1024));
+	E(mdb_env_open(env, "testdb/w", MDB_NOSYNC|MDB_NORDAHEAD, 0664));
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	E(mdb_dbi_open(txn, NULL, 0, &dbi));
+	for (i=0; i<nkeys; i++) {
+		key.mv_size = sprintf(kbuf, "%08d", i);
+		key.mv_data = kbuf;
+		data.mv_size = i % 10 ? 100 : 3000 + i % 5000;
+		data.mv_data = vbuf;
+		memset(vbuf, 'a' + i % 26, data.mv_size);
+		E(mdb_put(txn, dbi, &key, &data, 0));
+	}
+	CHECK(walk(txn, dbi, MDB_NEXT) == nkeys, "all records forward");
+	E(mdb_txn_commit(txn));
+	E(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn));
+	CHECK(walk(txn, dbi, MDB_NEXT) == nkeys, "all records forward");
+	CHECK(walk(txn, dbi, MDB_PREV) == nkeys, "all records backward");
+	mdb_txn_abort(txn);
+	mdb_env_close(env);
+}
+
+int main(int argc,char * argv[])
+{
+	int i, rc;
+	MDB_env *env;
+	MDB_txn *txn;
+	MDB_dbi dbi;
+	int nkeys = argc > 1 ? atoi(argv[1]) : 50000;
+
+	env = open_env(0);
+	rc = mdb_env_set_prefault(env, 0x100);
+	CHECK(rc == EINVAL, "unknown hints");
+	fill(env, nkeys, 0);
+	mdb_env_close(env);
+
+	/* Named DBs are warmed once they are open */
+	env = open_env(MDB_PF_WILLNEED|MDB_PF_HUGEPAGE);
+	E(mdb_env_prefault(env, 0));
+	E(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn));
+	for (i=0; names[i]; i++)
+		E(mdb_dbi_open(txn, names[i], 0, &dbi));
+	E(mdb_txn_commit(txn));
+	E(mdb_env_prefault(env, 2));
+	/* Writers go on meanwhile */
+	for (i=1; i<3; i++) {
+		fill(env, nkeys / 10, i);
+		E(mdb_env_prefault(env, i == 1 ? 100 : 0));
+	}
+	E(mdb_env_set_mapsize(env, 128*1024*1024));
+	check(env, nkeys + 2 * (nkeys / 10));
+	E(mdb_env_prefault(env, 0));
+	mdb_env_close(env);
+
+	env = open_env(MDB_PF_POPULATE);
+	check(env, nkeys + 2 * (nkeys / 10));
+	E(mdb_env_prefault(env, 1));
+	mdb_env_close(env);
+
+	walks(nkeys);
+
+	return 0;
+}
@@ -0,0 +1,291 @@
+/* mtest18.c - memory-mapped database tester/toy */
+/*
+ * Copyright 2011-2018 Howard Chu, Symas Corp.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Tests for mdb_env_verify(): databases of every kind pass with one
+ * or several threads, with a page list or an extent list of free pages.
+ * Then copies of the environment are damaged in a few ways, and each
+ * damaged copy must fail.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "lmdb.h"
+
+#define E(expr) CHECK((rc = (expr)) == MDB_SUCCESS, #expr)
+#define CHECK(test, msg) ((test) ? (void)0 : ((void)fprintf(stderr, \
+	"%s:%d: %s: %s\n", __FILE__, __LINE__, msg, mdb_strerror(rc)), abort()))
+
+static const char *names[] = { "plain", "big", "dups", "fixed", "int", "prefix", "custom", NULL };
+static unsigned int dbflags[] = { 0, 0, MDB_DUPSORT, MDB_DUPSORT|MDB_DUPFIXED,
+	MDB_INTEGERKEY, MDB_PREFIXKEYS, 0 };
+
+/* Keys in descending order */
+static int
+revcmp(const MDB_val *a, const MDB_val *b)
+{
+	size_t n = a->mv_size < b->mv_size ? a->mv_size : b->mv_size;
+	int rc = memcmp(b->mv_data, a->mv_data, n);
+	return rc ? rc : (int)b->mv_size - (int)a->mv_size;
+}
+
+static size_t nmsgs;
+
+static int
+msg(const char *m, void *ctx)
+{
+	nmsgs++;
+	if (ctx)
+		fputs(m, stdout);
+	return 0;
+}
+
+static MDB_env *
+open_env(const char *path, int custom)
+{
+	int rc;
+	MDB_env *env;
+	MDB_txn *txn;
+	MDB_dbi dbi;
+
+	E(mdb_env_create(&env));
+	E(mdb_env_set_maxdbs(env, 8));
+	E(mdb_env_set_mapsize(env, 256*1024*1024));
+	E(mdb_env_open(env, path, MDB_NOSYNC, 0664));
+	if (custom) {
+		E(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn));
+		E(mdb_dbi_open(txn, "custom", 0, &dbi));
+		E(mdb_set_compare(txn, dbi, revcmp));
+		E(mdb_txn_commit(txn));
+	}
+	return env;
+}
+
+static void
+fill(MDB_env *env, int nkeys)
+{
+	int i, j, rc;
+	MDB_txn *txn;
+	MDB_dbi maindbi, dbi[7];
+	MDB_val key, data;
+	char kbuf[64], vbuf[12000];
+	size_t v;
+
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	E(mdb_dbi_open(txn, NULL, 0, &maindbi));
+	for (i=0; names[i]; i++)
+		E(mdb_dbi_open(txn, names[i], MDB_CREATE|dbflags[i], &dbi[i]));
+	E(mdb_set_compare(txn, dbi[6], revcmp));
+	memset(vbuf, 'v', sizeof(vbuf));
+	key.mv_data = kbuf;
+	data.mv_data = vbuf;
+	for (i=0; i<8; i++) {
+		key.mv_size = sprintf(kbuf, "main%04d", i);
+		data.mv_size = i & 1 ? 6000 : 40;
+		E(mdb_put(txn, maindbi, &key, &data, 0));
+	}
+	for (i=0; i<nkeys; i++) {
+		key.mv_size = sprintf(kbuf, "%08d", i);
+		data.mv_size = 50 + i % 100;
+		E(mdb_put(txn, dbi[0], &key, &data, 0));
+		E(mdb_put(txn, dbi[6], &key, &data, 0));
+		key.mv_size = sprintf(kbuf, "cn=user%08d,ou=people,dc=example,dc=com", i);
+		E(mdb_put(txn, dbi[5], &key, &data, 0));
+		v = i * 3;
+		key.mv_size = sizeof(v);
+		key.mv_data = &v;
+		E(mdb_put(txn, dbi[4], &key, &data, 0));
+		key.mv_data = kbuf;
+	}
+	for (i=0; i<300; i++) {
+		key.mv_size = sprintf(kbuf, "%08d", i);
+		data.mv_size = 2000 + i * 30;
+		E(mdb_put(txn, dbi[1], &key, &data, 0));
+	}
+	/* A few keys with enough duplicates for trees of several levels */
+	for (i=0; i<200; i++) {
+		key.mv_size = sprintf(kbuf, "%05d", i);
+		for (j=0; j<(i % 50 ? i % 50 + 1 : 30000); j++) {
+			char dbuf[32];
+			unsigned int u = j * 7 + i;
+			data.mv_size = sprintf(dbuf, "dup%010u", u);
+			data.mv_data = dbuf;
+			E(mdb_put(txn, dbi[2], &key, &data, 0));
+			data.mv_size = sizeof(u);
+			data.mv_data = &u;
+			E(mdb_put(txn, dbi[3], &key, &data, 0));
+		}
+	}
+	data.mv_data = vbuf;
+	E(mdb_txn_commit(txn));
+
+	/* Leave some free pages behind */
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	for (i=0; i<nkeys; i+=3) {
+		key.mv_size = sprintf(kbuf, "%08d", i);
+		E(mdb_del(txn, dbi[0], &key, NULL));
+	}
+	for (i=0; i<300; i+=4) {
+		key.mv_size = sprintf(kbuf, "%08d", i);
+		E(mdb_del(txn, dbi[1], &key, NULL));
+	}
+	E(mdb_txn_commit(txn));
+}
+
+/* Check that \b env has problems if \b expect is set, and print them
+ * if \b print is set.
+ */
+static void
+verify(MDB_env *env, unsigned int flags, int nthreads, int expect, int print)
+{
+	int rc;
+
+	nmsgs = 0;
+	rc = mdb_env_verify(env, flags, nthreads, msg, print ? (void *)1 : NULL);
+	CHECK(rc == expect, "mdb_env_verify");
+	CHECK(!expect == !nmsgs, "problems reported");
+}
+
+/* Find the pages of a DB */
+typedef struct pgfind {
+	unsigned int type;
+	size_t pgno;
+} pgfind;
+
+static int
+findpg(const MDB_pginfo *pi, void *ctx)
+{
+	pgfind *pf = ctx;
+	if (pi->pi_type == pf->type && pi->pi_nkeys != 1) {
+		pf->pgno = pi->pi_pgno;
+		return 1;
+	}
+	return 0;
+}
+
+static size_t
+find(MDB_env *env, const char *name, unsigned int type)
+{
+	int rc;
+	MDB_txn *txn;
+	MDB_dbi dbi;
+	pgfind pf;
+
+	pf.type = type;
+	pf.pgno = 0;
+	E(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn));
+	E(mdb_dbi_open(txn, name, 0, &dbi));
+	rc = mdb_page_walk(txn, dbi, findpg, &pf);
+	CHECK(rc == 1, "page found");
+	mdb_txn_abort(txn);
+	return pf.pgno;
+}
+
+/* Overwrite \b len bytes at offset \b off of page \b pgno */
+static void
+damage(const char *path, unsigned int psize, size_t pgno, size_t off,
+	void *buf, size_t len)
+{
+	FILE *f = fopen(path, "r+b");
+	int rc = 0;
+
+	CHECK(f != NULL, "fopen");
+	CHECK(!fseek(f, (long)(pgno * psize + off), SEEK_SET), "fseek");
+	CHECK(fwrite(buf, 1, len, f) == len, "fwrite");
+	fclose(f);
+}
+
+/* Damage a fresh copy of the environment at offset \b off of page \b pgno */
+static void
+broken(MDB_env *env, unsigned int psize, size_t pgno, size_t off,
+	void *buf, size_t len)
+{
+	int rc;
+	MDB_env *env2;
+
+	remove("testdb/bad/data.mdb");
+	E(mdb_env_copy(env, "testdb/bad"));
+	damage("testdb/bad/data.mdb", psize, pgno, off, buf, len);
+	env2 = open_env("testdb/bad", 1);
+	verify(env2, 0, 1, MDB_CORRUPTED, 1);
+	verify(env2, 0, 4, MDB_CORRUPTED, 0);
+	mdb_env_close(env2);
+}
+
+int main(int argc,char * argv[])
+{
+	int rc;
+	MDB_env *env;
+	MDB_stat st;
+	size_t pg, bad, hdr = sizeof(size_t);	/* page number, at the start of a page */
+	unsigned short ptrs[2], tmp;
+	unsigned int pages;
+	int nkeys = argc > 1 ? atoi(argv[1]) : 20000;
+
+	env = open_env("./testdb", 0);
+	fill(env, nkeys);
+	verify(env, 0, 1, 0, 0);
+	verify(env, 0, 4, 0, 0);
+	mdb_env_close(env);
+
+	/* The custom order is unknown until the DB is opened */
+	env = open_env("./testdb", 0);
+	verify(env, 0, 2, MDB_CORRUPTED, 0);
+	verify(env, MDB_VERIFY_NOORDER, 2, 0, 0);
+	mdb_env_close(env);
+	env = open_env("./testdb", 1);
+	verify(env, 0, 4, 0, 0);
+
+	/* A free extent list */
+	mkdir("testdb/x", 0775);
+	E(mdb_env_copy3(env, "testdb/x", MDB_CP_COMPACT|MDB_CP_EXTFREE, 4));
+	{
+		MDB_env *env2 = open_env("testdb/x", 1);
+		verify(env2, 0, 3, 0, 0);
+		mdb_env_close(env2);
+	}
+
+	E(mdb_env_stat(env, &st));
+	mkdir("testdb/bad", 0775);
+
+	/* A leaf page with the wrong page number */
+	pg = find(env, "plain", MDB_PG_LEAF);
+	bad = pg + 1;
+	broken(env, st.ms_psize, pg, 0, &bad, hdr);
+
+	/* Keys out of order */
+	pg = find(env, "plain", MDB_PG_LEAF);
+	{
+		FILE *f = fopen("testdb/data.mdb", "rb");
+		CHECK(f != NULL, "fopen");
+		CHECK(!fseek(f, (long)(pg * st.ms_psize + hdr + 8), SEEK_SET), "fseek");
+		CHECK(fread(ptrs, 1, sizeof(ptrs), f) == sizeof(ptrs), "fread");
+		fclose(f);
+	}
+	tmp = ptrs[0], ptrs[0] = ptrs[1], ptrs[1] = tmp;
+	broken(env, st.ms_psize, pg, hdr + 8, ptrs, sizeof(ptrs));
+
+	/* An overflow page of the wrong size */
+	pg = find(env, "big", MDB_PG_OVERFLOW);
+	pages = 0;
+	broken(env, st.ms_psize, pg, hdr + 4, &pages, sizeof(pages));
+
+	/* A branch page of duplicates turned into a leaf */
+	pg = find(env, "dups", MDB_PG_BRANCH|MDB_PG_DUPSORT);
+	tmp = 0x02;
+	broken(env, st.ms_psize, pg, hdr + 2, &tmp, sizeof(tmp));
+
+	mdb_env_close(env);
+	return 0;
+}
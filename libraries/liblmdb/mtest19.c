@@ -0,0 +1,191 @@
+/* mtest19.c - memory-mapped database tester/toy */
+/*
+ * Copyright 2011-2018 Howard Chu, Symas Corp.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Tests for read-only transactions begun on the snapshot of another:
+ * they see the parent's snapshot after many later commits, in the
+ * parent's thread or another, and take no reader slot of their own.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "lmdb.h"
+
+#define E(expr) CHECK((rc = (expr)) == MDB_SUCCESS, #expr)
+#define CHECK(test, msg) ((test) ? (void)0 : ((void)fprintf(stderr, \
+	"%s:%d: %s: %s\n", __FILE__, __LINE__, msg, mdb_strerror(rc)), abort()))
+
+#define NKEYS	2000
+
+static MDB_env *env;
+static MDB_dbi dbi;
+
+/* Rewrite every value with generation \b gen */
+static void
+write_gen(int gen)
+{
+	int i, rc;
+	MDB_txn *txn;
+	MDB_val key, data;
+	char kbuf[16], dbuf[64];
+
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	key.mv_data = kbuf;
+	data.mv_data = dbuf;
+	for (i=0; i<NKEYS; i++) {
+		key.mv_size = sprintf(kbuf, "%08d", i);
+		data.mv_size = sprintf(dbuf, "generation %d of key %d", gen, i);
+		E(mdb_put(txn, dbi, &key, &data, 0));
+	}
+	E(mdb_txn_commit(txn));
+}
+
+/* Check that \b txn sees generation \b gen of every value */
+static void
+check_gen(MDB_txn *txn, int gen)
+{
+	int i = 0, rc;
+	MDB_cursor *mc;
+	MDB_val key, data;
+	char dbuf[64];
+
+	E(mdb_cursor_open(txn, dbi, &mc));
+	while ((rc = mdb_cursor_get(mc, &key, &data, MDB_NEXT)) == 0) {
+		int n = sprintf(dbuf, "generation %d of key %d", gen, i);
+		CHECK(data.mv_size == (size_t)n && !memcmp(data.mv_data, dbuf, n),
+			"value of the snapshot");
+		i++;
+	}
+	CHECK(rc == MDB_NOTFOUND, "mdb_cursor_get");
+	rc = 0;
+	CHECK(i == NKEYS, "keys of the snapshot");
+	mdb_cursor_close(mc);
+}
+
+typedef struct snapper {
+	MDB_txn *parent;
+	MDB_txn *txn;
+	pthread_mutex_t mx;
+	pthread_cond_t cond;
+	int state;
+} snapper;
+
+/* Begin a txn on the parent's snapshot, check it before and after the
+ * main thread writes more.
+ */
+static void *
+reader(void *arg)
+{
+	snapper *s = arg;
+	int rc;
+
+	E(mdb_txn_begin(env, s->parent, MDB_RDONLY, &s->txn));
+	CHECK(mdb_txn_id(s->txn) == mdb_txn_id(s->parent), "same txnid");
+	check_gen(s->txn, 1);
+
+	pthread_mutex_lock(&s->mx);
+	s->state = 1;
+	pthread_cond_signal(&s->cond);
+	while (s->state != 2)
+		pthread_cond_wait(&s->cond, &s->mx);
+	pthread_mutex_unlock(&s->mx);
+
+	check_gen(s->txn, 1);
+	mdb_txn_abort(s->txn);
+	return NULL;
+}
+
+/* Readers of the environment that ever held a slot */
+static unsigned int
+numreaders(void)
+{
+	MDB_envinfo info;
+	int rc;
+
+	E(mdb_env_info(env, &info));
+	return info.me_numreaders;
+}
+
+int main(int argc,char * argv[])
+{
+	int i, rc;
+	MDB_txn *txn, *txn2;
+	pthread_t thr;
+	snapper s;
+
+	E(mdb_env_create(&env));
+	E(mdb_env_set_maxreaders(env, 8));
+	E(mdb_env_set_mapsize(env, 64*1024*1024));
+	E(mdb_env_open(env, "./testdb", MDB_NOSYNC, 0664));
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	E(mdb_dbi_open(txn, NULL, 0, &dbi));
+	E(mdb_txn_commit(txn));
+	write_gen(1);
+
+	/* The snapshot of generation 1, then enough commits to reuse both
+	 * meta pages and any page the snapshot doesn't hold
+	 */
+	E(mdb_txn_begin(env, NULL, MDB_RDONLY, &s.parent));
+	for (i=2; i<10; i++)
+		write_gen(i);
+
+	/* A txn in the parent's thread doesn't take over its slot, the
+	 * parent still holds the snapshot once the txn has ended
+	 */
+	E(mdb_txn_begin(env, s.parent, MDB_RDONLY, &txn2));
+	check_gen(txn2, 1);
+	mdb_txn_abort(txn2);
+	for (i=10; i<15; i++)
+		write_gen(i);
+	check_gen(s.parent, 1);
+
+	pthread_mutex_init(&s.mx, NULL);
+	pthread_cond_init(&s.cond, NULL);
+	s.state = 0;
+	CHECK(!pthread_create(&thr, NULL, reader, &s), "pthread_create");
+	pthread_mutex_lock(&s.mx);
+	while (s.state != 1)
+		pthread_cond_wait(&s.cond, &s.mx);
+	pthread_mutex_unlock(&s.mx);
+
+	/* Only the parent has a slot */
+	rc = 0;
+	CHECK(numreaders() == 1, "reader slots");
+	for (i=15; i<20; i++)
+		write_gen(i);
+
+	pthread_mutex_lock(&s.mx);
+	s.state = 2;
+	pthread_cond_signal(&s.cond);
+	pthread_mutex_unlock(&s.mx);
+	pthread_join(thr, NULL);
+
+	/* A txn may be ended after its parent */
+	E(mdb_txn_begin(env, s.parent, MDB_RDONLY, &txn2));
+	mdb_txn_abort(s.parent);
+	mdb_txn_abort(txn2);
+
+	/* A write txn has no snapshot to share */
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	rc = mdb_txn_begin(env, txn, MDB_RDONLY, &txn2);
+	CHECK(rc == MDB_BAD_TXN, "read-only child of a write txn");
+	mdb_txn_abort(txn);
+
+	E(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn));
+	check_gen(txn, 19);
+	mdb_txn_abort(txn);
+
+	mdb_env_close(env);
+	return 0;
+}
@@ -0,0 +1,154 @@
+/* mtest7.c - memory-mapped database tester/toy */
+/*
+ * Copyright 2011-2018 Howard Chu, Symas Corp.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Tests for the extent freelist (MDB_EXTFREE) and converting to it */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "lmdb.h"
+
+#define E(expr) CHECK((rc = (expr)) == MDB_SUCCESS, #expr)
+#define RES(err, expr) ((rc = expr) == (err) || (CHECK(!rc, #expr), 0))
+#define CHECK(test, msg) ((test) ? (void)0 : ((void)fprintf(stderr, \
+	"%s:%d: %s: %s\n", __FILE__, __LINE__, msg, mdb_strerror(rc)), abort()))
+
+#define NKEYS	1000
+
+static char buf[64*1024];
+
+/* Small values, and values spanning one to sixteen overflow pages */
+static size_t
+valsize(void)
+{
+	return (rand() % 3) ? (size_t)(rand() % 200) + 8 : (size_t)(rand() % 16) * 4096 + 2000;
+}
+
+static void
+valfill(int k, size_t size)
+{
+	size_t i;
+	for (i = 0; i < size; i++)
+		buf[i] = (char)(k + size + i);
+}
+
+/* Delete and rewrite random keys, keeping sizes[] current */
+static void
+churn(MDB_env *env, MDB_dbi dbi, size_t *sizes, int rounds)
+{
+	int i, j, k, rc;
+	MDB_txn *txn, *rtxn = NULL;
+	MDB_val key, data;
+
+	for (i = 0; i < rounds; i++) {
+		/* Hold an old snapshot now and then, so the freelist grows */
+		if (i % 10 == 2)
+			E(mdb_txn_begin(env, NULL, MDB_RDONLY, &rtxn));
+		E(mdb_txn_begin(env, NULL, 0, &txn));
+		for (j = 0; j < 50; j++) {
+			k = rand() % NKEYS;
+			key.mv_size = sizeof(k);
+			key.mv_data = &k;
+			if (rand() % 2) {
+				if (!RES(MDB_NOTFOUND, mdb_del(txn, dbi, &key, NULL)))
+					sizes[k] = 0;
+			} else {
+				sizes[k] = valsize();
+				valfill(k, sizes[k]);
+				data.mv_size = sizes[k];
+				data.mv_data = buf;
+				E(mdb_put(txn, dbi, &key, &data, 0));
+			}
+		}
+		E(mdb_txn_commit(txn));
+		if (rtxn && i % 10 == 7) {
+			mdb_txn_abort(rtxn);
+			rtxn = NULL;
+		}
+	}
+	if (rtxn)
+		mdb_txn_abort(rtxn);
+}
+
+static void
+verify(MDB_env *env, MDB_dbi dbi, size_t *sizes)
+{
+	int k, rc;
+	MDB_txn *txn;
+	MDB_val key, data;
+
+	E(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn));
+	for (k = 0; k < NKEYS; k++) {
+		key.mv_size = sizeof(k);
+		key.mv_data = &k;
+		if (RES(MDB_NOTFOUND, mdb_get(txn, dbi, &key, &data))) {
+			CHECK(!sizes[k], "missing key");
+			continue;
+		}
+		valfill(k, sizes[k]);
+		CHECK(data.mv_size == sizes[k] && !memcmp(data.mv_data, buf, sizes[k]),
+			"bad data");
+	}
+	mdb_txn_abort(txn);
+}
+
+int main(int argc,char * argv[])
+{
+	int fd, rc;
+	MDB_env *env;
+	MDB_dbi dbi;
+	MDB_txn *txn;
+	unsigned int flags;
+	size_t *sizes;
+
+	srand(time(NULL));
+	sizes = calloc(NKEYS, sizeof(size_t));
+
+	/* Start out with a plain freelist */
+	E(mdb_env_create(&env));
+	E(mdb_env_set_mapsize(env, 104857600));
+	E(mdb_env_open(env, "./testdb/plain.mdb", MDB_NOSUBDIR|MDB_NOSYNC, 0664));
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	E(mdb_dbi_open(txn, NULL, MDB_INTEGERKEY, &dbi));
+	E(mdb_txn_commit(txn));
+	churn(env, dbi, sizes, 50);
+	verify(env, dbi, sizes);
+
+	/* Convert it, as the main data file of ./testdb */
+	fd = open("./testdb/data.mdb", O_WRONLY|O_CREAT|O_EXCL, 0664);
+	CHECK(fd >= 0, "open");
+	E(mdb_env_copyfd2(env, fd, MDB_CP_COMPACT|MDB_CP_EXTFREE));
+	close(fd);
+	mdb_env_close(env);
+
+	/* The format is persistent, and not requested on open */
+	E(mdb_env_create(&env));
+	E(mdb_env_set_mapsize(env, 104857600));
+	E(mdb_env_open(env, "./testdb", MDB_NOSYNC, 0664));
+	E(mdb_env_get_flags(env, &flags));
+	CHECK(flags & MDB_EXTFREE, "not an extent freelist");
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	E(mdb_dbi_open(txn, NULL, MDB_INTEGERKEY, &dbi));
+	E(mdb_txn_commit(txn));
+	verify(env, dbi, sizes);
+	churn(env, dbi, sizes, 100);
+	verify(env, dbi, sizes);
+	E(mdb_env_sync(env, 1));
+	mdb_env_close(env);
+	free(sizes);
+
+	return 0;
+}
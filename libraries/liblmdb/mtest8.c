@@ -0,0 +1,114 @@
+/* mtest8.c - memory-mapped database tester/toy */
+/*
+ * Copyright 2011-2018 Howard Chu, Symas Corp.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Tests for group commit (MDB_GROUPCOMMIT) from concurrent writers */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "lmdb.h"
+
+#define E(expr) CHECK((rc = (expr)) == MDB_SUCCESS, #expr)
+#define CHECK(test, msg) ((test) ? (void)0 : ((void)fprintf(stderr, \
+	"%s:%d: %s: %s\n", __FILE__, __LINE__, msg, mdb_strerror(rc)), abort()))
+
+#define NTHREADS	8
+#define NCOMMITS	100
+
+static MDB_env *env;
+static MDB_dbi dbi;
+static unsigned int txnflags;
+
+/* Commit NCOMMITS small transactions, with keys unique to this thread */
+static void *
+writer(void *arg)
+{
+	int i, rc, id = (int)(size_t)arg;
+	char kbuf[16];
+	MDB_txn *txn;
+	MDB_val key, data;
+
+	for (i = 0; i < NCOMMITS; i++) {
+		E(mdb_txn_begin(env, NULL, txnflags, &txn));
+		sprintf(kbuf, "%02d-%04d", id, i);
+		key.mv_size = strlen(kbuf);
+		key.mv_data = kbuf;
+		data.mv_size = sizeof(i);
+		data.mv_data = &i;
+		E(mdb_put(txn, dbi, &key, &data, MDB_NOOVERWRITE));
+		E(mdb_txn_commit(txn));
+	}
+	return NULL;
+}
+
+/* Run the writers, then check and empty the DB */
+static void
+run(const char *mode, unsigned int envflags, unsigned int flags)
+{
+	pthread_t thr[NTHREADS];
+	struct timeval beg, end;
+	int i, rc = 0;
+	MDB_txn *txn;
+	MDB_stat mst;
+
+	E(mdb_env_set_flags(env, MDB_GROUPCOMMIT, 0));
+	if (envflags)
+		E(mdb_env_set_flags(env, envflags, 1));
+	txnflags = flags;
+	gettimeofday(&beg, NULL);
+	for (i = 0; i < NTHREADS; i++)
+		CHECK(!pthread_create(&thr[i], NULL, writer, (void *)(size_t)i),
+			"pthread_create");
+	for (i = 0; i < NTHREADS; i++)
+		pthread_join(thr[i], NULL);
+	gettimeofday(&end, NULL);
+	printf("%d commits in %d threads, %s: %.3fs\n", NTHREADS*NCOMMITS,
+		NTHREADS, mode, (end.tv_sec - beg.tv_sec) +
+		(end.tv_usec - beg.tv_usec) / 1e6);
+
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	E(mdb_stat(txn, dbi, &mst));
+	CHECK(mst.ms_entries == NTHREADS*NCOMMITS, "lost a commit");
+	E(mdb_drop(txn, dbi, 0));
+	E(mdb_txn_commit(txn));
+}
+
+int main(int argc,char * argv[])
+{
+	int rc;
+	MDB_txn *txn;
+	unsigned int flags;
+
+	E(mdb_env_create(&env));
+	E(mdb_env_set_maxreaders(env, NTHREADS+1));
+	E(mdb_env_set_mapsize(env, 10485760));
+	E(mdb_env_open(env, "./testdb", 0, 0664));
+	E(mdb_env_get_flags(env, &flags));
+	CHECK(!(flags & MDB_GROUPCOMMIT), "group commit is not the default");
+
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	E(mdb_dbi_open(txn, NULL, 0, &dbi));
+	E(mdb_drop(txn, dbi, 0));
+	E(mdb_txn_commit(txn));
+
+	run("single", 0, 0);
+	run("grouped per txn", 0, MDB_GROUPCOMMIT);
+	run("grouped per env", MDB_GROUPCOMMIT, 0);
+	E(mdb_env_get_flags(env, &flags));
+	CHECK(flags & MDB_GROUPCOMMIT, "mdb_env_set_flags");
+	mdb_env_close(env);
+
+	return 0;
+}
@@ -0,0 +1,121 @@
+/* mtest9.c - memory-mapped database tester/toy */
+/*
+ * Copyright 2011-2018 Howard Chu, Symas Corp.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Compare commit latency of page writes through io_uring and without.
+ * Usage: mtest9 [commits [keys per commit]]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "lmdb.h"
+
+#define E(expr) CHECK((rc = (expr)) == MDB_SUCCESS, #expr)
+#define CHECK(test, msg) ((test) ? (void)0 : ((void)fprintf(stderr, \
+	"%s:%d: %s: %s\n", __FILE__, __LINE__, msg, mdb_strerror(rc)), abort()))
+
+#define NKEYS	100000
+
+static int
+cmpdbl(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+static double
+now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* Load the DB, then time small random-update commits */
+static void
+run(const char *mode, unsigned int envflags, int ncommits, int nput)
+{
+	int i, j, k, rc;
+	char val[200];
+	double t, *lat, sum = 0;
+	MDB_env *env;
+	MDB_dbi dbi;
+	MDB_txn *txn;
+	MDB_val key, data;
+
+	lat = malloc(ncommits * sizeof(double));
+	memset(val, 'x', sizeof(val));
+	E(mdb_env_create(&env));
+	E(mdb_env_set_mapsize(env, 268435456));
+	E(mdb_env_open(env, "./testdb", envflags, 0664));
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	E(mdb_dbi_open(txn, NULL, MDB_INTEGERKEY, &dbi));
+	E(mdb_drop(txn, dbi, 0));
+	key.mv_size = sizeof(k);
+	key.mv_data = &k;
+	data.mv_size = sizeof(val);
+	data.mv_data = val;
+	/* One big commit, with more writes than the ring holds */
+	t = now();
+	for (k = 0; k < NKEYS; k++)
+		E(mdb_put(txn, dbi, &key, &data, MDB_APPEND));
+	E(mdb_txn_commit(txn));
+	printf("%s: load %d keys: %.3fs\n", mode, NKEYS, now() - t);
+
+	srand(1);
+	for (i = 0; i < ncommits; i++) {
+		t = now();
+		E(mdb_txn_begin(env, NULL, 0, &txn));
+		for (j = 0; j < nput; j++) {
+			k = rand() % NKEYS;
+			val[0] = 'a' + i % 26;
+			E(mdb_put(txn, dbi, &key, &data, 0));
+		}
+		E(mdb_txn_commit(txn));
+		lat[i] = now() - t;
+		sum += lat[i];
+	}
+	qsort(lat, ncommits, sizeof(double), cmpdbl);
+	printf("%s: %d commits of %d keys: avg %.1fus, p50 %.1fus, "
+		"p99 %.1fus, max %.1fus\n", mode, ncommits, nput,
+		sum / ncommits * 1e6, lat[ncommits / 2] * 1e6,
+		lat[ncommits * 99 / 100] * 1e6, lat[ncommits - 1] * 1e6);
+
+	/* Both runs must leave the same data */
+	E(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn));
+	for (k = 0; k < NKEYS; k++) {
+		E(mdb_get(txn, dbi, &key, &data));
+		CHECK(data.mv_size == sizeof(val) &&
+			!memcmp((char *)data.mv_data + 1, val + 1, sizeof(val) - 1),
+			"bad data");
+	}
+	mdb_txn_abort(txn);
+	mdb_env_close(env);
+	free(lat);
+}
+
+int main(int argc,char * argv[])
+{
+	int ncommits = argc > 1 ? atoi(argv[1]) : 200;
+	int nput = argc > 2 ? atoi(argv[2]) : 100;
+
+	if (ncommits < 1 || nput < 1) {
+		fprintf(stderr, "usage: %s [commits [keys per commit]]\n", argv[0]);
+		return 1;
+	}
+	run("pwrite", MDB_NOURING, ncommits, nput);
+	run("io_uring", 0, ncommits, nput);
+
+	return 0;
+}
@@ -95,7 +95,7 @@ mdb_attr_dbs_open(
 	struct mdb_info *mdb = (struct mdb_info *) be->be_private;
 	MDB_txn *txn;
 	MDB_dbi *dbis = NULL;
-	int i, flags;
+	int i, flags, partial = 0;
 	int rc;
 
 	txn = tx0;
@@ -138,6 +138,21 @@ mdb_attr_dbs_open(
 		/* Remember newly opened DBI handles */
 		if ( dbis )
 			dbis[i] = mdb->mi_attrs[i]->ai_dbi;
+		if ( !(slapMode & SLAP_TOOL_READONLY) ) {
+			rc = mdb_idl_stats_init( txn, mdb, mdb->mi_attrs[i],
+				&partial );
+			if ( rc ) {
+				snprintf( cr->msg, sizeof(cr->msg), "database \"%s\": "
+					"statistics of index %s failed: %s (%d).",
+					be->be_suffix[0].bv_val,
+					mdb->mi_attrs[i]->ai_desc->ad_type->sat_cname.bv_val,
+					mdb_strerror(rc), rc );
+				Debug( LDAP_DEBUG_ANY,
+					LDAP_XSTRING(mdb_attr_dbs) ": %s\n",
+					cr->msg, 0, 0 );
+				break;
+			}
+		}
 	}
 
 	/* Only commit if this is our txn */
@@ -168,6 +183,10 @@ mdb_attr_dbs_open(
 		ch_free( dbis );
 	}
 
+	/* the keys of some indices are left to count */
+	if ( rc == 0 && partial )
+		mdb->mi_flags |= MDB_STATS_SCAN;
+
 	return rc;
 }
 
@@ -384,6 +403,8 @@ fail:
 		a->ai_root = NULL;
 		a->ai_desc = ad;
 		a->ai_dbi = 0;
+		a->ai_stat = NULL;
+		a->ai_statflag = 0;
 
 		if ( mdb->mi_flags & MDB_IS_OPEN ) {
 			a->ai_indexmask = 0;
@@ -503,6 +524,7 @@ mdb_attr_info_free( AttrInfo *ai )
 #ifdef LDAP_COMP_MATCH
 	free( ai->ai_cr );
 #endif
+	ch_free( ai->ai_stat );
 	free( ai );
 }
 
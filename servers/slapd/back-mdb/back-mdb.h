@@ -33,7 +33,10 @@ LDAP_BEGIN_DECL
 #define MDB_DN2ID		1
 #define MDB_ID2ENTRY	2
 #define MDB_ID2VAL		3
-#define MDB_NDB			4
+#define MDB_IX2B		4
+#define MDB_IX2S		5
+#define MDB_IX2O		6
+#define MDB_NDB			7
 
 /* The default search IDL stack cache depth */
 #define DEFAULT_SEARCH_STACK_DEPTH	16
@@ -51,6 +54,13 @@ LDAP_BEGIN_DECL
 /* Most users will never see this */
 #define DEFAULT_RTXN_SIZE	10000
 
+/* Fewer candidates than this are evaluated by the searching thread alone */
+#define DEFAULT_SEARCH_MINCAND	4096
+
+/* Memory for candidates kept between the pages of paged searches */
+#define DEFAULT_PAGED_MAX	(16*1048576)
+#define DEFAULT_PAGED_EXPIRE	300
+
 #ifdef LDAP_DEVEL
 #define MDB_MONITOR_IDX
 #endif
@@ -89,6 +99,24 @@ struct mdb_info {
 
 	struct re_s		*mi_txn_cp_task;
 	struct re_s		*mi_index_task;
+	struct re_s		*mi_stats_task;
+
+	char		*mi_backup_dir;
+	uint32_t	mi_backup_min;
+	int			mi_backup_threads;
+	struct re_s		*mi_backup_task;
+
+	int			mi_prefault;	/* levels to read at startup, or -1 */
+	unsigned	mi_prefault_hints;
+
+	int			mi_search_threads;	/* threads evaluating candidates */
+	ID			mi_search_mincand;
+
+	struct mdb_paged	*mi_paged;	/* candidates of paged searches */
+	size_t		mi_paged_size;	/* memory they take */
+	size_t		mi_paged_max;
+	int			mi_paged_expire;	/* seconds unused before dropped */
+	ldap_pvt_thread_mutex_t	mi_paged_mutex;
 
 	mdb_monitor_t	mi_monitor;
 
@@ -103,6 +131,7 @@ struct mdb_info {
 #define	MDB_DEL_INDEX	0x08
 #define	MDB_RE_OPEN		0x10
 #define	MDB_NEED_UPGRADE	0x20
+#define	MDB_STATS_SCAN	0x40	/* index statistics to complete */
 
 	int mi_numads;
 
@@ -122,6 +151,46 @@ struct mdb_info {
 #define mi_dn2id	mi_dbis[MDB_DN2ID]
 #define mi_ad2id	mi_dbis[MDB_AD2ID]
 #define mi_id2val	mi_dbis[MDB_ID2VAL]
+#define mi_ix2b		mi_dbis[MDB_IX2B]
+#define mi_ix2s		mi_dbis[MDB_IX2S]
+#define mi_ix2o		mi_dbis[MDB_IX2O]
+
+/* Statistics of an index DB, kept in the ix2s DB under the name of the
+ * indexed attribute and updated along with the index. The record of an
+ * index that already had keys when it was first opened starts out
+ * partial: a background task counts the keys in order, and until it is
+ * done only the keys up to is_last are counted and kept up to date.
+ */
+#define MDB_ISTAT_HIST	16	/* keys of 1, 2-3, 4-7 ... 32K-64K IDs */
+#define MDB_ISTAT_TOP	8	/* keys with the most IDs */
+#define MDB_ISTAT_KEYMAX	16	/* longer keys are not kept in is_top */
+#define MDB_ISTAT_LASTMAX	255	/* the scan doesn't stop at longer keys */
+
+typedef struct mdb_itop {
+	ID		it_count;	/* 0 if the slot is unused */
+	unsigned char	it_len;
+	unsigned char	it_key[MDB_ISTAT_KEYMAX];
+} mdb_itop;
+
+typedef struct mdb_istat {
+	ID		is_keys;	/* distinct keys */
+	ID		is_ids;		/* IDs under all the keys */
+	ID		is_ranges;	/* keys kept as a range */
+	ID		is_hist[MDB_ISTAT_HIST];	/* other keys by log2 of their IDs */
+	mdb_itop	is_top[MDB_ISTAT_TOP];	/* by descending it_count */
+	ID		is_flags;
+#define MDB_ISTAT_PARTIAL	0x01	/* keys after is_last not counted yet */
+	ID		is_lastlen;	/* 0 if no key is counted yet */
+	unsigned char	is_last[MDB_ISTAT_LASTMAX];	/* last key counted */
+} mdb_istat;
+
+/* The order index: the ix2o DB has a key for each value of an attribute
+ * indexed "order", the attribute name, a NUL and the normalized value,
+ * with the IDs of the entries holding the value as its sorted duplicates.
+ * Keys are cut to MDB_OKEY_MAX bytes, values sharing a cut key are put
+ * in order by the search that reads them.
+ */
+#define MDB_OKEY_MAX	255
 
 typedef struct mdb_op_info {
 	OpExtra		moi_oe;
@@ -133,6 +202,12 @@ typedef struct mdb_op_info {
 #define MOI_FREEIT	0x02
 #define MOI_KEEPER	0x04
 
+/* The stored attributes a partial entry decode keeps */
+typedef struct mdb_attrsel {
+	int		as_nads;	/* DB attribute indexes it covers */
+	unsigned char	*as_keep;	/* nonzero to keep, by DB attribute index */
+} mdb_attrsel;
+
 LDAP_END_DECL
 
 /* for the cache of attribute information (which are indexed, etc.) */
@@ -147,6 +222,11 @@ typedef struct mdb_attrinfo {
 	MDB_cursor *ai_cursor;	/* for tools */
 	int ai_idx;	/* position in AI array */
 	MDB_dbi ai_dbi;
+	mdb_istat *ai_stat;	/* for tools */
+	int ai_statflag;	/* for tools */
+#define MDB_ISTAT_READ	0x01
+#define MDB_ISTAT_NONE	0x02	/* the index has no statistics */
+#define MDB_ISTAT_DIRTY	0x04
 } AttrInfo;
 
 /* tool threaded indexer state */
@@ -20,6 +20,8 @@
 #include <ac/ctype.h>
 #include <ac/string.h>
 #include <ac/errno.h>
+#include <ac/unistd.h>
+#include <sys/stat.h>
 
 #include "back-mdb.h"
 
@@ -28,10 +30,18 @@
 #include "lutil.h"
 #include "ldap_rq.h"
 
+#ifdef _WIN32
+#define mkdir(a,b)	mkdir(a)
+#define move_file(from, to) (!MoveFileEx(from, to, MOVEFILE_REPLACE_EXISTING))
+#else
+#define move_file(from, to) rename(from, to)
+#endif
+
 static ConfigDriver mdb_cf_gen;
 
 enum {
-	MDB_CHKPT = 1,
+	MDB_BACKUP = 1,
+	MDB_CHKPT,
 	MDB_DIRECTORY,
 	MDB_DBNOSYNC,
 	MDB_ENVFLAGS,
@@ -39,10 +49,17 @@ enum {
 	MDB_MAXREADERS,
 	MDB_MAXSIZE,
 	MDB_MODE,
+	MDB_PREFAULT,
 	MDB_SSTACK,
+	MDB_STHREADS,
+	MDB_PAGED,
 };
 
 static ConfigTable mdbcfg[] = {
+	{ "backup", "dir> <min> <threads", 3, 4, 0, ARG_MAGIC|MDB_BACKUP,
+		mdb_cf_gen, "( OLcfgDbAt:12.8 NAME 'olcDbBackup' "
+			"DESC 'Online backup directory, interval in minutes and number of copy threads' "
+			"SYNTAX OMsDirectoryString SINGLE-VALUE )", NULL, NULL },
 	{ "directory", "dir", 2, 2, 0, ARG_STRING|ARG_MAGIC|MDB_DIRECTORY,
 		mdb_cf_gen, "( OLcfgDbAt:0.1 NAME 'olcDbDirectory' "
 			"DESC 'Directory for database content' "
@@ -93,6 +110,14 @@ static ConfigTable mdbcfg[] = {
 		"( OLcfgDbAt:12.7 NAME 'olcDbMultivalLo' "
 		"DESC 'Threshold for consolidating multivalued attr back into main blob' "
 		"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
+	{ "pagedcache", "bytes> <seconds", 2, 3, 0, ARG_MAGIC|MDB_PAGED,
+		mdb_cf_gen, "( OLcfgDbAt:12.11 NAME 'olcDbPagedCache' "
+		"DESC 'Memory for the candidates of paged searches kept between pages, and seconds they are kept unused' "
+		"SYNTAX OMsDirectoryString SINGLE-VALUE )", NULL, NULL },
+	{ "prefault", "levels> <hints", 2, 0, 0, ARG_MAGIC|MDB_PREFAULT,
+		mdb_cf_gen, "( OLcfgDbAt:12.9 NAME 'olcDbPrefault' "
+		"DESC 'Levels of each DB to read at startup, and memory map hints' "
+		"SYNTAX OMsDirectoryString SINGLE-VALUE )", NULL, NULL },
 	{ "rtxnsize", "entries", 2, 2, 0, ARG_UINT|ARG_OFFSET,
 		(void *)offsetof(struct mdb_info, mi_rtxn_size),
 		"( OLcfgDbAt:12.5 NAME 'olcDbRtxnSize' "
@@ -102,6 +127,10 @@ static ConfigTable mdbcfg[] = {
 		mdb_cf_gen, "( OLcfgDbAt:1.9 NAME 'olcDbSearchStack' "
 		"DESC 'Depth of search stack in IDLs' "
 		"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
+	{ "searchthreads", "threads> <mincand", 2, 3, 0, ARG_MAGIC|MDB_STHREADS,
+		mdb_cf_gen, "( OLcfgDbAt:12.10 NAME 'olcDbSearchThreads' "
+		"DESC 'Threads evaluating the candidates of one search, and the least number of candidates to use them' "
+		"SYNTAX OMsDirectoryString SINGLE-VALUE )", NULL, NULL },
 	{ NULL, NULL, 0, 0, 0, ARG_IGNORED,
 		NULL, NULL, NULL, NULL }
 };
@@ -113,10 +142,11 @@ static ConfigOCs mdbocs[] = {
 		"DESC 'MDB backend configuration' "
 		"SUP olcDatabaseConfig "
 		"MUST olcDbDirectory "
-		"MAY ( olcDbCheckpoint $ olcDbEnvFlags $ "
+		"MAY ( olcDbBackup $ olcDbCheckpoint $ olcDbEnvFlags $ "
 		"olcDbNoSync $ olcDbIndex $ olcDbMaxReaders $ olcDbMaxSize $ "
 		"olcDbMode $ olcDbSearchStack $ olcDbMaxEntrySize $ olcDbRtxnSize $ "
-		"olcDbMultivalHi $ olcDbMultivalLo ) )",
+		"olcDbMultivalHi $ olcDbMultivalLo $ olcDbPrefault $ "
+		"olcDbSearchThreads $ olcDbPagedCache ) )",
 		 	Cft_Database, mdbcfg },
 	{ NULL, 0, NULL }
 };
@@ -127,6 +157,14 @@ static slap_verbmasks mdb_envflags[] = {
 	{ BER_BVC("writemap"),	MDB_WRITEMAP },
 	{ BER_BVC("mapasync"),	MDB_MAPASYNC },
 	{ BER_BVC("nordahead"),	MDB_NORDAHEAD },
+	{ BER_BVC("groupcommit"),	MDB_GROUPCOMMIT },
+	{ BER_BVNULL, 0 }
+};
+
+static slap_verbmasks mdb_pfhints[] = {
+	{ BER_BVC("willneed"),	MDB_PF_WILLNEED },
+	{ BER_BVC("populate"),	MDB_PF_POPULATE },
+	{ BER_BVC("hugepage"),	MDB_PF_HUGEPAGE },
 	{ BER_BVNULL, 0 }
 };
 
@@ -144,6 +182,56 @@ mdb_checkpoint( void *ctx, void *arg )
 	return NULL;
 }
 
+/* perform periodic online backups */
+static void *
+mdb_backup( void *ctx, void *arg )
+{
+	struct re_s *rtask = arg;
+	struct mdb_info *mdb = rtask->arg;
+	char *tmpdir, *from, *to;
+	int len, rc;
+
+	/* Compact into a scratch directory, then replace the previous
+	 * backup, so that a complete backup is always there.
+	 */
+	len = strlen( mdb->mi_backup_dir );
+	tmpdir = ch_malloc( 3 * ( len + STRLENOF( LDAP_DIRSEP "backup.tmp"
+		LDAP_DIRSEP "data.mdb" ) + 1 ));
+	from = tmpdir + len + STRLENOF( LDAP_DIRSEP "backup.tmp" LDAP_DIRSEP "data.mdb" ) + 1;
+	to = from + len + STRLENOF( LDAP_DIRSEP "backup.tmp" LDAP_DIRSEP "data.mdb" ) + 1;
+	sprintf( tmpdir, "%s" LDAP_DIRSEP "backup.tmp", mdb->mi_backup_dir );
+	sprintf( from, "%s" LDAP_DIRSEP "backup.tmp" LDAP_DIRSEP "data.mdb",
+		mdb->mi_backup_dir );
+	sprintf( to, "%s" LDAP_DIRSEP "data.mdb", mdb->mi_backup_dir );
+
+	if ( !( mdb->mi_flags & MDB_IS_OPEN )) {
+		rc = 0;
+	} else if ( mkdir( tmpdir, 0700 ) < 0 && errno != EEXIST ) {
+		rc = errno;
+	} else {
+		/* left over from an interrupted backup */
+		unlink( from );
+		rc = mdb_env_copy3( mdb->mi_dbenv, tmpdir, MDB_CP_COMPACT,
+			mdb->mi_backup_threads );
+		if ( rc == 0 && move_file( from, to ) < 0 )
+			rc = errno;
+		if ( rc )
+			unlink( from );
+		rmdir( tmpdir );
+	}
+	if ( rc ) {
+		Debug( LDAP_DEBUG_ANY,
+			LDAP_XSTRING(mdb_backup) ": backup to %s failed: %s (%d)\n",
+			mdb->mi_backup_dir, mdb_strerror(rc), rc );
+	}
+	ch_free( tmpdir );
+
+	ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
+	ldap_pvt_runqueue_stoptask( &slapd_rq, rtask );
+	ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
+	return NULL;
+}
+
 /* reindex entries on the fly */
 static void *
 mdb_online_index( void *ctx, void *arg )
@@ -247,6 +335,88 @@ mdb_online_index( void *ctx, void *arg )
 	return NULL;
 }
 
+/* Count the keys of the indices whose statistics are partial, a
+ * step at a time, each in its own write txn
+ */
+#define MDB_STATS_SCAN_KEYS	1024
+
+static void *
+mdb_stats_scan( void *ctx, void *arg )
+{
+	struct re_s *rtask = arg;
+	BackendDB *be = rtask->arg;
+	struct mdb_info *mdb = be->be_private;
+	MDB_txn *txn;
+	AttrInfo *ai;
+	int i, rc = 0, done;
+
+	while ( 1 ) {
+		ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
+		if ( rc || !( mdb->mi_flags & MDB_STATS_SCAN )) {
+			ldap_pvt_runqueue_stoptask( &slapd_rq, rtask );
+			mdb->mi_stats_task = NULL;
+			ldap_pvt_runqueue_remove( &slapd_rq, rtask );
+			ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
+			break;
+		}
+		mdb->mi_flags ^= MDB_STATS_SCAN;
+		ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
+
+		for ( i = 0; i < mdb->mi_nattrs; ) {
+			if ( slapd_shutdown || !( mdb->mi_flags & MDB_IS_OPEN ))
+				break;
+			ai = mdb->mi_attrs[i];
+			if ( !ai->ai_dbi ) {
+				i++;
+				continue;
+			}
+			rc = mdb_txn_begin( mdb->mi_dbenv, NULL, 0, &txn );
+			if ( rc == 0 ) {
+				rc = mdb_idl_stats_scan( txn, mdb, ai,
+					MDB_STATS_SCAN_KEYS, &done );
+				if ( rc == 0 )
+					rc = mdb_txn_commit( txn );
+				else
+					mdb_txn_abort( txn );
+			}
+			if ( rc ) {
+				Debug( LDAP_DEBUG_ANY,
+					LDAP_XSTRING(mdb_stats_scan) ": statistics of "
+					"index %s failed: %s (%d)\n",
+					ai->ai_desc->ad_type->sat_cname.bv_val,
+					mdb_strerror(rc), rc );
+				break;
+			}
+			if ( done )
+				i++;
+			/* let cn=config changes go ahead, they may change
+			 * the indices, so the scan goes on from where it is
+			 */
+			ldap_pvt_thread_pool_pausecheck( &connection_pool );
+		}
+	}
+
+	return NULL;
+}
+
+/* Start counting the keys of the indices left partial, if any */
+void
+mdb_stats_scan_start( BackendDB *be )
+{
+	struct mdb_info *mdb = be->be_private;
+
+	if ( !( slapMode & SLAP_SERVER_MODE ) ||
+		!( mdb->mi_flags & MDB_STATS_SCAN ))
+		return;
+	ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
+	/* Set a long interval (10 hours) so that it only gets scheduled once */
+	if ( !mdb->mi_stats_task )
+		mdb->mi_stats_task = ldap_pvt_runqueue_insert( &slapd_rq, 36000,
+			mdb_stats_scan, be, LDAP_XSTRING(mdb_stats_scan),
+			be->be_suffix[0].bv_val );
+	ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
+}
+
 /* Cleanup loose ends after Modify completes */
 static int
 mdb_cf_cleanup( ConfigArgs *c )
@@ -279,6 +449,8 @@ mdb_cf_cleanup( ConfigArgs *c )
 		rc = mdb_attr_dbs_open( c->be, NULL, &c->reply );
 		if ( rc )
 			rc = LDAP_OTHER;
+		else
+			mdb_stats_scan_start( c->be );
 	}
 	return rc;
 }
@@ -304,6 +476,41 @@ mdb_cf_gen( ConfigArgs *c )
 			}
 			} break;
 
+		case MDB_BACKUP:
+			if ( mdb->mi_backup_dir ) {
+				struct berval bv;
+				bv.bv_len = STRLENOF("\"\" 4294967295 2147483647") +
+					strlen( mdb->mi_backup_dir );
+				bv.bv_val = ch_malloc( bv.bv_len + 1 );
+				bv.bv_len = sprintf( bv.bv_val, "\"%s\" %ld %d",
+					mdb->mi_backup_dir, (long) mdb->mi_backup_min,
+					mdb->mi_backup_threads );
+				ber_bvarray_add( &c->rvalue_vals, &bv );
+			} else {
+				rc = 1;
+			}
+			break;
+
+		case MDB_PREFAULT:
+			if ( mdb->mi_prefault >= 0 ) {
+				char buf[64], *ptr;
+				struct berval bv;
+				int i;
+				ptr = buf + sprintf( buf, "%d", mdb->mi_prefault );
+				for ( i=0; mdb_pfhints[i].mask; i++ ) {
+					if ( mdb->mi_prefault_hints & mdb_pfhints[i].mask ) {
+						*ptr++ = ' ';
+						ptr = lutil_strcopy( ptr, mdb_pfhints[i].word.bv_val );
+					}
+				}
+				bv.bv_val = buf;
+				bv.bv_len = ptr - buf;
+				value_add_one( &c->rvalue_vals, &bv );
+			} else {
+				rc = 1;
+			}
+			break;
+
 		case MDB_CHKPT:
 			if ( mdb->mi_txn_cp ) {
 				char buf[64];
@@ -350,6 +557,28 @@ mdb_cf_gen( ConfigArgs *c )
 			c->value_int = mdb->mi_search_stack_depth;
 			break;
 
+		case MDB_STHREADS:
+			if ( mdb->mi_search_threads ) {
+				char buf[64];
+				struct berval bv;
+				bv.bv_val = buf;
+				bv.bv_len = sprintf( buf, "%d %lu", mdb->mi_search_threads,
+					(unsigned long) mdb->mi_search_mincand );
+				value_add_one( &c->rvalue_vals, &bv );
+			} else {
+				rc = 1;
+			}
+			break;
+
+		case MDB_PAGED: {
+			char buf[64];
+			struct berval bv;
+			bv.bv_val = buf;
+			bv.bv_len = sprintf( buf, "%lu %d",
+				(unsigned long) mdb->mi_paged_max, mdb->mi_paged_expire );
+			value_add_one( &c->rvalue_vals, &bv );
+			} break;
+
 		case MDB_MAXREADERS:
 			c->value_int = mdb->mi_readers;
 			break;
@@ -376,6 +605,36 @@ mdb_cf_gen( ConfigArgs *c )
 		case MDB_MAXSIZE:
 			break;
 
+		case MDB_BACKUP:
+			if ( mdb->mi_backup_task ) {
+				struct re_s *re = mdb->mi_backup_task;
+				mdb->mi_backup_task = NULL;
+				ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
+				if ( ldap_pvt_runqueue_isrunning( &slapd_rq, re ) )
+					ldap_pvt_runqueue_stoptask( &slapd_rq, re );
+				ldap_pvt_runqueue_remove( &slapd_rq, re );
+				ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
+			}
+			ch_free( mdb->mi_backup_dir );
+			mdb->mi_backup_dir = NULL;
+			break;
+
+		case MDB_STHREADS:
+			mdb->mi_search_threads = 0;
+			mdb->mi_search_mincand = DEFAULT_SEARCH_MINCAND;
+			break;
+
+		case MDB_PAGED:
+			mdb->mi_paged_max = DEFAULT_PAGED_MAX;
+			mdb->mi_paged_expire = DEFAULT_PAGED_EXPIRE;
+			mdb_paged_free( mdb, NULL );
+			break;
+
+		/* takes effect when the database is next opened */
+		case MDB_PREFAULT:
+			mdb->mi_prefault = -1;
+			mdb->mi_prefault_hints = 0;
+			break;
 		case MDB_CHKPT:
 			if ( mdb->mi_txn_cp_task ) {
 				struct re_s *re = mdb->mi_txn_cp_task;
@@ -534,6 +793,76 @@ mdb_cf_gen( ConfigArgs *c )
 			mdb->mi_dbenv_mode = mode;
 		}
 		break;
+	case MDB_BACKUP: {
+		unsigned long	l;
+		int	threads = 1;
+		if ( lutil_atoulx( &l, c->argv[2], 0 ) != 0 || l == 0 ) {
+			fprintf( stderr, "%s: "
+				"invalid minutes \"%s\" in \"backup\".\n",
+				c->log, c->argv[2] );
+			return 1;
+		}
+		if ( c->argc > 3 && ( lutil_atoi( &threads, c->argv[3] ) != 0 ||
+			threads < 1 )) {
+			fprintf( stderr, "%s: "
+				"invalid threads \"%s\" in \"backup\".\n",
+				c->log, c->argv[3] );
+			return 1;
+		}
+		if ( c->be->be_suffix == NULL || BER_BVISNULL( &c->be->be_suffix[0] ) ) {
+			fprintf( stderr, "%s: "
+				"\"backup\" must occur after \"suffix\".\n",
+				c->log );
+			return 1;
+		}
+		if ( mdb->mi_backup_dir )
+			ch_free( mdb->mi_backup_dir );
+		mdb->mi_backup_dir = ch_strdup( c->argv[1] );
+		mdb->mi_backup_min = l;
+		mdb->mi_backup_threads = threads;
+		/* Only a running server takes backups */
+		if ( slapMode & SLAP_SERVER_MODE ) {
+			struct re_s *re = mdb->mi_backup_task;
+			if ( re ) {
+				re->interval.tv_sec = mdb->mi_backup_min * 60;
+			} else {
+				ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
+				mdb->mi_backup_task = ldap_pvt_runqueue_insert( &slapd_rq,
+					mdb->mi_backup_min * 60, mdb_backup, mdb,
+					LDAP_XSTRING(mdb_backup), c->be->be_suffix[0].bv_val );
+				ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
+			}
+		}
+		} break;
+
+	case MDB_PREFAULT: {
+		int	i, j, levels;
+		unsigned hints = 0;
+		if ( lutil_atoi( &levels, c->argv[1] ) != 0 || levels < 0 ) {
+			fprintf( stderr, "%s: "
+				"invalid levels \"%s\" in \"prefault\".\n",
+				c->log, c->argv[1] );
+			return 1;
+		}
+		for ( i=2; i<c->argc; i++ ) {
+			j = verb_to_mask( c->argv[i], mdb_pfhints );
+			if ( !mdb_pfhints[j].mask ) {
+				fprintf( stderr, "%s: "
+					"unknown hint \"%s\" in \"prefault\".\n",
+					c->log, c->argv[i] );
+				return 1;
+			}
+			hints |= mdb_pfhints[j].mask;
+		}
+		mdb->mi_prefault = levels;
+		mdb->mi_prefault_hints = hints;
+		/* Hints apply when the map is next set up, the warm-up
+		 * can start right away.
+		 */
+		if ( mdb->mi_flags & MDB_IS_OPEN )
+			mdb_env_prefault( mdb->mi_dbenv, levels );
+		} break;
+
 	case MDB_CHKPT: {
 		long	l;
 		mdb->mi_txn_cp = 1;
@@ -678,6 +1007,47 @@ mdb_cf_gen( ConfigArgs *c )
 		mdb->mi_search_stack_depth = c->value_int;
 		break;
 
+	case MDB_STHREADS: {
+		int threads;
+		unsigned long mincand = DEFAULT_SEARCH_MINCAND;
+		if ( lutil_atoi( &threads, c->argv[1] ) != 0 || threads < 0 ) {
+			fprintf( stderr, "%s: "
+				"invalid threads \"%s\" in \"searchthreads\".\n",
+				c->log, c->argv[1] );
+			return 1;
+		}
+		if ( c->argc > 2 && lutil_atoul( &mincand, c->argv[2] ) != 0 ) {
+			fprintf( stderr, "%s: "
+				"invalid mincand \"%s\" in \"searchthreads\".\n",
+				c->log, c->argv[2] );
+			return 1;
+		}
+		mdb->mi_search_threads = threads;
+		mdb->mi_search_mincand = mincand;
+		} break;
+
+	case MDB_PAGED: {
+		unsigned long max;
+		int expire = DEFAULT_PAGED_EXPIRE;
+		if ( lutil_atoul( &max, c->argv[1] ) != 0 ) {
+			fprintf( stderr, "%s: "
+				"invalid bytes \"%s\" in \"pagedcache\".\n",
+				c->log, c->argv[1] );
+			return 1;
+		}
+		if ( c->argc > 2 && ( lutil_atoi( &expire, c->argv[2] ) != 0 ||
+			expire < 0 )) {
+			fprintf( stderr, "%s: "
+				"invalid seconds \"%s\" in \"pagedcache\".\n",
+				c->log, c->argv[2] );
+			return 1;
+		}
+		mdb->mi_paged_max = max;
+		mdb->mi_paged_expire = expire;
+		/* drop what no longer fits */
+		mdb_paged_free( mdb, NULL );
+		} break;
+
 	case MDB_MAXREADERS:
 		mdb->mi_readers = c->value_int;
 		if ( mdb->mi_flags & MDB_IS_OPEN ) {
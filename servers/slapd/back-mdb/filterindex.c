@@ -56,6 +56,13 @@ static int substring_candidates(
 	SubstringsAssertion *sub,
 	ID *ids,
 	ID *tmp );
+static int keys_candidates(
+	Operation *op,
+	MDB_txn *rtxn,
+	MDB_dbi dbi,
+	struct berval *keys,
+	ID *ids,
+	ID *tmp );
 
 static int list_candidates(
 	Operation *op,
@@ -558,6 +565,232 @@ base:
 	return 0;
 }
 
+/* The components of an AND are fetched in the order of their estimates,
+ * the most selective first. Components that can't use an index are not
+ * fetched at all. Once there are no more than MDB_AND_STOP candidates,
+ * components that would read more IDs are skipped: each candidate is
+ * tested against the whole filter anyway. An OR is all the entries as
+ * soon as one of its components is, so nothing is fetched then.
+ */
+#define MDB_AND_STOP	32
+
+typedef struct mdb_fplan {
+	Filter *fp_f;
+	ID fp_est;
+	MDB_dbi fp_dbi;
+	struct berval *fp_keys;	/* of an index lookup, to fetch it with */
+} mdb_fplan;
+
+/* Estimate how many IDs the index keys of a filter have, with as few
+ * reads as possible: only the number of IDs of each key is read, never
+ * the IDs. NOID means the filter can't be narrowed by an index, and its
+ * candidates are all the entries. If count is zero, indexed filters are
+ * not looked up and just return 1. If fp is set, the keys of an index
+ * lookup are left there for list_candidates() to fetch.
+ */
+
+#define EST_UNKNOWN	(NOID-1)	/* indexed, but too costly to estimate */
+
+/* The byte order of the index keys, near enough: a padded key may be
+ * out of place, and is then just searched from the root.
+ */
+static int
+keys_cmp( const void *a, const void *b )
+{
+	const struct berval *x = a, *y = b;
+	ber_len_t len = x->bv_len < y->bv_len ? x->bv_len : y->bv_len;
+	int rc;
+
+	rc = memcmp( x->bv_val, y->bv_val, len );
+	if ( rc == 0 )
+		rc = x->bv_len < y->bv_len ? -1 : x->bv_len > y->bv_len;
+	return rc;
+}
+
+static void
+keys_sort( struct berval *keys )
+{
+	int n;
+
+	for ( n = 0; keys[n].bv_val != NULL; n++ )
+		;
+	if ( n > 1 )
+		qsort( keys, n, sizeof( struct berval ), keys_cmp );
+}
+
+static ID
+keys_estimate(
+	Operation *op,
+	MDB_txn *rtxn,
+	AttributeDescription *desc,
+	int ftype,
+	MatchingRule *mr,
+	void *assertion,
+	int count,
+	mdb_fplan *fp )
+{
+	MDB_dbi dbi;
+	MDB_cursor *mc;
+	slap_mask_t mask;
+	struct berval prefix = {0, NULL};
+	struct berval *keys = NULL;
+	ID est = NOID, n;
+	int i, rc;
+
+	rc = mdb_index_param( op->o_bd, desc, ftype, &dbi, &mask, &prefix );
+	if ( rc != LDAP_SUCCESS || !mr || !mr->smr_filter )
+		return NOID;
+
+	rc = (mr->smr_filter)( ftype, mask, desc->ad_type->sat_syntax, mr,
+		&prefix, assertion, &keys, op->o_tmpmemctx );
+	if ( rc != LDAP_SUCCESS || keys == NULL )
+		return NOID;
+
+	if ( !count ) {
+		est = 1;
+	} else if ( mdb_cursor_open( rtxn, dbi, &mc ) == 0 ) {
+		/* The keys are intersected, the smallest one bounds them */
+		keys_sort( keys );
+		for ( i = 0; keys[i].bv_val != NULL; i++ ) {
+			rc = mdb_key_count( op->o_bd, mc, &keys[i], &n );
+			if ( rc == MDB_NOTFOUND ) {
+				est = 0;
+				break;
+			}
+			if ( rc == 0 && n < est )
+				est = n;
+		}
+		mdb_cursor_close( mc );
+	}
+	if ( est == NOID )
+		est = EST_UNKNOWN;
+	if ( fp ) {
+		fp->fp_dbi = dbi;
+		fp->fp_keys = keys;
+	} else {
+		ber_bvarray_free_x( keys, op->o_tmpmemctx );
+	}
+	return est;
+}
+
+static ID
+filter_estimate(
+	Operation *op,
+	MDB_txn *rtxn,
+	Filter *f,
+	int count,
+	mdb_fplan *fp )
+{
+	AttributeDescription *desc;
+	MatchingRule *mr;
+	MDB_dbi dbi;
+	MDB_cursor *mc;
+	slap_mask_t mask;
+	struct berval prefix = {0, NULL};
+	ID est, n;
+	int rc;
+
+	if ( f->f_choice & SLAPD_FILTER_UNDEFINED )
+		return 0;
+
+	switch ( f->f_choice ) {
+	case SLAPD_FILTER_COMPUTED:
+		if ( f->f_result == LDAP_COMPARE_FALSE ||
+			f->f_result == SLAPD_COMPARE_UNDEFINED )
+			return 0;
+		return NOID;
+
+	case LDAP_FILTER_PRESENT:
+		if ( f->f_desc == slap_schema.si_ad_objectClass )
+			return NOID;
+		rc = mdb_index_param( op->o_bd, f->f_desc, LDAP_FILTER_PRESENT,
+			&dbi, &mask, &prefix );
+		if ( rc != LDAP_SUCCESS || prefix.bv_val == NULL )
+			return NOID;
+		if ( !count )
+			return 1;
+		rc = mdb_cursor_open( rtxn, dbi, &mc );
+		if ( rc == 0 ) {
+			rc = mdb_key_count( op->o_bd, mc, &prefix, &n );
+			mdb_cursor_close( mc );
+		}
+		if ( rc == MDB_NOTFOUND )
+			return 0;
+		return rc ? EST_UNKNOWN : n;
+
+	case LDAP_FILTER_EQUALITY:
+		desc = f->f_ava->aa_desc;
+		if ( desc == slap_schema.si_ad_entryDN )
+			return 1;
+#ifdef LDAP_COMP_MATCH
+		if ( is_aliased_attribute && is_aliased_attribute( desc ))
+			return EST_UNKNOWN;
+#endif
+		return keys_estimate( op, rtxn, desc, LDAP_FILTER_EQUALITY,
+			desc->ad_type->sat_equality, &f->f_ava->aa_value, count, fp );
+
+	case LDAP_FILTER_APPROX:
+		desc = f->f_ava->aa_desc;
+		mr = desc->ad_type->sat_approx;
+		if ( !mr )
+			mr = desc->ad_type->sat_equality;
+		return keys_estimate( op, rtxn, desc, LDAP_FILTER_APPROX,
+			mr, &f->f_ava->aa_value, count, fp );
+
+	case LDAP_FILTER_SUBSTRINGS:
+		desc = f->f_sub->sa_desc;
+		return keys_estimate( op, rtxn, desc, LDAP_FILTER_SUBSTRINGS,
+			desc->ad_type->sat_substr, f->f_sub, count, fp );
+
+	case LDAP_FILTER_GE:
+	case LDAP_FILTER_LE:
+		/* Ordered keys are read in a run, don't guess their size */
+		desc = f->f_ava->aa_desc;
+		if ( desc->ad_type->sat_ordering &&
+			( desc->ad_type->sat_ordering->smr_usage & SLAP_MR_ORDERED_INDEX ))
+			rc = mdb_index_param( op->o_bd, desc, LDAP_FILTER_EQUALITY,
+				&dbi, &mask, &prefix );
+		else
+			rc = mdb_index_param( op->o_bd, desc, LDAP_FILTER_PRESENT,
+				&dbi, &mask, &prefix );
+		return rc == LDAP_SUCCESS ? EST_UNKNOWN : NOID;
+
+	case LDAP_FILTER_AND:
+		est = NOID;
+		for ( f = f->f_and; f; f = f->f_next ) {
+			n = filter_estimate( op, rtxn, f, count, NULL );
+			if ( n < est )
+				est = n;
+			if ( !est )
+				break;
+		}
+		return est;
+
+	case LDAP_FILTER_OR:
+		est = 0;
+		for ( f = f->f_or; f; f = f->f_next ) {
+			n = filter_estimate( op, rtxn, f, count, NULL );
+			if ( n >= NOID - est )
+				return n == NOID ? NOID : EST_UNKNOWN;
+			est += n;
+		}
+		return est;
+
+	case LDAP_FILTER_EXT:
+#ifdef LDAP_COMP_MATCH
+		if ( f->f_mra->ma_cf )
+			return EST_UNKNOWN;
+#endif
+		if ( f->f_mra->ma_desc == slap_schema.si_ad_entryDN )
+			return f->f_mra->ma_rule == slap_schema.si_mr_distinguishedNameMatch ?
+				1 : EST_UNKNOWN;
+		return NOID;
+
+	default:
+		return NOID;
+	}
+}
+
 static int
 list_candidates(
 	Operation *op,
@@ -568,19 +801,59 @@ list_candidates(
 	ID *tmp,
 	ID *save )
 {
-	int rc = 0;
+	int rc = 0, got = 0, i, j, n;
 	Filter	*f;
+	mdb_fplan *plan, pbuf[8], fp;
 
 	Debug( LDAP_DEBUG_FILTER, "=> mdb_list_candidates 0x%x\n", ftype, 0, 0 );
-	for ( f = flist; f != NULL; f = f->f_next ) {
+
+	for ( n = 0, f = flist; f != NULL; f = f->f_next )
+		n++;
+	plan = n <= sizeof(pbuf)/sizeof(pbuf[0]) ? pbuf :
+		op->o_tmpalloc( n * sizeof(mdb_fplan), op->o_tmpmemctx );
+
+	for ( n = 0, f = flist; f != NULL; f = f->f_next ) {
 		/* ignore precomputed scopes */
 		if ( f->f_choice == SLAPD_FILTER_COMPUTED &&
 		     f->f_result == LDAP_SUCCESS ) {
 			continue;
 		}
+		fp.fp_f = f;
+		fp.fp_keys = NULL;
+		fp.fp_est = filter_estimate( op, rtxn, f,
+			ftype == LDAP_FILTER_AND, &fp );
+		if ( fp.fp_est == NOID ) {
+			if ( ftype == LDAP_FILTER_AND )
+				continue;
+			Debug( LDAP_DEBUG_FILTER,
+				"   mdb_list_candidates: OR of an unindexed filter\n",
+				0, 0, 0 );
+			MDB_IDL_ALL( ids );
+			goto done;
+		}
+		/* insertion sort, stable */
+		for ( j = n; j > 0 && plan[j-1].fp_est > fp.fp_est; j-- )
+			plan[j] = plan[j-1];
+		plan[j] = fp;
+		n++;
+	}
+
+	for ( i = 0; i < n; i++ ) {
+		if ( ftype == LDAP_FILTER_AND && got &&
+			ids[0] <= MDB_AND_STOP && plan[i].fp_est > MDB_AND_STOP ) {
+			Debug( LDAP_DEBUG_FILTER,
+				"   mdb_list_candidates: %d left of %d, to test_filter\n",
+				n - i, n, 0 );
+			break;
+		}
 		MDB_IDL_ZERO( save );
-		rc = mdb_filter_candidates( op, rtxn, f, save, tmp,
-			save+MDB_IDL_UM_SIZE );
+		if ( plan[i].fp_keys ) {
+			rc = keys_candidates( op, rtxn, plan[i].fp_dbi,
+				plan[i].fp_keys, save, tmp );
+		} else {
+			rc = mdb_filter_candidates( op, rtxn, plan[i].fp_f, save, tmp,
+				save+MDB_IDL_UM_SIZE );
+		}
 
 		if ( rc != 0 ) {
 			if ( ftype == LDAP_FILTER_AND ) {
@@ -590,23 +863,28 @@ list_candidates(
 			break;
 		}
 
-		
-		if ( ftype == LDAP_FILTER_AND ) {
-			if ( f == flist ) {
-				MDB_IDL_CPY( ids, save );
-			} else {
-				mdb_idl_intersection( ids, save );
-			}
-			if( MDB_IDL_IS_ZERO( ids ) )
-				break;
+		if ( !got ) {
+			MDB_IDL_CPY( ids, save );
+			got = 1;
+		} else if ( ftype == LDAP_FILTER_AND ) {
+			mdb_idl_intersection( ids, save );
 		} else {
-			if ( f == flist ) {
-				MDB_IDL_CPY( ids, save );
-			} else {
-				mdb_idl_union( ids, save );
-			}
+			mdb_idl_union( ids, save );
 		}
+		if ( ftype == LDAP_FILTER_AND && MDB_IDL_IS_ZERO( ids ))
+			break;
 	}
+	/* No component of the AND could use an index */
+	if ( ftype == LDAP_FILTER_AND && !got )
+		MDB_IDL_ALL( ids );
+
+done:
+	for ( i = 0; i < n; i++ ) {
+		if ( plan[i].fp_keys )
+			ber_bvarray_free_x( plan[i].fp_keys, op->o_tmpmemctx );
+	}
+	if ( plan != pbuf )
+		op->o_tmpfree( plan, op->o_tmpmemctx );
 
 	if( rc == LDAP_SUCCESS ) {
 		Debug( LDAP_DEBUG_FILTER,
@@ -703,7 +981,6 @@ equality_candidates(
 	ID *tmp )
 {
 	MDB_dbi	dbi;
-	int i;
 	int rc;
 	slap_mask_t mask;
 	struct berval prefix = {0, NULL};
@@ -781,38 +1058,7 @@ equality_candidates(
 		return 0;
 	}
 
-	for ( i= 0; keys[i].bv_val != NULL; i++ ) {
-		rc = mdb_key_read( op->o_bd, rtxn, dbi, &keys[i], tmp, NULL, 0 );
-
-		if( rc == MDB_NOTFOUND ) {
-			MDB_IDL_ZERO( ids );
-			rc = 0;
-			break;
-		} else if( rc != LDAP_SUCCESS ) {
-			Debug( LDAP_DEBUG_TRACE,
-				"<= mdb_equality_candidates: (%s) "
-				"key read failed (%d)\n",
-				ava->aa_desc->ad_cname.bv_val, rc, 0 );
-			break;
-		}
-
-		if( MDB_IDL_IS_ZERO( tmp ) ) {
-			Debug( LDAP_DEBUG_TRACE,
-				"<= mdb_equality_candidates: (%s) NULL\n", 
-				ava->aa_desc->ad_cname.bv_val, 0, 0 );
-			MDB_IDL_ZERO( ids );
-			break;
-		}
-
-		if ( i == 0 ) {
-			MDB_IDL_CPY( ids, tmp );
-		} else {
-			mdb_idl_intersection( ids, tmp );
-		}
-
-		if( MDB_IDL_IS_ZERO( ids ) )
-			break;
-	}
+	rc = keys_candidates( op, rtxn, dbi, keys, ids, tmp );
 
 	ber_bvarray_free_x( keys, op->o_tmpmemctx );
 
@@ -834,7 +1080,6 @@ approx_candidates(
 	ID *tmp )
 {
 	MDB_dbi	dbi;
-	int i;
 	int rc;
 	slap_mask_t mask;
 	struct berval prefix = {0, NULL};
@@ -902,38 +1147,7 @@ approx_candidates(
 		return 0;
 	}
 
-	for ( i= 0; keys[i].bv_val != NULL; i++ ) {
-		rc = mdb_key_read( op->o_bd, rtxn, dbi, &keys[i], tmp, NULL, 0 );
-
-		if( rc == MDB_NOTFOUND ) {
-			MDB_IDL_ZERO( ids );
-			rc = 0;
-			break;
-		} else if( rc != LDAP_SUCCESS ) {
-			Debug( LDAP_DEBUG_TRACE,
-				"<= mdb_approx_candidates: (%s) "
-				"key read failed (%d)\n",
-				ava->aa_desc->ad_cname.bv_val, rc, 0 );
-			break;
-		}
-
-		if( MDB_IDL_IS_ZERO( tmp ) ) {
-			Debug( LDAP_DEBUG_TRACE,
-				"<= mdb_approx_candidates: (%s) NULL\n",
-				ava->aa_desc->ad_cname.bv_val, 0, 0 );
-			MDB_IDL_ZERO( ids );
-			break;
-		}
-
-		if ( i == 0 ) {
-			MDB_IDL_CPY( ids, tmp );
-		} else {
-			mdb_idl_intersection( ids, tmp );
-		}
-
-		if( MDB_IDL_IS_ZERO( ids ) )
-			break;
-	}
+	rc = keys_candidates( op, rtxn, dbi, keys, ids, tmp );
 
 	ber_bvarray_free_x( keys, op->o_tmpmemctx );
 
@@ -953,7 +1167,6 @@ substring_candidates(
 	ID *tmp )
 {
 	MDB_dbi	dbi;
-	int i;
 	int rc;
 	slap_mask_t mask;
 	struct berval prefix = {0, NULL};
@@ -1017,8 +1230,44 @@ substring_candidates(
 		return 0;
 	}
 
+	rc = keys_candidates( op, rtxn, dbi, keys, ids, tmp );
+
+	ber_bvarray_free_x( keys, op->o_tmpmemctx );
+
+	Debug( LDAP_DEBUG_TRACE, "<= mdb_substring_candidates: %ld, first=%ld, last=%ld\n",
+		(long) ids[0],
+		(long) MDB_IDL_FIRST(ids),
+		(long) MDB_IDL_LAST(ids) );
+	return( rc );
+}
+
+/* The IDs under all of keys, which are intersected. They are read in
+ * their order through one cursor, see mdb_key_seek().
+ */
+static int
+keys_candidates(
+	Operation *op,
+	MDB_txn *rtxn,
+	MDB_dbi dbi,
+	struct berval *keys,
+	ID *ids,
+	ID *tmp )
+{
+	MDB_cursor *mc;
+	int i;
+	int rc;
+
+	rc = mdb_cursor_open( rtxn, dbi, &mc );
+	if ( rc ) {
+		Debug( LDAP_DEBUG_TRACE,
+			"<= mdb_keys_candidates: cursor failed (%d)\n",
+			rc, 0, 0 );
+		return rc;
+	}
+	keys_sort( keys );
+
 	for ( i= 0; keys[i].bv_val != NULL; i++ ) {
-		rc = mdb_key_read( op->o_bd, rtxn, dbi, &keys[i], tmp, NULL, 0 );
+		rc = mdb_key_seek( op->o_bd, mc, &keys[i], tmp );
 
 		if( rc == MDB_NOTFOUND ) {
 			MDB_IDL_ZERO( ids );
@@ -1026,16 +1275,12 @@ substring_candidates(
 			break;
 		} else if( rc != LDAP_SUCCESS ) {
 			Debug( LDAP_DEBUG_TRACE,
-				"<= mdb_substring_candidates: (%s) "
-				"key read failed (%d)\n",
-				sub->sa_desc->ad_cname.bv_val, rc, 0 );
+				"<= mdb_keys_candidates: key read failed (%d)\n",
+				rc, 0, 0 );
 			break;
 		}
 
 		if( MDB_IDL_IS_ZERO( tmp ) ) {
-			Debug( LDAP_DEBUG_TRACE,
-				"<= mdb_substring_candidates: (%s) NULL\n",
-				sub->sa_desc->ad_cname.bv_val, 0, 0 );
 			MDB_IDL_ZERO( ids );
 			break;
 		}
@@ -1049,14 +1294,8 @@ substring_candidates(
 		if( MDB_IDL_IS_ZERO( ids ) )
 			break;
 	}
-
-	ber_bvarray_free_x( keys, op->o_tmpmemctx );
-
-	Debug( LDAP_DEBUG_TRACE, "<= mdb_substring_candidates: %ld, first=%ld, last=%ld\n",
-		(long) ids[0],
-		(long) MDB_IDL_FIRST(ids),
-		(long) MDB_IDL_LAST(ids) );
-	return( rc );
+	mdb_cursor_close( mc );
+	return rc;
 }
 
 static int
@@ -0,0 +1,149 @@
+#! /bin/sh
+# grambench.sh - compare the hashed and the trigram substring index
+# $OpenLDAP$
+## This work is part of OpenLDAP Software <http://www.openldap.org/>.
+##
+## Copyright 2011-2018 The OpenLDAP Foundation.
+## All rights reserved.
+##
+## Redistribution and use in source and binary forms, with or without
+## modification, are permitted only as authorized by the OpenLDAP
+## Public License.
+##
+## A copy of this license is available in the file LICENSE in the
+## top-level directory of the distribution or, alternatively, at
+## <http://www.OpenLDAP.org/license.html>.
+
+# Loads a directory of person names twice, once with "index cn,sn sub"
+# and once with "index cn,sn sub,subgram", then for each substring
+# filter prints the number of entries it matches, the candidates each
+# index hands to the search, and the time of <loops> searches.
+# Set FILTERS to a list of filters, one per line, to try others.
+#
+#	./grambench.sh <build dir> [entries] [loops]
+#
+# <build dir> is the top of a configured and built tree with back-mdb
+# static; the tests and clients must be built too.
+
+BUILD=${1:?usage: $0 <build dir> [entries] [loops]}
+ENTRIES=${2:-20000}
+LOOPS=${3:-200}
+
+SRCDIR=`cd \`dirname $0\`/../../..; pwd`
+SLAPD=$BUILD/servers/slapd/slapd
+SEARCH=$BUILD/tests/progs/slapd-search
+LDAPSEARCH=$BUILD/clients/tools/ldapsearch
+DIR=${TMPDIR:-/tmp}/grambench.$$
+PORT=${PORT:-9011}
+URI=ldap://127.0.0.1:$PORT/
+BASE="o=grambench"
+
+FILTERS=${FILTERS:-'(cn=*smi*)
+(cn=*son*)
+(cn=*ann*)
+(cn=*ar*)
+(cn=*ohn m*)
+(cn=mar*)
+(cn=mi*)
+(sn=*sen)
+(sn=*ez)
+(sn=gar*ez)
+(cn=*ria*rod*)
+(cn=*elizabeth*)'}
+
+mkdir -p $DIR || exit 1
+trap 'kill $PID 2>/dev/null; rm -rf $DIR' 0 1 2 15
+
+awk -v n=$ENTRIES -v base="$BASE" 'BEGIN {
+	ng = split("James Mary John Patricia Robert Jennifer Michael Linda " \
+		"William Elizabeth David Barbara Richard Susan Joseph Jessica " \
+		"Thomas Sarah Charles Karen Christopher Nancy Daniel Lisa " \
+		"Matthew Margaret Anthony Betty Mark Sandra Donald Ashley " \
+		"Steven Dorothy Paul Kimberly Andrew Emily Joshua Donna " \
+		"Kenneth Michelle Kevin Carol Brian Amanda George Melissa " \
+		"Edward Deborah Ronald Stephanie Timothy Rebecca Jason Laura " \
+		"Jeffrey Sharon Ryan Cynthia Jacob Kathleen Gary Amy " \
+		"Nicholas Shirley Eric Angela Jonathan Helen Stephen Anna " \
+		"Larry Brenda Justin Pamela Scott Nicole Brandon Samantha " \
+		"Maria Jose Juan Ana Luis Carmen Sven Ingrid Hans Greta", given, " ")
+	ns = split("Smith Johnson Williams Brown Jones Garcia Miller Davis " \
+		"Rodriguez Martinez Hernandez Lopez Gonzalez Wilson Anderson " \
+		"Thomas Taylor Moore Jackson Martin Lee Perez Thompson White " \
+		"Harris Sanchez Clark Ramirez Lewis Robinson Walker Young " \
+		"Allen King Wright Scott Torres Nguyen Hill Flores Green " \
+		"Adams Nelson Baker Hall Rivera Campbell Mitchell Carter " \
+		"Roberts Gomez Phillips Evans Turner Diaz Parker Cruz " \
+		"Edwards Collins Reyes Stewart Morris Morales Murphy Cook " \
+		"Rogers Gutierrez Ortiz Morgan Cooper Peterson Bailey Reed " \
+		"Kelly Howard Ramos Kim Cox Ward Richardson Watson Brooks " \
+		"Chavez Wood James Bennett Gray Mendoza Ruiz Hughes Price " \
+		"Alvarez Castillo Sanders Patel Myers Long Ross Foster " \
+		"Jimenez Hansen Jensen Nielsen Larsen Andersen Pedersen " \
+		"Schmidt Schneider Fischer Weber Meyer Wagner Becker Schulz " \
+		"Smithers Goldsmith Nakamura Tanaka Watanabe Suzuki", sur, " ")
+	srand(1)
+	printf "dn: %s\nobjectClass: organization\no: grambench\n\n", base
+	for ( i = 1; i <= n; i++ ) {
+		g = given[int(rand() * ng) + 1]
+		s = sur[int(rand() * ns) + 1]
+		m = substr("ABCDEFGHIJKLMNOPQRSTUVWXYZ", int(rand() * 26) + 1, 1)
+		printf "dn: uid=u%d,%s\nobjectClass: inetOrgPerson\n", i, base
+		printf "uid: u%d\ncn: %s %s. %s\ngivenName: %s\nsn: %s\n\n", \
+			i, g, m, s, g, s
+	}
+}' > $DIR/names.ldif
+
+for INDEX in sub sub,subgram ; do
+	rm -rf $DIR/db
+	mkdir $DIR/db
+	cat > $DIR/slapd.conf <<EOF
+include		$SRCDIR/servers/slapd/schema/core.schema
+include		$SRCDIR/servers/slapd/schema/cosine.schema
+include		$SRCDIR/servers/slapd/schema/inetorgperson.schema
+pidfile		$DIR/slapd.pid
+argsfile	$DIR/slapd.args
+sizelimit	unlimited
+database	mdb
+suffix		"$BASE"
+directory	$DIR/db
+maxsize		1073741824
+index		objectClass eq
+index		cn,sn $INDEX
+EOF
+	$SLAPD -Ta -q -f $DIR/slapd.conf -l $DIR/names.ldif || exit 1
+
+	# one pass under trace for the candidate counts...
+	$SLAPD -f $DIR/slapd.conf -h $URI -d trace > $DIR/trace 2>&1 &
+	PID=$!
+	sleep 1
+	echo "$FILTERS" | while read F ; do
+		L=`wc -l < $DIR/trace`
+		M=`$LDAPSEARCH -x -LLL -H $URI -b "$BASE" "$F" 1.1 | grep -c '^dn:'`
+		C=`sed -n "$((L + 1)),\$ s/.*<= mdb_substring_candidates: \([0-9]*\),.*/\1/p" \
+			$DIR/trace | head -1`
+		echo "$M ${C:--}"
+	done > $DIR/cands.$INDEX
+	kill $PID; wait $PID 2>/dev/null
+
+	# ...and one quiet one for the times
+	$SLAPD -f $DIR/slapd.conf -h $URI > /dev/null 2>&1
+	sleep 1
+	PID=`cat $DIR/slapd.pid`
+	echo "$FILTERS" | while read F ; do
+		T0=`date +%s%N`
+		$SEARCH -H $URI -b "$BASE" -s sub -f "$F" -l $LOOPS -N > /dev/null 2>&1
+		T1=`date +%s%N`
+		echo $(( (T1 - T0) / 1000 / $LOOPS ))
+	done > $DIR/times.$INDEX
+	kill $PID; sleep 1
+	echo "$INDEX: `du -k $DIR/db/data.mdb | cut -f1` KB"
+done
+
+echo
+printf "%-16s %8s %10s %10s %10s %10s\n" filter matches \
+	"sub cand" "gram cand" "sub us" "gram us"
+echo "$FILTERS" > $DIR/filters
+paste -d'|' $DIR/filters $DIR/cands.sub $DIR/cands.sub,subgram \
+	$DIR/times.sub $DIR/times.sub,subgram | \
+	awk -F'|' '{ split($2, s, " "); split($3, g, " ")
+		printf "%-16s %8s %10s %10s %10s %10s\n", $1, s[1], s[2], g[2], $4, $5 }'
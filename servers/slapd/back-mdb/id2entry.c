@@ -292,7 +292,9 @@ static int mdb_id2entry_put(
 
 again:
 	data.mv_size = ec.dlen;
-	if ( mc )
+	if ( slapMode & SLAP_TOOL_QUICK )
+		rc = mdb_tool_id2entry_put( txn, mc, mdb->mi_id2entry, &key, &data, flag );
+	else if ( mc )
 		rc = mdb_cursor_put( mc, &key, &data, flag );
 	else
 		rc = mdb_put( txn, mdb->mi_id2entry, &key, &data, flag );
@@ -397,8 +399,12 @@ int mdb_id2entry(
 	key.mv_data = &id;
 	key.mv_size = sizeof(ID);
 
-	/* fetch it */
-	rc = mdb_cursor_get( mc, &key, &data, MDB_SET );
+	/* fetch it. Searches fetch candidates in ID order through one
+	 * cursor, and a batch lookup picks up where the last one left off.
+	 */
+	rc = mdb_cursor_get_batch( mc, &key, &data, 1 );
+	if ( rc == MDB_SUCCESS && !data.mv_data )
+		rc = MDB_NOTFOUND;
 	if ( rc == MDB_NOTFOUND ) {
 		/* Looking for root entry on an empty-dn suffix? */
 		if ( !id && BER_BVISEMPTY( &op->o_bd->be_nsuffix[0] )) {
@@ -436,7 +442,7 @@ int mdb_id2entry(
 		rc = MDB_NOTFOUND;
 	if ( rc ) return rc;
 
-	rc = mdb_entry_decode( op, mdb_cursor_txn( mc ), &data, id, e );
+	rc = mdb_entry_decode( op, mdb_cursor_txn( mc ), &data, id, NULL, e );
 	if ( rc ) return rc;
 
 	(*e)->e_id = id;
@@ -991,17 +997,48 @@ static int mdb_entry_encode(Operation *op, Entry *e, MDB_val *data, Ecount *eh)
 	return 0;
 }
 
+/* Select the stored attributes that are subtypes of any of ads,
+ * a NULL-terminated list, for a partial mdb_entry_decode. Attributes
+ * added to the DB later are not known here and are always decoded.
+ * Free the result with op->o_tmpfree.
+ */
+mdb_attrsel *mdb_attrsel_new(Operation *op, AttributeDescription **ads)
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	mdb_attrsel *sel;
+	int i, k, n = mdb->mi_numads;
+
+	sel = op->o_tmpalloc(sizeof(mdb_attrsel) + n + 1, op->o_tmpmemctx);
+	sel->as_nads = n;
+	sel->as_keep = (unsigned char *)(sel+1);
+	sel->as_keep[0] = 0;
+	for (i=1; i<=n; i++) {
+		sel->as_keep[i] = 0;
+		for (k=0; ads[k]; k++) {
+			if (is_ad_subtype(mdb->mi_ads[i], ads[k])) {
+				sel->as_keep[i] = 1;
+				break;
+			}
+		}
+	}
+	return sel;
+}
+
 /* Retrieve an Entry that was stored using entry_encode above.
+ * If sel is set, only the attributes it selects are decoded; the
+ * others are stepped over using the value lengths in the header,
+ * and their separately stored values are not read at all.
  *
  * Note: everything is stored in a single contiguous block, so
  * you can not free individual attributes or names from this
  * structure. Attempting to do so will likely corrupt memory.
  */
 
-int mdb_entry_decode(Operation *op, MDB_txn *txn, MDB_val *data, ID id, Entry **e)
+int mdb_entry_decode(Operation *op, MDB_txn *txn, MDB_val *data, ID id,
+	mdb_attrsel *sel, Entry **e)
 {
 	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
-	int i, j, nattrs, nvals;
+	int i, j, nattrs, nvals, skipped = 0;
 	int rc;
 	Attribute *a;
 	Entry *x;
@@ -1028,16 +1065,16 @@ int mdb_entry_decode(Operation *op, MDB_txn *txn, MDB_val *data, ID id, Entry **
 	ptr = (unsigned char *)(lp + i);
 
 	for (;nattrs>0; nattrs--) {
-		int have_nval = 0, multi = 0;
-		a->a_flags = SLAP_ATTR_DONT_FREE_DATA | SLAP_ATTR_DONT_FREE_VALS;
+		int have_nval = 0, multi = 0, flags;
+		flags = SLAP_ATTR_DONT_FREE_DATA | SLAP_ATTR_DONT_FREE_VALS;
 		i = *lp++;
 		if (i & MDB_AT_SORTED) {
 			i ^= MDB_AT_SORTED;
-			a->a_flags |= SLAP_ATTR_SORTED_VALS;
+			flags |= SLAP_ATTR_SORTED_VALS;
 		}
 		if (i & MDB_AT_MULTI) {
 			i ^= MDB_AT_MULTI;
-			a->a_flags |= SLAP_ATTR_BIG_MULTI;
+			flags |= SLAP_ATTR_BIG_MULTI;
 			multi = 1;
 		}
 		if (i > mdb->mi_numads) {
@@ -1052,6 +1089,21 @@ int mdb_entry_decode(Operation *op, MDB_txn *txn, MDB_val *data, ID id, Entry **
 				goto leave;
 			}
 		}
+		if (sel && i <= sel->as_nads && !sel->as_keep[i]) {
+			/* not selected, step over its values */
+			unsigned int nv = *lp++;
+			if (nv & MDB_AT_NVALS) {
+				nv ^= MDB_AT_NVALS;
+				nv *= 2;
+			}
+			if (!multi) {
+				for (; nv>0; nv--)
+					ptr += *lp++ + 1;
+			}
+			skipped++;
+			continue;
+		}
+		a->a_flags = flags;
 		a->a_desc = mdb->mi_ads[i];
 		a->a_numvals = *lp++;
 		if (a->a_numvals & MDB_AT_NVALS) {
@@ -1113,10 +1165,17 @@ int mdb_entry_decode(Operation *op, MDB_txn *txn, MDB_val *data, ID id, Entry **
 		a->a_next = a+1;
 		a = a->a_next;
 	}
-	a[-1].a_next = NULL;
+	if (a == x->e_attrs)
+		x->e_attrs = NULL;
+	else
+		a[-1].a_next = NULL;
 done:
-	Debug(LDAP_DEBUG_TRACE, "<= mdb_entry_decode\n",
-		0, 0, 0 );
+	if (sel)
+		Debug(LDAP_DEBUG_TRACE, "<= mdb_entry_decode: %d attributes not selected\n",
+			skipped, 0, 0 );
+	else
+		Debug(LDAP_DEBUG_TRACE, "<= mdb_entry_decode\n",
+			0, 0, 0 );
 	*e = x;
 	rc = 0;
 
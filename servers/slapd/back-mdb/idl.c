@@ -22,6 +22,15 @@
 #include "back-mdb.h"
 #include "idl.h"
 
+/* The AVX2 list kernels are compiled in whenever the compiler can
+ * target AVX2, and only used if the CPU has it.
+ */
+#if defined(__x86_64__) && !defined(_WIN32) && \
+	( defined(__clang__) || __GNUC__ > 4 || ( __GNUC__ == 4 && __GNUC_MINOR__ >= 9 ))
+#define IDL_AVX2	1
+#include <immintrin.h>
+#endif
+
 #define IDL_MAX(x,y)	( (x) > (y) ? (x) : (y) )
 #define IDL_MIN(x,y)	( (x) < (y) ? (x) : (y) )
 #define IDL_CMP(x,y)	( (x) < (y) ? -1 : (x) > (y) )
@@ -31,6 +40,9 @@ static void idl_check( ID *ids )
 {
 	if( MDB_IDL_IS_RANGE( ids ) ) {
 		assert( MDB_IDL_RANGE_FIRST(ids) <= MDB_IDL_RANGE_LAST(ids) );
+	} else if( MDB_IDL_IS_BITMAP( ids ) ) {
+		assert( MDB_IDL_FIRST(ids) <= MDB_IDL_LAST(ids) );
+		assert( MDB_IDL_BM_SIZE(ids) <= MDB_IDL_BM_MAX );
 	} else {
 		ID i;
 		for( i=1; i < ids[0]; i++ ) {
@@ -48,6 +60,13 @@ static void idl_dump( ID *ids )
 			(long) MDB_IDL_RANGE_FIRST( ids ),
 			(long) MDB_IDL_RANGE_LAST( ids ) );
 
+	} else if( MDB_IDL_IS_BITMAP( ids ) ) {
+		Debug( LDAP_DEBUG_ANY,
+			"IDL: bitmap ( %ld - %ld ) of %ld\n",
+			(long) MDB_IDL_FIRST( ids ),
+			(long) MDB_IDL_LAST( ids ),
+			(long) MDB_IDL_BM_N( ids ) );
+
 	} else {
 		ID i;
 		Debug( LDAP_DEBUG_ANY, "IDL: size %ld", (long) ids[0], 0, 0 );
@@ -258,134 +277,1483 @@ mdb_show_key(
 	}
 }
 
+/* Bitmap IDLs.
+ *
+ * When an index key has more than MDB_IDL_DB_MAX IDs, the index DB only
+ * keeps the range of its IDs. The IDs themselves are kept in the ix2b DB,
+ * in one container for each block of 64K IDs. A container is a sorted
+ * array of the low 16 bits of its IDs, a bitmap of the whole block, or a
+ * list of runs of consecutive IDs, whichever is smallest. The key of a
+ * container is the name of the index DB with its trailing NUL, the length
+ * of the index key, the index key, and the block number in big-endian
+ * order. An index key with a range and no containers was written by an
+ * older version; its range is used as is.
+ *
+ * In a bitmap IDL, each container is preceded by an mdb_bcont and padded
+ * to a multiple of an ID.
+ */
+
+#define BM_BITS		(1<<16)		/* IDs in a block */
+#define BM_WORDS	(BM_BITS/32)	/* unsigned ints in a bitmap */
+#define BM_LOW(id)	((unsigned)((id) & (BM_BITS-1)))
+#define BM_KEYMAX	511		/* largest LMDB key */
+
+#define BM_SET(bits, i)		((bits)[(i)>>5] |= 1U << ((i)&31))
+#define BM_CLR(bits, i)		((bits)[(i)>>5] &= ~(1U << ((i)&31)))
+#define BM_ISSET(bits, i)	((bits)[(i)>>5] & (1U << ((i)&31)))
+
+#define BC_ARRAY	0
+#define BC_BITMAP	1
+#define BC_RUN		2
+
+/* The header of a container, as stored in the ix2b DB */
+typedef struct mdb_bhead {
+	unsigned int bh_card;		/* number of IDs */
+	unsigned short bh_type;		/* BC_ARRAY, BC_BITMAP or BC_RUN */
+	unsigned short bh_nruns;	/* number of runs of a BC_RUN */
+} mdb_bhead;
+
+/* The header of a container in a bitmap IDL */
+typedef struct mdb_bcont {
+	ID bc_key;			/* block number */
+	mdb_bhead bc_head;
+} mdb_bcont;
+
+#define BC_HDR		((sizeof(mdb_bcont) + sizeof(ID) - 1) / sizeof(ID))
+#define BC_DATA(c)	((unsigned short *)((ID *)(c) + BC_HDR))
+#define BC_WORDS(h)	((bc_size(h) + sizeof(ID) - 1) / sizeof(ID))
+#define BC_NEXT(c)	(BC_HDR + BC_WORDS(&(c)->bc_head))
+
+/* Buffer for a container read from the ix2b DB, in IDs */
+#define BM_VALSIZE	((sizeof(mdb_bhead) + BM_WORDS * sizeof(unsigned)) \
+	/ sizeof(ID) + 1)
+
+static size_t
+bc_size( mdb_bhead *h )
+{
+	switch ( h->bh_type ) {
+	case BC_ARRAY:
+		return h->bh_card * sizeof(unsigned short);
+	case BC_BITMAP:
+		return BM_WORDS * sizeof(unsigned);
+	default:
+		return h->bh_nruns * 2 * sizeof(unsigned short);
+	}
+}
+
+static unsigned
+bm_count( unsigned w )
+{
+#ifdef __GNUC__
+	return __builtin_popcount( w );
+#else
+	w -= (w >> 1) & 0x55555555;
+	w = (w & 0x33333333) + ((w >> 2) & 0x33333333);
+	return (((w + (w >> 4)) & 0x0f0f0f0f) * 0x01010101) >> 24;
+#endif
+}
+
+/* Position of the lowest set bit of w, which isn't 0 */
+static unsigned
+bm_lowbit( unsigned w )
+{
+#ifdef __GNUC__
+	return __builtin_ctz( w );
+#else
+	unsigned n = 0;
+	for ( ; !( w & 1 ); w >>= 1 )
+		n++;
+	return n;
+#endif
+}
+
+/* Return the first bit at or after i that is set, or clear if
+ * set is 0, or BM_BITS if there is none
+ */
+static unsigned
+bm_scan( unsigned *bits, unsigned i, int set )
+{
+	unsigned w;
+
+	for ( ; i < BM_BITS; i = ( i | 31 ) + 1 ) {
+		w = set ? bits[i >> 5] : ~bits[i >> 5];
+		w &= ~0U << ( i & 31 );
+		if ( w )
+			return ( i & ~31U ) + bm_lowbit( w );
+	}
+	return BM_BITS;
+}
+
+/* Set the bits lo to hi inclusive */
+static void
+bm_setrange( unsigned *bits, unsigned lo, unsigned hi )
+{
+	for ( ; lo <= hi && ( lo & 31 ); lo++ )
+		BM_SET( bits, lo );
+	for ( ; lo + 31 <= hi; lo += 32 )
+		bits[lo >> 5] = ~0U;
+	for ( ; lo <= hi; lo++ )
+		BM_SET( bits, lo );
+}
+
+/* Add the IDs of a container to a bitmap */
+static void
+bc_decode( mdb_bhead *h, unsigned short *data, unsigned *bits )
+{
+	unsigned i, w;
+
+	switch ( h->bh_type ) {
+	case BC_ARRAY:
+		for ( i=0; i<h->bh_card; i++ )
+			BM_SET( bits, data[i] );
+		break;
+	case BC_BITMAP:
+		for ( i=0; i<BM_WORDS; i++ ) {
+			memcpy( &w, data + i * 2, sizeof(w) );
+			bits[i] |= w;
+		}
+		break;
+	default:
+		for ( i=0; i<h->bh_nruns; i++ )
+			bm_setrange( bits, data[2*i], data[2*i] + data[2*i+1] );
+		break;
+	}
+}
+
+/* Store a bitmap in the smallest kind of container.
+ * A run is stored as its first ID and its length minus one.
+ */
+static void
+bc_encode( unsigned *bits, mdb_bhead *h, unsigned short *data )
+{
+	unsigned i, j, w, prev = 0, card = 0, nruns = 0, n = 0;
+
+	for ( i=0; i<BM_WORDS; i++ ) {
+		w = bits[i];
+		card += bm_count( w );
+		/* A run starts at each set bit whose lower neighbor is clear */
+		nruns += bm_count( w & ~(( w << 1 ) | prev ));
+		prev = w >> 31;
+	}
+	h->bh_card = card;
+	h->bh_nruns = 0;
+	if ( nruns * 2 < card && nruns < BM_WORDS ) {
+		h->bh_type = BC_RUN;
+		h->bh_nruns = nruns;
+		for ( i = bm_scan( bits, 0, 1 ); i < BM_BITS; i = bm_scan( bits, j, 1 )) {
+			j = bm_scan( bits, i, 0 );
+			data[n++] = i;
+			data[n++] = j - 1 - i;
+		}
+	} else if ( card * sizeof(unsigned short) < BM_WORDS * sizeof(unsigned)) {
+		h->bh_type = BC_ARRAY;
+		for ( i=0; i<BM_WORDS; i++ ) {
+			for ( w = bits[i]; w; w &= w - 1 )
+				data[n++] = ( i << 5 ) + bm_lowbit( w );
+		}
+	} else {
+		h->bh_type = BC_BITMAP;
+		memcpy( data, bits, BM_WORDS * sizeof(unsigned));
+	}
+}
+
+/* Return the first ID of a container at or after lo, or -1 */
+static int
+bc_next( mdb_bhead *h, unsigned short *data, unsigned lo )
+{
+	unsigned i, w, n, base;
+
+	if ( lo >= BM_BITS )
+		return -1;
+
+	switch ( h->bh_type ) {
+	case BC_ARRAY:
+		base = 0;
+		n = h->bh_card;
+		while ( n ) {
+			unsigned pivot = n >> 1;
+			if ( data[base + pivot] < lo ) {
+				base += pivot + 1;
+				n -= pivot + 1;
+			} else {
+				n = pivot;
+			}
+		}
+		return base < h->bh_card ? (int)data[base] : -1;
+	case BC_BITMAP:
+		for ( i = lo >> 5; i < BM_WORDS; i++ ) {
+			memcpy( &w, data + i * 2, sizeof(w) );
+			if ( i == lo >> 5 )
+				w &= ~0U << ( lo & 31 );
+			if ( w )
+				return ( i << 5 ) + bm_lowbit( w );
+		}
+		return -1;
+	default:
+		for ( i=0; i<h->bh_nruns; i++ ) {
+			if ( data[2*i] + data[2*i+1] >= lo )
+				return data[2*i] > lo ? data[2*i] : lo;
+		}
+		return -1;
+	}
+}
+
+/* Return the last ID of a container */
+static unsigned
+bc_last( mdb_bhead *h, unsigned short *data )
+{
+	unsigned i, w, n;
+
+	switch ( h->bh_type ) {
+	case BC_ARRAY:
+		return data[h->bh_card - 1];
+	case BC_BITMAP:
+		for ( i = BM_WORDS; i--; ) {
+			memcpy( &w, data + i * 2, sizeof(w) );
+			if ( w ) {
+				for ( n = i << 5; w > 1; w >>= 1, n++ ) ;
+				return n;
+			}
+		}
+		return 0;
+	default:
+		i = h->bh_nruns - 1;
+		return data[2*i] + data[2*i+1];
+	}
+}
+
+/* Add low bits lo to a container whose IDs are all below it, in
+ * place. Returns 0 if the container must be rebuilt instead.
+ */
+static int
+bc_append( mdb_bhead *h, unsigned short *data, unsigned lo )
+{
+	unsigned last = bc_last( h, data ), w;
+
+	if ( !h->bh_card || lo <= last )
+		return 0;
+	switch ( h->bh_type ) {
+	case BC_ARRAY:
+		if ( h->bh_card + 1 >= BM_BITS / 16 )
+			return 0;
+		if ( lo == last + 1 && data[0] + h->bh_card == lo ) {
+			/* All consecutive, make it a run */
+			h->bh_type = BC_RUN;
+			h->bh_nruns = 1;
+			data[1] = h->bh_card;
+		} else {
+			data[h->bh_card] = lo;
+		}
+		break;
+	case BC_BITMAP:
+		memcpy( &w, data + ( lo >> 5 ) * 2, sizeof(w) );
+		w |= 1U << ( lo & 31 );
+		memcpy( data + ( lo >> 5 ) * 2, &w, sizeof(w) );
+		break;
+	default:
+		if ( lo == last + 1 ) {
+			data[2 * h->bh_nruns - 1]++;
+		} else if (( h->bh_nruns + 1 ) * 2 < h->bh_card + 1 &&
+			h->bh_nruns + 1 < BM_WORDS ) {
+			data[2 * h->bh_nruns] = lo;
+			data[2 * h->bh_nruns + 1] = 0;
+			h->bh_nruns++;
+		} else {
+			return 0;
+		}
+		break;
+	}
+	h->bh_card++;
+	return 1;
+}
+
+static void
+bm_init( ID *ids )
+{
+	ids[0] = MDB_IDL_BITMAP;
+	ids[1] = 0;
+	ids[2] = 0;
+	MDB_IDL_BM_N( ids ) = 0;
+	MDB_IDL_BM_SIZE( ids ) = MDB_IDL_BM_HDR;
+}
+
+/* Append a container for block key to a bitmap IDL.
+ * Returns -1 if the IDL is full.
+ */
+static int
+bm_add( ID *ids, ID key, mdb_bhead *h, unsigned short *data )
+{
+	mdb_bcont *c;
+	size_t n = BC_HDR + BC_WORDS( h );
+
+	if ( !h->bh_card )
+		return 0;
+	if ( MDB_IDL_BM_SIZE( ids ) + n > MDB_IDL_BM_MAX )
+		return -1;
+	c = (mdb_bcont *)( ids + MDB_IDL_BM_SIZE( ids ));
+	c->bc_key = key;
+	c->bc_head = *h;
+	memcpy( BC_DATA( c ), data, bc_size( h ));
+	if ( !MDB_IDL_BM_N( ids ))
+		ids[1] = key << 16 | bc_next( h, data, 0 );
+	ids[2] = key << 16 | bc_last( h, data );
+	MDB_IDL_BM_N( ids ) += h->bh_card;
+	MDB_IDL_BM_SIZE( ids ) += n;
+	return 0;
+}
+
+/* Append block key of a bitmap to a bitmap IDL */
+static int
+bm_put( ID *ids, ID key, unsigned *bits )
+{
+	ID buf[BM_VALSIZE];
+	mdb_bhead h;
+
+	bc_encode( bits, &h, (unsigned short *)buf );
+	return bm_add( ids, key, &h, (unsigned short *)buf );
+}
+
+/* Find the first ID at or after low bits lo of the container at
+ * offset pos of a bitmap IDL, and set the cursor to it.
+ */
+static ID
+bm_next( ID *ids, ID pos, unsigned lo, ID *cursor )
+{
+	mdb_bcont *c;
+	int n;
+
+	for ( ; pos < MDB_IDL_BM_SIZE( ids ); pos += BC_NEXT( c ), lo = 0 ) {
+		c = (mdb_bcont *)( ids + pos );
+		n = bc_next( &c->bc_head, BC_DATA( c ), lo );
+		if ( n >= 0 ) {
+			*cursor = pos << 16 | n;
+			return c->bc_key << 16 | n;
+		}
+	}
+	return NOID;
+}
+
+/* Look for an ID in a bitmap IDL. *pos is the offset of the container
+ * to start at, for a series of lookups in ascending order.
+ */
+static int
+bm_has( ID *ids, ID *pos, ID id )
+{
+	mdb_bcont *c;
+
+	for ( ; *pos < MDB_IDL_BM_SIZE( ids ); *pos += BC_NEXT( c )) {
+		c = (mdb_bcont *)( ids + *pos );
+		if ( c->bc_key >= id >> 16 ) {
+			return c->bc_key == id >> 16 &&
+				bc_next( &c->bc_head, BC_DATA( c ), BM_LOW( id )) == (int)BM_LOW( id );
+		}
+	}
+	return 0;
+}
+
+int
+mdb_idl_bm_has( ID *ids, ID id )
+{
+	ID pos = MDB_IDL_BM_HDR;
+
+	return bm_has( ids, &pos, id );
+}
+
+/* Walks an IDL of any kind one block at a time */
+typedef struct bm_iter {
+	ID *bi_ids;
+	ID bi_pos;		/* next list index, or next container offset */
+} bm_iter;
+
+static void
+bmi_init( bm_iter *it, ID *ids )
+{
+	it->bi_ids = ids;
+	it->bi_pos = MDB_IDL_IS_BITMAP( ids ) ? MDB_IDL_BM_HDR : 1;
+}
+
+/* Return the first block at or after key that has IDs, or NOID */
+static ID
+bmi_seek( bm_iter *it, ID key )
+{
+	ID *ids = it->bi_ids;
+	mdb_bcont *c;
+
+	if ( MDB_IDL_IS_RANGE( ids )) {
+		if ( key > ids[2] >> 16 )
+			return NOID;
+		return IDL_MAX( key, ids[1] >> 16 );
+	}
+	if ( MDB_IDL_IS_BITMAP( ids )) {
+		while ( it->bi_pos < MDB_IDL_BM_SIZE( ids )) {
+			c = (mdb_bcont *)( ids + it->bi_pos );
+			if ( c->bc_key >= key )
+				return c->bc_key;
+			it->bi_pos += BC_NEXT( c );
+		}
+		return NOID;
+	}
+	for ( ; it->bi_pos <= ids[0]; it->bi_pos++ ) {
+		if ( ids[it->bi_pos] >> 16 >= key )
+			return ids[it->bi_pos] >> 16;
+	}
+	return NOID;
+}
+
+/* Add the IDs in block key, just returned by bmi_seek, to a bitmap */
+static void
+bmi_fill( bm_iter *it, ID key, unsigned *bits )
+{
+	ID *ids = it->bi_ids;
+	mdb_bcont *c;
+
+	if ( MDB_IDL_IS_RANGE( ids )) {
+		bm_setrange( bits,
+			key == ids[1] >> 16 ? BM_LOW( ids[1] ) : 0,
+			key == ids[2] >> 16 ? BM_LOW( ids[2] ) : BM_BITS - 1 );
+	} else if ( MDB_IDL_IS_BITMAP( ids )) {
+		c = (mdb_bcont *)( ids + it->bi_pos );
+		bc_decode( &c->bc_head, BC_DATA( c ), bits );
+		it->bi_pos += BC_NEXT( c );
+	} else {
+		for ( ; it->bi_pos <= ids[0] && ids[it->bi_pos] >> 16 == key;
+			it->bi_pos++ )
+			BM_SET( bits, BM_LOW( ids[it->bi_pos] ));
+	}
+}
+
+/* Copy a bitmap IDL to a list, if it fits in one, else as it is */
+static void
+bm_copy( ID *ids, ID *bm )
+{
+	ID id, cursor, n = 0;
+
+	if ( !MDB_IDL_BM_N( bm )) {
+		MDB_IDL_ZERO( ids );
+	} else if ( MDB_IDL_BM_N( bm ) < MDB_IDL_DB_MAX ) {
+		for ( id = bm_next( bm, MDB_IDL_BM_HDR, 0, &cursor ); id != NOID;
+			id = mdb_idl_next( bm, &cursor ))
+			ids[++n] = id;
+		ids[0] = n;
+	} else {
+		MDB_IDL_CPY( ids, bm );
+	}
+}
+
+/* a = a intersection b, or a = a union b, when one of them is
+ * a bitmap IDL. If the result doesn't fit in a bitmap IDL, it
+ * is widened to a range.
+ */
+static void
+bm_op( ID *a, ID *b, int and )
+{
+	unsigned bits[BM_WORDS], bitsb[BM_WORDS];
+	bm_iter ia, ib;
+	ID ka, kb, key = 0, *out;
+	int i, rc = 0;
+
+	out = ch_malloc( MDB_IDL_BM_MAX * sizeof(ID));
+	bm_init( out );
+	bmi_init( &ia, a );
+	bmi_init( &ib, b );
+
+	for (;;) {
+		ka = bmi_seek( &ia, key );
+		if ( and ) {
+			if ( ka == NOID )
+				break;
+			kb = bmi_seek( &ib, ka );
+			if ( kb == NOID )
+				break;
+			if ( kb != ka ) {
+				key = kb;
+				continue;
+			}
+			key = ka;
+		} else {
+			kb = bmi_seek( &ib, key );
+			if ( ka == NOID && kb == NOID )
+				break;
+			key = IDL_MIN( ka, kb );
+		}
+		memset( bits, 0, sizeof(bits));
+		memset( bitsb, 0, sizeof(bitsb));
+		if ( ka == key )
+			bmi_fill( &ia, key, bits );
+		if ( kb == key )
+			bmi_fill( &ib, key, bitsb );
+		if ( and ) {
+			for ( i=0; i<BM_WORDS; i++ )
+				bits[i] &= bitsb[i];
+		} else {
+			for ( i=0; i<BM_WORDS; i++ )
+				bits[i] |= bitsb[i];
+		}
+		rc = bm_put( out, key, bits );
+		if ( rc || key == NOID >> 16 )
+			break;
+		key++;
+	}
+
+	if ( rc ) {
+		if ( and ) {
+			ka = IDL_MAX( MDB_IDL_FIRST( a ), MDB_IDL_FIRST( b ));
+			kb = IDL_MIN( MDB_IDL_LAST( a ), MDB_IDL_LAST( b ));
+		} else {
+			ka = IDL_MIN( MDB_IDL_FIRST( a ), MDB_IDL_FIRST( b ));
+			kb = IDL_MAX( MDB_IDL_LAST( a ), MDB_IDL_LAST( b ));
+		}
+		MDB_IDL_RANGE( a, ka, kb );
+	} else {
+		bm_copy( a, out );
+	}
+	ch_free( out );
+}
+
+/* Keep the IDs of a list that are in a bitmap IDL */
+static void
+bm_filter( ID *ids, ID *bm )
+{
+	ID i, n = 0, pos = MDB_IDL_BM_HDR;
+
+	for ( i=1; i<=ids[0]; i++ ) {
+		if ( bm_has( bm, &pos, ids[i] ))
+			ids[++n] = ids[i];
+	}
+	ids[0] = n;
+}
+
+/* The attribute of index DB dbi, or NULL if it isn't an index */
+static AttrInfo *
+idx_attr( struct mdb_info *mdb, MDB_dbi dbi )
+{
+	int i;
+
+	for ( i=0; i<mdb->mi_nattrs; i++ ) {
+		if ( mdb->mi_attrs[i]->ai_dbi == dbi )
+			return mdb->mi_attrs[i];
+	}
+	return NULL;
+}
+
+/* Build the key prefix of the containers of an index key in buf.
+ * Returns its length, or 0 if the key can't have containers.
+ */
+static int
+bm_prefix( struct mdb_info *mdb, MDB_dbi dbi, MDB_val *key, char *buf )
+{
+	struct berval *name = NULL;
+	AttrInfo *ai;
+	int i;
+
+	if ( !mdb->mi_ix2b || key->mv_size > 255 )
+		return 0;
+	ai = idx_attr( mdb, dbi );
+	if ( ai )
+		name = &ai->ai_desc->ad_type->sat_cname;
+	if ( !name || name->bv_len + 2 + key->mv_size + sizeof(ID) > BM_KEYMAX )
+		return 0;
+	memcpy( buf, name->bv_val, name->bv_len );
+	i = name->bv_len;
+	buf[i++] = '\0';
+	buf[i++] = key->mv_size;
+	memcpy( buf + i, key->mv_data, key->mv_size );
+	return i + key->mv_size;
+}
+
+/* Point key at the container of block bk */
+static void
+bm_key( MDB_val *key, char *buf, int plen, ID bk )
+{
+	int i;
+
+	for ( i = sizeof(ID); i--; bk >>= 8 )
+		buf[plen + i] = bk & 0xff;
+	key->mv_data = buf;
+	key->mv_size = plen + sizeof(ID);
+}
+
+/* Position on the first container of an index key */
+static int
+bm_first( MDB_cursor *mc, char *buf, int plen )
+{
+	MDB_val key, data;
+	int rc;
+
+	bm_key( &key, buf, plen, 0 );
+	rc = mdb_cursor_get( mc, &key, &data, MDB_SET_RANGE );
+	if ( rc == 0 && memcmp( key.mv_data, buf, plen ))
+		rc = MDB_NOTFOUND;
+	return rc;
+}
+
+/* Delete all the containers of an index key */
+static int
+bm_clear( MDB_cursor *mc, char *buf, int plen )
+{
+	int rc;
+
+	while (( rc = bm_first( mc, buf, plen )) == 0 ) {
+		rc = mdb_cursor_del( mc, 0 );
+		if ( rc )
+			return rc;
+	}
+	return rc == MDB_NOTFOUND ? 0 : rc;
+}
+
+/* Store block bk of an index key */
+static int
+bm_store( MDB_cursor *mc, char *buf, int plen, ID bk, unsigned *bits )
+{
+	MDB_val key, data;
+	ID vbuf[BM_VALSIZE];
+	mdb_bhead *h = (mdb_bhead *)vbuf;
+
+	bc_encode( bits, h, (unsigned short *)( h+1 ));
+	bm_key( &key, buf, plen, bk );
+	data.mv_data = vbuf;
+	data.mv_size = sizeof(mdb_bhead) + bc_size( h );
+	return mdb_cursor_put( mc, &key, &data, 0 );
+}
+
+/* Store the IDs of the index key under cursor in containers */
+static int
+bm_build( MDB_cursor *cursor, MDB_cursor *mc, char *buf, int plen )
+{
+	MDB_val key, data;
+	unsigned bits[BM_WORDS];
+	ID id, bk = NOID;
+	char *ptr;
+	size_t i;
+	int rc;
+
+	rc = mdb_cursor_get( cursor, &key, &data, MDB_GET_MULTIPLE );
+	while ( rc == 0 ) {
+		ptr = data.mv_data;
+		for ( i=0; i < data.mv_size / sizeof(ID); i++, ptr += sizeof(ID) ) {
+			memcpy( &id, ptr, sizeof(ID) );
+			if ( id >> 16 != bk ) {
+				if ( bk != NOID ) {
+					rc = bm_store( mc, buf, plen, bk, bits );
+					if ( rc )
+						return rc;
+				}
+				bk = id >> 16;
+				memset( bits, 0, sizeof(bits));
+			}
+			BM_SET( bits, BM_LOW( id ));
+		}
+		rc = mdb_cursor_get( cursor, &key, &data, MDB_NEXT_MULTIPLE );
+	}
+	if ( rc != MDB_NOTFOUND )
+		return rc;
+	return bk != NOID ? bm_store( mc, buf, plen, bk, bits ) : 0;
+}
+
+/* Add or delete an ID in the containers of an index key.
+ * Returns MDB_NOTFOUND if the key has no containers, and MDB_KEYEXIST
+ * if they are left as they were.
+ */
+static int
+bm_update( MDB_cursor *mc, char *buf, int plen, ID id, int add )
+{
+	MDB_val key, data;
+	ID vbuf[BM_VALSIZE];
+	unsigned bits[BM_WORDS];
+	mdb_bhead *h = (mdb_bhead *)vbuf;
+	unsigned short *payload = (unsigned short *)( h+1 );
+	int rc;
+
+	bm_key( &key, buf, plen, id >> 16 );
+	rc = mdb_cursor_get( mc, &key, &data, MDB_SET );
+	if ( rc == MDB_NOTFOUND ) {
+		/* A new block, if the key has other blocks */
+		rc = bm_first( mc, buf, plen );
+		if ( rc )
+			return rc;
+		if ( !add )
+			return MDB_KEYEXIST;
+		h->bh_card = 1;
+		h->bh_type = BC_ARRAY;
+		h->bh_nruns = 0;
+		payload[0] = BM_LOW( id );
+		goto put;
+	}
+	if ( rc )
+		return rc;
+	if ( data.mv_size > sizeof(vbuf))
+		return MDB_CORRUPTED;
+	memcpy( vbuf, data.mv_data, data.mv_size );
+	/* IDs are mostly added in ascending order */
+	if ( add && bc_append( h, payload, BM_LOW( id )))
+		goto put;
+
+	memset( bits, 0, sizeof(bits));
+	bc_decode( h, payload, bits );
+	if ( !BM_ISSET( bits, BM_LOW( id )) == !add )
+		return MDB_KEYEXIST;
+	if ( add ) {
+		BM_SET( bits, BM_LOW( id ));
+	} else {
+		BM_CLR( bits, BM_LOW( id ));
+		if ( h->bh_card == 1 )
+			return mdb_cursor_del( mc, 0 );
+	}
+	return bm_store( mc, buf, plen, id >> 16, bits );
+
+put:
+	bm_key( &key, buf, plen, id >> 16 );
+	data.mv_data = vbuf;
+	data.mv_size = sizeof(mdb_bhead) + bc_size( h );
+	return mdb_cursor_put( mc, &key, &data, 0 );
+}
+
+/* Open a cursor on the ix2b DB, if it isn't open yet */
+static int
+bm_cursor( struct mdb_info *mdb, MDB_cursor *cursor, MDB_cursor **mc )
+{
+	if ( *mc )
+		return 0;
+	return mdb_cursor_open( mdb_cursor_txn( cursor ), mdb->mi_ix2b, mc );
+}
+
+/* Load the containers of an index key into ids, which holds the range
+ * of the key. If the key has no containers, or they don't fit in a
+ * bitmap IDL, the range is left as it is.
+ */
+static int
+bm_load( MDB_txn *txn, struct mdb_info *mdb, char *buf, int plen, ID *ids )
+{
+	MDB_cursor *mc;
+	MDB_val key, data;
+	ID vbuf[BM_VALSIZE], lo = ids[1], hi = ids[2], bk;
+	mdb_bhead *h = (mdb_bhead *)vbuf;
+	unsigned char *ptr;
+	unsigned i;
+	int rc, full = 0;
+
+	rc = mdb_cursor_open( txn, mdb->mi_ix2b, &mc );
+	if ( rc )
+		return rc;
+	bm_init( ids );
+	rc = bm_first( mc, buf, plen );
+	while ( rc == 0 ) {
+		rc = mdb_cursor_get( mc, &key, &data, MDB_GET_CURRENT );
+		if ( rc )
+			break;
+		if ( key.mv_size != plen + sizeof(ID) || memcmp( key.mv_data, buf, plen ))
+			break;
+		if ( data.mv_size > sizeof(vbuf)) {
+			rc = MDB_CORRUPTED;
+			break;
+		}
+		memcpy( vbuf, data.mv_data, data.mv_size );
+		ptr = (unsigned char *)key.mv_data + plen;
+		for ( i=0, bk=0; i<sizeof(ID); i++ )
+			bk = bk << 8 | ptr[i];
+		if ( bm_add( ids, bk, h, (unsigned short *)( h+1 ))) {
+			full = 1;
+			break;
+		}
+		rc = mdb_cursor_get( mc, &key, &data, MDB_NEXT );
+	}
+	mdb_cursor_close( mc );
+	if ( rc == MDB_NOTFOUND )
+		rc = 0;
+	/* Too big, or no containers: keep the range */
+	if ( rc == 0 && ( full || !MDB_IDL_BM_N( ids )))
+		MDB_IDL_RANGE( ids, lo, hi );
+	return rc;
+}
+
+/* Add up the IDs in the containers of an index key. count is left
+ * alone if the key has no containers.
+ */
+static int
+bm_card( MDB_txn *txn, struct mdb_info *mdb, char *buf, int plen, ID *count )
+{
+	MDB_cursor *mc;
+	MDB_val key, data;
+	mdb_bhead h;
+	ID n = 0;
+	int rc;
+
+	rc = mdb_cursor_open( txn, mdb->mi_ix2b, &mc );
+	if ( rc )
+		return rc;
+	rc = bm_first( mc, buf, plen );
+	while ( rc == 0 ) {
+		rc = mdb_cursor_get( mc, &key, &data, MDB_GET_CURRENT );
+		if ( rc )
+			break;
+		if ( key.mv_size != plen + sizeof(ID) || memcmp( key.mv_data, buf, plen ))
+			break;
+		if ( data.mv_size < sizeof(h)) {
+			rc = MDB_CORRUPTED;
+			break;
+		}
+		memcpy( &h, data.mv_data, sizeof(h));
+		n += h.bh_card;
+		rc = mdb_cursor_get( mc, &key, &data, MDB_NEXT );
+	}
+	mdb_cursor_close( mc );
+	if ( rc == MDB_NOTFOUND )
+		rc = 0;
+	if ( rc == 0 && n )
+		*count = n;
+	return rc;
+}
+
+/* Put cursor on key. Sorted keys looked up one after the other through
+ * the same cursor each only search the part of the tree below where the
+ * one before was found.
+ */
+static int
+idl_seek( MDB_cursor *cursor, MDB_val *key, MDB_val *data )
+{
+	int rc;
+
+	rc = mdb_cursor_get_batch( cursor, key, data, 1 );
+	if ( rc == 0 && !data->mv_data )
+		rc = MDB_NOTFOUND;
+	return rc;
+}
+
+/* Count the IDs of an index key without reading them. For a key that
+ * only has a range, the count is the size of the range.
+ */
+int
+mdb_idl_count_key(
+	BackendDB	*be,
+	MDB_cursor	*cursor,
+	MDB_val		*key,
+	ID			*count )
+{
+	struct mdb_info *mdb = be->be_private;
+	MDB_txn *txn = mdb_cursor_txn( cursor );
+	MDB_dbi dbi = mdb_cursor_dbi( cursor );
+	MDB_val data, k2;
+	ID id, lo, hi;
+	size_t n;
+	int rc, plen;
+	char bkey[BM_KEYMAX];
+
+	rc = idl_seek( cursor, key, &data );
+	if ( rc == 0 ) {
+		memcpy( &id, data.mv_data, sizeof(ID));
+		if ( id ) {
+			rc = mdb_cursor_count( cursor, &n );
+			*count = n;
+		} else {
+			/* On disk, a range is denoted by 0 in the first element */
+			rc = mdb_cursor_get( cursor, &k2, &data, MDB_NEXT_DUP );
+			if ( rc == 0 ) {
+				memcpy( &lo, data.mv_data, sizeof(ID));
+				rc = mdb_cursor_get( cursor, &k2, &data, MDB_NEXT_DUP );
+			}
+			if ( rc == 0 ) {
+				memcpy( &hi, data.mv_data, sizeof(ID));
+				*count = hi - lo + 1;
+				plen = bm_prefix( mdb, dbi, key, bkey );
+				if ( plen )
+					rc = bm_card( txn, mdb, bkey, plen, count );
+			}
+		}
+	}
+	return rc;
+}
+
+/* Read the IDs of key, which cursor is on. data is the item the cursor
+ * was put on, MDB_GET_MULTIPLE leaves it alone if it is the only one.
+ */
+static int
+idl_read_ids(
+	struct mdb_info *mdb,
+	MDB_cursor	*cursor,
+	MDB_val		*key,
+	MDB_val		*data,
+	ID			*ids )
+{
+	MDB_val k2;
+	ID *i;
+	int rc, plen;
+	char bkey[BM_KEYMAX];
+
+	i = ids+1;
+	rc = mdb_cursor_get( cursor, &k2, data, MDB_GET_MULTIPLE );
+	while (rc == 0) {
+		memcpy( i, data->mv_data, data->mv_size );
+		i += data->mv_size / sizeof(ID);
+		rc = mdb_cursor_get( cursor, &k2, data, MDB_NEXT_MULTIPLE );
+	}
+	if ( rc == MDB_NOTFOUND ) rc = 0;
+	ids[0] = i - &ids[1];
+	/* On disk, a range is denoted by 0 in the first element */
+	if (ids[1] == 0) {
+		if (ids[0] != MDB_IDL_RANGE_SIZE) {
+			Debug( LDAP_DEBUG_ANY, "=> mdb_idl_fetch_key: "
+				"range size mismatch: expected %d, got %ld\n",
+				MDB_IDL_RANGE_SIZE, ids[0], 0 );
+			return -1;
+		}
+		MDB_IDL_RANGE( ids, ids[2], ids[3] );
+		/* Get the exact IDs, if the key has them */
+		plen = bm_prefix( mdb, mdb_cursor_dbi( cursor ), key, bkey );
+		if ( plen ) {
+			rc = bm_load( mdb_cursor_txn( cursor ), mdb, bkey, plen, ids );
+			if ( rc ) {
+				Debug( LDAP_DEBUG_ANY, "=> mdb_idl_fetch_key: "
+					"bitmap failed: %s (%d)\n",
+					mdb_strerror(rc), rc, 0 );
+			}
+		}
+	}
+	return rc;
+}
+
+int
+mdb_idl_fetch_key(
+	BackendDB	*be,
+	MDB_txn		*txn,
+	MDB_dbi		dbi,
+	MDB_val		*key,
+	ID			*ids,
+	MDB_cursor	**saved_cursor,
+	int			get_flag )
+{
+	struct mdb_info *mdb = be->be_private;
+	MDB_val data, key2, *kptr;
+	MDB_cursor *cursor;
+	size_t len;
+	int rc;
+	MDB_cursor_op opflag;
+
+	char keybuf[16];
+
+	Debug( LDAP_DEBUG_ARGS,
+		"mdb_idl_fetch_key: %s\n", 
+		mdb_show_key( keybuf, key->mv_data, key->mv_size ), 0, 0 );
+
+	assert( ids != NULL );
+
+	if ( saved_cursor && *saved_cursor ) {
+		opflag = MDB_NEXT;
+	} else if ( get_flag == LDAP_FILTER_GE ) {
+		opflag = MDB_SET_RANGE;
+	} else if ( get_flag == LDAP_FILTER_LE ) {
+		opflag = MDB_FIRST;
+	} else {
+		opflag = MDB_SET;
+	}
+
+	/* If we're not reusing an existing cursor, get a new one */
+	if( opflag != MDB_NEXT ) {
+		rc = mdb_cursor_open( txn, dbi, &cursor );
+		if( rc != 0 ) {
+			Debug( LDAP_DEBUG_ANY, "=> mdb_idl_fetch_key: "
+				"cursor failed: %s (%d)\n", mdb_strerror(rc), rc, 0 );
+			return rc;
+		}
+	} else {
+		cursor = *saved_cursor;
+	}
+	
+	/* If this is a LE lookup, save original key so we can determine
+	 * when to stop. If this is a GE lookup, save the key since it
+	 * will be overwritten.
+	 */
+	if ( get_flag == LDAP_FILTER_LE || get_flag == LDAP_FILTER_GE ) {
+		key2.mv_data = keybuf;
+		key2.mv_size = key->mv_size;
+		AC_MEMCPY( keybuf, key->mv_data, key->mv_size );
+		kptr = &key2;
+	} else {
+		kptr = key;
+	}
+	len = key->mv_size;
+	rc = mdb_cursor_get( cursor, kptr, &data, opflag );
+
+	/* skip presence key on range inequality lookups */
+	while (rc == 0 && kptr->mv_size != len) {
+		rc = mdb_cursor_get( cursor, kptr, &data, MDB_NEXT_NODUP );
+	}
+	/* If we're doing a LE compare and the new key is greater than
+	 * our search key, we're done
+	 */
+	if (rc == 0 && get_flag == LDAP_FILTER_LE && memcmp( kptr->mv_data,
+		key->mv_data, key->mv_size ) > 0 ) {
+		rc = MDB_NOTFOUND;
+	}
+	if (rc == 0) {
+		rc = idl_read_ids( mdb, cursor, kptr, &data, ids );
+		if ( rc ) {
+			mdb_cursor_close( cursor );
+			return rc;
+		}
+		data.mv_size = MDB_IDL_SIZEOF(ids);
+	}
+
+	if ( saved_cursor && rc == 0 ) {
+		if ( !*saved_cursor )
+			*saved_cursor = cursor;
+	}
+	else
+		mdb_cursor_close( cursor );
+
+	if( rc == MDB_NOTFOUND ) {
+		return rc;
+
+	} else if( rc != 0 ) {
+		Debug( LDAP_DEBUG_ANY, "=> mdb_idl_fetch_key: "
+			"get failed: %s (%d)\n",
+			mdb_strerror(rc), rc, 0 );
+		return rc;
+
+	} else if ( data.mv_size == 0 || data.mv_size % sizeof( ID ) ) {
+		/* size not multiple of ID size */
+		Debug( LDAP_DEBUG_ANY, "=> mdb_idl_fetch_key: "
+			"odd size: expected %ld multiple, got %ld\n",
+			(long) sizeof( ID ), (long) data.mv_size, 0 );
+		return -1;
+
+	} else if ( data.mv_size != MDB_IDL_SIZEOF(ids) ) {
+		/* size mismatch */
+		Debug( LDAP_DEBUG_ANY, "=> mdb_idl_fetch_key: "
+			"get size mismatch: expected %ld, got %ld\n",
+			(long) ((1 + ids[0]) * sizeof( ID )), (long) data.mv_size, 0 );
+		return -1;
+	}
+
+	return rc;
+}
+
+/* Read the IDs of key through cursor, see idl_seek() */
+int
+mdb_idl_seek_key(
+	BackendDB	*be,
+	MDB_cursor	*cursor,
+	MDB_val		*key,
+	ID			*ids )
+{
+	MDB_val data;
+	int rc;
+
+	rc = idl_seek( cursor, key, &data );
+	if ( rc == 0 )
+		rc = idl_read_ids( be->be_private, cursor, key, &data, ids );
+	return rc;
+}
+
+/* Index statistics.
+ *
+ * The ix2s DB holds an mdb_istat for each index DB, under the name of
+ * the indexed attribute. mdb_idl_insert_keys() and mdb_idl_delete_keys()
+ * update it in the same transaction as the keys, if the index has one.
+ * The record is created along with an empty index, and reset when
+ * slapindex truncates the index, so it describes the whole index. The
+ * first open of an index that already has keys creates it partial, and
+ * mdb_idl_stats_scan() counts the keys in order in later transactions.
+ * Until then the updates leave out the keys after the last one counted,
+ * the scan counts them as they are when it gets there. The counts of
+ * the keys in is_top are exact, but once IDs have been deleted another
+ * key may have overtaken the last of them.
+ *
+ * The tools keep the statistics of each index in its AttrInfo for the
+ * whole transaction, and write them with mdb_idl_stats_flush() before
+ * they commit.
+ */
+
+/* floor(log2(n)) of a number of IDs, n > 0 */
+static int
+istat_bucket( ID n )
+{
+	int b = 0;
+
+	while ( n >>= 1 )
+		b++;
+	return b < MDB_ISTAT_HIST ? b : MDB_ISTAT_HIST - 1;
+}
+
+static int
+istat_read( MDB_txn *txn, struct mdb_info *mdb, struct berval *name,
+	mdb_istat *st )
+{
+	MDB_val key, data;
+	int rc;
+
+	if ( !mdb->mi_ix2s || !name )
+		return MDB_NOTFOUND;
+	key.mv_data = name->bv_val;
+	key.mv_size = name->bv_len;
+	rc = mdb_get( txn, mdb->mi_ix2s, &key, &data );
+	if ( rc == 0 ) {
+		if ( data.mv_size != sizeof( *st ))
+			return MDB_NOTFOUND;
+		memcpy( st, data.mv_data, sizeof( *st ));
+	}
+	return rc;
+}
+
+static int
+istat_write( MDB_txn *txn, struct mdb_info *mdb, struct berval *name,
+	mdb_istat *st )
+{
+	MDB_val key, data;
+
+	key.mv_data = name->bv_val;
+	key.mv_size = name->bv_len;
+	data.mv_data = st;
+	data.mv_size = sizeof( *st );
+	return mdb_put( txn, mdb->mi_ix2s, &key, &data, 0 );
+}
+
+static mdb_itop *
+istat_find( mdb_istat *st, MDB_val *key )
+{
+	int i;
+
+	for ( i=0; i<MDB_ISTAT_TOP && st->is_top[i].it_count; i++ ) {
+		if ( st->is_top[i].it_len == key->mv_size &&
+			!memcmp( st->is_top[i].it_key, key->mv_data, key->mv_size ))
+			return &st->is_top[i];
+	}
+	return NULL;
+}
+
+/* Set the count of an index key in is_top. The key is added if it is
+ * one of the heaviest, and dropped when its count is 0.
+ */
+static void
+istat_top( mdb_istat *st, MDB_val *key, ID count )
+{
+	mdb_itop *t, tmp;
+	int i;
+
+	t = istat_find( st, key );
+	if ( !t ) {
+		t = &st->is_top[MDB_ISTAT_TOP-1];
+		if ( key->mv_size > MDB_ISTAT_KEYMAX || count <= t->it_count )
+			return;
+		t->it_len = key->mv_size;
+		memcpy( t->it_key, key->mv_data, key->mv_size );
+	}
+	t->it_count = count;
+	if ( !count )
+		t->it_len = 0;
+	for ( i = t - st->is_top; i > 0 &&
+		st->is_top[i-1].it_count < st->is_top[i].it_count; i-- ) {
+		tmp = st->is_top[i-1];
+		st->is_top[i-1] = st->is_top[i];
+		st->is_top[i] = tmp;
+	}
+	for ( ; i < MDB_ISTAT_TOP-1 &&
+		st->is_top[i+1].it_count > st->is_top[i].it_count; i++ ) {
+		tmp = st->is_top[i+1];
+		st->is_top[i+1] = st->is_top[i];
+		st->is_top[i] = tmp;
+	}
+}
+
+/* A key kept as a list went from n to n2 IDs */
+static void
+istat_list( mdb_istat *st, MDB_val *key, ID n, ID n2 )
+{
+	if ( n )
+		st->is_hist[istat_bucket( n )]--;
+	else
+		st->is_keys++;
+	if ( n2 )
+		st->is_hist[istat_bucket( n2 )]++;
+	else
+		st->is_keys--;
+	st->is_ids += n2 - n;
+	istat_top( st, key, n2 );
+}
+
+/* An ID was added to or deleted from the containers of a range key.
+ * span is the size of its range, which bounds the number of its IDs:
+ * they are only counted if that may put the key in is_top.
+ */
+static int
+istat_range( MDB_txn *txn, struct mdb_info *mdb, mdb_istat *st,
+	MDB_val *key, char *buf, int plen, ID span, int add )
+{
+	mdb_itop *t = istat_find( st, key );
+	ID n;
+	int rc;
+
+	if ( add )
+		st->is_ids++;
+	else
+		st->is_ids--;
+	if ( t ) {
+		istat_top( st, key, add ? t->it_count + 1 : t->it_count - 1 );
+		return 0;
+	}
+	if ( !add || span <= st->is_top[MDB_ISTAT_TOP-1].it_count )
+		return 0;
+	n = 0;
+	rc = bm_card( txn, mdb, buf, plen, &n );
+	if ( rc == 0 )
+		istat_top( st, key, n );
+	return rc;
+}
+
+/* The statistics of the index of cursor, in st or in the AttrInfo for
+ * the tools. NULL if the index has none.
+ */
+static mdb_istat *
+istat_get( struct mdb_info *mdb, MDB_cursor *cursor, AttrInfo *ai,
+	mdb_istat *st )
+{
+	struct berval *name;
+
+	if ( !ai || !mdb->mi_ix2s )
+		return NULL;
+	name = &ai->ai_desc->ad_type->sat_cname;
+	if ( !( slapMode & SLAP_TOOL_MODE ))
+		return istat_read( mdb_cursor_txn( cursor ), mdb, name, st ) ? NULL : st;
+
+	if ( !ai->ai_statflag ) {
+		if ( !ai->ai_stat )
+			ai->ai_stat = ch_malloc( sizeof( mdb_istat ));
+		ai->ai_statflag = istat_read( mdb_cursor_txn( cursor ), mdb, name,
+			ai->ai_stat ) ? MDB_ISTAT_NONE : MDB_ISTAT_READ;
+	}
+	return ai->ai_statflag & MDB_ISTAT_NONE ? NULL : ai->ai_stat;
+}
+
+/* The statistics to update for key, NULL if a partial record doesn't
+ * count it yet
+ */
+static mdb_istat *
+istat_key( mdb_istat *st, MDB_cursor *cursor, MDB_val *key )
+{
+	MDB_val last;
+
+	if ( !st || !( st->is_flags & MDB_ISTAT_PARTIAL ))
+		return st;
+	if ( !st->is_lastlen )
+		return NULL;
+	last.mv_data = st->is_last;
+	last.mv_size = st->is_lastlen;
+	return mdb_cmp( mdb_cursor_txn( cursor ), mdb_cursor_dbi( cursor ),
+		key, &last ) <= 0 ? st : NULL;
+}
+
+static int
+istat_put( struct mdb_info *mdb, MDB_cursor *cursor, AttrInfo *ai,
+	mdb_istat *st )
+{
+	if ( slapMode & SLAP_TOOL_MODE ) {
+		ai->ai_statflag |= MDB_ISTAT_DIRTY;
+		return 0;
+	}
+	return istat_write( mdb_cursor_txn( cursor ), mdb,
+		&ai->ai_desc->ad_type->sat_cname, st );
+}
+
+/* Write the statistics the tools kept for txn. With no txn, the
+ * transaction was aborted and they are dropped.
+ */
+int
+mdb_idl_stats_flush(
+	MDB_txn		*txn,
+	struct mdb_info *mdb )
+{
+	AttrInfo *ai;
+	int i, rc = 0;
+
+	for ( i=0; i<mdb->mi_nattrs; i++ ) {
+		ai = mdb->mi_attrs[i];
+		if ( txn && rc == 0 && ( ai->ai_statflag & MDB_ISTAT_DIRTY ))
+			rc = istat_write( txn, mdb, &ai->ai_desc->ad_type->sat_cname,
+				ai->ai_stat );
+		ai->ai_statflag = 0;
+	}
+	return rc;
+}
+
+/* Read the statistics of an index. Returns MDB_NOTFOUND if it has none. */
+int
+mdb_idl_stats(
+	MDB_txn		*txn,
+	struct mdb_info *mdb,
+	AttrInfo	*ai,
+	mdb_istat	*st )
+{
+	return istat_read( txn, mdb, &ai->ai_desc->ad_type->sat_cname, st );
+}
+
+/* Start the statistics of an index that has none. Those of an index
+ * that already has keys start partial. *partial is set if they are.
+ */
+int
+mdb_idl_stats_init(
+	MDB_txn		*txn,
+	struct mdb_info *mdb,
+	AttrInfo	*ai,
+	int			*partial )
+{
+	struct berval *name = &ai->ai_desc->ad_type->sat_cname;
+	mdb_istat st;
+	MDB_stat ms;
+	int rc;
+
+	if ( !mdb->mi_ix2s )
+		return 0;
+	rc = istat_read( txn, mdb, name, &st );
+	if ( rc == 0 && ( st.is_flags & MDB_ISTAT_PARTIAL ))
+		*partial = 1;
+	if ( rc != MDB_NOTFOUND )
+		return rc;
+	rc = mdb_stat( txn, ai->ai_dbi, &ms );
+	if ( rc )
+		return rc;
+	memset( &st, 0, sizeof( st ));
+	if ( ms.ms_entries ) {
+		st.is_flags = MDB_ISTAT_PARTIAL;
+		*partial = 1;
+	}
+	return istat_write( txn, mdb, name, &st );
+}
+
+/* Count up to nkeys more keys of an index whose statistics are partial.
+ * *done is set once they are complete, or if they aren't partial.
+ */
 int
-mdb_idl_fetch_key(
-	BackendDB	*be,
+mdb_idl_stats_scan(
 	MDB_txn		*txn,
-	MDB_dbi		dbi,
-	MDB_val		*key,
-	ID			*ids,
-	MDB_cursor	**saved_cursor,
-	int			get_flag )
+	struct mdb_info *mdb,
+	AttrInfo	*ai,
+	int			nkeys,
+	int			*done )
 {
-	MDB_val data, key2, *kptr;
-	MDB_cursor *cursor;
-	ID *i;
-	size_t len;
-	int rc;
-	MDB_cursor_op opflag;
-
-	char keybuf[16];
-
-	Debug( LDAP_DEBUG_ARGS,
-		"mdb_idl_fetch_key: %s\n", 
-		mdb_show_key( keybuf, key->mv_data, key->mv_size ), 0, 0 );
-
-	assert( ids != NULL );
-
-	if ( saved_cursor && *saved_cursor ) {
-		opflag = MDB_NEXT;
-	} else if ( get_flag == LDAP_FILTER_GE ) {
-		opflag = MDB_SET_RANGE;
-	} else if ( get_flag == LDAP_FILTER_LE ) {
-		opflag = MDB_FIRST;
-	} else {
-		opflag = MDB_SET;
-	}
+	struct berval *name = &ai->ai_desc->ad_type->sat_cname;
+	mdb_istat st;
+	MDB_cursor *mc;
+	MDB_val key, data;
+	ID n, *i;
+	size_t count;
+	char bkey[BM_KEYMAX];
+	int rc, plen;
+
+	*done = 1;
+	rc = istat_read( txn, mdb, name, &st );
+	if ( rc == MDB_NOTFOUND )
+		return 0;
+	if ( rc || !( st.is_flags & MDB_ISTAT_PARTIAL ))
+		return rc;
 
-	/* If we're not reusing an existing cursor, get a new one */
-	if( opflag != MDB_NEXT ) {
-		rc = mdb_cursor_open( txn, dbi, &cursor );
-		if( rc != 0 ) {
-			Debug( LDAP_DEBUG_ANY, "=> mdb_idl_fetch_key: "
-				"cursor failed: %s (%d)\n", mdb_strerror(rc), rc, 0 );
-			return rc;
-		}
-	} else {
-		cursor = *saved_cursor;
-	}
-	
-	/* If this is a LE lookup, save original key so we can determine
-	 * when to stop. If this is a GE lookup, save the key since it
-	 * will be overwritten.
-	 */
-	if ( get_flag == LDAP_FILTER_LE || get_flag == LDAP_FILTER_GE ) {
-		key2.mv_data = keybuf;
-		key2.mv_size = key->mv_size;
-		AC_MEMCPY( keybuf, key->mv_data, key->mv_size );
-		kptr = &key2;
+	rc = mdb_cursor_open( txn, ai->ai_dbi, &mc );
+	if ( rc )
+		return rc;
+	if ( st.is_lastlen ) {
+		key.mv_data = st.is_last;
+		key.mv_size = st.is_lastlen;
+		rc = mdb_cursor_get( mc, &key, &data, MDB_SET_RANGE );
+		if ( rc == 0 && key.mv_size == st.is_lastlen &&
+			!memcmp( key.mv_data, st.is_last, st.is_lastlen ))
+			rc = mdb_cursor_get( mc, &key, &data, MDB_NEXT_NODUP );
 	} else {
-		kptr = key;
-	}
-	len = key->mv_size;
-	rc = mdb_cursor_get( cursor, kptr, &data, opflag );
-
-	/* skip presence key on range inequality lookups */
-	while (rc == 0 && kptr->mv_size != len) {
-		rc = mdb_cursor_get( cursor, kptr, &data, MDB_NEXT_NODUP );
-	}
-	/* If we're doing a LE compare and the new key is greater than
-	 * our search key, we're done
-	 */
-	if (rc == 0 && get_flag == LDAP_FILTER_LE && memcmp( kptr->mv_data,
-		key->mv_data, key->mv_size ) > 0 ) {
-		rc = MDB_NOTFOUND;
+		rc = mdb_cursor_get( mc, &key, &data, MDB_FIRST );
 	}
-	if (rc == 0) {
-		i = ids+1;
-		rc = mdb_cursor_get( cursor, key, &data, MDB_GET_MULTIPLE );
-		while (rc == 0) {
-			memcpy( i, data.mv_data, data.mv_size );
-			i += data.mv_size / sizeof(ID);
-			rc = mdb_cursor_get( cursor, key, &data, MDB_NEXT_MULTIPLE );
+	while ( rc == 0 ) {
+		i = data.mv_data;
+		if ( i[0] ) {
+			rc = mdb_cursor_count( mc, &count );
+			if ( rc )
+				break;
+			n = count;
+			st.is_hist[istat_bucket( n )]++;
+		} else {
+			/* As many IDs as the containers have, if the key has
+			 * any, else the range bounds them
+			 */
+			n = i[2] - i[1] + 1;
+			plen = bm_prefix( mdb, ai->ai_dbi, &key, bkey );
+			if ( plen ) {
+				rc = bm_card( txn, mdb, bkey, plen, &n );
+				if ( rc )
+					break;
+			}
+			st.is_ranges++;
 		}
-		if ( rc == MDB_NOTFOUND ) rc = 0;
-		ids[0] = i - &ids[1];
-		/* On disk, a range is denoted by 0 in the first element */
-		if (ids[1] == 0) {
-			if (ids[0] != MDB_IDL_RANGE_SIZE) {
-				Debug( LDAP_DEBUG_ANY, "=> mdb_idl_fetch_key: "
-					"range size mismatch: expected %d, got %ld\n",
-					MDB_IDL_RANGE_SIZE, ids[0], 0 );
-				mdb_cursor_close( cursor );
-				return -1;
+		st.is_keys++;
+		st.is_ids += n;
+		istat_top( &st, &key, n );
+		/* the updates need to know where we stopped */
+		if ( key.mv_size <= MDB_ISTAT_LASTMAX ) {
+			st.is_lastlen = key.mv_size;
+			memcpy( st.is_last, key.mv_data, key.mv_size );
+			if ( --nkeys <= 0 ) {
+				*done = 0;
+				break;
 			}
-			MDB_IDL_RANGE( ids, ids[2], ids[3] );
 		}
-		data.mv_size = MDB_IDL_SIZEOF(ids);
+		rc = mdb_cursor_get( mc, &key, &data, MDB_NEXT_NODUP );
 	}
-
-	if ( saved_cursor && rc == 0 ) {
-		if ( !*saved_cursor )
-			*saved_cursor = cursor;
+	mdb_cursor_close( mc );
+	if ( rc == MDB_NOTFOUND ) {
+		st.is_flags &= ~MDB_ISTAT_PARTIAL;
+		st.is_lastlen = 0;
+		rc = 0;
 	}
-	else
-		mdb_cursor_close( cursor );
+	if ( rc == 0 )
+		rc = istat_write( txn, mdb, name, &st );
+	return rc;
+}
 
-	if( rc == MDB_NOTFOUND ) {
-		return rc;
+/* Delete the keys of dbi that start with name and its NUL */
+static int
+idl_drop_prefix( MDB_txn *txn, MDB_dbi dbi, struct berval *name )
+{
+	MDB_cursor *mc;
+	MDB_val key, data;
+	int rc;
 
-	} else if( rc != 0 ) {
-		Debug( LDAP_DEBUG_ANY, "=> mdb_idl_fetch_key: "
-			"get failed: %s (%d)\n",
-			mdb_strerror(rc), rc, 0 );
+	rc = mdb_cursor_open( txn, dbi, &mc );
+	if ( rc )
 		return rc;
+	do {
+		key.mv_data = name->bv_val;
+		key.mv_size = name->bv_len + 1;
+		rc = mdb_cursor_get( mc, &key, &data, MDB_SET_RANGE );
+		if ( rc || key.mv_size <= name->bv_len ||
+			memcmp( key.mv_data, name->bv_val, name->bv_len + 1 ))
+			break;
+		rc = mdb_cursor_del( mc, MDB_NODUPDATA );
+	} while ( rc == 0 );
+	mdb_cursor_close( mc );
+	if ( rc == MDB_NOTFOUND )
+		rc = 0;
+	return rc;
+}
 
-	} else if ( data.mv_size == 0 || data.mv_size % sizeof( ID ) ) {
-		/* size not multiple of ID size */
-		Debug( LDAP_DEBUG_ANY, "=> mdb_idl_fetch_key: "
-			"odd size: expected %ld multiple, got %ld\n",
-			(long) sizeof( ID ), (long) data.mv_size, 0 );
-		return -1;
+/* Empty an index: its keys, their containers, its order keys and its
+ * statistics
+ */
+int
+mdb_idl_truncate(
+	MDB_txn		*txn,
+	struct mdb_info *mdb,
+	AttrInfo	*ai )
+{
+	struct berval *name = &ai->ai_desc->ad_type->sat_cname;
+	mdb_istat st;
+	int rc;
 
-	} else if ( data.mv_size != MDB_IDL_SIZEOF(ids) ) {
-		/* size mismatch */
-		Debug( LDAP_DEBUG_ANY, "=> mdb_idl_fetch_key: "
-			"get size mismatch: expected %ld, got %ld\n",
-			(long) ((1 + ids[0]) * sizeof( ID )), (long) data.mv_size, 0 );
-		return -1;
+	rc = mdb_drop( txn, ai->ai_dbi, 0 );
+	/* the container keys start with the name and its NUL */
+	if ( rc == 0 && mdb->mi_ix2b )
+		rc = idl_drop_prefix( txn, mdb->mi_ix2b, name );
+	if ( rc == 0 && mdb->mi_ix2o )
+		rc = idl_drop_prefix( txn, mdb->mi_ix2o, name );
+	if ( rc == 0 && mdb->mi_ix2s ) {
+		memset( &st, 0, sizeof( st ));
+		rc = istat_write( txn, mdb, name, &st );
+		ai->ai_statflag = 0;
 	}
-
 	return rc;
 }
 
@@ -397,11 +1765,17 @@ mdb_idl_insert_keys(
 	ID			id )
 {
 	struct mdb_info *mdb = be->be_private;
-	MDB_val key, data;
-	ID lo, hi, *i;
+	MDB_val key, data, skey;
+	MDB_cursor *mc = NULL;
+	ID lo, hi, tmp, *i;
+	size_t count;
 	char *err;
-	int	rc = 0, k;
+	int	rc = 0, k, plen;
 	unsigned int flag = MDB_NODUPDATA;
+	char bkey[BM_KEYMAX];
+	AttrInfo *ai = idx_attr( mdb, mdb_cursor_dbi( cursor ));
+	mdb_istat stbuf, *strec, *st;
+	int dirty = 0;
 #ifndef	MISALIGNED_OK
 	int kbuf[2];
 #endif
@@ -415,6 +1789,8 @@ mdb_idl_insert_keys(
 
 	assert( id != NOID );
 
+	strec = istat_get( mdb, cursor, ai, &stbuf );
+
 #ifndef MISALIGNED_OK
 	if (keys[0].bv_len & ALIGNER)
 		kbuf[1] = 0;
@@ -434,6 +1810,8 @@ mdb_idl_insert_keys(
 		key.mv_size = keys[k].bv_len;
 		key.mv_data = keys[k].bv_val;
 	}
+	skey = key;
+	st = istat_key( strec, cursor, &skey );
 	rc = mdb_cursor_get( cursor, &key, &data, MDB_SET );
 	err = "c_get";
 	if ( rc == 0 ) {
@@ -441,7 +1819,6 @@ mdb_idl_insert_keys(
 		memcpy(&lo, data.mv_data, sizeof(ID));
 		if ( lo != 0 ) {
 			/* not a range, count the number of items */
-			size_t count;
 			rc = mdb_cursor_count( cursor, &count );
 			if ( rc != 0 ) {
 				err = "c_count";
@@ -450,6 +1827,18 @@ mdb_idl_insert_keys(
 			if ( count >= MDB_IDL_DB_MAX ) {
 			/* No room, convert to a range */
 				lo = *i;
+				/* Keep the exact IDs in containers */
+				plen = bm_prefix( mdb, mdb_cursor_dbi( cursor ), &key, bkey );
+				if ( plen ) {
+					err = "bitmap build";
+					rc = bm_cursor( mdb, cursor, &mc );
+					if ( rc == 0 )
+						rc = bm_clear( mc, bkey, plen );
+					if ( rc == 0 )
+						rc = bm_build( cursor, mc, bkey, plen );
+					if ( rc != 0 )
+						goto fail;
+				}
 				rc = mdb_cursor_get( cursor, &key, &data, MDB_LAST_DUP );
 				if ( rc != 0 && rc != MDB_NOTFOUND ) {
 					err = "c_get last_dup";
@@ -471,25 +1860,44 @@ mdb_idl_insert_keys(
 				}
 				/* Store the range */
 				data.mv_size = sizeof(ID);
-				data.mv_data = &id;
-				id = 0;
+				data.mv_data = &tmp;
+				tmp = 0;
 				rc = mdb_cursor_put( cursor, &key, &data, 0 );
 				if ( rc != 0 ) {
 					err = "c_put range";
 					goto fail;
 				}
-				id = lo;
+				tmp = lo;
 				rc = mdb_cursor_put( cursor, &key, &data, 0 );
 				if ( rc != 0 ) {
 					err = "c_put lo";
 					goto fail;
 				}
-				id = hi;
+				tmp = hi;
 				rc = mdb_cursor_put( cursor, &key, &data, 0 );
 				if ( rc != 0 ) {
 					err = "c_put hi";
 					goto fail;
 				}
+				tmp = count + 1;
+				if ( plen ) {
+					rc = bm_update( mc, bkey, plen, id, 1 );
+					if ( rc == MDB_KEYEXIST ) {
+						tmp = count;
+						rc = 0;
+					}
+					if ( rc != 0 ) {
+						err = "bitmap put";
+						goto fail;
+					}
+				}
+				if ( st ) {
+					st->is_hist[istat_bucket( count )]--;
+					st->is_ranges++;
+					st->is_ids += tmp - count;
+					istat_top( st, &skey, tmp );
+					dirty = 1;
+				}
 			} else {
 			/* There's room, just store it */
 				if (id == mdb->mi_nextid)
@@ -526,15 +1934,38 @@ mdb_idl_insert_keys(
 					goto fail;
 				}
 			}
+			/* Add it to the containers, if the key has them */
+			plen = bm_prefix( mdb, mdb_cursor_dbi( cursor ), &key, bkey );
+			if ( plen ) {
+				err = "bitmap put";
+				rc = bm_cursor( mdb, cursor, &mc );
+				if ( rc == 0 )
+					rc = bm_update( mc, bkey, plen, id, 1 );
+				if ( rc == 0 && st ) {
+					rc = istat_range( mdb_cursor_txn( cursor ), mdb,
+						st, &skey, bkey, plen, IDL_MAX( hi, id ) -
+						IDL_MIN( lo, id ) + 1, 1 );
+					dirty = 1;
+				}
+				if ( rc == MDB_NOTFOUND || rc == MDB_KEYEXIST )
+					rc = 0;
+				if ( rc != 0 )
+					goto fail;
+			}
 		}
 	} else if ( rc == MDB_NOTFOUND ) {
 		flag &= ~MDB_APPENDDUP;
+		count = 0;
 put1:	data.mv_data = &id;
 		data.mv_size = sizeof(ID);
 		rc = mdb_cursor_put( cursor, &key, &data, flag );
 		/* Don't worry if it's already there */
-		if ( rc == MDB_KEYEXIST )
+		if ( rc == MDB_KEYEXIST ) {
 			rc = 0;
+		} else if ( rc == 0 && st ) {
+			istat_list( st, &skey, count, count + 1 );
+			dirty = 1;
+		}
 		if ( rc ) {
 			err = "c_put id";
 			goto fail;
@@ -547,6 +1978,14 @@ fail:
 		break;
 	}
 	}
+	if ( mc )
+		mdb_cursor_close( mc );
+	if ( rc == 0 && dirty ) {
+		rc = istat_put( mdb, cursor, ai, strec );
+		if ( rc )
+			Debug( LDAP_DEBUG_ANY, "=> mdb_idl_insert_keys: "
+				"statistics put failed: %s (%d)\n", mdb_strerror(rc), rc, 0 );
+	}
 	return rc;
 }
 
@@ -557,10 +1996,17 @@ mdb_idl_delete_keys(
 	struct berval *keys,
 	ID			id )
 {
-	int	rc = 0, k;
-	MDB_val key, data;
+	struct mdb_info *mdb = be->be_private;
+	int	rc = 0, k, plen;
+	MDB_val key, data, skey;
+	MDB_cursor *mc = NULL;
 	ID lo, hi, tmp, *i;
+	size_t count;
 	char *err;
+	char bkey[BM_KEYMAX];
+	AttrInfo *ai = idx_attr( mdb, mdb_cursor_dbi( cursor ));
+	mdb_istat stbuf, *strec, *st;
+	int dirty = 0;
 #ifndef	MISALIGNED_OK
 	int kbuf[2];
 #endif
@@ -573,6 +2019,8 @@ mdb_idl_delete_keys(
 	}
 	assert( id != NOID );
 
+	strec = istat_get( mdb, cursor, ai, &stbuf );
+
 #ifndef MISALIGNED_OK
 	if (keys[0].bv_len & ALIGNER)
 		kbuf[1] = 0;
@@ -592,6 +2040,8 @@ mdb_idl_delete_keys(
 		key.mv_size = keys[k].bv_len;
 		key.mv_data = keys[k].bv_val;
 	}
+	skey = key;
+	st = istat_key( strec, cursor, &skey );
 	rc = mdb_cursor_get( cursor, &key, &data, MDB_SET );
 	err = "c_get";
 	if ( rc == 0 ) {
@@ -605,17 +2055,71 @@ mdb_idl_delete_keys(
 				err = "c_get id";
 				goto fail;
 			}
+			if ( st ) {
+				rc = mdb_cursor_count( cursor, &count );
+				if ( rc != 0 ) {
+					err = "c_count";
+					goto fail;
+				}
+			}
 			rc = mdb_cursor_del( cursor, 0 );
 			if ( rc != 0 ) {
 				err = "c_del id";
 				goto fail;
 			}
+			if ( st ) {
+				istat_list( st, &skey, count, count - 1 );
+				dirty = 1;
+			}
 		} else {
-			/* It's a range, see if we need to rewrite
-			 * the boundaries
+			/* If the key has containers, delete it from them,
+			 * and delete the key once they are empty. The range
+			 * may be wider than the IDs, that's harmless.
 			 */
 			lo = i[1];
 			hi = i[2];
+			plen = bm_prefix( mdb, mdb_cursor_dbi( cursor ), &key, bkey );
+			if ( plen ) {
+				err = "bitmap del";
+				rc = bm_cursor( mdb, cursor, &mc );
+				if ( rc == 0 )
+					rc = bm_update( mc, bkey, plen, id, 0 );
+				if ( rc == MDB_KEYEXIST ) {
+					rc = 0;
+					continue;
+				}
+				if ( rc == 0 && st ) {
+					rc = istat_range( mdb_cursor_txn( cursor ), mdb,
+						st, &skey, bkey, plen, 0, 0 );
+					dirty = 1;
+					if ( rc != 0 )
+						goto fail;
+				}
+				if ( rc == 0 ) {
+					rc = bm_first( mc, bkey, plen );
+					if ( rc == 0 )
+						continue;
+					if ( rc != MDB_NOTFOUND )
+						goto fail;
+					rc = mdb_cursor_del( cursor, MDB_NODUPDATA );
+					if ( rc != 0 ) {
+						err = "c_del dup";
+						goto fail;
+					}
+					if ( st ) {
+						st->is_keys--;
+						st->is_ranges--;
+						istat_top( st, &skey, 0 );
+					}
+					continue;
+				}
+				if ( rc != MDB_NOTFOUND )
+					goto fail;
+				rc = 0;
+			}
+			/* No containers, see if we need to rewrite
+			 * the boundaries
+			 */
 			if ( id == lo || id == hi ) {
 				ID lo2 = lo, hi2 = hi;
 				if ( id == lo ) {
@@ -630,6 +2134,12 @@ mdb_idl_delete_keys(
 						err = "c_del dup";
 						goto fail;
 					}
+					if ( st ) {
+						st->is_keys--;
+						st->is_ranges--;
+						istat_top( st, &skey, 0 );
+						dirty = 1;
+					}
 				} else {
 					/* position on lo */
 					rc = mdb_cursor_get( cursor, &key, &data, MDB_NEXT_DUP );
@@ -662,10 +2172,202 @@ fail:
 		}
 	}
 	}
+	if ( mc )
+		mdb_cursor_close( mc );
+	if ( rc == 0 && dirty ) {
+		rc = istat_put( mdb, cursor, ai, strec );
+		if ( rc )
+			Debug( LDAP_DEBUG_ANY, "=> mdb_idl_delete_keys: "
+				"statistics put failed: %s (%d)\n", mdb_strerror(rc), rc, 0 );
+	}
 	return rc;
 }
 
 
+/* List kernels.
+ *
+ * Lists of similar sizes are merged without branching on the order of
+ * their IDs. When few of their IDs can match, AVX2 compares four IDs of
+ * one list with four IDs of the other at a time, if the CPU has it and
+ * IDs are 64 bits. When one list is more than IDL_GALLOP times longer
+ * than the other, each ID of the short list is looked up in the long
+ * one by galloping: the step doubles until it passes the ID, and a
+ * binary search finishes within the last step.
+ */
+
+#define IDL_GALLOP	32
+#define IDL_SPARSE	4	/* AVX2 if at most one ID in 4 is in a list */
+
+/* Index of the first ID >= id in ids[lo..hi], or hi+1 */
+static ID
+idl_bsearch( ID *ids, ID lo, ID hi, ID id )
+{
+	ID mid;
+
+	hi++;
+	while ( lo < hi ) {
+		mid = lo + ( hi - lo ) / 2;
+		if ( ids[mid] < id )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* Same as idl_bsearch, for an ID expected near ids[lo] */
+static ID
+idl_gallop( ID *ids, ID lo, ID hi, ID id )
+{
+	ID step = 1;
+
+	if ( lo > hi || ids[lo] >= id )
+		return lo;
+	while ( lo + step <= hi && ids[lo + step] < id ) {
+		lo += step;
+		step <<= 1;
+	}
+	return idl_bsearch( ids, lo + 1, IDL_MIN( lo + step, hi + 1 ) - 1, id );
+}
+
+#ifdef IDL_AVX2
+static int idl_avx2 = -1;
+
+/* Intersect a[*ip..an] and b[*jp..bn] four IDs at a time, appending
+ * the result to a[1..c]. Returns the new c, the remaining IDs are left
+ * to the caller.
+ */
+static ID __attribute__((target("avx2")))
+idl_and_avx2( ID *a, ID *ip, ID an, ID *b, ID *jp, ID bn, ID c )
+{
+	ID i = *ip, j = *jp, amax, bmax;
+	__m256i va, vb, eq;
+	unsigned mask;
+
+	while ( i + 3 <= an && j + 3 <= bn ) {
+		va = _mm256_loadu_si256( (__m256i *)( a + i ));
+		vb = _mm256_loadu_si256( (__m256i *)( b + j ));
+		eq = _mm256_cmpeq_epi64( va, vb );
+		eq = _mm256_or_si256( eq, _mm256_cmpeq_epi64( va,
+			_mm256_permute4x64_epi64( vb, 0x39 )));
+		eq = _mm256_or_si256( eq, _mm256_cmpeq_epi64( va,
+			_mm256_permute4x64_epi64( vb, 0x4e )));
+		eq = _mm256_or_si256( eq, _mm256_cmpeq_epi64( va,
+			_mm256_permute4x64_epi64( vb, 0x93 )));
+		mask = _mm256_movemask_pd( _mm256_castsi256_pd( eq ));
+		amax = a[i + 3];
+		bmax = b[j + 3];
+		/* The result never overtakes the IDs still to be read */
+		while ( mask ) {
+			a[++c] = a[i + bm_lowbit( mask )];
+			mask &= mask - 1;
+		}
+		i += ( amax <= bmax ) << 2;
+		j += ( bmax <= amax ) << 2;
+	}
+	/* Matches from a block of a that is not done yet may have been
+	 * written over it: skip them, so that the merge which finishes the
+	 * lists doesn't write ahead of a[i].
+	 */
+	if ( c >= i ) {
+		amax = a[c];
+		while ( i <= an && a[i] <= amax )
+			i++;
+	}
+	*ip = i;
+	*jp = j;
+	return c;
+}
+#endif
+
+/* Intersect the lists a[i..an] and b[j..bn] into a[1..], return the
+ * number of IDs in the result.
+ */
+static ID
+idl_and_lists( ID *a, ID i, ID an, ID *b, ID j, ID bn )
+{
+	ID c = 0, x, y;
+
+	if ( i > an || j > bn )
+		return 0;
+
+	if ( an - i > ( bn - j + 1 ) * IDL_GALLOP ) {
+		for ( ; j <= bn; j++ ) {
+			i = idl_gallop( a, i, an, b[j] );
+			if ( i > an )
+				break;
+			if ( a[i] == b[j] )
+				a[++c] = a[i++];
+		}
+		return c;
+	}
+	if ( bn - j > ( an - i + 1 ) * IDL_GALLOP ) {
+		for ( ; i <= an; i++ ) {
+			j = idl_gallop( b, j, bn, a[i] );
+			if ( j > bn )
+				break;
+			if ( a[i] == b[j] )
+				a[++c] = a[i];
+		}
+		return c;
+	}
+
+#ifdef IDL_AVX2
+	if ( idl_avx2 < 0 ) {
+		__builtin_cpu_init();
+		idl_avx2 = sizeof(ID) == 8 && __builtin_cpu_supports( "avx2" );
+	}
+	/* It's slower than the plain merge when most IDs match */
+	if ( idl_avx2 && IDL_MAX( an - i, bn - j ) * IDL_SPARSE <
+		IDL_MIN( a[an], b[bn] ) - IDL_MAX( a[i], b[j] ))
+		c = idl_and_avx2( a, &i, an, b, &j, bn, c );
+#endif
+	/* a[c+1] is at most a[i], it may be written before a[i] is done */
+	while ( i <= an && j <= bn ) {
+		x = a[i];
+		y = b[j];
+		a[c + 1] = x;
+		c += x == y;
+		i += x <= y;
+		j += y <= x;
+	}
+	return c;
+}
+
+/* Number of IDs of b[1..bn] that are also in a[1..an] */
+static ID
+idl_common( ID *a, ID an, ID *b, ID bn )
+{
+	ID i = 1, j = 1, c = 0, x, y;
+
+	if ( an > bn * IDL_GALLOP ) {
+		for ( ; j <= bn; j++ ) {
+			i = idl_gallop( a, i, an, b[j] );
+			if ( i > an )
+				break;
+			c += a[i] == b[j];
+		}
+		return c;
+	}
+	if ( bn > an * IDL_GALLOP ) {
+		for ( ; i <= an; i++ ) {
+			j = idl_gallop( b, j, bn, a[i] );
+			if ( j > bn )
+				break;
+			c += a[i] == b[j];
+		}
+		return c;
+	}
+	while ( i <= an && j <= bn ) {
+		x = a[i];
+		y = b[j];
+		c += x == y;
+		i += x <= y;
+		j += y <= x;
+	}
+	return c;
+}
+
 /*
  * idl_intersection - return a = a intersection b
  */
@@ -674,7 +2376,7 @@ mdb_idl_intersection(
 	ID *a,
 	ID *b )
 {
-	ID ida, idb;
+	ID lasta, lastb;
 	ID idmax, idmin;
 	ID cursora = 0, cursorb = 0, cursorc;
 	int swap = 0;
@@ -695,6 +2397,19 @@ mdb_idl_intersection(
 		return 0;
 	}
 
+	if ( MDB_IDL_IS_BITMAP( a ) || MDB_IDL_IS_BITMAP( b ) ) {
+		/* A list is just filtered by a bitmap */
+		if ( !MDB_IDL_IS_BITMAP( a ) && !MDB_IDL_IS_RANGE( a ) ) {
+			bm_filter( a, b );
+		} else if ( !MDB_IDL_IS_BITMAP( b ) && !MDB_IDL_IS_RANGE( b ) ) {
+			bm_filter( b, a );
+			MDB_IDL_CPY( a, b );
+		} else {
+			bm_op( a, b, 1 );
+		}
+		return 0;
+	}
+
 	if ( MDB_IDL_IS_RANGE( a ) ) {
 		if ( MDB_IDL_IS_RANGE(b) ) {
 		/* If both are ranges, just shrink the boundaries */
@@ -726,24 +2441,16 @@ mdb_idl_intersection(
 		goto done;
 	}
 
-	/* Fine, do the intersection one element at a time.
-	 * First advance to idmin in both IDLs.
-	 */
-	cursora = cursorb = idmin;
-	ida = mdb_idl_first( a, &cursora );
-	idb = mdb_idl_first( b, &cursorb );
-	cursorc = 0;
-
-	while( ida <= idmax || idb <= idmax ) {
-		if( ida == idb ) {
-			a[++cursorc] = ida;
-			ida = mdb_idl_next( a, &cursora );
-			idb = mdb_idl_next( b, &cursorb );
-		} else if ( ida < idb ) {
-			ida = mdb_idl_next( a, &cursora );
-		} else {
-			idb = mdb_idl_next( b, &cursorb );
-		}
+	/* Only the IDs from idmin to idmax can be in both */
+	cursora = idl_gallop( a, 1, a[0], idmin );
+	lasta = idl_bsearch( a, cursora, a[0], idmax + 1 ) - 1;
+	if ( MDB_IDL_IS_RANGE( b ) ) {
+		for ( cursorc = 0; cursora <= lasta; )
+			a[++cursorc] = a[cursora++];
+	} else {
+		cursorb = idl_gallop( b, 1, b[0], idmin );
+		lastb = idl_bsearch( b, cursorb, b[0], idmax + 1 ) - 1;
+		cursorc = idl_and_lists( a, cursora, lasta, b, cursorb, lastb );
 	}
 	a[0] = cursorc;
 done:
@@ -775,7 +2482,7 @@ mdb_idl_union(
 	}
 
 	if ( MDB_IDL_IS_RANGE( a ) || MDB_IDL_IS_RANGE(b) ) {
-over:		ida = IDL_MIN( MDB_IDL_FIRST(a), MDB_IDL_FIRST(b) );
+		ida = IDL_MIN( MDB_IDL_FIRST(a), MDB_IDL_FIRST(b) );
 		idb = IDL_MAX( MDB_IDL_LAST(a), MDB_IDL_LAST(b) );
 		a[0] = NOID;
 		a[1] = ida;
@@ -783,42 +2490,58 @@ over:		ida = IDL_MIN( MDB_IDL_FIRST(a), MDB_IDL_FIRST(b) );
 		return 0;
 	}
 
-	ida = mdb_idl_first( a, &cursora );
-	idb = mdb_idl_first( b, &cursorb );
-
-	cursorc = b[0];
-
-	/* The distinct elements of a are cat'd to b */
-	while( ida != NOID || idb != NOID ) {
-		if ( ida < idb ) {
-			if( ++cursorc > MDB_IDL_UM_MAX ) {
-				goto over;
-			}
-			b[cursorc] = ida;
-			ida = mdb_idl_next( a, &cursora );
-
-		} else {
-			if ( ida == idb )
-				ida = mdb_idl_next( a, &cursora );
-			idb = mdb_idl_next( b, &cursorb );
-		}
+	if ( MDB_IDL_IS_BITMAP( a ) || MDB_IDL_IS_BITMAP( b ) ) {
+over:	/* Too many IDs for a list, a and b are still intact */
+		bm_op( a, b, 0 );
+		return 0;
 	}
 
-	/* b is copied back to a in sorted order */
+	/* Count the IDs of b that a lacks, then merge from the end so
+	 * a can be extended in place. The IDs of a below b's first one
+	 * stay where they are.
+	 */
+	cursorc = a[0] + b[0] - idl_common( a, a[0], b, b[0] );
+	if ( cursorc > MDB_IDL_UM_MAX )
+		goto over;
+	cursora = a[0];
+	cursorb = b[0];
 	a[0] = cursorc;
-	cursora = 1;
-	cursorb = 1;
-	cursorc = b[0]+1;
-	while (cursorb <= b[0] || cursorc <= a[0]) {
-		if (cursorc > a[0])
-			idb = NOID;
-		else
-			idb = b[cursorc];
-		if (cursorb <= b[0] && b[cursorb] < idb)
-			a[cursora++] = b[cursorb++];
-		else {
-			a[cursora++] = idb;
-			cursorc++;
+	if ( cursora > b[0] * IDL_GALLOP ) {
+		/* Move the IDs of a between two IDs of b in one piece */
+		while ( cursorc > cursora ) {
+			idb = b[cursorb--];
+			ida = idl_bsearch( a, 1, cursora, idb + 1 );
+			cursorc -= cursora - ida + 1;
+			AC_MEMCPY( a + cursorc + 1, a + ida,
+				( cursora - ida + 1 ) * sizeof(ID) );
+			cursora = ida - 1;
+			if ( cursora && a[cursora] == idb )
+				continue;
+			a[cursorc--] = idb;
+		}
+	} else if ( cursorb > cursora * IDL_GALLOP ) {
+		/* Copy the IDs of b between two IDs of a in one piece */
+		while ( cursorc > cursora ) {
+			ida = cursora ? a[cursora] : 0;
+			idb = idl_bsearch( b, 1, cursorb, ida + 1 );
+			cursorc -= cursorb - idb + 1;
+			AC_MEMCPY( a + cursorc + 1, b + idb,
+				( cursorb - idb + 1 ) * sizeof(ID) );
+			if ( !cursora )
+				break;
+			cursorb = idb - 1;
+			if ( cursorb && b[cursorb] == ida )
+				cursorb--;
+			a[cursorc--] = ida;
+			cursora--;
+		}
+	} else {
+		while ( cursorc > cursora ) {
+			ida = cursora ? a[cursora] : 0;
+			idb = b[cursorb];
+			a[cursorc--] = IDL_MAX( ida, idb );
+			cursora -= ida >= idb;
+			cursorb -= idb >= ida;
 		}
 	}
 
@@ -896,6 +2619,22 @@ ID mdb_idl_first( ID *ids, ID *cursor )
 		return *cursor;
 	}
 
+	/* In a bitmap, the cursor is the offset of the container
+	 * and the low bits of the ID
+	 */
+	if ( MDB_IDL_IS_BITMAP( ids ) ) {
+		mdb_bcont *c;
+		pos = MDB_IDL_BM_HDR;
+		while ( pos < MDB_IDL_BM_SIZE( ids ) ) {
+			c = (mdb_bcont *)( ids + pos );
+			if ( c->bc_key >= *cursor >> 16 )
+				return bm_next( ids, pos, c->bc_key == *cursor >> 16
+					? BM_LOW( *cursor ) : 0, cursor );
+			pos += BC_NEXT( c );
+		}
+		return NOID;
+	}
+
 	if ( *cursor == 0 )
 		pos = 1;
 	else
@@ -918,6 +2657,10 @@ ID mdb_idl_next( ID *ids, ID *cursor )
 		return *cursor;
 	}
 
+	if ( MDB_IDL_IS_BITMAP( ids ) ) {
+		return bm_next( ids, *cursor >> 16, BM_LOW( *cursor ) + 1, cursor );
+	}
+
 	if ( ++(*cursor) <= ids[0] ) {
 		return ids[*cursor];
 	}
@@ -925,6 +2668,46 @@ ID mdb_idl_next( ID *ids, ID *cursor )
 	return NOID;
 }
 
+/* Copy an IDL to as little memory as it fits in, a list becoming a
+ * bitmap IDL when that is smaller. The size of the copy in bytes is
+ * returned in *size.
+ */
+ID *
+mdb_idl_pack( ID *ids, size_t *size )
+{
+	unsigned bits[BM_WORDS];
+	bm_iter it;
+	ID key, *bm = NULL, *out;
+	size_t n = MDB_IDL_SIZEOF( ids );
+
+	if ( !MDB_IDL_IS_RANGE( ids ) && !MDB_IDL_IS_BITMAP( ids ) &&
+		ids[0] > MDB_IDL_BM_HDR ) {
+		bm = ch_malloc( MDB_IDL_BM_MAX * sizeof(ID));
+		bm_init( bm );
+		bmi_init( &it, ids );
+		for ( key = 0; ( key = bmi_seek( &it, key )) != NOID; key++ ) {
+			memset( bits, 0, sizeof(bits));
+			bmi_fill( &it, key, bits );
+			if ( bm_put( bm, key, bits ) ||
+				MDB_IDL_BM_SIZE( bm ) * sizeof(ID) >= n ) {
+				ch_free( bm );
+				bm = NULL;
+				break;
+			}
+		}
+		if ( bm ) {
+			ids = bm;
+			n = MDB_IDL_SIZEOF( bm );
+		}
+	}
+	out = ch_malloc( n );
+	AC_MEMCPY( out, ids, n );
+	if ( bm )
+		ch_free( bm );
+	*size = n;
+	return out;
+}
+
 /* Add one ID to an unsorted list. We ensure that the first element is the
  * minimum and the last element is the maximum, for fast range compaction.
  *   this means IDLs up to length 3 are always sorted...
@@ -33,7 +33,21 @@
 #define MDB_IDL_RANGE_SIZE		(3)
 #define MDB_IDL_RANGE_SIZEOF	(MDB_IDL_RANGE_SIZE * sizeof(ID))
 #define MDB_IDL_SIZEOF(ids)		((MDB_IDL_IS_RANGE(ids) \
-	? MDB_IDL_RANGE_SIZE : ((ids)[0]+1)) * sizeof(ID))
+	? MDB_IDL_RANGE_SIZE : MDB_IDL_IS_BITMAP(ids) \
+	? MDB_IDL_BM_SIZE(ids) : ((ids)[0]+1)) * sizeof(ID))
+
+/* A bitmap IDL holds a large set of IDs exactly, as compressed
+ * containers of 64K IDs each. ids[1] and ids[2] are the first and
+ * last IDs, ids[3] the number of IDs and ids[4] the size of the
+ * IDL in IDs. The containers follow this header. A bitmap IDL is
+ * never larger than MDB_IDL_BM_MAX, so it fits in any IDL buffer.
+ */
+#define MDB_IDL_BITMAP		(NOID-1)
+#define MDB_IDL_IS_BITMAP(ids)	((ids)[0] == MDB_IDL_BITMAP)
+#define MDB_IDL_BM_HDR		(5)
+#define MDB_IDL_BM_N(ids)		((ids)[3])
+#define MDB_IDL_BM_SIZE(ids)	((ids)[4])
+#define MDB_IDL_BM_MAX		MDB_IDL_DB_SIZE
 
 #define MDB_IDL_RANGE_FIRST(ids)	((ids)[1])
 #define MDB_IDL_RANGE_LAST(ids)		((ids)[2])
@@ -64,10 +78,11 @@
 #define MDB_IDL_FIRST( ids )	( (ids)[1] )
 #define MDB_IDL_LLAST( ids )	( (ids)[(ids)[0]] )
 #define MDB_IDL_LAST( ids )		( MDB_IDL_IS_RANGE(ids) \
-	? (ids)[2] : (ids)[(ids)[0]] )
+	|| MDB_IDL_IS_BITMAP(ids) ? (ids)[2] : (ids)[(ids)[0]] )
 
 #define MDB_IDL_N( ids )		( MDB_IDL_IS_RANGE(ids) \
-	? ((ids)[2]-(ids)[1])+1 : (ids)[0] )
+	? ((ids)[2]-(ids)[1])+1 : MDB_IDL_IS_BITMAP(ids) \
+	? MDB_IDL_BM_N(ids) : (ids)[0] )
 
 	/** An ID2 is an ID/value pair.
 	 */
@@ -0,0 +1,293 @@
+/* idlbench.c - benchmark of back-mdb IDL intersection and union */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 2011-2018 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Times mdb_idl_intersection() and mdb_idl_union() against the plain
+ * merges they used to do, on pairs of IDLs shaped like the index keys
+ * of a directory, and checks that both give the same result.
+ *
+ *	make idlbench
+ *	./idlbench [iterations]
+ */
+
+#include "portable.h"
+
+#include <stdio.h>
+#include <ac/stdlib.h>
+#include <ac/string.h>
+#include <ac/time.h>
+
+#include "back-mdb.h"
+#include "idl.h"
+
+/* What idl.o needs from slapd */
+int slap_debug;
+int ldap_syslog;
+int ldap_syslog_level;
+int slapMode;
+
+void *
+ch_malloc( ber_len_t size )
+{
+	void *p = malloc( size );
+	if ( p == NULL ) {
+		perror( "malloc" );
+		exit( EXIT_FAILURE );
+	}
+	return p;
+}
+
+void
+ch_free( void *p )
+{
+	free( p );
+}
+
+/* The list merge of mdb_idl_intersection before the size-adaptive
+ * kernels.
+ */
+static void
+old_intersection( ID *a, ID *b )
+{
+	ID ida, idb;
+	ID idmax, idmin;
+	ID cursora, cursorb, cursorc;
+
+	idmin = a[1] > b[1] ? a[1] : b[1];
+	idmax = a[a[0]] < b[b[0]] ? a[a[0]] : b[b[0]];
+	if ( idmin > idmax ) {
+		a[0] = 0;
+		return;
+	} else if ( idmin == idmax ) {
+		a[0] = 1;
+		a[1] = idmin;
+		return;
+	}
+
+	cursora = cursorb = idmin;
+	ida = mdb_idl_first( a, &cursora );
+	idb = mdb_idl_first( b, &cursorb );
+	cursorc = 0;
+
+	while( ida <= idmax || idb <= idmax ) {
+		if( ida == idb ) {
+			a[++cursorc] = ida;
+			ida = mdb_idl_next( a, &cursora );
+			idb = mdb_idl_next( b, &cursorb );
+		} else if ( ida < idb ) {
+			ida = mdb_idl_next( a, &cursora );
+		} else {
+			idb = mdb_idl_next( b, &cursorb );
+		}
+	}
+	a[0] = cursorc;
+}
+
+/* The list merge of mdb_idl_union before the size-adaptive kernels */
+static void
+old_union( ID *a, ID *b )
+{
+	ID ida, idb;
+	ID cursora = 0, cursorb = 0, cursorc;
+
+	ida = mdb_idl_first( a, &cursora );
+	idb = mdb_idl_first( b, &cursorb );
+
+	cursorc = b[0];
+
+	while( ida != NOID || idb != NOID ) {
+		if ( ida < idb ) {
+			b[++cursorc] = ida;
+			ida = mdb_idl_next( a, &cursora );
+		} else {
+			if ( ida == idb )
+				ida = mdb_idl_next( a, &cursora );
+			idb = mdb_idl_next( b, &cursorb );
+		}
+	}
+
+	a[0] = cursorc;
+	cursora = 1;
+	cursorb = 1;
+	cursorc = b[0]+1;
+	while (cursorb <= b[0] || cursorc <= a[0]) {
+		if (cursorc > a[0])
+			idb = NOID;
+		else
+			idb = b[cursorc];
+		if (cursorb <= b[0] && b[cursorb] < idb)
+			a[cursora++] = b[cursorb++];
+		else {
+			a[cursora++] = idb;
+			cursorc++;
+		}
+	}
+}
+
+static unsigned long seed = 1;
+
+static ID
+rnd( ID n )
+{
+	seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+	return ( seed >> 33 ) % n;
+}
+
+/* n distinct IDs from first to first+span-1, evenly spread when dense,
+ * random otherwise
+ */
+static void
+mkidl( ID *ids, ID n, ID first, ID span )
+{
+	ID i, j;
+
+	if ( n * 2 >= span ) {
+		/* keep each ID with probability n/span */
+		for ( i = 0, j = 0; i < span && j < n; i++ ) {
+			if ( rnd( span - i ) < n - j )
+				ids[++j] = first + i;
+		}
+	} else {
+		/* random gaps with the right mean */
+		ID gap = span / n * 2 - 1, id = first;
+		for ( j = 0; j < n; ) {
+			ids[++j] = id;
+			id += 1 + rnd( gap );
+		}
+	}
+	ids[0] = j;
+}
+
+typedef struct shape {
+	const char *name;
+	ID na, fa, sa;	/* size, first ID, span of a */
+	ID nb, fb, sb;	/* same for b */
+} shape;
+
+/* Index keys of a directory of about a million entries loaded in
+ * order: equality keys of nearly unique values have a few IDs, keys of
+ * common values and objectClass keys of a large subtree have up to
+ * the 64K IDs an index DB keeps as a list, and the candidate list of
+ * a subtree is dense within the subtree.
+ */
+static const shape shapes[] = {
+	{ "cn=x & objectClass", 3, 1, 1000000, 65535, 1, 1000000 },
+	{ "sn=x & ou subtree", 300, 1, 1000000, 65535, 200000, 70000 },
+	{ "sub & objectClass", 2000, 1, 1000000, 65535, 1, 1000000 },
+	{ "l=x & title=y", 20000, 1, 1000000, 40000, 1, 1000000 },
+	{ "dept & subtree", 60000, 1, 100000, 65535, 20000, 80000 },
+	{ "two keys, disjoint", 30000, 1, 500000, 30000, 500001, 500000 },
+	{ NULL }
+};
+
+typedef void (idl_op)( ID *a, ID *b );
+
+static void
+new_intersection( ID *a, ID *b )
+{
+	mdb_idl_intersection( a, b );
+}
+
+static void
+new_union( ID *a, ID *b )
+{
+	mdb_idl_union( a, b );
+}
+
+static double
+now( void )
+{
+	struct timeval tv;
+
+	gettimeofday( &tv, NULL );
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* Microseconds per call of op on a copy of a. Neither operation
+ * changes the IDs of b, the old union only uses the space after them.
+ */
+static double
+timeop( idl_op *op, ID *a, ID *b, ID *ta, ID *tb, int iter )
+{
+	double t, copy;
+	int i;
+
+	MDB_IDL_CPY( tb, b );
+	t = now();
+	for ( i = 0; i < iter; i++ )
+		MDB_IDL_CPY( ta, a );
+	copy = now() - t;
+
+	t = now();
+	for ( i = 0; i < iter; i++ ) {
+		MDB_IDL_CPY( ta, a );
+		op( ta, tb );
+	}
+	t = now() - t - copy;
+	return ( t > 0 ? t : 0 ) * 1e6 / iter;
+}
+
+int
+main( int argc, char *argv[] )
+{
+	ID *a, *b, *ta, *tb, *ra;
+	const shape *s;
+	double to, tn;
+	int iter = argc > 1 ? atoi( argv[1] ) : 500;
+	int k, rc = 0;
+	static const char *opname[] = { "and", "or" };
+	static idl_op *oldop[] = { old_intersection, old_union };
+	static idl_op *newop[] = { new_intersection, new_union };
+
+	a = ch_malloc( MDB_IDL_UM_SIZE * sizeof(ID) );
+	b = ch_malloc( MDB_IDL_UM_SIZE * sizeof(ID) );
+	ta = ch_malloc( MDB_IDL_UM_SIZE * sizeof(ID) );
+	tb = ch_malloc( MDB_IDL_UM_SIZE * sizeof(ID) );
+	ra = ch_malloc( MDB_IDL_UM_SIZE * sizeof(ID) );
+
+	printf( "%-22s %-3s %6s %6s %6s %10s %10s %7s\n", "shape", "op",
+		"|a|", "|b|", "result", "old us", "new us", "speedup" );
+	for ( s = shapes; s->name; s++ ) {
+		mkidl( a, s->na, s->fa, s->sa );
+		mkidl( b, s->nb, s->fb, s->sb );
+		for ( k = 0; k < 2; k++ ) {
+			/* each order of the operands */
+			ID *x = a, *y = b;
+			int swap;
+			for ( swap = 0; swap < 2; swap++ ) {
+				MDB_IDL_CPY( ra, x );
+				MDB_IDL_CPY( tb, y );
+				oldop[k]( ra, tb );
+				MDB_IDL_CPY( ta, x );
+				MDB_IDL_CPY( tb, y );
+				newop[k]( ta, tb );
+				if ( ta[0] != ra[0] || memcmp( ta, ra,
+					MDB_IDL_SIZEOF( ra ))) {
+					printf( "%s %s: results differ\n",
+						s->name, opname[k] );
+					rc = 1;
+				}
+				to = timeop( oldop[k], x, y, ta, tb, iter );
+				tn = timeop( newop[k], x, y, ta, tb, iter );
+				printf( "%-22s %-3s %6lu %6lu %6lu %10.1f %10.1f %7.2f\n",
+					swap ? "" : s->name, opname[k], x[0], y[0],
+					ra[0], to, tn, tn > 0 ? to / tn : 0 );
+				x = b;
+				y = a;
+			}
+		}
+	}
+	return rc;
+}
@@ -161,6 +161,73 @@ done:
 	return LDAP_SUCCESS;
 }
 
+/* The ix2o key of a value of ad, cut to MDB_OKEY_MAX. Returns nonzero
+ * if the value didn't fit. The keys start with the type name, as the
+ * ix2b and ix2s ones do.
+ */
+int
+mdb_okey(
+	AttributeDescription *ad,
+	struct berval *val,
+	char *buf,
+	MDB_val *key )
+{
+	struct berval *name = &ad->ad_type->sat_cname;
+	ber_len_t len = name->bv_len + 1;
+	int cut = 0;
+
+	AC_MEMCPY( buf, name->bv_val, len - 1 );
+	buf[len - 1] = '\0';
+	if ( len + val->bv_len > MDB_OKEY_MAX ) {
+		AC_MEMCPY( buf + len, val->bv_val, MDB_OKEY_MAX - len );
+		len = MDB_OKEY_MAX;
+		cut = 1;
+	} else {
+		AC_MEMCPY( buf + len, val->bv_val, val->bv_len );
+		len += val->bv_len;
+	}
+	key->mv_data = buf;
+	key->mv_size = len;
+	return cut;
+}
+
+static int
+order_keys(
+	MDB_txn *txn,
+	struct mdb_info *mdb,
+	AttributeDescription *ad,
+	BerVarray vals,
+	ID id,
+	int opid )
+{
+	MDB_val key, data;
+	char buf[MDB_OKEY_MAX];
+	int i, cut, rc = 0;
+
+	data.mv_data = &id;
+	data.mv_size = sizeof(ID);
+	for ( i = 0; !BER_BVISNULL( &vals[i] ); i++ ) {
+		if ( ad->ad_type->sat_cname.bv_len + 1 >= MDB_OKEY_MAX )
+			break;
+		cut = mdb_okey( ad, &vals[i], buf, &key );
+		if ( opid == SLAP_INDEX_ADD_OP ) {
+			rc = mdb_put( txn, mdb->mi_ix2o, &key, &data, MDB_NODUPDATA );
+			if ( rc == MDB_KEYEXIST )
+				rc = 0;
+		} else if ( !cut ) {
+			/* Another value may share a cut key, the search checks
+			 * the values of the IDs it finds under one.
+			 */
+			rc = mdb_del( txn, mdb->mi_ix2o, &key, &data );
+			if ( rc == MDB_NOTFOUND )
+				rc = 0;
+		}
+		if ( rc )
+			break;
+	}
+	return rc;
+}
+
 static int indexer(
 	Operation *op,
 	MDB_txn *txn,
@@ -268,6 +335,18 @@ static int indexer(
 		rc = LDAP_SUCCESS;
 	}
 
+	if( IS_SLAP_INDEX( mask, SLAP_INDEX_ORDER ) ) {
+		struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+
+		if ( mdb->mi_ix2o ) {
+			rc = order_keys( txn, mdb, ad, vals, id, opid );
+			if( rc ) {
+				err = "order";
+				goto done;
+			}
+		}
+	}
+
 done:
 	if ( !(slapMode & SLAP_TOOL_QUICK))
 		mdb_cursor_close( mc );
@@ -293,7 +372,7 @@ static int index_at_values(
 	int opid )
 {
 	int rc;
-	slap_mask_t mask = 0;
+	slap_mask_t mask = 0, omask = 0;
 	int ixop = opid;
 	AttrInfo *ai = NULL;
 
@@ -324,6 +403,11 @@ static int index_at_values(
 				}
 			}
 #endif
+			/* The order index only holds the values of the attribute
+			 * itself, a sort doesn't look at its subtypes or tags.
+			 */
+			if ( ad != type->sat_ad )
+				omask = SLAP_INDEX_ORDER;
 			ad = type->sat_ad;
 			/* If we're updating the index, just set the new bits that aren't
 			 * already in the old mask.
@@ -335,6 +419,7 @@ static int index_at_values(
 			 * just use the old mask.
 			 */
 				mask = ai->ai_newmask ? ai->ai_newmask : ai->ai_indexmask;
+			mask &= ~omask;
 			if( mask ) {
 				rc = indexer( op, txn, ai, ad, &type->sat_cname,
 					vals, id, ixop, mask );
@@ -356,6 +441,7 @@ static int index_at_values(
 					mask = ai->ai_newmask & ~ai->ai_indexmask;
 				else
 					mask = ai->ai_newmask ? ai->ai_newmask : ai->ai_indexmask;
+				mask &= ~SLAP_INDEX_ORDER;
 				if ( mask ) {
 					rc = indexer( op, txn, ai, desc, &desc->ad_cname,
 						vals, id, ixop, mask );
@@ -449,6 +535,7 @@ int mdb_index_recrun(
 {
 	IndexRec *ir;
 	AttrList *al;
+	slap_mask_t mask;
 	int i, rc = 0;
 
 	/* Never index ID 0 */
@@ -460,10 +547,13 @@ int mdb_index_recrun(
 		if ( !ir->ir_ai ) continue;
 		while (( al = ir->ir_attrs )) {
 			ir->ir_attrs = al->next;
+			/* not the subtypes and tags in the order index */
+			mask = ir->ir_ai->ai_indexmask;
+			if ( al->attr->a_desc != ir->ir_ai->ai_desc )
+				mask &= ~SLAP_INDEX_ORDER;
 			rc = indexer( op, txn, ir->ir_ai, ir->ir_ai->ai_desc,
 				&ir->ir_ai->ai_desc->ad_type->sat_cname,
-				al->attr->a_nvals, id, SLAP_INDEX_ADD_OP,
-				ir->ir_ai->ai_indexmask );
+				al->attr->a_nvals, id, SLAP_INDEX_ADD_OP, mask );
 			free( al );
 			if ( rc ) break;
 		}
@@ -32,6 +32,9 @@ static const struct berval mdmi_databases[] = {
 	BER_BVC("dn2i"),
 	BER_BVC("id2e"),
 	BER_BVC("id2v"),
+	BER_BVC("ix2b"),
+	BER_BVC("ix2s"),
+	BER_BVC("ix2o"),
 	BER_BVNULL
 };
 
@@ -66,6 +69,11 @@ mdb_db_init( BackendDB *be, ConfigReply *cr )
 	mdb->mi_rtxn_size = DEFAULT_RTXN_SIZE;
 	mdb->mi_multi_hi = UINT_MAX;
 	mdb->mi_multi_lo = UINT_MAX;
+	mdb->mi_prefault = -1;
+	mdb->mi_search_mincand = DEFAULT_SEARCH_MINCAND;
+	mdb->mi_paged_max = DEFAULT_PAGED_MAX;
+	mdb->mi_paged_expire = DEFAULT_PAGED_EXPIRE;
+	ldap_pvt_thread_mutex_init( &mdb->mi_paged_mutex );
 
 	be->be_private = mdb;
 	be->be_cf_ocs = be->bd_info->bi_cf_ocs;
@@ -154,6 +162,15 @@ mdb_db_open( BackendDB *be, ConfigReply *cr )
 		goto fail;
 	}
 
+	rc = mdb_env_set_prefault( mdb->mi_dbenv, mdb->mi_prefault_hints );
+	if( rc != 0 ) {
+		Debug( LDAP_DEBUG_ANY,
+			LDAP_XSTRING(mdb_db_open) ": database \"%s\": "
+			"mdb_env_set_prefault failed: %s (%d).\n",
+			be->be_suffix[0].bv_val, mdb_strerror(rc), rc );
+		goto fail;
+	}
+
 #ifdef HAVE_EBCDIC
 	strcpy( path, mdb->mi_dbenv_home );
 	__atoe( path );
@@ -206,6 +223,10 @@ mdb_db_open( BackendDB *be, ConfigReply *cr )
 				flags |= MDB_DUPSORT;
 			if ( i == MDB_ID2VAL )
 				flags ^= MDB_INTEGERKEY|MDB_DUPSORT;
+			if ( i == MDB_IX2B || i == MDB_IX2S )
+				flags ^= MDB_INTEGERKEY;
+			if ( i == MDB_IX2O )
+				flags ^= MDB_INTEGERKEY|MDB_DUPSORT|MDB_DUPFIXED|MDB_INTEGERDUP;
 			if ( !(slapMode & SLAP_TOOL_READONLY) )
 				flags |= MDB_CREATE;
 		}
@@ -215,6 +236,15 @@ mdb_db_open( BackendDB *be, ConfigReply *cr )
 			flags,
 			&mdb->mi_dbis[i] );
 
+		/* Databases from older versions have no index bitmaps,
+		 * statistics or order index
+		 */
+		if ( rc == MDB_NOTFOUND && ( i == MDB_IX2B || i == MDB_IX2S ||
+			i == MDB_IX2O )) {
+			mdb->mi_dbis[i] = 0;
+			continue;
+		}
+
 		if ( rc != 0 ) {
 			snprintf( cr->msg, sizeof(cr->msg), "database \"%s\": "
 				"mdb_dbi_open(%s/%s) failed: %s (%d).", 
@@ -293,6 +323,19 @@ mdb_db_open( BackendDB *be, ConfigReply *cr )
 		goto fail;
 	}
 
+	/* Read the upper levels of all the DBs in the background, so
+	 * the first searches after a restart don't wait on the disk.
+	 */
+	if ( mdb->mi_prefault >= 0 && ( slapMode & SLAP_SERVER_MODE )) {
+		rc = mdb_env_prefault( mdb->mi_dbenv, mdb->mi_prefault );
+		if ( rc != 0 ) {
+			Debug( LDAP_DEBUG_ANY,
+				LDAP_XSTRING(mdb_db_open) ": database \"%s\": "
+				"mdb_env_prefault failed: %s (%d).\n",
+				be->be_suffix[0].bv_val, mdb_strerror(rc), rc );
+		}
+	}
+
 	/* monitor setup */
 	rc = mdb_monitor_db_open( be );
 	if ( rc != 0 ) {
@@ -301,6 +344,9 @@ mdb_db_open( BackendDB *be, ConfigReply *cr )
 
 	mdb->mi_flags |= MDB_IS_OPEN;
 
+	/* complete the statistics of indices from older versions */
+	mdb_stats_scan_start( be );
+
 	return 0;
 
 fail:
@@ -319,6 +365,8 @@ mdb_db_close( BackendDB *be, ConfigReply *cr )
 
 	mdb->mi_flags &= ~MDB_IS_OPEN;
 
+	mdb_paged_free( mdb, NULL );
+
 	if( mdb->mi_dbenv ) {
 		mdb_reader_flush( mdb->mi_dbenv );
 	}
@@ -368,6 +416,18 @@ mdb_db_destroy( BackendDB *be, ConfigReply *cr )
 		ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
 	}
 
+	/* stop and remove backup task */
+	if ( mdb->mi_backup_task ) {
+		struct re_s *re = mdb->mi_backup_task;
+		mdb->mi_backup_task = NULL;
+		ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
+		if ( ldap_pvt_runqueue_isrunning( &slapd_rq, re ) )
+			ldap_pvt_runqueue_stoptask( &slapd_rq, re );
+		ldap_pvt_runqueue_remove( &slapd_rq, re );
+		ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
+	}
+	if ( mdb->mi_backup_dir ) ch_free( mdb->mi_backup_dir );
+
 	/* monitor handling */
 	(void)mdb_monitor_db_destroy( be );
 
@@ -375,12 +435,21 @@ mdb_db_destroy( BackendDB *be, ConfigReply *cr )
 
 	mdb_attr_index_destroy( mdb );
 
+	ldap_pvt_thread_mutex_destroy( &mdb->mi_paged_mutex );
+
 	ch_free( mdb );
 	be->be_private = NULL;
 
 	return 0;
 }
 
+static int
+mdb_connection_destroy( BackendDB *be, Connection *c )
+{
+	mdb_paged_free( (struct mdb_info *) be->be_private, c );
+	return 0;
+}
+
 int
 mdb_back_initialize(
 	BackendInfo	*bi )
@@ -492,7 +561,7 @@ mdb_back_initialize(
 	bi->bi_tool_entry_delete = mdb_tool_entry_delete;
 
 	bi->bi_connection_init = 0;
-	bi->bi_connection_destroy = 0;
+	bi->bi_connection_destroy = mdb_connection_destroy;
 
 	rc = mdb_back_init_cf( bi );
 
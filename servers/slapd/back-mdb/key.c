@@ -70,3 +70,72 @@ mdb_key_read(
 
 	return rc;
 }
+
+/* read a key through a cursor on its index, the keys of an
+ * intersection are read in their order with the same cursor
+ */
+int
+mdb_key_seek(
+	Backend	*be,
+	MDB_cursor *cursor,
+	struct berval *k,
+	ID *ids
+)
+{
+	int rc;
+	MDB_val key;
+#ifndef MISALIGNED_OK
+	int kbuf[2];
+
+	if (k->bv_len & ALIGNER) {
+		key.mv_size = sizeof(kbuf);
+		key.mv_data = kbuf;
+		kbuf[1] = 0;
+		memcpy(kbuf, k->bv_val, k->bv_len);
+	} else
+#endif
+	{
+		key.mv_size = k->bv_len;
+		key.mv_data = k->bv_val;
+	}
+
+	rc = mdb_idl_seek_key( be, cursor, &key, ids );
+
+	if( rc != LDAP_SUCCESS ) {
+		Debug( LDAP_DEBUG_TRACE, "<= mdb_key_seek: failed (%d)\n",
+			rc, 0, 0 );
+	} else {
+		Debug( LDAP_DEBUG_TRACE, "<= mdb_key_seek %ld candidates\n",
+			(long) MDB_IDL_N(ids), 0, 0 );
+	}
+
+	return rc;
+}
+
+/* count the IDs of a key, through a cursor on its index */
+int
+mdb_key_count(
+	Backend	*be,
+	MDB_cursor *cursor,
+	struct berval *k,
+	ID *count
+)
+{
+	MDB_val key;
+#ifndef MISALIGNED_OK
+	int kbuf[2];
+
+	if (k->bv_len & ALIGNER) {
+		key.mv_size = sizeof(kbuf);
+		key.mv_data = kbuf;
+		kbuf[1] = 0;
+		memcpy(kbuf, k->bv_val, k->bv_len);
+	} else
+#endif
+	{
+		key.mv_size = k->bv_len;
+		key.mv_data = k->bv_val;
+	}
+
+	return mdb_idl_count_key( be, cursor, &key, count );
+}
@@ -32,6 +32,7 @@
 static ObjectClass		*oc_olmMDBDatabase;
 
 static AttributeDescription *ad_olmDbDirectory;
+static AttributeDescription *ad_olmDbIndexStats;
 
 #ifdef MDB_MONITOR_IDX
 static int
@@ -88,6 +89,17 @@ static struct {
 		&ad_olmDbNotIndexed },
 #endif /* MDB_MONITOR_IDX */
 
+	/* olmMDBAttributes:1-3 are taken by back-bdb, which uses the same arc */
+	{ "( olmMDBAttributes:4 "
+		"NAME ( 'olmDbIndexStats' ) "
+		"DESC 'Statistics of an index: whether they are partial, "
+			"number of keys, of IDs, of keys kept as a range, of "
+			"keys by number of IDs, and the keys with the most IDs' "
+		"SUP monitoredInfo "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmDbIndexStats },
+
 	{ NULL }
 };
 
@@ -105,12 +117,108 @@ static struct {
 #ifdef MDB_MONITOR_IDX
 			"$ olmDbNotIndexed "
 #endif /* MDB_MONITOR_IDX */
+			"$ olmDbIndexStats "
 			") )",
 		&oc_olmMDBDatabase },
 
 	{ NULL }
 };
 
+/* One value of olmDbIndexStats:
+ * <attr>[#partial]#keys=<n>#ids=<n>#ranges=<n>#hist=<ids>:<keys>,...#top=<key>:<ids>,...
+ * where hist gives the number of keys with <ids> to 2*<ids>-1 IDs, and
+ * top the keys in hex with the most IDs. partial is there while the keys
+ * of an index are still being counted, the numbers only cover those
+ * counted so far.
+ */
+static void
+mdb_monitor_stats2bv( AttrInfo *ai, mdb_istat *st, struct berval *bv )
+{
+	char buf[ 1024 ], *ptr, *end = buf + sizeof( buf );
+	const char *sep;
+	int i, j;
+
+	ptr = buf + snprintf( buf, sizeof( buf ), "%s%s#keys=%lu#ids=%lu#ranges=%lu#hist=",
+		ai->ai_desc->ad_type->sat_cname.bv_val,
+		( st->is_flags & MDB_ISTAT_PARTIAL ) ? "#partial" : "",
+		st->is_keys, st->is_ids, st->is_ranges );
+	for ( i = 0, sep = ""; i < MDB_ISTAT_HIST && ptr < end; i++ ) {
+		if ( st->is_hist[ i ] ) {
+			ptr += snprintf( ptr, end - ptr, "%s%lu:%lu", sep,
+				1UL << i, st->is_hist[ i ] );
+			sep = ",";
+		}
+	}
+	if ( ptr < end )
+		ptr += snprintf( ptr, end - ptr, "#top=" );
+	for ( i = 0, sep = ""; i < MDB_ISTAT_TOP && st->is_top[ i ].it_count
+		&& ptr < end; i++ ) {
+		ptr += snprintf( ptr, end - ptr, "%s", sep );
+		for ( j = 0; j < st->is_top[ i ].it_len && ptr < end; j++ )
+			ptr += snprintf( ptr, end - ptr, "%02x", st->is_top[ i ].it_key[ j ] );
+		if ( ptr < end )
+			ptr += snprintf( ptr, end - ptr, ":%lu", st->is_top[ i ].it_count );
+		sep = ",";
+	}
+	if ( ptr > end - 1 )
+		ptr = end - 1;
+	ber_str2bv( buf, ptr - buf, 1, bv );
+}
+
+static int
+mdb_monitor_stats_entry_add(
+	Operation	*op,
+	struct mdb_info	*mdb,
+	Entry		*e )
+{
+	mdb_op_info	opinfo = {{{0}}}, *moi = &opinfo;
+	BerVarray	vals = NULL;
+	struct berval	bv;
+	Attribute	*a;
+	mdb_istat	st;
+	int		i;
+
+	if ( !mdb->mi_ix2s || mdb_opinfo_get( op, mdb, 1, &moi ))
+		return 0;
+
+	for ( i = 0; i < mdb->mi_nattrs; i++ ) {
+		if ( mdb_idl_stats( moi->moi_txn, mdb, mdb->mi_attrs[ i ], &st ))
+			continue;
+		mdb_monitor_stats2bv( mdb->mi_attrs[ i ], &st, &bv );
+		ber_bvarray_add( &vals, &bv );
+	}
+
+	if ( moi == &opinfo ) {
+		mdb_txn_reset( moi->moi_txn );
+		LDAP_SLIST_REMOVE( &op->o_extra, &moi->moi_oe, OpExtra, oe_next );
+	} else {
+		moi->moi_ref--;
+	}
+
+	a = attr_find( e->e_attrs, ad_olmDbIndexStats );
+	if ( vals == NULL ) {
+		if ( a != NULL )
+			attr_delete( &e->e_attrs, ad_olmDbIndexStats );
+		return 0;
+	}
+	if ( a != NULL ) {
+		ber_bvarray_free( a->a_vals );
+	} else {
+		Attribute	**ap;
+
+		for ( ap = &e->e_attrs; *ap != NULL; ap = &(*ap)->a_next )
+			;
+		*ap = attr_alloc( ad_olmDbIndexStats );
+		a = *ap;
+	}
+	a->a_vals = vals;
+	a->a_nvals = a->a_vals;
+	for ( a->a_numvals = 0; !BER_BVISNULL( &vals[ a->a_numvals ] ); a->a_numvals++ )
+		;
+
+	return 0;
+}
+
 static int
 mdb_monitor_update(
 	Operation	*op,
@@ -118,12 +226,14 @@ mdb_monitor_update(
 	Entry		*e,
 	void		*priv )
 {
-#ifdef MDB_MONITOR_IDX
 	struct mdb_info		*mdb = (struct mdb_info *) priv;
 
+#ifdef MDB_MONITOR_IDX
 	mdb_monitor_idx_entry_add( mdb, e );
 #endif /* MDB_MONITOR_IDX */
 
+	mdb_monitor_stats_entry_add( op, mdb, e );
+
 	return SLAP_CB_CONTINUE;
 }
 
@@ -54,6 +54,7 @@ int mdb_ad_get( struct mdb_info *mdb, MDB_txn *txn, AttributeDescription *ad );
  */
 
 int mdb_back_init_cf( BackendInfo *bi );
+void mdb_stats_scan_start( BackendDB *be );
 
 /*
  * dn2entry.c
@@ -205,7 +206,9 @@ BI_entry_release_rw mdb_entry_release;
 BI_entry_get_rw mdb_entry_get;
 BI_op_txn mdb_txn;
 
-int mdb_entry_decode( Operation *op, MDB_txn *txn, MDB_val *data, ID id, Entry **e );
+int mdb_entry_decode( Operation *op, MDB_txn *txn, MDB_val *data, ID id,
+	mdb_attrsel *sel, Entry **e );
+mdb_attrsel *mdb_attrsel_new( Operation *op, AttributeDescription **ads );
 
 void mdb_reader_flush( MDB_env *env );
 int mdb_opinfo_get( Operation *op, struct mdb_info *mdb, int rdonly, mdb_op_info **moi );
@@ -218,6 +221,7 @@ int mdb_mval_del(Operation *op, MDB_cursor *mc, ID id, Attribute *a);
  */
 
 unsigned mdb_idl_search( ID *ids, ID id );
+int mdb_idl_bm_has( ID *ids, ID id );
 
 int mdb_idl_fetch_key(
 	BackendDB	*be,
@@ -228,6 +232,18 @@ int mdb_idl_fetch_key(
 	MDB_cursor	**saved_cursor,
 	int                     get_flag );
 
+int mdb_idl_seek_key(
+	BackendDB	*be,
+	MDB_cursor	*cursor,
+	MDB_val		*key,
+	ID			*ids );
+
+int mdb_idl_count_key(
+	BackendDB	*be,
+	MDB_cursor	*cursor,
+	MDB_val		*key,
+	ID			*count );
+
 int mdb_idl_insert( ID *ids, ID id );
 
 typedef int (mdb_idl_keyfunc)(
@@ -239,6 +255,15 @@ typedef int (mdb_idl_keyfunc)(
 mdb_idl_keyfunc mdb_idl_insert_keys;
 mdb_idl_keyfunc mdb_idl_delete_keys;
 
+int mdb_idl_stats( MDB_txn *txn, struct mdb_info *mdb, AttrInfo *ai,
+	mdb_istat *st );
+int mdb_idl_stats_init( MDB_txn *txn, struct mdb_info *mdb, AttrInfo *ai,
+	int *partial );
+int mdb_idl_stats_scan( MDB_txn *txn, struct mdb_info *mdb, AttrInfo *ai,
+	int nkeys, int *done );
+int mdb_idl_truncate( MDB_txn *txn, struct mdb_info *mdb, AttrInfo *ai );
+int mdb_idl_stats_flush( MDB_txn *txn, struct mdb_info *mdb );
+
 int
 mdb_idl_intersection(
 	ID *a,
@@ -251,6 +276,7 @@ mdb_idl_union(
 
 ID mdb_idl_first( ID *ids, ID *cursor );
 ID mdb_idl_next( ID *ids, ID *cursor );
+ID *mdb_idl_pack( ID *ids, size_t *size );
 
 void mdb_idl_sort( ID *ids, ID *tmp );
 int mdb_idl_append( ID *a, ID *b );
@@ -276,6 +302,13 @@ mdb_index_param LDAP_P((
 	slap_mask_t *mask,
 	struct berval *prefix ));
 
+extern int
+mdb_okey LDAP_P((
+	AttributeDescription *ad,
+	struct berval *val,
+	char *buf,
+	MDB_val *key ));
+
 extern int
 mdb_index_values LDAP_P((
 	Operation *op,
@@ -323,6 +356,20 @@ mdb_key_read(
     MDB_cursor **saved_cursor,
         int get_flags );
 
+extern int
+mdb_key_seek(
+	Backend	*be,
+	MDB_cursor *cursor,
+	struct berval *k,
+	ID *ids );
+
+extern int
+mdb_key_count(
+	Backend	*be,
+	MDB_cursor *cursor,
+	struct berval *k,
+	ID *count );
+
 /*
  * nextid.c
  */
@@ -359,6 +406,12 @@ mdb_monitor_idx_add(
 	slap_mask_t		type );
 #endif /* MDB_MONITOR_IDX */
 
+/*
+ * search.c
+ */
+
+void mdb_paged_free( struct mdb_info *mdb, Connection *c );
+
 /*
  * former external.h
  */
@@ -396,6 +449,14 @@ extern BI_tool_entry_delete		mdb_tool_entry_delete;
 
 extern mdb_idl_keyfunc mdb_tool_idl_add;
 
+int mdb_tool_id2entry_put(
+	MDB_txn *txn,
+	MDB_cursor *mc,
+	MDB_dbi dbi,
+	MDB_val *key,
+	MDB_val *data,
+	int flag );
+
 LDAP_END_DECL
 
 #endif /* _PROTO_MDB_H */
@@ -36,12 +36,13 @@ static int search_candidates(
 	ID	*ids,
 	ID *stack );
 
-static int parse_paged_cookie( Operation *op, SlapReply *rs );
+static int parse_paged_cookie( Operation *op, SlapReply *rs, int sorted );
 
 static void send_paged_response( 
 	Operation *op,
 	SlapReply *rs,
 	ID  *lastid,
+	struct berval *pos,
 	int tentries );
 
 /* Dereference aliases for a single alias entry. Return the final
@@ -410,13 +411,1380 @@ mdb_waitfixup( Operation *op, ww_ctx *ww, MDB_cursor *mci, MDB_cursor *mcd, IdSc
 	return rc;
 }
 
+/* Partial decoding of candidates. A filter usually tests a few
+ * attributes, so a candidate is first decoded with those only, and
+ * with whatever the ACLs that test_filter consults may look at in the
+ * entry. If nothing but the frontend gets to see the entries sent, the
+ * requested attributes are enough for those too; otherwise an entry
+ * that matches is decoded again in full.
+ */
+typedef struct search_ads {
+	AttributeDescription **sa_ads;	/* NULL-terminated */
+	int sa_num;
+	int sa_max;
+} search_ads;
+
+static void
+search_ads_add( Operation *op, search_ads *sa, AttributeDescription *ad )
+{
+	int i;
+
+	for ( i = 0; i < sa->sa_num; i++ ) {
+		if ( sa->sa_ads[i] == ad )
+			return;
+	}
+	if ( sa->sa_num + 1 >= sa->sa_max ) {
+		sa->sa_max = sa->sa_max ? sa->sa_max * 2 : 16;
+		sa->sa_ads = op->o_tmprealloc( sa->sa_ads,
+			sa->sa_max * sizeof( AttributeDescription * ), op->o_tmpmemctx );
+	}
+	sa->sa_ads[sa->sa_num++] = ad;
+	sa->sa_ads[sa->sa_num] = NULL;
+}
+
+/* Add the attributes the filter f tests, return -1 if it may test any */
+static int
+search_filter_ads( Operation *op, Filter *f, search_ads *sa )
+{
+	for ( ; f; f = f->f_next ) {
+		switch ( f->f_choice & SLAPD_FILTER_MASK ) {
+		case LDAP_FILTER_AND:
+		case LDAP_FILTER_OR:
+		case LDAP_FILTER_NOT:
+			if ( search_filter_ads( op, f->f_list, sa ))
+				return -1;
+			break;
+		case LDAP_FILTER_EQUALITY:
+		case LDAP_FILTER_GE:
+		case LDAP_FILTER_LE:
+		case LDAP_FILTER_APPROX:
+			search_ads_add( op, sa, f->f_av_desc );
+			break;
+		case LDAP_FILTER_SUBSTRINGS:
+			search_ads_add( op, sa, f->f_sub_desc );
+			break;
+		case LDAP_FILTER_PRESENT:
+			search_ads_add( op, sa, f->f_desc );
+			break;
+		case LDAP_FILTER_EXT:
+			if ( !f->f_mr_desc || f->f_mr_dnattrs )
+				return -1;
+			search_ads_add( op, sa, f->f_mr_desc );
+			break;
+		case SLAPD_FILTER_COMPUTED:
+			break;
+		default:
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Add the attributes of the entry the ACLs may look at, return -1
+ * if they may look at any
+ */
+static int
+search_acl_ads( Operation *op, AccessControl *acl, search_ads *sa )
+{
+	Access *b;
+
+	for ( ; acl; acl = acl->acl_next ) {
+		if ( acl->acl_filter && search_filter_ads( op, acl->acl_filter, sa ))
+			return -1;
+		for ( b = acl->acl_access; b; b = b->a_next ) {
+			if ( !BER_BVISEMPTY( &b->a_set_pat ))
+				return -1;
+#ifdef SLAP_DYNACL
+			if ( b->a_dynacl )
+				return -1;
+#endif
+			if ( b->a_dn_at )
+				search_ads_add( op, sa, b->a_dn_at );
+			if ( b->a_realdn_at )
+				search_ads_add( op, sa, b->a_realdn_at );
+			/* the group may be the entry itself */
+			if ( b->a_group_at )
+				search_ads_add( op, sa, b->a_group_at );
+		}
+	}
+	return 0;
+}
+
+/* Select the attributes to decode for testing the filter, and for
+ * sending an entry. Either is NULL if entries must be decoded in full.
+ * The attribute the entries are sorted by is tested with the filter.
+ */
+static void
+search_attrsel( Operation *op, AttributeDescription *sortad,
+	mdb_attrsel **fsel, mdb_attrsel **ssel )
+{
+	search_ads sa = { NULL, 0, 0 };
+	AttributeName *an;
+	int nf;
+
+	*fsel = *ssel = NULL;
+	search_ads_add( op, &sa, slap_schema.si_ad_objectClass );
+	if ( sortad )
+		search_ads_add( op, &sa, sortad );
+	if ( search_filter_ads( op, op->ors_filter, &sa ))
+		goto done;
+	if ( !be_isroot( op ) &&
+		( search_acl_ads( op, op->o_bd->be_acl, &sa ) ||
+		search_acl_ads( op, frontendDB->be_acl, &sa )))
+		goto done;
+	*fsel = mdb_attrsel_new( op, sa.sa_ads );
+
+	/* callbacks may look at anything */
+	if ( op->o_callback || !op->ors_attrs )
+		goto done;
+	nf = sa.sa_num;
+	for ( an = op->ors_attrs; !BER_BVISNULL( &an->an_name ); an++ ) {
+		if ( an->an_desc ) {
+			search_ads_add( op, &sa, an->an_desc );
+		} else if ( an->an_oc || !bvmatch( &an->an_name, slap_bv_no_attrs )) {
+			/* all user or operational attributes, or an objectClass */
+			goto done;
+		}
+	}
+	*ssel = sa.sa_num == nf ? *fsel : mdb_attrsel_new( op, sa.sa_ads );
+
+done:
+	op->o_tmpfree( sa.sa_ads, op->o_tmpmemctx );
+}
+
+/* Replace the partial decode of an entry by the whole entry */
+static int
+search_entry_full( Operation *op, MDB_txn *txn, MDB_val *data, Entry **ep )
+{
+	Entry *e = *ep, *x;
+	int rc;
+
+	rc = mdb_entry_decode( op, txn, data, e->e_id, NULL, &x );
+	if ( rc )
+		return rc;
+	x->e_id = e->e_id;
+	x->e_name = e->e_name;
+	x->e_nname = e->e_nname;
+	op->o_tmpfree( e, op->o_tmpmemctx );
+	*ep = x;
+	return 0;
+}
+
+/* Server-side sorting from the order index. If the sort control has a
+ * single key, on an attribute indexed "order" whose ordering rule just
+ * compares the normalized values, the candidates are returned in the
+ * order of the ix2o keys of the attribute and the sssvlv overlay passes
+ * them on as they come, instead of holding all of them. An entry is
+ * listed under each of its values and returned under the least one.
+ * Entries without the attribute come last, or first in a reverse sort,
+ * as the overlay puts them; the search tells them by reading them. The
+ * IDs under a key cut to MDB_OKEY_MAX are sorted here by their whole
+ * values.
+ *
+ * A paged search ends its page on the entry the next one starts with,
+ * and adds where that entry is in the order to the cookie: the phase,
+ * then the key, then for a cut key the value. A VLV request walks the
+ * list twice, to count it and find the target, then to send the window
+ * around it. Nothing is kept between requests.
+ */
+typedef struct search_oval {
+	ID ov_id;
+	struct berval ov_val;
+} search_oval;
+
+typedef struct search_order {
+	MDB_cursor *so_mc;
+	AttributeDescription *so_ad;
+	mdb_attrsel *so_sel;	/* for reading the values of a cut key */
+	ID *so_cand;
+	int so_dir;		/* 1, or -1 in a reverse sort */
+	int so_phase;
+	int so_seek;	/* so_mc must be positioned again */
+	ID so_id;		/* last ID taken from so_key */
+	MDB_val so_key;	/* in so_kbuf */
+	char so_kbuf[MDB_OKEY_MAX];
+	ID so_ccursor;	/* in so_cand, for the entries without a value */
+	ID so_lo, so_hi;
+	unsigned char *so_seen;	/* candidates so_lo to so_hi found in the
+							 * index before the phase of SO_NULLS */
+	search_oval *so_grp;	/* candidates of a cut key, sorted */
+	int so_ngrp, so_igrp;
+} search_order;
+
+#define SO_KEYS		1	/* going through the index */
+#define SO_NULLS	2	/* going through the candidates not in it */
+
+/* The sort key if the candidates can be returned in its order, and
+ * the VLV request if there is one
+ */
+static sort_key *
+search_order_key( Operation *op, struct mdb_info *mdb, vlv_ctrl **vcp )
+{
+	sort_ctrl *sc;
+	sort_key *sk;
+	AttrInfo *ai;
+	int cid;
+
+	*vcp = NULL;
+	if ( !mdb->mi_ix2o || op->ors_scope == LDAP_SCOPE_BASE ||
+		get_pagedresults( op ) > SLAP_CONTROL_IGNORED ||
+		SLAP_GLUE_INSTANCE( op->o_bd ) || SLAP_GLUE_SUBORDINATE( op->o_bd ))
+		return NULL;
+	if ( slap_find_control_id( LDAP_CONTROL_SORTREQUEST, &cid ) ||
+		op->o_ctrlflag[cid] <= SLAP_CONTROL_IGNORED )
+		return NULL;
+	sc = op->o_controls[cid];
+	if ( !sc || sc->sc_backend != SLAP_SORT_OFFERED || sc->sc_nkeys != 1 )
+		return NULL;
+	sk = &sc->sc_keys[0];
+	if ( sk->sk_ordering->smr_match != octetStringOrderingMatch )
+		return NULL;
+	ai = mdb_attr_mask( mdb, sk->sk_ad );
+	if ( !ai || ai->ai_desc != sk->sk_ad ||
+		sk->sk_ad != sk->sk_ad->ad_type->sat_ad ||
+		( ai->ai_indexmask & MDB_INDEX_DELETING ) ||
+		!IS_SLAP_INDEX( ai->ai_indexmask, SLAP_INDEX_ORDER ) ||
+		sk->sk_ad->ad_type->sat_cname.bv_len + 1 >= MDB_OKEY_MAX )
+		return NULL;
+	sc->sc_backend = SLAP_SORT_BACKEND;
+	/* the overlay left the pages to us */
+	if ( sc->sc_paged > SLAP_CONTROL_IGNORED )
+		op->o_pagedresults = sc->sc_paged;
+	if ( !slap_find_control_id( LDAP_CONTROL_VLVREQUEST, &cid ) &&
+		op->o_ctrlflag[cid] > SLAP_CONTROL_IGNORED )
+		*vcp = op->o_controls[cid];
+	return sk;
+}
+
+static int
+search_cand_has( ID *ids, ID id )
+{
+	unsigned i;
+
+	if ( MDB_IDL_IS_RANGE( ids ))
+		return id >= MDB_IDL_RANGE_FIRST( ids ) &&
+			id <= MDB_IDL_RANGE_LAST( ids );
+	if ( MDB_IDL_IS_BITMAP( ids ))
+		return mdb_idl_bm_has( ids, id );
+	i = mdb_idl_search( ids, id );
+	return i <= ids[0] && ids[i] == id;
+}
+
+/* Whether key is one of the attribute's */
+static int
+search_order_mine( search_order *so, MDB_val *key )
+{
+	ber_len_t len = so->so_ad->ad_type->sat_cname.bv_len + 1;
+
+	return key->mv_size >= len && !memcmp( key->mv_data, so->so_kbuf, len );
+}
+
+static void
+search_order_seen( search_order *so, ID id )
+{
+	if ( id >= so->so_lo && id <= so->so_hi ) {
+		id -= so->so_lo;
+		so->so_seen[id >> 3] |= 1 << ( id & 7 );
+	}
+}
+
+static int
+search_order_was_seen( search_order *so, ID id )
+{
+	if ( id < so->so_lo || id > so->so_hi )
+		return 0;
+	id -= so->so_lo;
+	return so->so_seen[id >> 3] & ( 1 << ( id & 7 ));
+}
+
+/* Position so_mc on the first ID of the last key. MDB_LAST leaves it
+ * at the end, where MDB_NEXT_DUP would find nothing more.
+ */
+static int
+search_order_last( search_order *so, MDB_val *key, MDB_val *data )
+{
+	int rc;
+
+	rc = mdb_cursor_get( so->so_mc, key, data, MDB_LAST );
+	if ( rc == 0 )
+		rc = mdb_cursor_get( so->so_mc, key, data, MDB_SET );
+	return rc;
+}
+
+/* Position so_mc on the first ID of the next key of the attribute in
+ * the order of the sort, or of its first key
+ */
+static int
+search_order_nextkey( search_order *so, int first, MDB_val *key, MDB_val *data )
+{
+	int rc;
+
+	if ( first ) {
+		key->mv_data = so->so_kbuf;
+		key->mv_size = so->so_ad->ad_type->sat_cname.bv_len + 1;
+		if ( so->so_dir > 0 )
+			return mdb_cursor_get( so->so_mc, key, data, MDB_SET_RANGE );
+		/* the last key of the attribute is before the first one
+		 * of the next name
+		 */
+		so->so_kbuf[key->mv_size - 1] = '\001';
+		rc = mdb_cursor_get( so->so_mc, key, data, MDB_SET_RANGE );
+		so->so_kbuf[so->so_ad->ad_type->sat_cname.bv_len] = '\0';
+		if ( rc == MDB_NOTFOUND )
+			return search_order_last( so, key, data );
+		if ( rc == 0 )
+			rc = mdb_cursor_get( so->so_mc, key, data, MDB_PREV_NODUP );
+	} else if ( so->so_dir > 0 ) {
+		return mdb_cursor_get( so->so_mc, key, data, MDB_NEXT_NODUP );
+	} else {
+		rc = mdb_cursor_get( so->so_mc, key, data, MDB_PREV_NODUP );
+	}
+	if ( rc == 0 )
+		rc = mdb_cursor_get( so->so_mc, key, data, MDB_FIRST_DUP );
+	return rc;
+}
+
+/* Put so_mc back after (so_key, so_id), the txn may have been reset */
+static int
+search_order_seek( search_order *so, MDB_val *key, MDB_val *data )
+{
+	ID id = so->so_id + 1;
+	int rc;
+
+	*key = so->so_key;
+	data->mv_data = &id;
+	data->mv_size = sizeof(ID);
+	rc = mdb_cursor_get( so->so_mc, key, data, MDB_GET_BOTH_RANGE );
+	if ( rc != MDB_NOTFOUND )
+		return rc;
+	*key = so->so_key;
+	rc = mdb_cursor_get( so->so_mc, key, data, MDB_SET_RANGE );
+	if ( rc == MDB_NOTFOUND ) {
+		if ( so->so_dir > 0 )
+			return rc;
+		return search_order_last( so, key, data );
+	}
+	/* past the key, or on the next one if it is gone */
+	if ( rc == 0 && ( so->so_dir < 0 ||
+		( key->mv_size == so->so_key.mv_size &&
+		!memcmp( key->mv_data, so->so_key.mv_data, key->mv_size ))))
+		rc = search_order_nextkey( so, 0, key, data );
+	return rc;
+}
+
+static int
+search_oval_cmp( const void *a, const void *b )
+{
+	const search_oval *x = a, *y = b;
+	int rc;
+
+	octetStringOrderingMatch( &rc, 0, NULL, NULL,
+		(struct berval *)&x->ov_val, (void *)&y->ov_val );
+	if ( rc == 0 )
+		rc = x->ov_id < y->ov_id ? -1 : x->ov_id > y->ov_id;
+	return rc;
+}
+
+/* Same for a reverse sort, the IDs of a value still go up */
+static int
+search_oval_rcmp( const void *a, const void *b )
+{
+	const search_oval *x = a, *y = b;
+	int rc;
+
+	octetStringOrderingMatch( &rc, 0, NULL, NULL,
+		(struct berval *)&y->ov_val, (void *)&x->ov_val );
+	if ( rc == 0 )
+		rc = x->ov_id < y->ov_id ? -1 : x->ov_id > y->ov_id;
+	return rc;
+}
+
+static void
+search_order_grpfree( search_order *so )
+{
+	int i;
+
+	for ( i = 0; i < so->so_ngrp; i++ )
+		ch_free( so->so_grp[i].ov_val.bv_val );
+	ch_free( so->so_grp );
+	so->so_grp = NULL;
+	so->so_ngrp = so->so_igrp = 0;
+}
+
+/* The least value of the sort attribute in e, or NULL */
+static struct berval *
+search_order_least( AttributeDescription *ad, Entry *e )
+{
+	Attribute *a = attr_find( e->e_attrs, ad );
+	struct berval *bv;
+	unsigned i;
+	int rc;
+
+	if ( !a )
+		return NULL;
+	bv = a->a_nvals;
+	for ( i = 1; i < a->a_numvals; i++ ) {
+		octetStringOrderingMatch( &rc, 0, NULL, NULL, bv, &a->a_nvals[i] );
+		if ( rc > 0 )
+			bv = &a->a_nvals[i];
+	}
+	return bv;
+}
+
+/* Read the sort values of candidate id, *ep is NULL if it is gone */
+static int
+search_order_fetch( Operation *op, search_order *so, MDB_cursor *mci,
+	ID id, Entry **ep )
+{
+	MDB_val edata;
+	int rc;
+
+	*ep = NULL;
+	rc = mdb_id2edata( op, mci, id, &edata );
+	if ( rc == MDB_NOTFOUND )
+		return 0;
+	if ( rc == 0 )
+		rc = mdb_entry_decode( op, mdb_cursor_txn( so->so_mc ), &edata,
+			id, so->so_sel, ep );
+	if ( rc == 0 ) {
+		(*ep)->e_id = id;
+		BER_BVZERO( &(*ep)->e_name );
+		BER_BVZERO( &(*ep)->e_nname );
+	}
+	return rc;
+}
+
+/* Whether a value of the sort attribute in e has the cut key. Deleting
+ * a value leaves its ID under a cut key another value may share, so
+ * the ID alone doesn't tell.
+ */
+static int
+search_order_holds( search_order *so, Entry *e, MDB_val *key )
+{
+	Attribute *a = attr_find( e->e_attrs, so->so_ad );
+	char kbuf[MDB_OKEY_MAX];
+	MDB_val k;
+	unsigned i;
+
+	if ( !a )
+		return 0;
+	for ( i = 0; i < a->a_numvals; i++ ) {
+		mdb_okey( so->so_ad, &a->a_nvals[i], kbuf, &k );
+		if ( k.mv_size == key->mv_size &&
+			!memcmp( kbuf, key->mv_data, k.mv_size ))
+			return 1;
+	}
+	return 0;
+}
+
+/* Sort the candidates under the cut key at so_mc by their values */
+static int
+search_order_group( Operation *op, search_order *so, MDB_cursor *mci,
+	MDB_val *key, MDB_val *data )
+{
+	ID id;
+	int rc, max = 0;
+
+	do {
+		MDB_val k;
+		Entry *e;
+		struct berval *bv;
+		char kbuf[MDB_OKEY_MAX];
+
+		memcpy( &id, data->mv_data, sizeof(ID) );
+		so->so_id = id;
+		if ( !search_cand_has( so->so_cand, id ))
+			continue;
+		rc = search_order_fetch( op, so, mci, id, &e );
+		if ( rc )
+			return rc;
+		if ( !e )
+			continue;
+		if ( search_order_holds( so, e, &so->so_key ))
+			search_order_seen( so, id );
+		/* only under the key of its least value */
+		bv = search_order_least( so->so_ad, e );
+		if ( bv ) {
+			mdb_okey( so->so_ad, bv, kbuf, &k );
+			if ( k.mv_size == so->so_key.mv_size &&
+				!memcmp( kbuf, so->so_kbuf, k.mv_size )) {
+				if ( so->so_ngrp == max ) {
+					max = max ? max * 2 : 64;
+					so->so_grp = ch_realloc( so->so_grp,
+						max * sizeof( search_oval ));
+				}
+				so->so_grp[so->so_ngrp].ov_id = id;
+				ber_dupbv( &so->so_grp[so->so_ngrp].ov_val, bv );
+				so->so_ngrp++;
+			}
+		}
+		mdb_entry_return( op, e );
+	} while (( rc = mdb_cursor_get( so->so_mc, key, data, MDB_NEXT_DUP )) == 0 );
+	if ( rc != MDB_NOTFOUND )
+		return rc;
+
+	if ( so->so_ngrp > 1 )
+		qsort( so->so_grp, so->so_ngrp, sizeof( search_oval ),
+			so->so_dir > 0 ? search_oval_cmp : search_oval_rcmp );
+	so->so_igrp = 0;
+	/* so_mc is past the key */
+	so->so_seek = 1;
+	return 0;
+}
+
+/* The next candidate that may lack a value, from so_ccursor on if
+ * first
+ */
+static ID
+search_order_nulls( search_order *so, int first )
+{
+	ID id;
+
+	if ( first ) {
+		so->so_phase = SO_NULLS;
+		id = mdb_idl_first( so->so_cand, &so->so_ccursor );
+	} else {
+		id = mdb_idl_next( so->so_cand, &so->so_ccursor );
+	}
+	while ( id != NOID && id <= so->so_hi && search_order_was_seen( so, id ))
+		id = mdb_idl_next( so->so_cand, &so->so_ccursor );
+	if ( id > so->so_hi )
+		id = NOID;
+	return id;
+}
+
+/* The next candidate in the order of the sort, or NOID */
+static ID
+search_order_next( Operation *op, search_order *so, MDB_cursor *mci )
+{
+	MDB_val key, data;
+	ID id;
+	int rc;
+
+	if ( so->so_phase == SO_NULLS ) {
+		id = search_order_nulls( so, 0 );
+		if ( id == NOID && so->so_dir < 0 ) {
+			so->so_phase = SO_KEYS;
+			so->so_id = NOID;
+		} else {
+			return id;
+		}
+	}
+
+	for (;;) {
+		if ( so->so_igrp < so->so_ngrp )
+			return so->so_grp[so->so_igrp++].ov_id;
+		if ( so->so_ngrp )
+			search_order_grpfree( so );
+
+		if ( so->so_id == NOID ) {
+			rc = search_order_nextkey( so, 1, &key, &data );
+		} else if ( so->so_seek ) {
+			so->so_seek = 0;
+			rc = search_order_seek( so, &key, &data );
+		} else {
+			rc = mdb_cursor_get( so->so_mc, &key, &data, MDB_NEXT_DUP );
+			if ( rc == MDB_NOTFOUND )
+				rc = search_order_nextkey( so, 0, &key, &data );
+		}
+		if ( rc == 0 && !search_order_mine( so, &key ))
+			rc = MDB_NOTFOUND;
+		if ( rc ) {
+			/* the end of the index */
+			if ( so->so_dir > 0 && rc == MDB_NOTFOUND ) {
+				so->so_ccursor = 0;
+				return search_order_nulls( so, 1 );
+			}
+			return NOID;
+		}
+
+		if ( key.mv_data != so->so_kbuf ) {
+			memcpy( so->so_kbuf, key.mv_data, key.mv_size );
+			so->so_key.mv_size = key.mv_size;
+		}
+		memcpy( &id, data.mv_data, sizeof(ID) );
+		so->so_id = id;
+		if ( key.mv_size == MDB_OKEY_MAX ) {
+			if ( search_order_group( op, so, mci, &key, &data ))
+				return NOID;
+			continue;
+		}
+		if ( search_cand_has( so->so_cand, id )) {
+			search_order_seen( so, id );
+			return id;
+		}
+	}
+}
+
+/* Whether e is returned where the sort is at */
+static int
+search_order_placed( search_order *so, Entry *e )
+{
+	struct berval *bv = search_order_least( so->so_ad, e );
+	char kbuf[MDB_OKEY_MAX];
+	MDB_val k;
+
+	if ( so->so_phase == SO_NULLS )
+		return bv == NULL;
+	if ( !bv )
+		return 0;
+	mdb_okey( so->so_ad, bv, kbuf, &k );
+	return k.mv_size == so->so_key.mv_size &&
+		!memcmp( kbuf, so->so_kbuf, k.mv_size );
+}
+
+/* Where the sort is at with candidate id of e, for the cookie of a
+ * paged search
+ */
+static void
+search_order_pos( Operation *op, search_order *so, Entry *e,
+	struct berval *pos )
+{
+	struct berval *bv = NULL;
+	char *ptr;
+
+	pos->bv_len = 1;
+	if ( so->so_phase == SO_KEYS ) {
+		pos->bv_len += so->so_key.mv_size;
+		if ( so->so_key.mv_size == MDB_OKEY_MAX ) {
+			bv = search_order_least( so->so_ad, e );
+			pos->bv_len += bv->bv_len;
+		}
+	}
+	ptr = pos->bv_val = op->o_tmpalloc( pos->bv_len, op->o_tmpmemctx );
+	*ptr++ = so->so_phase;
+	if ( so->so_phase == SO_KEYS ) {
+		AC_MEMCPY( ptr, so->so_kbuf, so->so_key.mv_size );
+		ptr += so->so_key.mv_size;
+		if ( bv )
+			AC_MEMCPY( ptr, bv->bv_val, bv->bv_len );
+	}
+}
+
+/* Go on from candidate id at pos, the cookie of the previous page.
+ * The entries may have changed since, they are checked again like
+ * any other.
+ */
+static ID
+search_order_resume( Operation *op, search_order *so, MDB_cursor *mci,
+	struct berval *pos, ID id )
+{
+	MDB_val key, data;
+	search_oval ov;
+	int rc;
+
+	if ( pos->bv_len == 1 && pos->bv_val[0] == SO_NULLS ) {
+		so->so_ccursor = id;
+		return search_order_nulls( so, 1 );
+	}
+	if ( pos->bv_len < 2 || pos->bv_val[0] != SO_KEYS )
+		return NOID;
+	so->so_phase = SO_KEYS;
+	so->so_key.mv_size = pos->bv_len - 1;
+	if ( so->so_key.mv_size > MDB_OKEY_MAX )
+		so->so_key.mv_size = MDB_OKEY_MAX;
+	AC_MEMCPY( so->so_kbuf, pos->bv_val + 1, so->so_key.mv_size );
+	if ( !search_order_mine( so, &so->so_key ))
+		return NOID;
+	/* a key that isn't cut goes on from the ID */
+	so->so_id = id - 1;
+	so->so_seek = 1;
+	if ( so->so_key.mv_size < MDB_OKEY_MAX )
+		return search_order_next( op, so, mci );
+
+	/* a cut key from its value and the ID, if it is still there */
+	key = so->so_key;
+	rc = mdb_cursor_get( so->so_mc, &key, &data, MDB_SET );
+	if ( rc == MDB_NOTFOUND )
+		return search_order_next( op, so, mci );
+	if ( rc || search_order_group( op, so, mci, &key, &data ))
+		return NOID;
+	ov.ov_id = id;
+	ov.ov_val.bv_val = pos->bv_val + 1 + MDB_OKEY_MAX;
+	ov.ov_val.bv_len = pos->bv_len - 1 - MDB_OKEY_MAX;
+	while ( so->so_igrp < so->so_ngrp &&
+		( so->so_dir > 0 ? search_oval_cmp : search_oval_rcmp )(
+		&so->so_grp[so->so_igrp], &ov ) < 0 )
+		so->so_igrp++;
+	return search_order_next( op, so, mci );
+}
+
+/* Set up the sort, return the first candidate in its order, or the
+ * one at pos if the search goes on from there
+ */
+static ID
+search_order_begin( Operation *op, search_order *so, sort_key *sk,
+	MDB_txn *txn, MDB_cursor *mci, ID *ids, mdb_attrsel *sel,
+	struct berval *pos, ID start )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	MDB_val key;
+	ID cursor = 0;
+
+	memset( so, 0, sizeof( search_order ));
+	so->so_ad = sk->sk_ad;
+	so->so_dir = sk->sk_direction;
+	so->so_sel = sel;
+	so->so_cand = ids;
+	so->so_id = NOID;
+	so->so_key.mv_data = so->so_kbuf;
+	memcpy( so->so_kbuf, so->so_ad->ad_type->sat_cname.bv_val, so->so_ad->ad_type->sat_cname.bv_len );
+	so->so_kbuf[so->so_ad->ad_type->sat_cname.bv_len] = '\0';
+	so->so_lo = mdb_idl_first( ids, &cursor );
+	if ( mdb_cursor_get( mci, &key, NULL, MDB_LAST ))
+		return NOID;
+	memcpy( &so->so_hi, key.mv_data, sizeof(ID) );
+	if ( so->so_lo > so->so_hi )
+		return NOID;
+	if ( mdb_cursor_open( txn, mdb->mi_ix2o, &so->so_mc ))
+		return NOID;
+	so->so_seen = ch_calloc( 1, ( so->so_hi - so->so_lo ) / 8 + 1 );
+
+	if ( pos )
+		return search_order_resume( op, so, mci, pos, start );
+	/* with nothing seen yet, all the candidates are read and the ones
+	 * with a value skipped
+	 */
+	if ( so->so_dir < 0 ) {
+		ID id = search_order_nulls( so, 1 );
+		if ( id != NOID )
+			return id;
+	}
+	so->so_phase = SO_KEYS;
+	so->so_id = NOID;
+	return search_order_next( op, so, mci );
+}
+
+static void
+search_order_end( search_order *so )
+{
+	if ( so->so_mc )
+		mdb_cursor_close( so->so_mc );
+	search_order_grpfree( so );
+	ch_free( so->so_seen );
+}
+
+/* A VLV request on the order index. The window is placed as the
+ * sssvlv overlay places it in its list.
+ */
+typedef struct search_vlv {
+	vlv_ctrl *sv_vc;
+	int sv_pass;	/* 1 counts the list, 2 sends the window */
+	int sv_n;		/* entries of the list so far */
+	int sv_target;	/* first entry not before sv_value */
+	int sv_first, sv_last;	/* the window */
+	struct berval sv_value;	/* normalized, if by value */
+} search_vlv;
+
+static int
+search_vlv_begin( Operation *op, search_vlv *sv, vlv_ctrl *vc, sort_key *sk )
+{
+	MatchingRule *mr = sk->sk_ordering;
+
+	memset( sv, 0, sizeof( search_vlv ));
+	sv->sv_vc = vc;
+	sv->sv_pass = 1;
+	if ( BER_BVISNULL( &vc->vc_value ))
+		return LDAP_SUCCESS;
+	if ( !mr->smr_normalize ) {
+		ber_dupbv_x( &sv->sv_value, &vc->vc_value, op->o_tmpmemctx );
+		return LDAP_SUCCESS;
+	}
+	return mr->smr_normalize( SLAP_MR_VALUE_OF_SYNTAX, mr->smr_syntax,
+		mr, &vc->vc_value, &sv->sv_value, op->o_tmpmemctx );
+}
+
+/* Entry e of the list: 0 if it is sent, 1 if not, -1 once the window
+ * has been sent
+ */
+static int
+search_vlv_entry( search_vlv *sv, search_order *so, Entry *e )
+{
+	int rc;
+
+	sv->sv_n++;
+	if ( sv->sv_pass == 2 ) {
+		if ( sv->sv_n > sv->sv_last )
+			return -1;
+		return sv->sv_n < sv->sv_first;
+	}
+	if ( sv->sv_target || BER_BVISNULL( &sv->sv_value ))
+		return 1;
+	/* entries without a value come after the value, or before it in
+	 * a reverse sort
+	 */
+	if ( so->so_phase == SO_NULLS ) {
+		rc = so->so_dir;
+	} else {
+		octetStringOrderingMatch( &rc, 0, NULL, NULL,
+			search_order_least( so->so_ad, e ), &sv->sv_value );
+		rc *= so->so_dir;
+	}
+	if ( rc >= 0 )
+		sv->sv_target = sv->sv_n;
+	return 1;
+}
+
+/* Place the window once the list is counted */
+static int
+search_vlv_window( search_vlv *sv )
+{
+	vlv_ctrl *vc = sv->sv_vc;
+	int n = sv->sv_n, target;
+
+	vc->vc_size = n;
+	sv->sv_pass = 2;
+	sv->sv_n = 0;
+	if ( !n )
+		return LDAP_SUCCESS;
+	if ( !BER_BVISNULL( &vc->vc_value )) {
+		target = sv->sv_target ? sv->sv_target : n + 1;
+	} else if ( vc->vc_offset == vc->vc_count ) {
+		target = n;
+	} else if ( vc->vc_offset == 1 ) {
+		target = 1;
+	} else if ( vc->vc_count && vc->vc_count != n ) {
+		if ( vc->vc_offset > vc->vc_count )
+			return LDAP_VLV_RANGE_ERROR;
+		target = n * vc->vc_offset / vc->vc_count;
+	} else {
+		if ( vc->vc_offset > n )
+			return LDAP_VLV_RANGE_ERROR;
+		target = vc->vc_offset;
+	}
+	vc->vc_target = target;
+	if ( target > n ) {
+		/* nothing is after the value, the last ones are sent */
+		sv->sv_first = n - ( vc->vc_before ? vc->vc_before : 1 ) + 1;
+		sv->sv_last = n;
+	} else {
+		if ( target < 1 )
+			target = 1;
+		sv->sv_first = target - vc->vc_before;
+		sv->sv_last = target + vc->vc_after;
+	}
+	if ( sv->sv_first < 1 )
+		sv->sv_first = 1;
+	return LDAP_SUCCESS;
+}
+
+/* Parallel evaluation of candidates, see "searchthreads".
+ * The candidates are taken a window at a time. The window is cut in
+ * chunks, which the searching thread and helpers from the connection
+ * pool evaluate: a helper reads the entries in its own read txn on
+ * the snapshot of the search, checks their scope and the filter, and
+ * keeps in place the IDs that may be returned. The search then goes
+ * through the kept IDs in order like through any candidate list, and
+ * checks them again. Windows start small and double, so a search that
+ * stops early does little more work than it used to.
+ */
+#define PS_CHUNK	256
+#define PS_WINMAX	MDB_IDL_DB_SIZE
+#define PS_NCHUNKS	(PS_WINMAX / PS_CHUNK)
+
+typedef struct mdb_psearch {
+	Operation *ps_op;
+	struct mdb_info *ps_mdb;
+	MDB_txn *ps_txn;	/* txn of the search, for the snapshot */
+	struct berval ps_base;	/* normalized DN of the base */
+	ID *ps_cand;		/* candidates */
+	ID ps_ccursor;
+	ID ps_cid;		/* next candidate, or NOID */
+	ID ps_clast;	/* last ID in id2entry */
+	ID *ps_win;		/* IDs of the window, then the ones kept */
+	ID ps_wsize;	/* size of the next window */
+	ID ps_wn;		/* IDs kept */
+	ID ps_wpos;
+	time_t ps_stoptime;
+	MDB_cursor *ps_mcd;	/* dn2id cursor of the searching thread */
+	int ps_nchunks;	/* chunks of the window */
+	int ps_next;	/* next chunk to evaluate */
+	int ps_busy;	/* chunks being evaluated by helpers */
+	int ps_helpers;	/* helper tasks not finished yet */
+	int ps_chunks;	/* chunks of all windows */
+	int ps_hchunks;	/* of them evaluated by helpers */
+	int ps_refs;
+	mdb_attrsel *ps_sel;	/* attributes for testing the filter */
+	ID ps_kept[PS_NCHUNKS];	/* IDs kept of each chunk */
+	ldap_pvt_thread_mutex_t ps_mutex;
+	ldap_pvt_thread_cond_t ps_cond;
+} mdb_psearch;
+
+/* Whether the entry of id may be returned by the search */
+static int
+psearch_test( Operation *op, mdb_psearch *ps, MDB_txn *txn, MDB_cursor *mci,
+	MDB_cursor **mcd, ID id )
+{
+	struct berval name, nname;
+	MDB_val edata;
+	Entry *e;
+	int rc;
+
+	rc = mdb_id2name( op, txn, mcd, id, &name, &nname );
+	if ( rc )
+		return rc != MDB_NOTFOUND;
+
+	if ( dnIsSuffixScope( &nname, &ps->ps_base, op->ors_scope )) {
+		rc = mdb_id2edata( op, mci, id, &edata );
+		if ( rc == MDB_SUCCESS )
+			rc = mdb_entry_decode( op, txn, &edata, id, ps->ps_sel, &e );
+		if ( rc == MDB_SUCCESS ) {
+			e->e_name = name;
+			e->e_nname = nname;
+			/* referrals are returned whatever the filter */
+			rc = ( !get_manageDSAit( op ) && is_entry_referral( e )) ||
+				test_filter( op, e, op->ors_filter ) == LDAP_COMPARE_TRUE;
+			mdb_entry_return( op, e );
+			return rc;
+		}
+		rc = rc != MDB_NOTFOUND;
+	}
+	op->o_tmpfree( nname.bv_val, op->o_tmpmemctx );
+	op->o_tmpfree( name.bv_val, op->o_tmpmemctx );
+	return rc;
+}
+
+/* Evaluate chunk k of the window, return the number of IDs kept */
+static ID
+psearch_chunk( Operation *op, mdb_psearch *ps, MDB_txn *txn, MDB_cursor *mci,
+	MDB_cursor **mcd, int k )
+{
+	ID *ids = ps->ps_win + k * PS_CHUNK;
+	ID i, n, kept = 0;
+
+	n = ps->ps_wn - k * PS_CHUNK;
+	if ( n > PS_CHUNK )
+		n = PS_CHUNK;
+	if ( op->ors_tlimit != SLAP_NO_LIMIT &&
+		slap_get_time() > ps->ps_stoptime )
+		return n;
+	for ( i = 0; i < n; i++ ) {
+		/* keep the rest, the search will notice */
+		if ( ps->ps_op->o_abandon || slapd_shutdown ) {
+			for ( ; i < n; i++ )
+				ids[kept++] = ids[i];
+			break;
+		}
+		if ( psearch_test( op, ps, txn, mci, mcd, ids[i] ))
+			ids[kept++] = ids[i];
+	}
+	return kept;
+}
+
+static void
+psearch_release( mdb_psearch *ps )
+{
+	int refs;
+
+	ldap_pvt_thread_mutex_lock( &ps->ps_mutex );
+	refs = --ps->ps_refs;
+	ldap_pvt_thread_mutex_unlock( &ps->ps_mutex );
+	if ( refs )
+		return;
+	ldap_pvt_thread_cond_destroy( &ps->ps_cond );
+	ldap_pvt_thread_mutex_destroy( &ps->ps_mutex );
+	ch_free( ps->ps_win );
+	ch_free( ps );
+}
+
+/* A helper: evaluate chunks of the window until there are none left.
+ * It only looks at the search while it holds a chunk, so the search
+ * and its txn are still there.
+ */
+static void *
+psearch_task( void *ctx, void *arg )
+{
+	mdb_psearch *ps = arg;
+	Operation op2;
+	Opheader oh;
+	mdb_op_info opinfo = {{{0}}};
+	MDB_txn *txn = NULL;
+	MDB_cursor *mci = NULL, *mcd = NULL;
+	ID n;
+	int k, rc;
+
+	ldap_pvt_thread_mutex_lock( &ps->ps_mutex );
+	while ( ps->ps_next < ps->ps_nchunks ) {
+		k = ps->ps_next++;
+		ps->ps_busy++;
+		if ( !txn ) {
+			op2 = *ps->ps_op;
+			oh = *ps->ps_op->o_hdr;
+			oh.oh_threadctx = ctx;
+			oh.oh_tmpmemctx = slap_sl_mem_create( SLAP_SLAB_SIZE,
+				SLAP_SLAB_STACK, ctx, 1 );
+			oh.oh_tmpmfuncs = &slap_sl_mfuncs;
+			op2.o_hdr = &oh;
+			op2.o_callback = NULL;
+			/* entries fetched by ACLs come from our txn too */
+			LDAP_SLIST_INIT( &op2.o_extra );
+			opinfo.moi_oe.oe_key = ps->ps_mdb;
+			opinfo.moi_flag = MOI_READER;
+			opinfo.moi_ref = 1;
+			LDAP_SLIST_INSERT_HEAD( &op2.o_extra, &opinfo.moi_oe, oe_next );
+		}
+		/* the search may have renewed its txn since the last window */
+		if ( txn && mdb_txn_id( txn ) != mdb_txn_id( ps->ps_txn )) {
+			mdb_cursor_close( mci );
+			if ( mcd )
+				mdb_cursor_close( mcd );
+			mci = mcd = NULL;
+			mdb_txn_abort( txn );
+			txn = NULL;
+		}
+		rc = 0;
+		if ( !txn ) {
+			rc = mdb_txn_begin( ps->ps_mdb->mi_dbenv, ps->ps_txn,
+				MDB_RDONLY, &txn );
+			if ( rc == 0 ) {
+				rc = mdb_cursor_open( txn, ps->ps_mdb->mi_id2entry, &mci );
+				if ( rc ) {
+					mdb_txn_abort( txn );
+					txn = NULL;
+				}
+			}
+			opinfo.moi_txn = txn;
+		}
+		ldap_pvt_thread_mutex_unlock( &ps->ps_mutex );
+
+		if ( rc ) {
+			Debug( LDAP_DEBUG_ANY, "mdb_search: helper cannot read "
+				"the snapshot: %s (%d)\n", mdb_strerror( rc ), rc, 0 );
+			/* the chunk is kept as it is */
+			n = ps->ps_wn - k * PS_CHUNK;
+			if ( n > PS_CHUNK )
+				n = PS_CHUNK;
+		} else {
+			n = psearch_chunk( &op2, ps, txn, mci, &mcd, k );
+		}
+
+		ldap_pvt_thread_mutex_lock( &ps->ps_mutex );
+		ps->ps_kept[k] = n;
+		ps->ps_hchunks++;
+		if ( !--ps->ps_busy )
+			ldap_pvt_thread_cond_signal( &ps->ps_cond );
+		if ( rc )
+			break;
+	}
+	ps->ps_helpers--;
+	ldap_pvt_thread_mutex_unlock( &ps->ps_mutex );
+
+	if ( txn ) {
+		mdb_cursor_close( mci );
+		if ( mcd )
+			mdb_cursor_close( mcd );
+		mdb_txn_abort( txn );
+	}
+	psearch_release( ps );
+	return NULL;
+}
+
+/* Evaluate the next window of candidates. Return the number of IDs
+ * kept, or 0 when there are no candidates left.
+ */
+static ID
+psearch_window( Operation *op, mdb_psearch *ps, MDB_cursor *mci )
+{
+	ID n, kept;
+	int i, k, want;
+
+	do {
+		for ( n = 0; n < ps->ps_wsize &&
+			ps->ps_cid != NOID && ps->ps_cid <= ps->ps_clast; n++ ) {
+			ps->ps_win[n] = ps->ps_cid;
+			ps->ps_cid = mdb_idl_next( ps->ps_cand, &ps->ps_ccursor );
+		}
+		if ( !n )
+			return 0;
+		if ( ps->ps_wsize < PS_WINMAX )
+			ps->ps_wsize <<= 1;
+
+		ldap_pvt_thread_mutex_lock( &ps->ps_mutex );
+		ps->ps_wn = n;
+		ps->ps_next = 0;
+		ps->ps_nchunks = ( n + PS_CHUNK - 1 ) / PS_CHUNK;
+		ps->ps_chunks += ps->ps_nchunks;
+		/* one helper for each chunk we don't evaluate ourselves */
+		want = ps->ps_mdb->mi_search_threads - 1;
+		if ( want > ps->ps_nchunks - 1 )
+			want = ps->ps_nchunks - 1;
+		for ( i = ps->ps_helpers; i < want; i++ ) {
+			if ( ldap_pvt_thread_pool_submit( &connection_pool,
+				psearch_task, ps ))
+				break;
+			ps->ps_helpers++;
+			ps->ps_refs++;
+		}
+		while ( ps->ps_next < ps->ps_nchunks ) {
+			k = ps->ps_next++;
+			ldap_pvt_thread_mutex_unlock( &ps->ps_mutex );
+			ps->ps_kept[k] = psearch_chunk( op, ps, ps->ps_txn, mci,
+				&ps->ps_mcd, k );
+			ldap_pvt_thread_mutex_lock( &ps->ps_mutex );
+		}
+		while ( ps->ps_busy )
+			ldap_pvt_thread_cond_wait( &ps->ps_cond, &ps->ps_mutex );
+		ps->ps_nchunks = 0;
+		ldap_pvt_thread_mutex_unlock( &ps->ps_mutex );
+
+		kept = ps->ps_kept[0];
+		for ( k = 1; k * PS_CHUNK < n; k++ ) {
+			AC_MEMCPY( ps->ps_win + kept, ps->ps_win + k * PS_CHUNK,
+				ps->ps_kept[k] * sizeof(ID) );
+			kept += ps->ps_kept[k];
+		}
+	} while ( !kept );
+
+	ps->ps_wn = kept;
+	ps->ps_wpos = 0;
+	return kept;
+}
+
+/* The next ID to look at, or NOID */
+static ID
+mdb_psearch_next( Operation *op, mdb_psearch *ps, MDB_cursor *mci )
+{
+	if ( ps->ps_wpos >= ps->ps_wn &&
+		!psearch_window( op, ps, mci ))
+		return NOID;
+	return ps->ps_win[ps->ps_wpos++];
+}
+
+/* Set up the evaluation of the candidates from ID start on, or return
+ * NULL if the search is better off on its own.
+ */
+static mdb_psearch *
+mdb_psearch_begin( Operation *op, MDB_txn *txn, MDB_cursor *mci,
+	Entry *base, ID *ids, ID start, time_t stoptime, mdb_attrsel *sel )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	mdb_psearch *ps;
+	MDB_val key;
+	ID last;
+
+	/* A size limit might stop the search well before the end */
+	if ( op->ors_slimit != SLAP_NO_LIMIT &&
+		!( get_pagedresults( op ) > SLAP_CONTROL_IGNORED ) &&
+		(unsigned) op->ors_slimit < MDB_IDL_N( ids ))
+		return NULL;
+
+	if ( mdb_cursor_get( mci, &key, NULL, MDB_LAST ))
+		return NULL;
+	memcpy( &last, key.mv_data, sizeof(ID) );
+
+	ps = ch_calloc( 1, sizeof( mdb_psearch ));
+	ps->ps_win = ch_malloc( PS_WINMAX * sizeof( ID ));
+	ps->ps_op = op;
+	ps->ps_mdb = mdb;
+	ps->ps_txn = txn;
+	ps->ps_base = base->e_nname;
+	ps->ps_cand = ids;
+	ps->ps_ccursor = start;
+	ps->ps_cid = mdb_idl_first( ids, &ps->ps_ccursor );
+	ps->ps_clast = last;
+	ps->ps_stoptime = stoptime;
+	ps->ps_sel = sel;
+	ps->ps_wsize = mdb->mi_search_threads * PS_CHUNK;
+	ps->ps_refs = 1;
+	ldap_pvt_thread_mutex_init( &ps->ps_mutex );
+	ldap_pvt_thread_cond_init( &ps->ps_cond );
+	return ps;
+}
+
+static void
+mdb_psearch_end( mdb_psearch *ps )
+{
+	ldap_pvt_thread_mutex_lock( &ps->ps_mutex );
+	Debug( LDAP_DEBUG_TRACE, LDAP_XSTRING(mdb_search)
+		": %d of %d chunks of candidates evaluated by helpers\n",
+		ps->ps_hchunks, ps->ps_chunks, 0 );
+	ldap_pvt_thread_mutex_unlock( &ps->ps_mutex );
+	if ( ps->ps_mcd )
+		mdb_cursor_close( ps->ps_mcd );
+	psearch_release( ps );
+}
+
+/* The candidates of a paged search, kept from one page to the next
+ * so that they needn't be found again, see "pagedcache". They are
+ * only taken up again by the same connection for the same search
+ * and cookie. Writes since don't matter: each candidate's scope and
+ * filter are checked again against the current entry, so the entries
+ * that were deleted or no longer match are skipped. Only the entries
+ * that came to match the search after its first page are missed. A
+ * search takes them off the list while it runs.
+ */
+typedef struct mdb_paged {
+	struct mdb_paged *mp_next;	/* older ones */
+	unsigned long mp_connid;
+	ID mp_cookie;		/* last ID sent */
+	time_t mp_time;		/* when last used */
+	ID mp_base;
+	int mp_scope;
+	int mp_deref;
+	int mp_ctrls;		/* see search_paged_ctrls() */
+	struct berval mp_filter;
+	size_t mp_size;		/* memory taken */
+	ID *mp_ids;
+} mdb_paged;
+
+static void
+search_paged_destroy( mdb_paged *mp )
+{
+	mdb_paged *next;
+
+	for ( ; mp; mp = next ) {
+		next = mp->mp_next;
+		ch_free( mp->mp_ids );
+		ch_free( mp );
+	}
+}
+
+/* Drop the candidates kept for connection c, or all of them */
+void
+mdb_paged_free( struct mdb_info *mdb, Connection *c )
+{
+	mdb_paged *mp, **prev, *dead = NULL;
+
+	ldap_pvt_thread_mutex_lock( &mdb->mi_paged_mutex );
+	for ( prev = &mdb->mi_paged; ( mp = *prev ) != NULL; ) {
+		if ( !c || mp->mp_connid == c->c_connid ) {
+			*prev = mp->mp_next;
+			mdb->mi_paged_size -= mp->mp_size;
+			mp->mp_next = dead;
+			dead = mp;
+		} else {
+			prev = &mp->mp_next;
+		}
+	}
+	ldap_pvt_thread_mutex_unlock( &mdb->mi_paged_mutex );
+	search_paged_destroy( dead );
+}
+
+/* The controls search_candidates() looks at */
+static int
+search_paged_ctrls( Operation *op )
+{
+	return ( get_manageDSAit( op ) ? 1 : 0 ) |
+		( get_domainScope( op ) ? 2 : 0 ) |
+		( get_subentries_visibility( op ) ? 4 : 0 );
+}
+
+/* Take the candidates kept by the previous page of this search */
+static mdb_paged *
+search_paged_get( Operation *op, struct mdb_info *mdb, Entry *base )
+{
+	PagedResultsState *ps = op->o_pagedresults_state;
+	PagedResultsCookie cookie;
+	mdb_paged *mp, **prev;
+
+	if ( ps->ps_cookieval.bv_len < sizeof( cookie ) || !mdb->mi_paged )
+		return NULL;
+	AC_MEMCPY( &cookie, ps->ps_cookieval.bv_val, sizeof( cookie ));
+
+	ldap_pvt_thread_mutex_lock( &mdb->mi_paged_mutex );
+	for ( prev = &mdb->mi_paged; ( mp = *prev ) != NULL;
+		prev = &mp->mp_next ) {
+		if ( mp->mp_connid == op->o_connid ) {
+			*prev = mp->mp_next;
+			mdb->mi_paged_size -= mp->mp_size;
+			mp->mp_next = NULL;
+			break;
+		}
+	}
+	ldap_pvt_thread_mutex_unlock( &mdb->mi_paged_mutex );
+
+	/* a connection has one paged search at a time, so if these
+	 * aren't for this one they are of no further use
+	 */
+	if ( mp && ( mp->mp_cookie != (ID)cookie ||
+		mp->mp_base != base->e_id || mp->mp_scope != op->ors_scope ||
+		mp->mp_deref != op->ors_deref ||
+		mp->mp_ctrls != search_paged_ctrls( op ) ||
+		ber_bvcmp( &mp->mp_filter, &op->ors_filterstr ))) {
+		search_paged_destroy( mp );
+		mp = NULL;
+	}
+	if ( mp ) {
+		Debug( LDAP_DEBUG_TRACE, LDAP_XSTRING(mdb_search)
+			": candidates kept from the previous page\n", 0, 0, 0 );
+	}
+	return mp;
+}
+
+/* Keep the candidates of this search for its next page, after the
+ * ID cookie. mp is what search_paged_get() returned, if anything.
+ */
+static void
+search_paged_put( Operation *op, struct mdb_info *mdb, mdb_paged *mp,
+	Entry *base, ID *ids, ID cookie )
+{
+	mdb_paged *old, **prev, *dead = NULL;
+
+	if ( !mp ) {
+		size_t size;
+
+		if ( !mdb->mi_paged_max )
+			return;
+		mp = ch_malloc( sizeof( mdb_paged ) + op->ors_filterstr.bv_len + 1 );
+		mp->mp_ids = mdb_idl_pack( ids, &size );
+		mp->mp_size = size + sizeof( mdb_paged ) +
+			op->ors_filterstr.bv_len + 1;
+		if ( mp->mp_size > mdb->mi_paged_max ) {
+			ch_free( mp->mp_ids );
+			ch_free( mp );
+			return;
+		}
+		mp->mp_connid = op->o_connid;
+		mp->mp_base = base->e_id;
+		mp->mp_scope = op->ors_scope;
+		mp->mp_deref = op->ors_deref;
+		mp->mp_ctrls = search_paged_ctrls( op );
+		mp->mp_filter.bv_len = op->ors_filterstr.bv_len;
+		mp->mp_filter.bv_val = (char *)( mp + 1 );
+		AC_MEMCPY( mp->mp_filter.bv_val, op->ors_filterstr.bv_val,
+			op->ors_filterstr.bv_len + 1 );
+	}
+	mp->mp_cookie = cookie;
+	mp->mp_time = op->o_time;
+
+	ldap_pvt_thread_mutex_lock( &mdb->mi_paged_mutex );
+	mp->mp_next = mdb->mi_paged;
+	mdb->mi_paged = mp;
+	mdb->mi_paged_size += mp->mp_size;
+	/* drop the ones left unused for too long... */
+	for ( prev = &mp->mp_next; ( old = *prev ) != NULL; ) {
+		if ( old->mp_connid == mp->mp_connid || ( mdb->mi_paged_expire &&
+			old->mp_time + mdb->mi_paged_expire < op->o_time )) {
+			*prev = old->mp_next;
+			mdb->mi_paged_size -= old->mp_size;
+			old->mp_next = dead;
+			dead = old;
+		} else {
+			prev = &old->mp_next;
+		}
+	}
+	/* ...and the oldest ones while they take too much */
+	while ( mdb->mi_paged_size > mdb->mi_paged_max ) {
+		for ( prev = &mdb->mi_paged; (*prev)->mp_next;
+			prev = &(*prev)->mp_next )
+			;
+		old = *prev;
+		*prev = NULL;
+		mdb->mi_paged_size -= old->mp_size;
+		old->mp_next = dead;
+		dead = old;
+	}
+	ldap_pvt_thread_mutex_unlock( &mdb->mi_paged_mutex );
+	search_paged_destroy( dead );
+}
+
 int
 mdb_search( Operation *op, SlapReply *rs )
 {
 	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
 	ID		id, cursor, nsubs, ncand, cscope;
 	ID		lastid = NOID;
-	ID		candidates[MDB_IDL_UM_SIZE];
+	ID		cbuf[MDB_IDL_UM_SIZE], *candidates = cbuf;
 	ID		iscopes[MDB_IDL_DB_SIZE];
 	ID2		*scopes;
 	void	*stack;
@@ -431,6 +1799,16 @@ mdb_search( Operation *op, SlapReply *rs )
 	MDB_cursor	*mci, *mcd;
 	ww_ctx wwctx;
 	slap_callback cb = { 0 };
+	mdb_psearch	*pcand = NULL;
+	int		parallel;
+	mdb_attrsel	*fsel = NULL, *ssel = NULL, *dsel = NULL;
+	sort_key	*sk;
+	search_order	sorder, *so = NULL;
+	vlv_ctrl	*vc;
+	search_vlv	svlv, *sv = NULL;
+	struct berval	pos = BER_BVNULL;
+	mdb_paged	*mp = NULL;
+	int		keep = 0;
 
 	mdb_op_info	opinfo = {{{0}}}, *moi = &opinfo;
 	MDB_txn			*ltid = NULL;
@@ -637,6 +2015,9 @@ dn2entry_retry:
 
 	e = NULL;
 
+	/* before the candidates, taking the sort may bring back paging */
+	sk = search_order_key( op, mdb, &vc );
+
 	/* select candidates */
 	if ( op->oq_search.rs_scope == LDAP_SCOPE_BASE ) {
 		rs->sr_err = base_candidate( op->o_bd, base, candidates );
@@ -663,8 +2044,24 @@ dn2entry_retry:
 		scopes[0].mid = 1;
 		scopes[1].mid = base->e_id;
 		scopes[1].mval.mv_data = NULL;
-		rs->sr_err = search_candidates( op, rs, base,
-			&isc, mci, candidates, stack );
+		/* Pages of a search in our own read txn may be able to use
+		 * the candidates of the previous one.
+		 */
+		if ( get_pagedresults( op ) > SLAP_CONTROL_IGNORED &&
+			moi == &opinfo ) {
+			keep = 1;
+			mp = search_paged_get( op, mdb, base );
+		}
+		if ( mp ) {
+			candidates = mp->mp_ids;
+			rs->sr_err = LDAP_SUCCESS;
+		} else {
+			rs->sr_err = search_candidates( op, rs, base,
+				&isc, mci, candidates, stack );
+			/* not with the scopes of aliases, they aren't kept */
+			if ( scopes[0].mid > 1 )
+				keep = 0;
+		}
 		ncand = MDB_IDL_N( candidates );
 		if ( !base->e_id || ncand == NOID ) {
 			/* grab entry count from id2entry stat
@@ -707,6 +2104,26 @@ dn2entry_retry:
 		tentries = ncand;
 	}
 
+	if ( op->ors_scope != LDAP_SCOPE_BASE ) {
+		search_attrsel( op, sk ? sk->sk_ad : NULL, &fsel, &ssel );
+		dsel = ssel ? ssel : fsel;
+	}
+
+	/* Candidates are only evaluated in parallel in our own read txn,
+	 * and without alias scopes, which are found by walking dn2id.
+	 */
+	parallel = mdb->mi_search_threads > 1 && moi == &opinfo &&
+		op->ors_scope != LDAP_SCOPE_BASE && scopes[0].mid == 1 &&
+		ncand >= mdb->mi_search_mincand && !sk;
+	/* They are evaluated in ID order. Walking the scope instead only
+	 * pays if it holds much fewer entries.
+	 */
+	if ( parallel && nsubs < ncand && nsubs >= ncand / 2 )
+		nsubs = ncand;
+	/* A sorted search goes through the order index */
+	if ( sk )
+		nsubs = ncand;
+
 	wwctx.flag = 0;
 	wwctx.nentries = 0;
 	/* If we're running in our own read txn */
@@ -722,7 +2139,7 @@ dn2entry_retry:
 	if ( get_pagedresults( op ) > SLAP_CONTROL_IGNORED ) {
 		PagedResultsState *ps = op->o_pagedresults_state;
 		/* deferred cookie parsing */
-		rs->sr_err = parse_paged_cookie( op, rs );
+		rs->sr_err = parse_paged_cookie( op, rs, sk != NULL );
 		if ( rs->sr_err != LDAP_SUCCESS ) {
 			send_ldap_result( op, rs );
 			goto done;
@@ -735,19 +2152,48 @@ dn2entry_retry:
 			send_ldap_result( op, rs );
 			goto done;
 		}
-		id = mdb_idl_first( candidates, &cursor );
+		/* a sorted search goes on where the cookie says */
+		if ( sk ) {
+			struct berval cpos, *cp = NULL;
+
+			if ( cursor ) {
+				cpos.bv_val = ps->ps_cookieval.bv_val +
+					sizeof( PagedResultsCookie );
+				cpos.bv_len = ps->ps_cookieval.bv_len -
+					sizeof( PagedResultsCookie );
+				cp = &cpos;
+			}
+			so = &sorder;
+			id = search_order_begin( op, so, sk, ltid, mci, candidates,
+				fsel, cp, cursor );
+			if ( id == NOID )
+				goto nochange;
+			goto loop_begin;
+		}
+		if ( parallel )
+			pcand = mdb_psearch_begin( op, ltid, mci, base, candidates,
+				cursor, stoptime, fsel );
+		if ( pcand ) {
+			id = mdb_psearch_next( op, pcand, mci );
+			/* none of the candidates left match */
+			if ( id == NOID )
+				goto nochange;
+		} else {
+			id = mdb_idl_first( candidates, &cursor );
+		}
 		if ( id == NOID ) {
 			Debug( LDAP_DEBUG_TRACE, 
 				LDAP_XSTRING(mdb_search)
 				": no paged results candidates\n",
 				0, 0, 0 );
-			send_paged_response( op, rs, &lastid, 0 );
+			send_paged_response( op, rs, &lastid, NULL, 0 );
 
 			rs->sr_err = LDAP_OTHER;
 			goto done;
 		}
 		if ( id == (ID)ps->ps_cookie )
-			id = mdb_idl_next( candidates, &cursor );
+			id = pcand ? mdb_psearch_next( op, pcand, mci ) :
+				mdb_idl_next( candidates, &cursor );
 		nsubs = ncand;	/* always bypass scope'd search */
 		goto loop_begin;
 	}
@@ -778,8 +2224,27 @@ dn2entry_retry:
 		else
 			id = isc.id;
 		cscope = 0;
+	} else if ( sk ) {
+		if ( vc ) {
+			sv = &svlv;
+			if ( search_vlv_begin( op, sv, vc, sk )) {
+				vc->vc_rc = LDAP_INAPPROPRIATE_MATCHING;
+				rs->sr_err = LDAP_VLV_ERROR;
+				send_ldap_result( op, rs );
+				goto done;
+			}
+		}
+		so = &sorder;
+		id = search_order_begin( op, so, sk, ltid, mci, candidates, fsel,
+			NULL, 0 );
 	} else {
-		id = mdb_idl_first( candidates, &cursor );
+		if ( parallel )
+			pcand = mdb_psearch_begin( op, ltid, mci, base, candidates,
+				cursor, stoptime, fsel );
+		if ( pcand )
+			id = mdb_psearch_next( op, pcand, mci );
+		else
+			id = mdb_idl_first( candidates, &cursor );
 	}
 
 	while (id != NOID)
@@ -825,6 +2290,8 @@ loop_begin:
 				if ( id >= MDB_IDL_RANGE_FIRST( candidates ) &&
 					id <= MDB_IDL_RANGE_LAST( candidates ))
 					scopeok = 1;
+			} else if (MDB_IDL_IS_BITMAP( candidates )) {
+				scopeok = mdb_idl_bm_has( candidates, id );
 			} else {
 				i = mdb_idl_search( candidates, id );
 				if (i <= candidates[0] && candidates[i] == id )
@@ -890,10 +2357,10 @@ scopeok:
 			rs->sr_err = mdb_id2edata( op, mci, id, &edata );
 			if ( rs->sr_err == MDB_NOTFOUND ) {
 notfound:
-				if( nsubs < ncand )
+				if( nsubs < ncand || so )
 					goto loop_continue;
 
-				if( !MDB_IDL_IS_RANGE(candidates) ) {
+				if( pcand || !MDB_IDL_IS_RANGE(candidates) ) {
 					/* only complain for non-range IDLs */
 					Debug( LDAP_DEBUG_TRACE,
 						LDAP_XSTRING(mdb_search)
@@ -922,8 +2389,9 @@ notfound:
 				goto done;
 			}
 
-			rs->sr_err = mdb_entry_decode( op, ltid, &edata, id, &e );
+			rs->sr_err = mdb_entry_decode( op, ltid, &edata, id, dsel, &e );
 			if ( rs->sr_err ) {
+decode_failed:
 				rs->sr_err = LDAP_OTHER;
 				rs->sr_text = "internal error in mdb_entry_decode";
 				send_ldap_result( op, rs );
@@ -934,6 +2402,10 @@ notfound:
 			e->e_nname.bv_val = NULL;
 		}
 
+		/* listed under another value */
+		if ( so && !search_order_placed( so, e ))
+			goto loop_continue;
+
 		if ( is_entry_subentry( e ) ) {
 			if( op->oq_search.rs_scope != LDAP_SCOPE_BASE ) {
 				if(!get_subentries_visibility( op )) {
@@ -1036,7 +2508,18 @@ notfound:
 		if ( !manageDSAit && op->oq_search.rs_scope != LDAP_SCOPE_BASE
 			&& is_entry_referral( e ) )
 		{
-			BerVarray erefs = get_entry_referrals( op, e );
+			BerVarray erefs;
+
+			/* sent while the list was counted */
+			if ( sv && sv->sv_pass == 2 )
+				goto loop_continue;
+
+			if ( e != base && dsel &&
+				search_entry_full( op, ltid, &edata, &e )) {
+				mdb_entry_return( op, e );
+				goto decode_failed;
+			}
+			erefs = get_entry_referrals( op, e );
 			rs->sr_ref = referral_rewrite( erefs, &e->e_name, NULL,
 				op->oq_search.rs_scope == LDAP_SCOPE_ONELEVEL
 					? LDAP_SCOPE_BASE : LDAP_SCOPE_SUBTREE );
@@ -1062,18 +2545,48 @@ notfound:
 		rs->sr_err = test_filter( op, e, op->oq_search.rs_filter );
 
 		if ( rs->sr_err == LDAP_COMPARE_TRUE ) {
+			/* only the window of a VLV request is sent */
+			if ( sv ) {
+				int rc = search_vlv_entry( sv, so, e );
+				if ( rc > 0 )
+					goto loop_continue;
+				if ( rc < 0 ) {
+					if ( e != base )
+						mdb_entry_return( op, e );
+					e = NULL;
+					break;
+				}
+			}
+
 			/* check size limit */
 			if ( get_pagedresults(op) > SLAP_CONTROL_IGNORED ) {
 				if ( rs->sr_nentries >= ((PagedResultsState *)op->o_pagedresults_state)->ps_size ) {
+					/* a sorted search starts the next page here */
+					if ( so ) {
+						lastid = id;
+						search_order_pos( op, so, e, &pos );
+					}
 					if (e != base)
 						mdb_entry_return( op, e );
 					e = NULL;
-					send_paged_response( op, rs, &lastid, tentries );
+					if ( keep ) {
+						search_paged_put( op, mdb, mp, base, candidates,
+							lastid );
+						mp = NULL;
+					}
+					send_paged_response( op, rs, &lastid,
+						so ? &pos : NULL, tentries );
 					goto done;
 				}
 				lastid = id;
 			}
 
+			if ( e && e != base && dsel != ssel &&
+				search_entry_full( op, ltid, &edata, &e )) {
+				mdb_entry_return( op, e );
+				goto decode_failed;
+			}
+
 			if (e) {
 				/* safe default */
 				rs->sr_attrs = op->oq_search.rs_attrs;
@@ -1136,6 +2649,10 @@ loop_continue:
 				send_ldap_result( op, rs );
 				goto done;
 			}
+			if ( so ) {
+				mdb_cursor_renew( ltid, so->so_mc );
+				so->so_seek = 1;
+			}
 		}
 
 		if( e != NULL ) {
@@ -1173,18 +2690,40 @@ loop_continue:
 				}
 			} else
 				id = isc.id;
+		} else if ( pcand ) {
+			id = mdb_psearch_next( op, pcand, mci );
+		} else if ( so ) {
+			id = search_order_next( op, so, mci );
 		} else {
 			id = mdb_idl_next( candidates, &cursor );
 		}
 	}
 
+	/* the list of a VLV request is counted, send its window */
+	if ( sv && sv->sv_pass == 1 ) {
+		rs->sr_err = search_vlv_window( sv );
+		if ( rs->sr_err != LDAP_SUCCESS ) {
+			vc->vc_rc = rs->sr_err;
+			rs->sr_err = LDAP_VLV_ERROR;
+			send_ldap_result( op, rs );
+			goto done;
+		}
+		if ( sv->sv_last ) {
+			search_order_end( so );
+			id = search_order_begin( op, so, sk, ltid, mci, candidates,
+				fsel, NULL, 0 );
+			if ( id != NOID )
+				goto loop_begin;
+		}
+	}
+
 nochange:
 	rs->sr_ctrls = NULL;
 	rs->sr_ref = rs->sr_v2ref;
 	rs->sr_err = (rs->sr_v2ref == NULL) ? LDAP_SUCCESS : LDAP_REFERRAL;
 	rs->sr_rspoid = NULL;
 	if ( get_pagedresults(op) > SLAP_CONTROL_IGNORED ) {
-		send_paged_response( op, rs, NULL, 0 );
+		send_paged_response( op, rs, NULL, NULL, 0 );
 	} else {
 		send_ldap_result( op, rs );
 	}
@@ -1203,6 +2742,20 @@ done:
 			}
 		}
 	}
+	if ( pcand )
+		mdb_psearch_end( pcand );
+	if ( mp )
+		search_paged_destroy( mp );
+	if ( so )
+		search_order_end( so );
+	if ( sv && sv->sv_value.bv_val )
+		op->o_tmpfree( sv->sv_value.bv_val, op->o_tmpmemctx );
+	if ( pos.bv_val )
+		op->o_tmpfree( pos.bv_val, op->o_tmpmemctx );
+	if ( ssel && ssel != fsel )
+		op->o_tmpfree( ssel, op->o_tmpmemctx );
+	if ( fsel )
+		op->o_tmpfree( fsel, op->o_tmpmemctx );
 	mdb_cursor_close( mcd );
 	mdb_cursor_close( mci );
 	if ( moi == &opinfo ) {
@@ -1400,8 +2953,11 @@ static int search_candidates(
 	return rc;
 }
 
+/* The cookie of a sorted search goes on with its position in the
+ * order
+ */
 static int
-parse_paged_cookie( Operation *op, SlapReply *rs )
+parse_paged_cookie( Operation *op, SlapReply *rs, int sorted )
 {
 	int		rc = LDAP_SUCCESS;
 	PagedResultsState *ps = op->o_pagedresults_state;
@@ -1414,7 +2970,8 @@ parse_paged_cookie( Operation *op, SlapReply *rs )
 	/* cookie decoding/checks deferred to backend... */
 	if ( ps->ps_cookieval.bv_len ) {
 		PagedResultsCookie reqcookie;
-		if( ps->ps_cookieval.bv_len != sizeof( reqcookie ) ) {
+		if( ps->ps_cookieval.bv_len != sizeof( reqcookie ) &&
+			!( sorted && ps->ps_cookieval.bv_len > sizeof( reqcookie ))) {
 			/* bad cookie */
 			rs->sr_text = "paged results cookie is invalid";
 			rc = LDAP_PROTOCOL_ERROR;
@@ -1450,6 +3007,7 @@ send_paged_response(
 	Operation	*op,
 	SlapReply	*rs,
 	ID		*lastid,
+	struct berval	*pos,
 	int		tentries )
 {
 	LDAPControl	*ctrls[2];
@@ -1470,6 +3028,14 @@ send_paged_response(
 		respcookie = ( PagedResultsCookie )(*lastid);
 		cookie.bv_len = sizeof( respcookie );
 		cookie.bv_val = (char *)&respcookie;
+		if ( pos ) {
+			cookie.bv_len += pos->bv_len;
+			cookie.bv_val = op->o_tmpalloc( cookie.bv_len,
+				op->o_tmpmemctx );
+			AC_MEMCPY( cookie.bv_val, &respcookie, sizeof( respcookie ));
+			AC_MEMCPY( cookie.bv_val + sizeof( respcookie ),
+				pos->bv_val, pos->bv_len );
+		}
 
 	} else {
 		respcookie = ( PagedResultsCookie )0;
@@ -1483,6 +3049,8 @@ send_paged_response(
 
 	/* return size of 0 -- no estimate */
 	ber_printf( ber, "{iO}", 0, &cookie ); 
+	if ( lastid && pos )
+		op->o_tmpfree( cookie.bv_val, op->o_tmpmemctx );
 
 	ctrls[0] = op->o_tmpalloc( sizeof(LDAPControl), op->o_tmpmemctx );
 	if ( ber_flatten2( ber, &ctrls[0]->ldctl_value, 0 ) == -1 ) {
@@ -54,6 +54,7 @@ MDB_txn *mdb_tool_txn = NULL;
 
 static MDB_txn *txi = NULL;
 static MDB_cursor *cursor = NULL, *idcursor = NULL;
+static MDB_bulk *idbulk = NULL;
 static MDB_cursor *mcp = NULL, *mcd = NULL;
 static MDB_val key, data;
 static ID previd = NOID;
@@ -98,6 +99,44 @@ static int	mdb_writes, mdb_writes_per_commit;
 static int
 mdb_tool_entry_get_int( BackendDB *be, ID id, Entry **ep );
 
+static void
+mdb_tool_bulk_close( void )
+{
+	if ( idbulk ) {
+		mdb_bulk_close( idbulk );
+		idbulk = NULL;
+	}
+}
+
+/* In quick mode entries are added in ID order, so id2entry appends
+ * go through a bulk loader instead of the B-tree insert path. Any
+ * other write to id2entry ends the bulk load first.
+ */
+int
+mdb_tool_id2entry_put(
+	MDB_txn *txn,
+	MDB_cursor *mc,
+	MDB_dbi dbi,
+	MDB_val *key,
+	MDB_val *data,
+	int flag )
+{
+	int rc;
+
+	if ( (flag & MDB_APPEND) && (slapMode & SLAP_TOOL_QUICK) ) {
+		if ( !idbulk ) {
+			rc = mdb_bulk_open( txn, dbi, &idbulk );
+			if ( rc )
+				return rc;
+		}
+		return mdb_bulk_put( idbulk, key, data, flag & MDB_RESERVE );
+	}
+	mdb_tool_bulk_close();
+	if ( mc )
+		return mdb_cursor_put( mc, key, data, flag );
+	return mdb_put( txn, dbi, key, data, flag );
+}
+
 int mdb_tool_entry_open(
 	BackendDB *be, int mode )
 {
@@ -190,6 +229,7 @@ int mdb_tool_entry_close(
 	}
 #endif
 
+	mdb_tool_bulk_close();
 	if( idcursor ) {
 		mdb_cursor_close( idcursor );
 		idcursor = NULL;
@@ -207,15 +247,37 @@ int mdb_tool_entry_close(
 		}
 	}
 	if( mdb_tool_txn ) {
+		int rc = 0;
+		if ( !txi )
+			rc = mdb_idl_stats_flush( mdb_tool_txn, be->be_private );
+		if ( rc )
+			mdb_txn_abort( mdb_tool_txn );
+		else
+			rc = mdb_txn_commit( mdb_tool_txn );
+		mdb_tool_txn = NULL;
+		if ( rc ) {
+			Debug( LDAP_DEBUG_ANY,
+				LDAP_XSTRING(mdb_tool_entry_close) ": database %s: "
+				"txn_commit failed: %s (%d)\n",
+				be->be_suffix[0].bv_val, mdb_strerror(rc), rc );
+			return -1;
+		}
+	}
+	if( txi ) {
 		int rc;
-		if (( rc = mdb_txn_commit( mdb_tool_txn ))) {
+		rc = mdb_idl_stats_flush( txi, be->be_private );
+		if ( rc )
+			mdb_txn_abort( txi );
+		else
+			rc = mdb_txn_commit( txi );
+		txi = NULL;
+		if ( rc ) {
 			Debug( LDAP_DEBUG_ANY,
 				LDAP_XSTRING(mdb_tool_entry_close) ": database %s: "
 				"txn_commit failed: %s (%d)\n",
 				be->be_suffix[0].bv_val, mdb_strerror(rc), rc );
 			return -1;
 		}
-		mdb_tool_txn = NULL;
 	}
 
 	if( nholes ) {
@@ -402,7 +464,7 @@ mdb_tool_entry_get_int( BackendDB *be, ID id, Entry **ep )
 			}
 		}
 	}
-	rc = mdb_entry_decode( &op, mdb_tool_txn, &data, id, &e );
+	rc = mdb_entry_decode( &op, mdb_tool_txn, &data, id, NULL, &e );
 	e->e_id = id;
 	if ( !BER_BVISNULL( &dn )) {
 		e->e_name = dn;
@@ -507,6 +569,7 @@ static int mdb_tool_next_id(
 			Debug( LDAP_DEBUG_ANY,
 				"=> mdb_tool_next_id: %s\n", text->bv_val, 0, 0 );
 		} else if ( hole ) {
+			struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
 			MDB_val key, data;
 			if ( nholes == nhmax - 1 ) {
 				if ( holes == hbuf ) {
@@ -523,7 +586,8 @@ static int mdb_tool_next_id(
 			key.mv_data = &e->e_id;
 			data.mv_size = 0;
 			data.mv_data = NULL;
-			rc = mdb_cursor_put( idcursor, &key, &data, MDB_NOOVERWRITE );
+			rc = mdb_tool_id2entry_put( tid, idcursor, mdb->mi_id2entry,
+				&key, &data, MDB_NOOVERWRITE|MDB_APPEND );
 			if ( rc == MDB_KEYEXIST )
 				rc = 0;
 			if ( rc ) {
@@ -745,12 +809,20 @@ done:
 		if ( mdb_writes >= mdb_writes_per_commit ) {
 			unsigned i;
 			MDB_TOOL_IDL_FLUSH( be, mdb_tool_txn );
-			rc = mdb_txn_commit( mdb_tool_txn );
+			rc = mdb_idl_stats_flush( mdb_tool_txn, mdb );
+			if ( rc == 0 )
+				rc = mdb_txn_commit( mdb_tool_txn );
+			else
+				mdb_txn_abort( mdb_tool_txn );
 			for ( i=0; i<mdb->mi_nattrs; i++ )
 				mdb->mi_attrs[i]->ai_cursor = NULL;
 			mdb_writes = 0;
+			/* id2entry is not DUPSORT, the bulk loader has nothing
+			 * pending and was freed along with the txn.
+			 */
 			mdb_tool_txn = NULL;
 			idcursor = NULL;
+			idbulk = NULL;
 			if( rc != 0 ) {
 				mdb->mi_numads = 0;
 				snprintf( text->bv_val, text->bv_len,
@@ -766,8 +838,10 @@ done:
 	} else {
 		unsigned i;
 		mdb_txn_abort( mdb_tool_txn );
+		mdb_idl_stats_flush( NULL, mdb );
 		mdb_tool_txn = NULL;
 		idcursor = NULL;
+		idbulk = NULL;
 		for ( i=0; i<mdb->mi_nattrs; i++ )
 			mdb->mi_attrs[i]->ai_cursor = NULL;
 		mdb_writes = 0;
@@ -882,7 +956,8 @@ int mdb_tool_entry_reindex(
 	if ( slapMode & SLAP_TRUNCATE_MODE ) {
 		int i;
 		for ( i=0; i < mi->mi_nattrs; i++ ) {
-			rc = mdb_drop( txi, mi->mi_attrs[i]->ai_dbi, 0 );
+			/* the index, its bitmaps and its statistics */
+			rc = mdb_idl_truncate( txi, mi, mi->mi_attrs[i] );
 			if ( rc ) {
 				Debug( LDAP_DEBUG_ANY,
 					LDAP_XSTRING(mdb_tool_entry_reindex)
@@ -918,7 +993,11 @@ done:
 			MDB_val key;
 			unsigned i;
 			MDB_TOOL_IDL_FLUSH( be, txi );
-			rc = mdb_txn_commit( txi );
+			rc = mdb_idl_stats_flush( txi, mi );
+			if ( rc == 0 )
+				rc = mdb_txn_commit( txi );
+			else
+				mdb_txn_abort( txi );
 			mdb_writes = 0;
 			for ( i=0; i<mi->mi_nattrs; i++ )
 				mi->mi_attrs[i]->ai_cursor = NULL;
@@ -947,6 +1026,7 @@ done:
 		mdb_cursor_close( cursor );
 		cursor = NULL;
 		mdb_txn_abort( txi );
+		mdb_idl_stats_flush( NULL, mi );
 		for ( i=0; i<mi->mi_nattrs; i++ )
 			mi->mi_attrs[i]->ai_cursor = NULL;
 		Debug( LDAP_DEBUG_ANY,
@@ -990,6 +1070,7 @@ ID mdb_tool_entry_modify(
 		mdb_cursor_close( cursor );
 		cursor = NULL;
 	}
+	mdb_tool_bulk_close();
 	if ( !mdb_tool_txn ) {
 		rc = mdb_txn_begin( mdb->mi_dbenv, NULL, 0, &mdb_tool_txn );
 		if( rc != 0 ) {
@@ -1020,6 +1101,8 @@ ID mdb_tool_entry_modify(
 	}
 
 done:
+	if( rc == 0 )
+		rc = mdb_idl_stats_flush( mdb_tool_txn, mdb );
 	if( rc == 0 ) {
 		rc = mdb_txn_commit( mdb_tool_txn );
 		if( rc != 0 ) {
@@ -1035,6 +1118,7 @@ done:
 
 	} else {
 		mdb_txn_abort( mdb_tool_txn );
+		mdb_idl_stats_flush( NULL, mdb );
 		snprintf( text->bv_val, text->bv_len,
 			"txn_aborted! %s (%d)",
 			mdb_strerror(rc), rc );
@@ -1080,6 +1164,7 @@ int mdb_tool_entry_delete(
 		mdb_cursor_close( cursor );
 		cursor = NULL;
 	}
+	mdb_tool_bulk_close();
 	if( !mdb_tool_txn ) {
 		rc = mdb_txn_begin( mdb->mi_dbenv, NULL, 0, &mdb_tool_txn );
 		if( rc != 0 ) {
@@ -1181,6 +1266,8 @@ done:
 		mdb_entry_return( &op, e );
 	}
 
+	if( rc == 0 )
+		rc = mdb_idl_stats_flush( mdb_tool_txn, mdb );
 	if( rc == 0 ) {
 		rc = mdb_txn_commit( mdb_tool_txn );
 		if( rc != 0 ) {
@@ -1194,6 +1281,7 @@ done:
 
 	} else {
 		mdb_txn_abort( mdb_tool_txn );
+		mdb_idl_stats_flush( NULL, mdb );
 		snprintf( text->bv_val, text->bv_len,
 			"txn_aborted! %s (%d)",
 			mdb_strerror(rc), rc );
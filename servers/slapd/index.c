@@ -26,11 +26,13 @@ static slap_verbmasks idxstr[] = {
 	{ BER_BVC("pres"), SLAP_INDEX_PRESENT },
 	{ BER_BVC("eq"), SLAP_INDEX_EQUALITY },
 	{ BER_BVC("approx"), SLAP_INDEX_APPROX },
+	{ BER_BVC("order"), SLAP_INDEX_ORDER },
 	{ BER_BVC("subinitial"), SLAP_INDEX_SUBSTR_INITIAL },
 	{ BER_BVC("subany"), SLAP_INDEX_SUBSTR_ANY },
 	{ BER_BVC("subfinal"), SLAP_INDEX_SUBSTR_FINAL },
 	{ BER_BVC("sub"), SLAP_INDEX_SUBSTR_DEFAULT },
 	{ BER_BVC("substr"), 0 },
+	{ BER_BVC("subgram"), SLAP_INDEX_SUBSTR_GRAM },
 	{ BER_BVC("notags"), SLAP_INDEX_NOTAGS },
 	{ BER_BVC("nolang"), 0 },	/* backwards compat */
 	{ BER_BVC("nosubtypes"), SLAP_INDEX_NOSUBTYPES },
@@ -61,6 +63,7 @@ void slap_index2bvlen( slap_mask_t idx, struct berval *bv )
 		if ( !idxstr[i].mask ) continue;
 		if ( IS_SLAP_INDEX( idx, idxstr[i].mask )) {
 			if ( (idxstr[i].mask & SLAP_INDEX_SUBSTR) &&
+				idxstr[i].mask != SLAP_INDEX_SUBSTR_GRAM &&
 				((idx & SLAP_INDEX_SUBSTR_DEFAULT) != idxstr[i].mask))
 				continue;
 			if ( bv->bv_len ) bv->bv_len++;
@@ -82,6 +85,7 @@ void slap_index2bv( slap_mask_t idx, struct berval *bv )
 		if ( !idxstr[i].mask ) continue;
 		if ( IS_SLAP_INDEX( idx, idxstr[i].mask )) {
 			if ( (idxstr[i].mask & SLAP_INDEX_SUBSTR) &&
+				idxstr[i].mask != SLAP_INDEX_SUBSTR_GRAM &&
 				((idx & SLAP_INDEX_SUBSTR_DEFAULT) != idxstr[i].mask))
 				continue;
 			if ( ptr != bv->bv_val ) *ptr++ = ',';
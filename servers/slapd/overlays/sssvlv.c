@@ -52,9 +52,6 @@
 #define LDAP_VLVBYINDEX_IDENTIFIER	   0xa0L
 #define LDAP_VLVBYVALUE_IDENTIFIER     0x81L
 #define LDAP_VLVCONTEXT_IDENTIFIER     0x04L
-
-#define LDAP_VLV_SSS_MISSING	0x4C
-#define LDAP_VLV_RANGE_ERROR	0x4D
 #endif
 
 #define SAFESTR(macro_str, macro_def) ((macro_str) ? (macro_str) : (macro_def))
@@ -65,28 +62,6 @@
 #define NO_PS_COOKIE (PagedResultsCookie) -1
 #define NO_VC_CONTEXT (unsigned long) -1
 
-typedef struct vlv_ctrl {
-	int vc_before;
-	int vc_after;
-	int	vc_offset;
-	int vc_count;
-	struct berval vc_value;
-	unsigned long vc_context;
-} vlv_ctrl;
-
-typedef struct sort_key
-{
-	AttributeDescription	*sk_ad;
-	MatchingRule			*sk_ordering;
-	int						sk_direction;	/* 1=normal, -1=reverse */
-} sort_key;
-
-typedef struct sort_ctrl {
-	int sc_nkeys;
-	sort_key sc_keys[1];
-} sort_ctrl;
-
-
 typedef struct sort_node
 {
 	int sn_conn;
@@ -216,7 +191,8 @@ static int pack_vlv_response_control(
 	rc = ber_printf( ber, "{iie", so->so_vlv_target, so->so_nentries,
 		so->so_vlv_rc );
 
-	if ( rc != -1 && so->so_vcontext ) {
+	/* no context for a list that isn't kept */
+	if ( rc != -1 && so->so_vcontext && so->so_tree ) {
 		cookie.bv_val = (char *)&so->so_vcontext;
 		cookie.bv_len = sizeof(so->so_vcontext);
 		rc = ber_printf( ber, "tO", LDAP_VLVCONTEXT_IDENTIFIER, &cookie );
@@ -694,7 +670,9 @@ static void send_result(
 		i++;
 		rc = -1;
 		if ( so->so_paged > SLAP_CONTROL_IGNORED ) {
-			rc = pack_pagedresult_response_control( op, rs, so, ctrls+1 );
+			/* or the backend added its own */
+			if ( so->so_ctrl->sc_backend != SLAP_SORT_BACKEND )
+				rc = pack_pagedresult_response_control( op, rs, so, ctrls+1 );
 		} else if ( so->so_vlv > SLAP_CONTROL_IGNORED ) {
 			rc = pack_vlv_response_control( op, rs, so, ctrls+1 );
 		}
@@ -729,6 +707,10 @@ static int sssvlv_op_response(
 		struct berval *bv;
 		char *ptr;
 
+		/* The backend returns them in order already */
+		if ( sc->sc_backend == SLAP_SORT_BACKEND )
+			return SLAP_CB_CONTINUE;
+
 		len = sizeof(sort_node) + sc->sc_nkeys * sizeof(struct berval) +
 			rs->sr_entry->e_nname.bv_len + 1;
 		sn = op->o_tmpalloc( len, op->o_tmpmemctx );
@@ -796,6 +778,24 @@ static int sssvlv_op_response(
 			op->o_callback = op->o_callback->sc_next;
 		}
 
+		/* The backend sent the window, nothing is kept for the
+		 * next request
+		 */
+		if ( sc->sc_backend == SLAP_SORT_BACKEND &&
+			so->so_vlv > SLAP_CONTROL_IGNORED ) {
+			vlv_ctrl *vc = op->o_controls[vlv_cid];
+			so->so_vlv_target = vc->vc_target;
+			so->so_nentries = vc->vc_size;
+			so->so_vlv_rc = vc->vc_rc;
+			/* send_result() adds no controls to an error */
+			if ( rs->sr_err == LDAP_VLV_ERROR ) {
+				LDAPControl *ctrls[2];
+				pack_vlv_response_control( op, rs, so, ctrls );
+				ctrls[1] = NULL;
+				slap_add_ctrls( op, rs, ctrls );
+			}
+		}
+
 		send_entry( op, rs, so );
 		send_result( op, rs, so );
 	}
@@ -953,6 +953,7 @@ static int sssvlv_op_search(
 			if ( ps ) {
 				so->so_paged = op->o_pagedresults;
 				so->so_page_size = ps->ps_size;
+				sc->sc_paged = op->o_pagedresults;
 				op->o_pagedresults = SLAP_CONTROL_IGNORED;
 			} else {
 				so->so_paged = 0;
@@ -965,6 +966,8 @@ static int sssvlv_op_search(
 					so->so_vlv = SLAP_CONTROL_NONE;
 				}
 			}
+			/* the backend may sort, and page or send the window */
+			sc->sc_backend = SLAP_SORT_OFFERED;
 			so->so_session = sess_id;
 			so->so_vlv = op->o_ctrlflag[vlv_cid];
 			so->so_vcontext = (unsigned long)so;
@@ -1153,6 +1156,8 @@ static int sss_parseCtrl(
 	sc = op->o_tmpalloc( sizeof(sort_ctrl) +
 		(i-1) * sizeof(sort_key), op->o_tmpmemctx );
 	sc->sc_nkeys = i;
+	sc->sc_backend = SLAP_SORT_NONE;
+	sc->sc_paged = SLAP_CONTROL_NONE;
 	op->o_controls[sss_cid] = sc;
 
 	/* peel off initial sequence */
@@ -1229,6 +1234,9 @@ static int vlv_parseCtrl(
 	} else {
 		vc2.vc_context = 0;
 	}
+	vc2.vc_target = 0;
+	vc2.vc_size = 0;
+	vc2.vc_rc = LDAP_SUCCESS;
 
 	vc = op->o_tmpalloc( sizeof(vlv_ctrl), op->o_tmpmemctx );
 	*vc = vc2;
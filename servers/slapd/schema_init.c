@@ -908,6 +908,223 @@ done:
 	return LDAP_SUCCESS;
 }
 
+/* Trigram substring keys, for an index with subgram: each window of
+ * SLAP_INDEX_SUBSTR_GRAM_LEN bytes in a value is hashed along with its
+ * offset, which is zero for subany and counted from the start or the
+ * end of the value for subinitial and subfinal.  Initial and final
+ * substrings shorter than a gram get keys of their own, marked in the
+ * offset byte.  A substring filter asks for the keys of all of its
+ * grams, so the candidates are the entries holding every one of them.
+ */
+#define GRAM_LEN	SLAP_INDEX_SUBSTR_GRAM_LEN
+#define GRAM_SHORT	0x80
+
+/* longest initial/final substring indexed by position */
+static ber_len_t
+gramIfMaxlen( ber_len_t len )
+{
+	ber_len_t max = index_substr_if_maxlen;
+
+	if ( max > SLAP_INDEX_SUBSTR_GRAM_POSMAX + GRAM_LEN )
+		max = SLAP_INDEX_SUBSTR_GRAM_POSMAX + GRAM_LEN;
+	return len < max ? len : max;
+}
+
+static void
+gramKey(
+	HASH_CONTEXT *HCcontext,
+	unsigned pos,
+	char *val,
+	ber_len_t len,
+	BerVarray keys,
+	ber_len_t *nkeys,
+	int uniq,
+	void *ctx )
+{
+	unsigned char HASHdigest[HASH_BYTES];
+	unsigned char buf[1+GRAM_LEN];
+	struct berval digest;
+	ber_len_t i;
+
+	buf[0] = pos;
+	AC_MEMCPY( buf+1, val, len );
+	hashIter( HCcontext, HASHdigest, buf, len+1 );
+	digest.bv_val = (char *)HASHdigest;
+	digest.bv_len = HASH_LEN;
+
+	if ( uniq ) {
+		for ( i=0; i<*nkeys; i++ ) {
+			if ( !memcmp( keys[i].bv_val, HASHdigest, HASH_LEN ))
+				return;
+		}
+	}
+	ber_dupbv_x( &keys[(*nkeys)++], &digest, ctx );
+}
+
+static int
+gramSubstringsIndexer(
+	slap_mask_t flags,
+	Syntax *syntax,
+	MatchingRule *mr,
+	struct berval *prefix,
+	BerVarray values,
+	BerVarray *keysp,
+	void *ctx )
+{
+	ber_len_t i, j, k, len, max, nkeys;
+	BerVarray keys;
+	HASH_CONTEXT HCany, HCini, HCfin;
+	int ini = flags & SLAP_INDEX_SUBSTR_INITIAL & SLAP_INDEX_SUBSTR_TYPE;
+	int fin = flags & SLAP_INDEX_SUBSTR_FINAL & SLAP_INDEX_SUBSTR_TYPE;
+
+	nkeys = 0;
+	for ( i = 0; !BER_BVISNULL( &values[i] ); i++ ) {
+		/* count, generously, the keys to generate */
+		nkeys += values[i].bv_len;
+		if ( ini ) nkeys += GRAM_LEN + gramIfMaxlen( values[i].bv_len );
+		if ( fin ) nkeys += GRAM_LEN + gramIfMaxlen( values[i].bv_len );
+	}
+
+	keys = slap_sl_malloc( sizeof( struct berval ) * (nkeys+1), ctx );
+
+	hashPreset( &HCany, prefix, SLAP_INDEX_SUBSTR_PREFIX, syntax, mr );
+	if ( ini )
+		hashPreset( &HCini, prefix, SLAP_INDEX_SUBSTR_INITIAL_PREFIX, syntax, mr );
+	if ( fin )
+		hashPreset( &HCfin, prefix, SLAP_INDEX_SUBSTR_FINAL_PREFIX, syntax, mr );
+
+	nkeys = 0;
+	for ( i = 0; !BER_BVISNULL( &values[i] ); i++ ) {
+		char *val = values[i].bv_val;
+
+		len = values[i].bv_len;
+		for ( j=0; j+GRAM_LEN <= len; j++ ) {
+			gramKey( &HCany, 0, &val[j], GRAM_LEN, keys, &nkeys, 0, ctx );
+		}
+
+		max = gramIfMaxlen( len );
+		for ( k=index_substr_if_minlen; k<GRAM_LEN && k<=max; k++ ) {
+			if ( ini )
+				gramKey( &HCini, GRAM_SHORT|k, val, k, keys, &nkeys, 0, ctx );
+			if ( fin )
+				gramKey( &HCfin, GRAM_SHORT|k, &val[len-k], k, keys, &nkeys, 0, ctx );
+		}
+		for ( j=0; j+GRAM_LEN <= max; j++ ) {
+			if ( ini )
+				gramKey( &HCini, j, &val[j], GRAM_LEN, keys, &nkeys, 0, ctx );
+			if ( fin )
+				gramKey( &HCfin, j, &val[len-GRAM_LEN-j], GRAM_LEN, keys, &nkeys, 0, ctx );
+		}
+	}
+
+	if( nkeys > 0 ) {
+		BER_BVZERO( &keys[nkeys] );
+		*keysp = keys;
+	} else {
+		slap_sl_free( keys, ctx );
+		*keysp = NULL;
+	}
+
+	return LDAP_SUCCESS;
+}
+
+static int
+gramSubstringsFilter(
+	slap_mask_t flags,
+	Syntax *syntax,
+	MatchingRule *mr,
+	struct berval *prefix,
+	SubstringsAssertion *sa,
+	BerVarray *keysp,
+	void *ctx )
+{
+	ber_len_t i, j, len, max, nkeys;
+	BerVarray keys;
+	HASH_CONTEXT HCany, HCini, HCfin;
+	int ini = flags & SLAP_INDEX_SUBSTR_INITIAL & SLAP_INDEX_SUBSTR_TYPE;
+	int fin = flags & SLAP_INDEX_SUBSTR_FINAL & SLAP_INDEX_SUBSTR_TYPE;
+	char *val;
+
+	nkeys = 0;
+	if ( !BER_BVISNULL( &sa->sa_initial ))
+		nkeys += sa->sa_initial.bv_len + 1;
+	if ( sa->sa_any != NULL ) {
+		for ( i=0; !BER_BVISNULL( &sa->sa_any[i] ); i++ )
+			nkeys += sa->sa_any[i].bv_len;
+	}
+	if ( !BER_BVISNULL( &sa->sa_final ))
+		nkeys += sa->sa_final.bv_len + 1;
+
+	if ( nkeys == 0 ) {
+		*keysp = NULL;
+		return LDAP_SUCCESS;
+	}
+
+	keys = slap_sl_malloc( sizeof( struct berval ) * (nkeys+1), ctx );
+	nkeys = 0;
+
+	hashPreset( &HCany, prefix, SLAP_INDEX_SUBSTR_PREFIX, syntax, mr );
+
+	if ( !BER_BVISNULL( &sa->sa_initial )) {
+		val = sa->sa_initial.bv_val;
+		len = sa->sa_initial.bv_len;
+		j = 0;
+		if ( ini ) {
+			/* anchored grams for the head, unanchored for the rest */
+			hashPreset( &HCini, prefix, SLAP_INDEX_SUBSTR_INITIAL_PREFIX, syntax, mr );
+			max = gramIfMaxlen( len );
+			if ( len < GRAM_LEN ) {
+				if ( len >= index_substr_if_minlen && len <= max )
+					gramKey( &HCini, GRAM_SHORT|len, val, len, keys, &nkeys, 1, ctx );
+			} else {
+				for ( ; j+GRAM_LEN <= max; j++ )
+					gramKey( &HCini, j, &val[j], GRAM_LEN, keys, &nkeys, 1, ctx );
+			}
+		}
+		for ( ; j+GRAM_LEN <= len; j++ )
+			gramKey( &HCany, 0, &val[j], GRAM_LEN, keys, &nkeys, 1, ctx );
+	}
+
+	if ( sa->sa_any != NULL ) {
+		for ( i=0; !BER_BVISNULL( &sa->sa_any[i] ); i++ ) {
+			val = sa->sa_any[i].bv_val;
+			len = sa->sa_any[i].bv_len;
+			for ( j=0; j+GRAM_LEN <= len; j++ )
+				gramKey( &HCany, 0, &val[j], GRAM_LEN, keys, &nkeys, 1, ctx );
+		}
+	}
+
+	if ( !BER_BVISNULL( &sa->sa_final )) {
+		val = sa->sa_final.bv_val;
+		len = sa->sa_final.bv_len;
+		j = 0;
+		if ( fin ) {
+			hashPreset( &HCfin, prefix, SLAP_INDEX_SUBSTR_FINAL_PREFIX, syntax, mr );
+			max = gramIfMaxlen( len );
+			if ( len < GRAM_LEN ) {
+				if ( len >= index_substr_if_minlen && len <= max )
+					gramKey( &HCfin, GRAM_SHORT|len, val, len, keys, &nkeys, 1, ctx );
+			} else {
+				for ( ; j+GRAM_LEN <= max; j++ )
+					gramKey( &HCfin, j, &val[len-GRAM_LEN-j], GRAM_LEN, keys, &nkeys, 1, ctx );
+			}
+		}
+		/* j grams from the end are anchored already */
+		for ( ; j+GRAM_LEN <= len; j++ )
+			gramKey( &HCany, 0, &val[len-GRAM_LEN-j], GRAM_LEN, keys, &nkeys, 1, ctx );
+	}
+
+	if( nkeys > 0 ) {
+		BER_BVZERO( &keys[nkeys] );
+		*keysp = keys;
+	} else {
+		slap_sl_free( keys, ctx );
+		*keysp = NULL;
+	}
+
+	return LDAP_SUCCESS;
+}
+
 /* Substring index generation function: Attribute values -> index hash keys */
 static int
 octetStringSubstringsIndexer(
@@ -929,6 +1146,10 @@ octetStringSubstringsIndexer(
 	digest.bv_val = (char *)HASHdigest;
 	digest.bv_len = HASH_LEN;
 
+	if ( IS_SLAP_INDEX( flags, SLAP_INDEX_SUBSTR_GRAM ))
+		return gramSubstringsIndexer( flags, syntax, mr, prefix,
+			values, keysp, ctx );
+
 	nkeys = 0;
 
 	for ( i = 0; !BER_BVISNULL( &values[i] ); i++ ) {
@@ -1048,6 +1269,10 @@ octetStringSubstringsFilter (
 
 	sa = (SubstringsAssertion *) assertedValue;
 
+	if ( IS_SLAP_INDEX( flags, SLAP_INDEX_SUBSTR_GRAM ))
+		return gramSubstringsFilter( flags, syntax, mr, prefix,
+			sa, keysp, ctx );
+
 	if( flags & SLAP_INDEX_SUBSTR_INITIAL &&
 		!BER_BVISNULL( &sa->sa_initial ) &&
 		sa->sa_initial.bv_len >= index_substr_if_minlen )
@@ -254,6 +254,7 @@ typedef struct slap_ssf_set {
 #define SLAP_INDEX_APPROX         0x0008UL
 #define SLAP_INDEX_SUBSTR         0x0010UL
 #define SLAP_INDEX_EXTENDED		  0x0020UL
+#define SLAP_INDEX_ORDER          0x0040UL	/* values in sort order */
 
 #define SLAP_INDEX_DEFAULT        SLAP_INDEX_EQUALITY
 
@@ -264,6 +265,7 @@ typedef struct slap_ssf_set {
 #define SLAP_INDEX_SUBSTR_INITIAL ( SLAP_INDEX_SUBSTR | 0x0100UL ) 
 #define SLAP_INDEX_SUBSTR_ANY     ( SLAP_INDEX_SUBSTR | 0x0200UL )
 #define SLAP_INDEX_SUBSTR_FINAL   ( SLAP_INDEX_SUBSTR | 0x0400UL )
+#define SLAP_INDEX_SUBSTR_GRAM    ( SLAP_INDEX_SUBSTR | 0x0800UL )	/* trigram keys */
 #define SLAP_INDEX_SUBSTR_DEFAULT \
 	( SLAP_INDEX_SUBSTR \
 	| SLAP_INDEX_SUBSTR_INITIAL \
@@ -278,6 +280,11 @@ typedef struct slap_ssf_set {
 #define SLAP_INDEX_SUBSTR_ANY_LEN_DEFAULT		4
 #define SLAP_INDEX_SUBSTR_ANY_STEP_DEFAULT		2
 
+/* trigram substring keys: gram length, and longest initial/final
+ * offset given its own key */
+#define SLAP_INDEX_SUBSTR_GRAM_LEN		3
+#define SLAP_INDEX_SUBSTR_GRAM_POSMAX	0x7f
+
 /* default for ordered integer index keys */
 #define SLAP_INDEX_INTLEN_DEFAULT	4
 
@@ -2462,6 +2469,54 @@ typedef struct PagedResultsState {
 	struct berval ps_cookieval;
 } PagedResultsState;
 
+/*
+ * Server Side Sort request (RFC 2891), as parsed by slapo-sssvlv.
+ * The overlay may offer the backend to return the entries in order
+ * itself; a backend that does sets sc_backend to SLAP_SORT_BACKEND
+ * before it sends the first entry. The overlay keeps the flag of a
+ * pagedResults control in sc_paged and hides the control from the
+ * backend, which puts it back if it takes the sort and then pages the
+ * entries itself. With a VLV request it returns the window asked for
+ * and sets the response fields of the vlv_ctrl.
+ */
+typedef struct sort_key {
+	AttributeDescription	*sk_ad;
+	MatchingRule			*sk_ordering;
+	int						sk_direction;	/* 1=normal, -1=reverse */
+} sort_key;
+
+typedef struct sort_ctrl {
+	int sc_nkeys;
+	int sc_backend;
+#define SLAP_SORT_NONE		0	/* the overlay sorts the entries */
+#define SLAP_SORT_OFFERED	1	/* the backend may return them in order */
+#define SLAP_SORT_BACKEND	2	/* and it does */
+	int sc_paged;	/* o_pagedresults, as the overlay found it */
+	sort_key sc_keys[1];
+} sort_ctrl;
+
+/*
+ * Virtual List View request (draft-ietf-ldapext-ldapv3-vlv-09), as
+ * parsed by slapo-sssvlv
+ */
+typedef struct vlv_ctrl {
+	int vc_before;
+	int vc_after;
+	int	vc_offset;
+	int vc_count;
+	struct berval vc_value;
+	unsigned long vc_context;
+	/* response of a backend that returns the window itself */
+	int vc_target;	/* position of the target entry */
+	int vc_size;	/* number of entries in the list */
+	int vc_rc;		/* virtualListViewResult */
+} vlv_ctrl;
+
+#ifndef LDAP_VLV_RANGE_ERROR
+#define LDAP_VLV_SSS_MISSING	0x4C
+#define LDAP_VLV_RANGE_ERROR	0x4D
+#endif
+
 struct slap_csn_entry {
 	Operation *ce_op;
 	struct berval ce_csn;
@@ -38,6 +38,7 @@ PPOLICY=${AC_ppolicy-ppolicyno}
 REFINT=${AC_refint-refintno}
 RETCODE=${AC_retcode-retcodeno}
 RWM=${AC_rwm-rwmno}
+SSSVLV=${AC_sssvlv-sssvlvno}
 SYNCPROV=${AC_syncprov-syncprovno}
 TRANSLUCENT=${AC_translucent-translucentno}
 UNIQUE=${AC_unique-uniqueno}
@@ -139,6 +140,14 @@ PASSWDCONF=$DATADIR/slapd-passwd.conf
 UNDOCONF=$DATADIR/slapd-config-undo.conf
 NAKEDCONF=$DATADIR/slapd-config-naked.conf
 VALREGEXCONF=$DATADIR/slapd-valregex.conf
+MDBSORTCONF=$DATADIR/slapd-mdb-sort.conf
+SUBGRAMCONF=$DATADIR/slapd-subgram.conf
+SUBTREECONF=$DATADIR/slapd-subtree.conf
+MDBPAGEDCONF=$DATADIR/slapd-mdb-paged.conf
+MDBIDLCONF=$DATADIR/slapd-mdb-idl.conf
+MDBFILTERCONF=$DATADIR/slapd-mdb-filter.conf
+MDBPSEARCHCONF=$DATADIR/slapd-mdb-psearch.conf
+MDBATTRSCONF=$DATADIR/slapd-mdb-attrs.conf
 
 DYNAMICCONF=$DATADIR/slapd-dynamic.ldif
 